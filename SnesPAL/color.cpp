@@ -0,0 +1,284 @@
+#include "color.h"
+#include "colortable.h"
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define COLOR_TARGET_AVX2
+	#else
+		#define COLOR_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+word Color_ConvertToSNES(byte r, byte g, byte b)
+{
+	word outCol = (b >> 3) << 10 | (g >> 3) << 5 | (r >> 3);
+	return outCol;
+}
+
+dword Color_ConvertFromSNES(word rgb)
+{
+	byte blue = (rgb >> 10) & 0x1F;
+	byte green = (rgb >> 5) & 0x1F;
+	byte red = rgb & 0x1F;
+	dword rgbout = COLOR_RGB((red * 255) / 31, (green * 255) / 31, (blue * 255) / 31);
+	return rgbout;
+}
+
+// Scalar kernels, plain lookups into the active color tables.
+
+static void FromSNES_Scalar(const word* in, dword* out, std::size_t count)
+{
+	for (std::size_t i = 0; i < count; ++i)
+		out[i] = Color_LookupFromSNES(in[i]);
+}
+
+static void ToSNES_Scalar(const dword* in, word* out, std::size_t count)
+{
+	for (std::size_t i = 0; i < count; ++i)
+		out[i] = Color_LookupToSNES(COLOR_R(in[i]), COLOR_G(in[i]), COLOR_B(in[i]));
+}
+
+#ifdef SNESPAL_X86
+
+// (v * 255) / 31 == (v * 2106) >> 8 for every 5-bit v, and v * 2106 still fits in 16 bits.
+#define EXPAND5_MUL		2106
+
+static void FromSNES_SSE2(const word* in, dword* out, std::size_t count)
+{
+	const __m128i mask = _mm_set1_epi16(0x1F);
+	const __m128i mul = _mm_set1_epi16(EXPAND5_MUL);
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i r = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(c, mask), mul), 8);
+		__m128i g = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(c, 5), mask), mul), 8);
+		__m128i b = _mm_srli_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(c, 10), mask), mul), 8);
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi16(rg, b));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4), _mm_unpackhi_epi16(rg, b));
+	}
+	FromSNES_Scalar(in + i, out + i, count - i);
+}
+
+static void ToSNES_SSE2(const dword* in, word* out, std::size_t count)
+{
+	const __m128i maskR = _mm_set1_epi32(0x001F);
+	const __m128i maskG = _mm_set1_epi32(0x03E0);
+	const __m128i maskB = _mm_set1_epi32(0x7C00);
+	std::size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4));
+		__m128i s0 = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(c0, 3), maskR),
+			_mm_and_si128(_mm_srli_epi32(c0, 6), maskG)),
+			_mm_and_si128(_mm_srli_epi32(c0, 9), maskB));
+		__m128i s1 = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(c1, 3), maskR),
+			_mm_and_si128(_mm_srli_epi32(c1, 6), maskG)),
+			_mm_and_si128(_mm_srli_epi32(c1, 9), maskB));
+		// Results never exceed 0x7FFF, so signed saturation is a plain narrowing.
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(s0, s1));
+	}
+	ToSNES_Scalar(in + i, out + i, count - i);
+}
+
+COLOR_TARGET_AVX2 static void FromSNES_AVX2(const word* in, dword* out, std::size_t count)
+{
+	const __m256i mask = _mm256_set1_epi16(0x1F);
+	const __m256i mul = _mm256_set1_epi16(EXPAND5_MUL);
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		__m256i r = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(c, mask), mul), 8);
+		__m256i g = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi16(c, 5), mask), mul), 8);
+		__m256i b = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi16(c, 10), mask), mul), 8);
+		__m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+		// Unpacks work per 128-bit lane: lo = colors 0-3, 8-11; hi = colors 4-7, 12-15.
+		__m256i lo = _mm256_unpacklo_epi16(rg, b);
+		__m256i hi = _mm256_unpackhi_epi16(rg, b);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	FromSNES_SSE2(in + i, out + i, count - i);
+}
+
+COLOR_TARGET_AVX2 static void ToSNES_AVX2(const dword* in, word* out, std::size_t count)
+{
+	const __m256i maskR = _mm256_set1_epi32(0x001F);
+	const __m256i maskG = _mm256_set1_epi32(0x03E0);
+	const __m256i maskB = _mm256_set1_epi32(0x7C00);
+	std::size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		__m256i c1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8));
+		__m256i s0 = _mm256_or_si256(_mm256_or_si256(
+			_mm256_and_si256(_mm256_srli_epi32(c0, 3), maskR),
+			_mm256_and_si256(_mm256_srli_epi32(c0, 6), maskG)),
+			_mm256_and_si256(_mm256_srli_epi32(c0, 9), maskB));
+		__m256i s1 = _mm256_or_si256(_mm256_or_si256(
+			_mm256_and_si256(_mm256_srli_epi32(c1, 3), maskR),
+			_mm256_and_si256(_mm256_srli_epi32(c1, 6), maskG)),
+			_mm256_and_si256(_mm256_srli_epi32(c1, 9), maskB));
+		// packs works per lane as well, so restore the color order afterwards.
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), 0xD8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+	}
+	ToSNES_SSE2(in + i, out + i, count - i);
+}
+
+static bool CPU_HasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool bOSXSave = (info[2] & (1 << 27)) != 0;
+	bool bAVX = (info[2] & (1 << 28)) != 0;
+	if (!bOSXSave || !bAVX || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SNESPAL_X86
+
+typedef void (*FromSNESProc)(const word*, dword*, std::size_t);
+typedef void (*ToSNESProc)(const dword*, word*, std::size_t);
+
+static const FromSNESProc pFromSNESKernels[COLOR_KERNEL_COUNT] =
+{
+	&FromSNES_Scalar,
+#ifdef SNESPAL_X86
+	&FromSNES_SSE2,
+	&FromSNES_AVX2
+#else
+	nullptr, nullptr
+#endif
+};
+
+static const ToSNESProc pToSNESKernels[COLOR_KERNEL_COUNT] =
+{
+	&ToSNES_Scalar,
+#ifdef SNESPAL_X86
+	&ToSNES_SSE2,
+	&ToSNES_AVX2
+#else
+	nullptr, nullptr
+#endif
+};
+
+static ColorKernel DetectKernel()
+{
+#ifdef SNESPAL_X86
+	if (CPU_HasAVX2())
+		return COLOR_KERNEL_AVX2;
+	return COLOR_KERNEL_SSE2;
+#else
+	return COLOR_KERNEL_SCALAR;
+#endif
+}
+
+static ColorKernel currentKernel = DetectKernel();
+
+bool Color_KernelSupported(ColorKernel kernel)
+{
+	switch (kernel)
+	{
+		case COLOR_KERNEL_SCALAR: return true;
+#ifdef SNESPAL_X86
+		case COLOR_KERNEL_SSE2: return true;
+		case COLOR_KERNEL_AVX2: return CPU_HasAVX2();
+#endif
+		default: return false;
+	}
+}
+
+const char* Color_KernelName(ColorKernel kernel)
+{
+	switch (kernel)
+	{
+		case COLOR_KERNEL_SCALAR: return "scalar";
+		case COLOR_KERNEL_SSE2: return "sse2";
+		case COLOR_KERNEL_AVX2: return "avx2";
+		default: return "unknown";
+	}
+}
+
+ColorKernel Color_GetKernel()
+{
+	return currentKernel;
+}
+
+bool Color_SetKernel(ColorKernel kernel)
+{
+	if (!Color_KernelSupported(kernel))
+		return false;
+	currentKernel = kernel;
+	return true;
+}
+
+// The SIMD kernels implement the divide expansion and truncating quantization
+// only; other expansion modes always go through the tables.
+void Color_ConvertFromSNESBatch(const word* in, dword* out, std::size_t count)
+{
+	if (Color_GetExpandMode() != COLOR_EXPAND_DIVIDE)
+		FromSNES_Scalar(in, out, count);
+	else
+		pFromSNESKernels[currentKernel](in, out, count);
+}
+
+void Color_ConvertToSNESBatch(const dword* in, word* out, std::size_t count)
+{
+	if (Color_GetExpandMode() == COLOR_EXPAND_GAMMA)
+		ToSNES_Scalar(in, out, count);
+	else
+		pToSNESKernels[currentKernel](in, out, count);
+}
+
+// The RGB24 variants go through a small 32-bit staging buffer, so they share
+// the kernels above instead of needing byte shuffles for every instruction set.
+#define COLOR_BATCH_CHUNK	256
+
+void Color_ConvertFromSNESBatchRGB24(const word* in, byte* out, std::size_t count)
+{
+	dword temp[COLOR_BATCH_CHUNK];
+	while (count)
+	{
+		std::size_t n = count < COLOR_BATCH_CHUNK ? count : COLOR_BATCH_CHUNK;
+		Color_ConvertFromSNESBatch(in, temp, n);
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			out[i * 3] = COLOR_R(temp[i]);
+			out[i * 3 + 1] = COLOR_G(temp[i]);
+			out[i * 3 + 2] = COLOR_B(temp[i]);
+		}
+		in += n; out += n * 3; count -= n;
+	}
+}
+
+void Color_ConvertToSNESBatchRGB24(const byte* in, word* out, std::size_t count)
+{
+	dword temp[COLOR_BATCH_CHUNK];
+	while (count)
+	{
+		std::size_t n = count < COLOR_BATCH_CHUNK ? count : COLOR_BATCH_CHUNK;
+		for (std::size_t i = 0; i < n; ++i)
+			temp[i] = COLOR_RGB(in[i * 3], in[i * 3 + 1], in[i * 3 + 2]);
+		Color_ConvertToSNESBatch(temp, out, n);
+		in += n * 3; out += n; count -= n;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// SNES BGR555 color conversion.
+// RGB values are packed as 0x00BBGGRR, the same layout as Win32 COLORREF.
+
+#include "types.h"
+
+#define COLOR_RGB(r,g,b)	((dword)(((byte)(r)) | ((dword)((byte)(g)) << 8) | ((dword)((byte)(b)) << 16)))
+#define COLOR_R(rgb)		((byte)((rgb) & 0xFF))
+#define COLOR_G(rgb)		((byte)(((rgb) >> 8) & 0xFF))
+#define COLOR_B(rgb)		((byte)(((rgb) >> 16) & 0xFF))
+
+word Color_ConvertToSNES(byte r, byte g, byte b);
+dword Color_ConvertFromSNES(word rgb);
+
+// Batch conversion kernels. Every kernel produces byte-identical output to
+// the single color functions above; the best supported one is picked at
+// startup and can be overridden with Color_SetKernel().
+enum ColorKernel
+{
+	COLOR_KERNEL_SCALAR = 0,
+	COLOR_KERNEL_SSE2,
+	COLOR_KERNEL_AVX2,
+	COLOR_KERNEL_COUNT
+};
+
+bool Color_KernelSupported(ColorKernel kernel);
+const char* Color_KernelName(ColorKernel kernel);
+ColorKernel Color_GetKernel();
+bool Color_SetKernel(ColorKernel kernel);
+
+// 0x00BBGGRR colors (COLORREF layout).
+void Color_ConvertFromSNESBatch(const word* in, dword* out, std::size_t count);
+void Color_ConvertToSNESBatch(const dword* in, word* out, std::size_t count);
+// Packed R, G, B byte triplets, as stored in .pal files.
+void Color_ConvertFromSNESBatchRGB24(const word* in, byte* out, std::size_t count);
+void Color_ConvertToSNESBatchRGB24(const byte* in, word* out, std::size_t count);
+
+// INIDISP master brightness on one 5-bit channel, c * level / 15 rounded,
+// level 0-15. The division is a multiply by COLOR_BRIGHTNESS_INV15 (2^16 / 15
+// rounded up) and a shift, exact for every product of a channel and a level
+// and small enough for the 16-bit lanes of the SSE2 fade kernel.
+#define COLOR_BRIGHTNESS_INV15	4370
+
+inline int Color_ApplyBrightness(int c, int level)
+{
+	return ((c * level + 7) * COLOR_BRIGHTNESS_INV15) >> 16;
+}
@@ -0,0 +1,144 @@
+#include "colormap.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// Table entries searched by one pool task.
+#define COLORMAP_CHUNK	0x1000
+
+void InverseColormap::SortEntries()
+{
+	sorted.clear();
+	for (int i = 0; i < nColors; ++i)
+		if (IsUsable(i))
+			sorted.push_back({ labs[i], i });
+	std::sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b) {
+		return a.lab.L != b.lab.L ? a.lab.L < b.lab.L : a.index < b.index;
+	});
+}
+
+// Starts from the hint, usually the match of the previous table entry, then
+// walks both ways from the entry closest in lightness; once the lightness
+// difference alone is above the best distance, no further entry can win.
+// Ties go to the lower palette index.
+int InverseColormap::FindNearest(const Lab& lab, int hint, float* pDist) const
+{
+	float best = FLT_MAX;
+	int bestIndex = COLORMAP_MAX_COLORS;
+	if (hint >= 0 && hint < nColors && IsUsable(hint))
+	{
+		best = ColorSpace_Distance(lab, labs[hint]);
+		bestIndex = hint;
+	}
+
+	auto test = [&](const Entry& e) {
+		float dL = lab.L - e.lab.L, da = lab.a - e.lab.a, db = lab.b - e.lab.b;
+		float d = dL * dL + da * da + db * db;
+		if (d < best || (d == best && e.index < bestIndex))
+		{
+			best = d;
+			bestIndex = e.index;
+		}
+	};
+
+	auto it = std::lower_bound(sorted.begin(), sorted.end(), lab.L, [](const Entry& e, float L) { return e.lab.L < L; });
+	for (auto up = it; up != sorted.end(); ++up)
+	{
+		float dL = up->lab.L - lab.L;
+		if (dL * dL > best)
+			break;
+		test(*up);
+	}
+	for (auto down = it; down != sorted.begin(); )
+	{
+		--down;
+		float dL = lab.L - down->lab.L;
+		if (dL * dL > best)
+			break;
+		test(*down);
+	}
+
+	*pDist = best;
+	return bestIndex < COLORMAP_MAX_COLORS ? bestIndex : 0;
+}
+
+void InverseColormap::Search(dword first, dword last)
+{
+	int hint = -1;
+	for (dword c = first; c < last; ++c)
+	{
+		hint = FindNearest(okLab[c], hint, &distances[c]);
+		table[c] = static_cast<byte>(hint);
+	}
+}
+
+void InverseColormap::Build(const word* palette, int nColors, bool bSkipTransparent, ThreadPool* pool)
+{
+	this->nColors = std::min(std::max(nColors, 0), COLORMAP_MAX_COLORS);
+	this->bSkipTransparent = bSkipTransparent;
+	okLab = ColorSpace_GetOKLabTable();
+	for (int i = 0; i < this->nColors; ++i)
+		labs[i] = okLab[palette[i] & 0x7FFF];
+	SortEntries();
+
+	if (!pool)
+	{
+		Search(0, 0x8000);
+		return;
+	}
+	for (dword first = 0; first < 0x8000; first += COLORMAP_CHUNK)
+		pool->Submit([this, first] { Search(first, first + COLORMAP_CHUNK); });
+	pool->Wait();
+}
+
+void InverseColormap::Update(int index, word color)
+{
+	if (index < 0 || index >= nColors)
+		return;
+	labs[index] = okLab[color & 0x7FFF];
+	SortEntries();
+	if (!IsUsable(index))
+		return;
+
+	const Lab& lab = labs[index];
+	for (dword c = 0; c < 0x8000; ++c)
+	{
+		if (table[c] == index)
+			table[c] = static_cast<byte>(FindNearest(okLab[c], -1, &distances[c]));
+		else
+		{
+			float d = ColorSpace_Distance(okLab[c], lab);
+			if (d < distances[c] || (d == distances[c] && index < table[c]))
+			{
+				table[c] = static_cast<byte>(index);
+				distances[c] = d;
+			}
+		}
+	}
+}
+
+void InverseColormap::Remap(const word* colors, byte* indices, std::size_t count) const
+{
+	for (std::size_t i = 0; i < count; ++i)
+		indices[i] = table[colors[i] & 0x7FFF];
+}
+
+int InverseColormap::FindNearestBruteForce(word color) const
+{
+	const Lab& lab = okLab[color & 0x7FFF];
+	float best = FLT_MAX;
+	int bestIndex = 0;
+	for (int i = 0; i < nColors; ++i)
+	{
+		if (!IsUsable(i))
+			continue;
+		float d = ColorSpace_Distance(lab, labs[i]);
+		if (d < best)
+		{
+			best = d;
+			bestIndex = i;
+		}
+	}
+	return bestIndex;
+}
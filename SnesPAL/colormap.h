@@ -0,0 +1,50 @@
+#pragma once
+
+// Inverse colormap: the nearest palette entry for every BGR555 color,
+// compared in OKLab. Lookups are a single table read, so remapping images to
+// the palette costs O(1) per pixel instead of a search over all entries.
+
+#include "types.h"
+#include "colorspace.h"
+
+#include <vector>
+
+class ThreadPool;
+
+#define COLORMAP_MAX_COLORS		0x100
+
+class InverseColormap
+{
+public:
+	// nColors <= COLORMAP_MAX_COLORS. With bSkipTransparent, color 0 of every
+	// 16-color row is never chosen, as the SNES does not draw it.
+	void Build(const word* palette, int nColors, bool bSkipTransparent, ThreadPool* pool = nullptr);
+	// One entry changed. Colors that used it are searched again, every other
+	// color only checks whether the new color beats its current match.
+	void Update(int index, word color);
+
+	int Lookup(word color) const { return table[color & 0x7FFF]; }
+	void Remap(const word* colors, byte* indices, std::size_t count) const;
+	// Reference search over every entry, for verification.
+	int FindNearestBruteForce(word color) const;
+
+private:
+	bool IsUsable(int index) const { return !(bSkipTransparent && (index & 0x0F) == 0); }
+	void SortEntries();
+	int FindNearest(const Lab& lab, int hint, float* pDist) const;
+	void Search(dword first, dword last);
+
+	struct Entry
+	{
+		Lab lab;
+		int index;
+	};
+
+	int nColors = 0;
+	bool bSkipTransparent = false;
+	const Lab* okLab = nullptr;
+	Lab labs[COLORMAP_MAX_COLORS];
+	std::vector<Entry> sorted;		// Usable entries ordered by lightness.
+	std::vector<byte> table = std::vector<byte>(0x8000, 0);
+	std::vector<float> distances = std::vector<float>(0x8000, 0.0f);
+};
@@ -0,0 +1,183 @@
+#include "colorspace.h"
+#include "color.h"
+#include "colortable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+float ColorSpace_DecodeSRGB(byte v)
+{
+	double c = v / 255.0;
+	return static_cast<float>((c <= 0.04045) ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+}
+
+Lab ColorSpace_LinearToOKLab(float r, float g, float b)
+{
+	float l = std::cbrt(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b);
+	float m = std::cbrt(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b);
+	float s = std::cbrt(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+	return {
+		0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+		1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+		0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s
+	};
+}
+
+void ColorSpace_OKLabToLinear(const Lab& lab, float& r, float& g, float& b)
+{
+	float l = lab.L + 0.3963377774f * lab.a + 0.2158037573f * lab.b;
+	float m = lab.L - 0.1055613458f * lab.a - 0.0638541728f * lab.b;
+	float s = lab.L - 0.0894841775f * lab.a - 1.2914855480f * lab.b;
+	l = l * l * l;
+	m = m * m * m;
+	s = s * s * s;
+	r = 4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s;
+	g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s;
+	b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s;
+}
+
+Lab ColorSpace_OKLabFromRGB(byte r, byte g, byte b)
+{
+	return ColorSpace_LinearToOKLab(ColorSpace_DecodeSRGB(r), ColorSpace_DecodeSRGB(g), ColorSpace_DecodeSRGB(b));
+}
+
+static float CIELabCurve(double t)
+{
+	const double delta = 6.0 / 29.0;
+	return static_cast<float>((t > delta * delta * delta) ? std::cbrt(t) : t / (3.0 * delta * delta) + 4.0 / 29.0);
+}
+
+Lab ColorSpace_LinearToCIELab(float r, float g, float b)
+{
+	// sRGB primaries to XYZ, normalized to the D65 white point.
+	float fx = CIELabCurve((0.4124564 * r + 0.3575761 * g + 0.1804375 * b) / 0.95047);
+	float fy = CIELabCurve(0.2126729 * r + 0.7151522 * g + 0.0721750 * b);
+	float fz = CIELabCurve((0.0193339 * r + 0.1191920 * g + 0.9503041 * b) / 1.08883);
+	return { 116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz) };
+}
+
+// Sharma, Wu and Dalal, "The CIEDE2000 color-difference formula:
+// implementation notes, supplementary test data, and mathematical observations".
+float ColorSpace_DeltaE2000(const Lab& x, const Lab& y)
+{
+	const double pi = 3.14159265358979323846, deg = pi / 180.0, pow25_7 = 6103515625.0;
+	double C1 = std::sqrt(static_cast<double>(x.a) * x.a + static_cast<double>(x.b) * x.b);
+	double C2 = std::sqrt(static_cast<double>(y.a) * y.a + static_cast<double>(y.b) * y.b);
+	double Cm7 = std::pow((C1 + C2) / 2.0, 7.0);
+	double G = 0.5 * (1.0 - std::sqrt(Cm7 / (Cm7 + pow25_7)));
+	double a1 = (1.0 + G) * x.a, a2 = (1.0 + G) * y.a;
+	double C1p = std::sqrt(a1 * a1 + static_cast<double>(x.b) * x.b);
+	double C2p = std::sqrt(a2 * a2 + static_cast<double>(y.b) * y.b);
+	double h1 = (C1p == 0.0) ? 0.0 : std::atan2(x.b, a1) / deg;
+	double h2 = (C2p == 0.0) ? 0.0 : std::atan2(y.b, a2) / deg;
+	if (h1 < 0.0)
+		h1 += 360.0;
+	if (h2 < 0.0)
+		h2 += 360.0;
+
+	double dL = static_cast<double>(y.L) - x.L;
+	double dC = C2p - C1p;
+	double dh = 0.0;
+	if (C1p * C2p != 0.0)
+	{
+		dh = h2 - h1;
+		if (dh > 180.0)
+			dh -= 360.0;
+		else if (dh < -180.0)
+			dh += 360.0;
+	}
+	double dH = 2.0 * std::sqrt(C1p * C2p) * std::sin(dh * deg / 2.0);
+
+	double Lm = (static_cast<double>(x.L) + y.L) / 2.0;
+	double Cmp = (C1p + C2p) / 2.0;
+	double Hm = h1 + h2;
+	if (C1p * C2p != 0.0)
+	{
+		if (std::fabs(h1 - h2) <= 180.0)
+			Hm /= 2.0;
+		else
+			Hm = (Hm < 360.0) ? (Hm + 360.0) / 2.0 : (Hm - 360.0) / 2.0;
+	}
+
+	double T = 1.0 - 0.17 * std::cos((Hm - 30.0) * deg) + 0.24 * std::cos(2.0 * Hm * deg)
+		+ 0.32 * std::cos((3.0 * Hm + 6.0) * deg) - 0.20 * std::cos((4.0 * Hm - 63.0) * deg);
+	double dTheta = 30.0 * std::exp(-((Hm - 275.0) / 25.0) * ((Hm - 275.0) / 25.0));
+	double Cmp7 = std::pow(Cmp, 7.0);
+	double RC = 2.0 * std::sqrt(Cmp7 / (Cmp7 + pow25_7));
+	double Lm50 = (Lm - 50.0) * (Lm - 50.0);
+	double SL = 1.0 + 0.015 * Lm50 / std::sqrt(20.0 + Lm50);
+	double SC = 1.0 + 0.045 * Cmp;
+	double SH = 1.0 + 0.015 * Cmp * T;
+	double RT = -std::sin(2.0 * dTheta * deg) * RC;
+
+	double tL = dL / SL, tC = dC / SC, tH = dH / SH;
+	return static_cast<float>(std::sqrt(tL * tL + tC * tC + tH * tH + RT * tC * tH));
+}
+
+// Per-mode tables of a color space over all BGR555 colors.
+typedef Lab (*LinearToLabProc)(float r, float g, float b);
+
+static const Lab* GetLabTable(std::once_flag* once, std::unique_ptr<Lab[]>* tables, LinearToLabProc proc)
+{
+	ColorExpand mode = Color_GetExpandMode();
+	std::call_once(once[mode], [mode, tables, proc] {
+		float linear[0x100];
+		for (int i = 0; i < 0x100; ++i)
+			linear[i] = ColorSpace_DecodeSRGB(static_cast<byte>(i));
+
+		const ColorTables& colorTables = Color_GetTables(mode);
+		std::unique_ptr<Lab[]> table(new Lab[0x8000]);
+		for (dword c = 0; c < 0x8000; ++c)
+		{
+			dword rgb = colorTables.fromSNES[c];
+			table[c] = proc(linear[COLOR_R(rgb)], linear[COLOR_G(rgb)], linear[COLOR_B(rgb)]);
+		}
+		tables[mode] = std::move(table);
+	});
+	return tables[mode].get();
+}
+
+const Lab* ColorSpace_GetOKLabTable()
+{
+	static std::once_flag once[COLOR_EXPAND_COUNT];
+	static std::unique_ptr<Lab[]> tables[COLOR_EXPAND_COUNT];
+	return GetLabTable(once, tables, &ColorSpace_LinearToOKLab);
+}
+
+const Lab* ColorSpace_GetCIELabTable()
+{
+	static std::once_flag once[COLOR_EXPAND_COUNT];
+	static std::unique_ptr<Lab[]> tables[COLOR_EXPAND_COUNT];
+	return GetLabTable(once, tables, &ColorSpace_LinearToCIELab);
+}
+
+const ColorLevelTable& ColorSpace_GetLevelTable()
+{
+	static std::once_flag once[COLOR_EXPAND_COUNT];
+	static std::unique_ptr<ColorLevelTable> tables[COLOR_EXPAND_COUNT];
+
+	ColorExpand mode = Color_GetExpandMode();
+	std::call_once(once[mode], [mode] {
+		float levels[0x20];
+		for (int v = 0; v < 0x20; ++v)
+			levels[v] = ColorTable::Expand(mode, static_cast<byte>(v));
+
+		std::unique_ptr<ColorLevelTable> table(new ColorLevelTable);
+		int v = 0;
+		for (int i = 0; i <= COLORSPACE_LEVEL_LUT_SIZE; ++i)
+		{
+			double c = static_cast<double>(i) / COLORSPACE_LEVEL_LUT_SIZE;
+			c = (c <= 0.0031308) ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+			float srgb = static_cast<float>(c * 255.0);
+			while (v < 0x1E && srgb >= levels[v + 1])
+				++v;
+			float f = (srgb - levels[v]) / (levels[v + 1] - levels[v]);
+			table->position[i] = v + std::min(std::max(f, 0.0f), 1.0f);
+			table->nearest[i] = static_cast<byte>(table->position[i] + 0.5f);
+		}
+		tables[mode] = std::move(table);
+	});
+	return *tables[mode];
+}
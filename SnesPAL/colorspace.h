@@ -0,0 +1,75 @@
+#pragma once
+
+// Perceptual color spaces shared by the gradient, quantizer and remapping code.
+
+#include "types.h"
+
+struct Lab
+{
+	float L, a, b;
+};
+
+// sRGB 0-255 to linear light 0-1.
+float ColorSpace_DecodeSRGB(byte v);
+Lab ColorSpace_LinearToOKLab(float r, float g, float b);
+void ColorSpace_OKLabToLinear(const Lab& lab, float& r, float& g, float& b);
+Lab ColorSpace_OKLabFromRGB(byte r, byte g, byte b);
+// CIE L*a*b* (D65), the space CIEDE2000 is defined in.
+Lab ColorSpace_LinearToCIELab(float r, float g, float b);
+// CIEDE2000 color difference, reference implementation in double precision.
+float ColorSpace_DeltaE2000(const Lab& x, const Lab& y);
+
+// OKLab of all 0x8000 BGR555 colors under the active 5-bit expansion mode.
+// Built once per mode on first use; safe to call from several threads.
+const Lab* ColorSpace_GetOKLabTable();
+// CIE L*a*b* of all 0x8000 BGR555 colors, same rules as the OKLab table.
+const Lab* ColorSpace_GetCIELabTable();
+
+// Linear light 0-1 to 5-bit channel, finer than the darkest 5-bit step.
+#define COLORSPACE_LEVEL_LUT_SIZE	4096
+
+// Linear light i / COLORSPACE_LEVEL_LUT_SIZE among the 5-bit levels of an
+// expansion mode. position is v + f when its sRGB value lies f of the way
+// from level v to level v + 1, for dithering; nearest is it rounded, which
+// a color that comes back unchanged keeps.
+struct ColorLevelTable
+{
+	float position[COLORSPACE_LEVEL_LUT_SIZE + 1];
+	byte nearest[COLORSPACE_LEVEL_LUT_SIZE + 1];
+};
+
+// Levels of the active expansion mode, same rules as the OKLab table.
+const ColorLevelTable& ColorSpace_GetLevelTable();
+
+inline int ColorSpace_LevelIndex(float v)
+{
+	float c = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+	return static_cast<int>(c * COLORSPACE_LEVEL_LUT_SIZE + 0.5f);
+}
+
+// Squared euclidean distance, enough for nearest-color comparisons.
+inline float ColorSpace_Distance(const Lab& x, const Lab& y)
+{
+	float dL = x.L - y.L, da = x.a - y.a, db = x.b - y.b;
+	return dL * dL + da * da + db * db;
+}
+
+#ifdef SNESPAL_X86
+#include <emmintrin.h>
+
+// ColorSpace_OKLabToLinear on four colors, same operations in the same order,
+// so the SSE2 kernels built on it give the scalar results.
+inline void ColorSpace_OKLabToLinear_SSE2(__m128 L, __m128 A, __m128 B, __m128& r, __m128& g, __m128& b)
+{
+	__m128 l = _mm_add_ps(_mm_add_ps(L, _mm_mul_ps(_mm_set1_ps(0.3963377774f), A)), _mm_mul_ps(_mm_set1_ps(0.2158037573f), B));
+	__m128 m = _mm_sub_ps(_mm_sub_ps(L, _mm_mul_ps(_mm_set1_ps(0.1055613458f), A)), _mm_mul_ps(_mm_set1_ps(0.0638541728f), B));
+	__m128 s = _mm_sub_ps(_mm_sub_ps(L, _mm_mul_ps(_mm_set1_ps(0.0894841775f), A)), _mm_mul_ps(_mm_set1_ps(1.2914855480f), B));
+	l = _mm_mul_ps(_mm_mul_ps(l, l), l);
+	m = _mm_mul_ps(_mm_mul_ps(m, m), m);
+	s = _mm_mul_ps(_mm_mul_ps(s, s), s);
+
+	r = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.0767416621f), l), _mm_mul_ps(_mm_set1_ps(3.3077115913f), m)), _mm_mul_ps(_mm_set1_ps(0.2309699292f), s));
+	g = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.2684380046f), l), _mm_mul_ps(_mm_set1_ps(2.6097574011f), m)), _mm_mul_ps(_mm_set1_ps(0.3413193965f), s));
+	b = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(-0.0041960863f), l), _mm_mul_ps(_mm_set1_ps(0.7034186147f), m)), _mm_mul_ps(_mm_set1_ps(1.7076147010f), s));
+}
+#endif
@@ -0,0 +1,103 @@
+#include "colortable.h"
+
+// Generated by the compiler; nothing here runs at startup.
+static constexpr ColorTables colorTables[COLOR_EXPAND_COUNT] =
+{
+	ColorTable::Build(COLOR_EXPAND_DIVIDE),
+	ColorTable::Build(COLOR_EXPAND_REPLICATE),
+	ColorTable::Build(COLOR_EXPAND_GAMMA)
+};
+
+// The expansions as closed forms, written apart from ColorTable::Expand()
+// so a mistake in either one fails the assert below. The gamma ramp has no
+// closed form; it is checked for spanning 0-255 in increasing steps instead.
+static constexpr int ExpectedChannel(int mode, int v)
+{
+	return mode == COLOR_EXPAND_DIVIDE ? v * 255 / 31 :
+		mode == COLOR_EXPAND_REPLICATE ? v * 8 + v / 4 :
+		ColorTable::gammaRamp[v];
+}
+
+static constexpr int GammaDistance(int i, int v)
+{
+	return ColorTable::gammaRamp[i] > v ? ColorTable::gammaRamp[i] - v : v - ColorTable::gammaRamp[i];
+}
+
+// Proves at compile time that every table entry matches the closed forms:
+// the linear modes quantize by dropping the low three bits, the gamma mode
+// to the nearest ramp entry.
+static constexpr bool VerifyTables()
+{
+	if (ColorTable::gammaRamp[0] != 0 || ColorTable::gammaRamp[0x1F] != 0xFF)
+		return false;
+	for (int v = 1; v < 0x20; ++v)
+		if (ColorTable::gammaRamp[v] <= ColorTable::gammaRamp[v - 1])
+			return false;
+
+	for (int m = 0; m < COLOR_EXPAND_COUNT; ++m)
+	{
+		const ColorTables& t = colorTables[m];
+		for (int c = 0; c < 0x8000; ++c)
+		{
+			dword rgb = t.fromSNES[c];
+			if ((rgb & 0xFF) != static_cast<dword>(ExpectedChannel(m, c & 0x1F)) ||
+				((rgb >> 8) & 0xFF) != static_cast<dword>(ExpectedChannel(m, (c >> 5) & 0x1F)) ||
+				((rgb >> 16) & 0xFF) != static_cast<dword>(ExpectedChannel(m, (c >> 10) & 0x1F)) ||
+				(rgb >> 24) != 0)
+				return false;
+		}
+		for (int v = 0; v < 0x100; ++v)
+		{
+			int q = t.quantR[v];
+			if (q > 0x1F || t.quantG[v] != (q << 5) || t.quantB[v] != (q << 10))
+				return false;
+			if (m != COLOR_EXPAND_GAMMA && q != v / 8)
+				return false;
+			if (m == COLOR_EXPAND_GAMMA)
+				for (int i = 0; i < 0x20; ++i)
+					if (GammaDistance(i, v) < GammaDistance(q, v))
+						return false;
+		}
+		// Expanding and quantizing again must give back the same 5-bit value.
+		for (int v = 0; v < 0x20; ++v)
+		{
+			int rgb = ExpectedChannel(m, v);
+			if (t.quantR[rgb] != v)
+				return false;
+		}
+	}
+	return true;
+}
+static_assert(VerifyTables(), "SNES color tables do not match the closed-form expansion.");
+
+static ColorExpand currentExpand = COLOR_EXPAND_DIVIDE;
+const ColorTables* pColorTables = &colorTables[COLOR_EXPAND_DIVIDE];
+
+ColorExpand Color_GetExpandMode()
+{
+	return currentExpand;
+}
+
+void Color_SetExpandMode(ColorExpand mode)
+{
+	if (mode < 0 || mode >= COLOR_EXPAND_COUNT)
+		return;
+	currentExpand = mode;
+	pColorTables = &colorTables[mode];
+}
+
+const char* Color_ExpandModeName(ColorExpand mode)
+{
+	switch (mode)
+	{
+		case COLOR_EXPAND_DIVIDE: return "divide";
+		case COLOR_EXPAND_REPLICATE: return "replicate";
+		case COLOR_EXPAND_GAMMA: return "gamma";
+		default: return "unknown";
+	}
+}
+
+const ColorTables& Color_GetTables(ColorExpand mode)
+{
+	return colorTables[(mode >= 0 && mode < COLOR_EXPAND_COUNT) ? mode : COLOR_EXPAND_DIVIDE];
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Compile-time BGR555 <-> RGB888 lookup tables.
+// Every one of the 32768 SNES colors has a precomputed RGB value for each
+// expansion mode, and the paired quantization tables turn an 8-bit channel
+// into its shifted 5-bit field, so conversion is three lookups and two ORs.
+
+#include "types.h"
+
+enum ColorExpand
+{
+	COLOR_EXPAND_DIVIDE = 0,	// v * 255 / 31, what the editor has always used.
+	COLOR_EXPAND_REPLICATE,		// (v << 3) | (v >> 2), bit replication.
+	COLOR_EXPAND_GAMMA,			// Gamma ramp used by SNES emulators.
+	COLOR_EXPAND_COUNT
+};
+
+struct ColorTables
+{
+	dword fromSNES[0x8000];
+	word quantR[0x100];
+	word quantG[0x100];
+	word quantB[0x100];
+};
+
+namespace ColorTable
+{
+	constexpr byte gammaRamp[0x20] =
+	{
+		0x00, 0x01, 0x03, 0x06, 0x0A, 0x0F, 0x15, 0x1C,
+		0x24, 0x2D, 0x37, 0x42, 0x4E, 0x5B, 0x69, 0x78,
+		0x88, 0x90, 0x98, 0xA0, 0xA8, 0xB0, 0xB8, 0xC0,
+		0xC8, 0xD0, 0xD8, 0xE0, 0xE8, 0xF0, 0xF8, 0xFF
+	};
+
+	// Reference 5-bit -> 8-bit expansion.
+	constexpr byte Expand(ColorExpand mode, byte v)
+	{
+		return mode == COLOR_EXPAND_REPLICATE ? static_cast<byte>((v << 3) | (v >> 2)) :
+			mode == COLOR_EXPAND_GAMMA ? gammaRamp[v] :
+			static_cast<byte>((v * 255) / 31);
+	}
+
+	// Reference 8-bit -> 5-bit quantization. The linear modes truncate like
+	// Color_ConvertToSNES(); the gamma ramp is not linear, so it picks the
+	// nearest ramp entry to keep load/save round trips stable.
+	constexpr byte Quantize(ColorExpand mode, byte v)
+	{
+		if (mode != COLOR_EXPAND_GAMMA)
+			return v >> 3;
+
+		byte best = 0;
+		int bestDist = 0x100;
+		for (int i = 0; i < 0x20; ++i)
+		{
+			int dist = gammaRamp[i] > v ? gammaRamp[i] - v : v - gammaRamp[i];
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				best = static_cast<byte>(i);
+			}
+		}
+		return best;
+	}
+
+	constexpr ColorTables Build(ColorExpand mode)
+	{
+		ColorTables t = {};
+		byte channel[0x20] = {};
+		for (int v = 0; v < 0x20; ++v)
+			channel[v] = Expand(mode, static_cast<byte>(v));
+
+		for (int c = 0; c < 0x8000; ++c)
+			t.fromSNES[c] = channel[c & 0x1F] | (channel[(c >> 5) & 0x1F] << 8) | (static_cast<dword>(channel[(c >> 10) & 0x1F]) << 16);
+
+		for (int v = 0; v < 0x100; ++v)
+		{
+			word q = Quantize(mode, static_cast<byte>(v));
+			t.quantR[v] = q;
+			t.quantG[v] = static_cast<word>(q << 5);
+			t.quantB[v] = static_cast<word>(q << 10);
+		}
+		return t;
+	}
+}
+
+extern const ColorTables* pColorTables;
+
+ColorExpand Color_GetExpandMode();
+void Color_SetExpandMode(ColorExpand mode);
+const char* Color_ExpandModeName(ColorExpand mode);
+const ColorTables& Color_GetTables(ColorExpand mode);
+
+// Lookups through the active expansion mode.
+inline dword Color_LookupFromSNES(word c)
+{
+	return pColorTables->fromSNES[c & 0x7FFF];
+}
+
+inline word Color_LookupToSNES(byte r, byte g, byte b)
+{
+	return pColorTables->quantR[r] | pColorTables->quantG[g] | pColorTables->quantB[b];
+}
@@ -0,0 +1,376 @@
+#include "diff.h"
+#include "colorspace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+#endif
+
+#define DIFF_PI			3.14159265f
+#define DIFF_DEG		(DIFF_PI / 180.0f)
+#define DIFF_POW25_7	6103515625.0f
+
+// atan(t) on [0, 1], minimax, |error| < 1e-5 rad.
+#define ATAN_C0		0.99997726f
+#define ATAN_C1		-0.33262347f
+#define ATAN_C2		0.19354346f
+#define ATAN_C3		-0.11643287f
+#define ATAN_C4		0.05265332f
+#define ATAN_C5		-0.01172120f
+
+// 2^f on [0, 1).
+#define EXP2_C1		0.69314718f
+#define EXP2_C2		0.24022650f
+#define EXP2_C3		0.05550411f
+#define EXP2_C4		0.00961813f
+#define EXP2_C5		0.00133336f
+
+static inline float Pow7(float c)
+{
+	float c2 = c * c;
+	return c2 * c2 * c2 * c;
+}
+
+// Hue angle in degrees, [0, 360).
+static inline float HueDegrees(float y, float x)
+{
+	float ax = std::fabs(x), ay = std::fabs(y);
+	float mx = std::max(ax, ay), mn = std::min(ax, ay);
+	float t = (mx > 0.0f) ? mn / mx : 0.0f;
+	float s = t * t;
+	float r = t * (ATAN_C0 + s * (ATAN_C1 + s * (ATAN_C2 + s * (ATAN_C3 + s * (ATAN_C4 + s * ATAN_C5)))));
+	if (ay > ax)
+		r = DIFF_PI / 2.0f - r;
+	if (x < 0.0f)
+		r = DIFF_PI - r;
+	if (y < 0.0f)
+		r = -r;
+	float deg = r * (180.0f / DIFF_PI);
+	return (deg < 0.0f) ? deg + 360.0f : deg;
+}
+
+// e^-u for u in [0, 80].
+static inline float ExpNeg(float u)
+{
+	float v = std::min(u, 80.0f) * -1.44269504f;
+	int i = static_cast<int>(v);
+	if (static_cast<float>(i) > v)
+		--i;
+	float f = v - static_cast<float>(i);
+	float p = 1.0f + f * (EXP2_C1 + f * (EXP2_C2 + f * (EXP2_C3 + f * (EXP2_C4 + f * EXP2_C5))));
+	int bits = (i + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return p * scale;
+}
+
+// sin(x) for x in [0, pi/3].
+static inline float SinSmall(float x)
+{
+	float x2 = x * x;
+	return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+}
+
+static float DeltaE_Scalar(const Lab& p, const Lab& q)
+{
+	float C1 = std::sqrt(p.a * p.a + p.b * p.b);
+	float C2 = std::sqrt(q.a * q.a + q.b * q.b);
+	float Cm7 = Pow7((C1 + C2) * 0.5f);
+	float G1 = 1.0f + 0.5f * (1.0f - std::sqrt(Cm7 / (Cm7 + DIFF_POW25_7)));
+	float a1 = G1 * p.a, a2 = G1 * q.a;
+	float C1p = std::sqrt(a1 * a1 + p.b * p.b);
+	float C2p = std::sqrt(a2 * a2 + q.b * q.b);
+
+	float dL = q.L - p.L;
+	float dC = C2p - C1p;
+
+	// The mean hue is the bisector of the shorter arc between the two hue
+	// directions, a zero chroma color adds nothing, as in the reference. Past
+	// 90 degrees apart u1 + u2 cancels out, u2 - u1 turned by -90 degrees
+	// (and flipped with the rotation sense) points the same way without that.
+	// Exactly opposite hues average to the smaller angle + 90 in the reference.
+	float u1x = (C1p > 0.0f) ? a1 / C1p : 0.0f, u1y = (C1p > 0.0f) ? p.b / C1p : 0.0f;
+	float u2x = (C2p > 0.0f) ? a2 / C2p : 0.0f, u2y = (C2p > 0.0f) ? q.b / C2p : 0.0f;
+	float ux = u2x - u1x, uy = u2y - u1y;
+	float cross = u1x * u2y - u1y * u2x;
+	float hx = u1x + u2x, hy = u1y + u2y;
+	if (u1x * u2x + u1y * u2y < 0.0f)
+	{
+		bool bFlip = (cross == 0.0f) ? !(u1y > 0.0f || (u1y == 0.0f && u1x > 0.0f)) : (cross < 0.0f);
+		hx = bFlip ? -uy : uy;
+		hy = bFlip ? ux : -ux;
+	}
+	// 2 sqrt(C1'C2') sin(dh/2), where 2 sin(dh/2) is the chord |u2 - u1|,
+	// signed like the hue rotation from 1 to 2.
+	float dH = std::copysign(std::sqrt(C1p * C2p) * std::sqrt(ux * ux + uy * uy), cross);
+	float hLength = std::sqrt(hx * hx + hy * hy);
+	float c1 = (hLength > 0.0f) ? hx / hLength : 1.0f;
+	float s1 = (hLength > 0.0f) ? hy / hLength : 0.0f;
+	float c2 = c1 * c1 - s1 * s1, s2 = 2.0f * c1 * s1;
+	float c3 = c1 * c2 - s1 * s2, s3 = s1 * c2 + c1 * s2;
+	float c4 = c2 * c2 - s2 * s2, s4 = 2.0f * c2 * s2;
+	// cos(H - 30), cos(2H), cos(3H + 6) and cos(4H - 63) by angle addition.
+	float T = 1.0f - 0.17f * (c1 * 0.86602540f + s1 * 0.5f) + 0.24f * c2
+		+ 0.32f * (c3 * 0.99452190f - s3 * 0.10452846f) - 0.20f * (c4 * 0.45399050f + s4 * 0.89100652f);
+
+	float Hm = HueDegrees(s1, c1);
+	float hT = (Hm - 275.0f) * (1.0f / 25.0f);
+	float dTheta = 30.0f * ExpNeg(hT * hT);
+	float Cmp = (C1p + C2p) * 0.5f;
+	float Cmp7 = Pow7(Cmp);
+	float RC = 2.0f * std::sqrt(Cmp7 / (Cmp7 + DIFF_POW25_7));
+	float Lm = (p.L + q.L) * 0.5f - 50.0f;
+	float Lm50 = Lm * Lm;
+	float SL = 1.0f + 0.015f * Lm50 / std::sqrt(20.0f + Lm50);
+	float SC = 1.0f + 0.045f * Cmp;
+	float SH = 1.0f + 0.015f * Cmp * T;
+	float RT = -SinSmall(2.0f * dTheta * DIFF_DEG) * RC;
+
+	float tL = dL / SL, tC = dC / SC, tH = dH / SH;
+	return std::sqrt(std::max(tL * tL + tC * tC + tH * tH + RT * tC * tH, 0.0f));
+}
+
+void Diff_DeltaEScalar(const word* x, const word* y, float* out, std::size_t count)
+{
+	const Lab* lab = ColorSpace_GetCIELabTable();
+	for (std::size_t i = 0; i < count; ++i)
+		out[i] = DeltaE_Scalar(lab[x[i] & 0x7FFF], lab[y[i] & 0x7FFF]);
+}
+
+#ifdef SNESPAL_X86
+
+#define SET1(k)			_mm_set1_ps(k)
+#define SELECT(m, a, b)	_mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+
+static inline __m128 Pow7_SSE2(__m128 c)
+{
+	__m128 c2 = _mm_mul_ps(c, c);
+	return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(c2, c2), c2), c);
+}
+
+static inline __m128 Abs_SSE2(__m128 v)
+{
+	return _mm_andnot_ps(SET1(-0.0f), v);
+}
+
+static inline __m128 HueDegrees_SSE2(__m128 y, __m128 x)
+{
+	__m128 ax = Abs_SSE2(x), ay = Abs_SSE2(y);
+	__m128 mx = _mm_max_ps(ax, ay), mn = _mm_min_ps(ax, ay);
+	__m128 t = _mm_and_ps(_mm_cmpgt_ps(mx, _mm_setzero_ps()), _mm_div_ps(mn, mx));
+	__m128 s = _mm_mul_ps(t, t);
+	__m128 poly = _mm_add_ps(SET1(ATAN_C4), _mm_mul_ps(s, SET1(ATAN_C5)));
+	poly = _mm_add_ps(SET1(ATAN_C3), _mm_mul_ps(s, poly));
+	poly = _mm_add_ps(SET1(ATAN_C2), _mm_mul_ps(s, poly));
+	poly = _mm_add_ps(SET1(ATAN_C1), _mm_mul_ps(s, poly));
+	poly = _mm_add_ps(SET1(ATAN_C0), _mm_mul_ps(s, poly));
+	__m128 r = _mm_mul_ps(t, poly);
+	r = SELECT(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(SET1(DIFF_PI / 2.0f), r), r);
+	r = SELECT(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(SET1(DIFF_PI), r), r);
+	r = SELECT(_mm_cmplt_ps(y, _mm_setzero_ps()), _mm_sub_ps(_mm_setzero_ps(), r), r);
+	__m128 deg = _mm_mul_ps(r, SET1(180.0f / DIFF_PI));
+	return SELECT(_mm_cmplt_ps(deg, _mm_setzero_ps()), _mm_add_ps(deg, SET1(360.0f)), deg);
+}
+
+static inline __m128 ExpNeg_SSE2(__m128 u)
+{
+	__m128 v = _mm_mul_ps(_mm_min_ps(u, SET1(80.0f)), SET1(-1.44269504f));
+	__m128i i = _mm_cvttps_epi32(v);
+	__m128 fi = _mm_cvtepi32_ps(i);
+	// Truncation rounds towards zero, floor needs one less for negative fractions.
+	__m128i adjust = _mm_castps_si128(_mm_cmpgt_ps(fi, v));
+	i = _mm_add_epi32(i, adjust);
+	fi = _mm_cvtepi32_ps(i);
+	__m128 f = _mm_sub_ps(v, fi);
+	__m128 p = _mm_add_ps(SET1(EXP2_C4), _mm_mul_ps(f, SET1(EXP2_C5)));
+	p = _mm_add_ps(SET1(EXP2_C3), _mm_mul_ps(f, p));
+	p = _mm_add_ps(SET1(EXP2_C2), _mm_mul_ps(f, p));
+	p = _mm_add_ps(SET1(EXP2_C1), _mm_mul_ps(f, p));
+	p = _mm_add_ps(SET1(1.0f), _mm_mul_ps(f, p));
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+	return _mm_mul_ps(p, scale);
+}
+
+static inline __m128 SinSmall_SSE2(__m128 x)
+{
+	__m128 x2 = _mm_mul_ps(x, x);
+	__m128 p = _mm_add_ps(SET1(-1.0f / 5040.0f), _mm_mul_ps(x2, SET1(1.0f / 362880.0f)));
+	p = _mm_add_ps(SET1(1.0f / 120.0f), _mm_mul_ps(x2, p));
+	p = _mm_add_ps(SET1(-1.0f / 6.0f), _mm_mul_ps(x2, p));
+	p = _mm_add_ps(SET1(1.0f), _mm_mul_ps(x2, p));
+	return _mm_mul_ps(x, p);
+}
+
+// Unit direction of (x, y), zero where the length is zero.
+static inline void Normalize_SSE2(__m128 x, __m128 y, __m128 length, __m128& ux, __m128& uy)
+{
+	__m128 valid = _mm_cmpgt_ps(length, _mm_setzero_ps());
+	ux = _mm_and_ps(valid, _mm_div_ps(x, length));
+	uy = _mm_and_ps(valid, _mm_div_ps(y, length));
+}
+
+static __m128 DeltaE_SSE2(__m128 L1, __m128 A1, __m128 B1, __m128 L2, __m128 A2, __m128 B2)
+{
+	const __m128 zero = _mm_setzero_ps(), half = SET1(0.5f);
+	__m128 C1 = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(A1, A1), _mm_mul_ps(B1, B1)));
+	__m128 C2 = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(A2, A2), _mm_mul_ps(B2, B2)));
+	__m128 Cm7 = Pow7_SSE2(_mm_mul_ps(_mm_add_ps(C1, C2), half));
+	__m128 G1 = _mm_add_ps(SET1(1.0f), _mm_mul_ps(half, _mm_sub_ps(SET1(1.0f), _mm_sqrt_ps(_mm_div_ps(Cm7, _mm_add_ps(Cm7, SET1(DIFF_POW25_7)))))));
+	__m128 a1 = _mm_mul_ps(G1, A1), a2 = _mm_mul_ps(G1, A2);
+	__m128 C1p = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a1, a1), _mm_mul_ps(B1, B1)));
+	__m128 C2p = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a2, a2), _mm_mul_ps(B2, B2)));
+
+	__m128 dL = _mm_sub_ps(L2, L1);
+	__m128 dC = _mm_sub_ps(C2p, C1p);
+
+	__m128 u1x, u1y, u2x, u2y;
+	Normalize_SSE2(a1, B1, C1p, u1x, u1y);
+	Normalize_SSE2(a2, B2, C2p, u2x, u2y);
+	__m128 opposite = _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(u1x, u2x), _mm_mul_ps(u1y, u2y)), zero);
+	__m128 ux = _mm_sub_ps(u2x, u1x), uy = _mm_sub_ps(u2y, u1y);
+	__m128 cross = _mm_sub_ps(_mm_mul_ps(u1x, u2y), _mm_mul_ps(u1y, u2x));
+	__m128 upper = _mm_or_ps(_mm_cmpgt_ps(u1y, zero), _mm_and_ps(_mm_cmpeq_ps(u1y, zero), _mm_cmpgt_ps(u1x, zero)));
+	__m128 flip = SELECT(_mm_cmpeq_ps(cross, zero), _mm_andnot_ps(upper, _mm_cmpeq_ps(zero, zero)), _mm_cmplt_ps(cross, zero));
+	__m128 sense = _mm_and_ps(flip, SET1(-0.0f));
+	__m128 hx = SELECT(opposite, _mm_xor_ps(uy, sense), _mm_add_ps(u1x, u2x));
+	__m128 hy = SELECT(opposite, _mm_xor_ps(_mm_xor_ps(ux, SET1(-0.0f)), sense), _mm_add_ps(u1y, u2y));
+	__m128 dH = _mm_mul_ps(_mm_sqrt_ps(_mm_mul_ps(C1p, C2p)), _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ux, ux), _mm_mul_ps(uy, uy))));
+	dH = _mm_or_ps(dH, _mm_and_ps(cross, SET1(-0.0f)));
+	__m128 hLength = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(hx, hx), _mm_mul_ps(hy, hy)));
+	__m128 hValid = _mm_cmpgt_ps(hLength, zero);
+	__m128 c1 = SELECT(hValid, _mm_div_ps(hx, hLength), SET1(1.0f));
+	__m128 s1 = _mm_and_ps(hValid, _mm_div_ps(hy, hLength));
+	__m128 c2 = _mm_sub_ps(_mm_mul_ps(c1, c1), _mm_mul_ps(s1, s1)), s2 = _mm_mul_ps(_mm_mul_ps(SET1(2.0f), c1), s1);
+	__m128 c3 = _mm_sub_ps(_mm_mul_ps(c1, c2), _mm_mul_ps(s1, s2)), s3 = _mm_add_ps(_mm_mul_ps(s1, c2), _mm_mul_ps(c1, s2));
+	__m128 c4 = _mm_sub_ps(_mm_mul_ps(c2, c2), _mm_mul_ps(s2, s2)), s4 = _mm_mul_ps(_mm_mul_ps(SET1(2.0f), c2), s2);
+	__m128 T = _mm_sub_ps(SET1(1.0f), _mm_mul_ps(SET1(0.17f), _mm_add_ps(_mm_mul_ps(c1, SET1(0.86602540f)), _mm_mul_ps(s1, half))));
+	T = _mm_add_ps(T, _mm_mul_ps(SET1(0.24f), c2));
+	T = _mm_add_ps(T, _mm_mul_ps(SET1(0.32f), _mm_sub_ps(_mm_mul_ps(c3, SET1(0.99452190f)), _mm_mul_ps(s3, SET1(0.10452846f)))));
+	T = _mm_sub_ps(T, _mm_mul_ps(SET1(0.20f), _mm_add_ps(_mm_mul_ps(c4, SET1(0.45399050f)), _mm_mul_ps(s4, SET1(0.89100652f)))));
+
+	__m128 Hm = HueDegrees_SSE2(s1, c1);
+	__m128 hT = _mm_mul_ps(_mm_sub_ps(Hm, SET1(275.0f)), SET1(1.0f / 25.0f));
+	__m128 dTheta = _mm_mul_ps(SET1(30.0f), ExpNeg_SSE2(_mm_mul_ps(hT, hT)));
+	__m128 Cmp = _mm_mul_ps(_mm_add_ps(C1p, C2p), half);
+	__m128 Cmp7 = Pow7_SSE2(Cmp);
+	__m128 RC = _mm_mul_ps(SET1(2.0f), _mm_sqrt_ps(_mm_div_ps(Cmp7, _mm_add_ps(Cmp7, SET1(DIFF_POW25_7)))));
+	__m128 Lm = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(L1, L2), half), SET1(50.0f));
+	__m128 Lm50 = _mm_mul_ps(Lm, Lm);
+	__m128 SL = _mm_add_ps(SET1(1.0f), _mm_div_ps(_mm_mul_ps(SET1(0.015f), Lm50), _mm_sqrt_ps(_mm_add_ps(SET1(20.0f), Lm50))));
+	__m128 SC = _mm_add_ps(SET1(1.0f), _mm_mul_ps(SET1(0.045f), Cmp));
+	__m128 SH = _mm_add_ps(SET1(1.0f), _mm_mul_ps(_mm_mul_ps(SET1(0.015f), Cmp), T));
+	__m128 RT = _mm_mul_ps(_mm_sub_ps(zero, SinSmall_SSE2(_mm_mul_ps(_mm_mul_ps(SET1(2.0f), dTheta), SET1(DIFF_DEG)))), RC);
+
+	__m128 tL = _mm_div_ps(dL, SL), tC = _mm_div_ps(dC, SC), tH = _mm_div_ps(dH, SH);
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tL, tL), _mm_mul_ps(tC, tC)), _mm_mul_ps(tH, tH)), _mm_mul_ps(_mm_mul_ps(RT, tC), tH));
+	return _mm_sqrt_ps(_mm_max_ps(sum, zero));
+}
+
+#undef SET1
+#undef SELECT
+
+#endif
+
+void Diff_DeltaE(const word* x, const word* y, float* out, std::size_t count)
+{
+#ifdef SNESPAL_X86
+	const Lab* lab = ColorSpace_GetCIELabTable();
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const Lab& p0 = lab[x[i] & 0x7FFF], & p1 = lab[x[i + 1] & 0x7FFF], & p2 = lab[x[i + 2] & 0x7FFF], & p3 = lab[x[i + 3] & 0x7FFF];
+		const Lab& q0 = lab[y[i] & 0x7FFF], & q1 = lab[y[i + 1] & 0x7FFF], & q2 = lab[y[i + 2] & 0x7FFF], & q3 = lab[y[i + 3] & 0x7FFF];
+		__m128 dE = DeltaE_SSE2(
+			_mm_setr_ps(p0.L, p1.L, p2.L, p3.L), _mm_setr_ps(p0.a, p1.a, p2.a, p3.a), _mm_setr_ps(p0.b, p1.b, p2.b, p3.b),
+			_mm_setr_ps(q0.L, q1.L, q2.L, q3.L), _mm_setr_ps(q0.a, q1.a, q2.a, q3.a), _mm_setr_ps(q0.b, q1.b, q2.b, q3.b));
+		_mm_storeu_ps(out + i, dE);
+	}
+	Diff_DeltaEScalar(x + i, y + i, out + i, count - i);
+#else
+	Diff_DeltaEScalar(x, y, out, count);
+#endif
+}
+
+static void Summarize(const word* oldColors, const word* newColors, const float* deltaE, int count, float threshold, DiffStats& stats)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		stats.maxDeltaE = std::max(stats.maxDeltaE, deltaE[i]);
+		sum += deltaE[i];
+		stats.nDifferent += ((oldColors[i] ^ newColors[i]) & 0x7FFF) ? 1 : 0;
+		stats.nChanged += (deltaE[i] > threshold) ? 1 : 0;
+	}
+	stats.meanDeltaE = sum / count;
+}
+
+void Diff_Compare(const word* oldPalette, const word* newPalette, float threshold, PaletteDiff& diff)
+{
+	Diff_DeltaE(oldPalette, newPalette, diff.deltaE, DIFF_COLORS);
+	for (int r = 0; r < DIFF_ROWS; ++r)
+	{
+		int first = r * DIFF_ROW_COLORS;
+		diff.rows[r] = DiffStats();
+		Summarize(oldPalette + first, newPalette + first, diff.deltaE + first, DIFF_ROW_COLORS, threshold, diff.rows[r]);
+	}
+	diff.total = DiffStats();
+	Summarize(oldPalette, newPalette, diff.deltaE, DIFF_COLORS, threshold, diff.total);
+}
+
+// Gap between the three grids, in cells.
+#define DIFF_GRID_GAP	1
+
+void Diff_GetGridSize(const RenderOptions& opt, int* pWidth, int* pHeight)
+{
+	int size = Render_GetGridSize(opt);
+	int gap = size / RENDER_CELLS * DIFF_GRID_GAP;
+	*pWidth = size * 3 + gap * 2;
+	*pHeight = size;
+}
+
+static void FrameRect(Framebuffer& fb, int left, int top, int right, int bottom, int width, dword color)
+{
+	Render_FillRect(fb, left, top, right, top + width, color);
+	Render_FillRect(fb, left, bottom - width, right, bottom, color);
+	Render_FillRect(fb, left, top, left + width, bottom, color);
+	Render_FillRect(fb, right - width, top, right, bottom, color);
+}
+
+void Diff_RenderGrid(Framebuffer& fb, const word* oldPalette, const word* newPalette, const PaletteDiff& diff, float threshold, const RenderOptions& opt)
+{
+	int width, height;
+	Diff_GetGridSize(opt, &width, &height);
+	int size = Render_GetGridSize(opt);
+	int gap = size / RENDER_CELLS * DIFF_GRID_GAP;
+	Render_FillRect(fb, 0, 0, width, height, opt.background);
+
+	Framebuffer panels[3];
+	for (int p = 0; p < 3; ++p)
+	{
+		int x = std::min(p * (size + gap), fb.width);
+		panels[p] = { fb.pixels + x, std::min(size, fb.width - x), std::min(size, fb.height), fb.stride };
+	}
+	Render_PaletteGrid(panels[0], oldPalette, opt);
+	Render_PaletteGrid(panels[1], newPalette, opt);
+	Render_FillRect(panels[2], 0, 0, size, size, opt.background);
+
+	// deltaE map: gray up to the threshold, then red, saturating at four times it.
+	int frame = std::max(opt.zoom, 1);
+	for (int i = 0; i < DIFF_COLORS; ++i)
+	{
+		int left, top, right, bottom;
+		Render_GetCellRect(opt, i, &left, &top, &right, &bottom);
+		float level = std::min(diff.deltaE[i] / (threshold * 4.0f), 1.0f);
+		byte v = static_cast<byte>(level * 255.0f + 0.5f);
+		dword color = (diff.deltaE[i] > threshold) ? RENDER_XRGB(0xFF, 0xFF - v, 0xFF - v) : RENDER_XRGB(v, v, v);
+		Render_FillRect(panels[2], left, top, right, bottom, color);
+		if (diff.deltaE[i] > threshold)
+		{
+			FrameRect(panels[0], left, top, right, bottom, frame, RENDER_XRGB(0xFF, 0x00, 0xFF));
+			FrameRect(panels[1], left, top, right, bottom, frame, RENDER_XRGB(0xFF, 0x00, 0xFF));
+		}
+	}
+}
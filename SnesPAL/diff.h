@@ -0,0 +1,48 @@
+#pragma once
+
+// Perceptual palette comparison: CIEDE2000 per color, summarized per
+// 16-color row and per palette, plus a side-by-side grid of both palettes.
+//
+// The kernels look both colors up in the CIE L*a*b* table of the active
+// expansion mode and evaluate CIEDE2000 four pairs at a time. The mean hue
+// and the T term are built from the hue directions instead of angles, so
+// only the hue rotation term needs approximations of atan2, exp and sin;
+// the results stay within DIFF_KERNEL_TOLERANCE of ColorSpace_DeltaE2000.
+
+#include "types.h"
+#include "render.h"
+
+#define DIFF_COLORS				0x100
+#define DIFF_ROW_COLORS			0x10
+#define DIFF_ROWS				(DIFF_COLORS / DIFF_ROW_COLORS)
+// Just noticeable difference under CIEDE2000.
+#define DIFF_DEFAULT_THRESHOLD	1.0f
+#define DIFF_KERNEL_TOLERANCE	0.01f
+
+struct DiffStats
+{
+	float maxDeltaE = 0.0f;
+	float meanDeltaE = 0.0f;
+	int nDifferent = 0;		// Colors that are not equal (bit 15 ignored).
+	int nChanged = 0;		// Colors with deltaE above the threshold.
+};
+
+struct PaletteDiff
+{
+	float deltaE[DIFF_COLORS];
+	DiffStats rows[DIFF_ROWS];
+	DiffStats total;
+};
+
+// CIEDE2000 between x[i] and y[i], vectorized where available.
+void Diff_DeltaE(const word* x, const word* y, float* out, std::size_t count);
+// Same operations in the same order, one pair at a time.
+void Diff_DeltaEScalar(const word* x, const word* y, float* out, std::size_t count);
+
+void Diff_Compare(const word* oldPalette, const word* newPalette, float threshold, PaletteDiff& diff);
+
+// Width and height of the grid drawn by Diff_RenderGrid.
+void Diff_GetGridSize(const RenderOptions& opt, int* pWidth, int* pHeight);
+// Old palette, new palette and a deltaE map side by side, cells drawn as in
+// the editor. Cells above the threshold are framed on both palettes.
+void Diff_RenderGrid(Framebuffer& fb, const word* oldPalette, const word* newPalette, const PaletteDiff& diff, float threshold, const RenderOptions& opt);
@@ -0,0 +1,113 @@
+#include "document.h"
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+// Rows taken from color arrays, by content hash. Entries expire with the
+// last palette using the row and are purged as the pool grows.
+static std::mutex rowPoolMtx;
+static std::unordered_multimap<std::size_t, std::weak_ptr<const PaletteRow>> rowPool;
+static std::size_t rowPoolPurgeAt = 0x100;
+
+static std::size_t HashRow(const word* colors)
+{
+	// FNV-1a.
+	std::size_t hash = static_cast<std::size_t>(14695981039346656037ull);
+	for (int i = 0; i < PALETTE_ROW_COLORS; ++i)
+		hash = (hash ^ colors[i]) * static_cast<std::size_t>(1099511628211ull);
+	return hash;
+}
+
+static std::shared_ptr<const PaletteRow> InternRow(const word* colors)
+{
+	std::size_t hash = HashRow(colors);
+	std::lock_guard<std::mutex> lock(rowPoolMtx);
+	auto range = rowPool.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		std::shared_ptr<const PaletteRow> row = it->second.lock();
+		if (row && !memcmp(row->colors, colors, sizeof(row->colors)))
+			return row;
+	}
+
+	if (rowPool.size() >= rowPoolPurgeAt)
+	{
+		for (auto it = rowPool.begin(); it != rowPool.end();)
+			it = it->second.expired() ? rowPool.erase(it) : std::next(it);
+		rowPoolPurgeAt = rowPool.size() * 2 + 0x100;
+	}
+
+	auto row = std::make_shared<PaletteRow>();
+	memcpy(row->colors, colors, sizeof(row->colors));
+	rowPool.emplace(hash, row);
+	return row;
+}
+
+Palette::Palette()
+{
+	static const word black[PALETTE_ROW_COLORS] = {};
+	std::shared_ptr<const PaletteRow> row = InternRow(black);
+	for (auto& r : rows)
+		r = row;
+}
+
+Palette::Palette(const word* colors)
+{
+	for (int row = 0; row < PALETTE_ROWS; ++row)
+		rows[row] = InternRow(colors + row * PALETTE_ROW_COLORS);
+}
+
+void Palette::Set(int index, word color)
+{
+	std::shared_ptr<const PaletteRow>& row = rows[(index >> 4) & 0xF];
+	if (row->colors[index & 0xF] == color)
+		return;
+	// Never written in place, other palettes may share the row.
+	auto copy = std::make_shared<PaletteRow>(*row);
+	copy->colors[index & 0xF] = color;
+	row = std::move(copy);
+}
+
+void Palette::Read(word* colors) const
+{
+	for (int row = 0; row < PALETTE_ROWS; ++row)
+		memcpy(colors + row * PALETTE_ROW_COLORS, rows[row]->colors, sizeof(PaletteRow::colors));
+}
+
+int Palette::Assign(const word* colors)
+{
+	int nChanged = 0;
+	for (int row = 0; row < PALETTE_ROWS; ++row)
+	{
+		const word* src = colors + row * PALETTE_ROW_COLORS;
+		if (memcmp(rows[row]->colors, src, sizeof(PaletteRow::colors)))
+		{
+			rows[row] = InternRow(src);
+			++nChanged;
+		}
+	}
+	return nChanged;
+}
+
+bool Palette::IsSameAs(const Palette& other) const
+{
+	for (int row = 0; row < PALETTE_ROWS; ++row)
+	{
+		if (rows[row] != other.rows[row] && memcmp(rows[row]->colors, other.rows[row]->colors, sizeof(PaletteRow::colors)))
+			return false;
+	}
+	return true;
+}
+
+std::size_t Palette_CountRows(const std::vector<const Palette*>& palettes)
+{
+	std::unordered_set<const PaletteRow*> rows;
+	for (const Palette* palette : palettes)
+	{
+		for (int row = 0; row < PALETTE_ROWS; ++row)
+			rows.insert(palette->GetRow(row));
+	}
+	return rows.size();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Palettes with structural sharing, for sessions with many files open.
+//
+// A Palette holds its 256 colors as 16 immutable rows of 16 colors behind
+// shared pointers. Copying one copies 16 pointers, and setting a color
+// copies only its row, so a snapshot costs O(1) and palettes derived from
+// each other share every row neither has changed. Rows taken from plain
+// color arrays are interned: level palettes that repeat the same rows, as
+// SMW's do, store them once. Memory scales with the distinct rows.
+
+#include "types.h"
+#include "history.h"
+#include "journal.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#define PALETTE_ROWS		0x10
+#define PALETTE_ROW_COLORS	0x10
+
+struct PaletteRow
+{
+	word colors[PALETTE_ROW_COLORS];
+};
+
+class Palette
+{
+public:
+	// All black.
+	Palette();
+	explicit Palette(const word* colors);
+
+	word Get(int index) const { return rows[(index >> 4) & 0xF]->colors[index & 0xF]; }
+	void Set(int index, word color);
+	void Read(word* colors) const;
+	// Replaces only the rows that differ from colors, returns how many did.
+	int Assign(const word* colors);
+
+	const PaletteRow* GetRow(int row) const { return rows[row].get(); }
+	// Same colors; rows shared with other are not compared.
+	bool IsSameAs(const Palette& other) const;
+
+private:
+	std::shared_ptr<const PaletteRow> rows[PALETTE_ROWS];
+};
+
+// Rows used by the palettes, each shared row counted once.
+std::size_t Palette_CountRows(const std::vector<const Palette*>& palettes);
+
+// A palette file (or a palette inside a ROM) kept open in the editor while
+// another one is being edited.
+struct PaletteDocument
+{
+	std::filesystem::path fn;
+	dword address = JOURNAL_NO_ADDRESS;	// ROM palettes only.
+	Palette palette;					// Colors being edited.
+	Palette saved;						// As last read from or written to disk.
+	History history;
+	bool bDrawMode = false;
+
+	bool IsModified() const { return !palette.IsSameAs(saved); }
+	std::filesystem::path GetJournalPath() const { return Journal_GetPath(fn, address); }
+};
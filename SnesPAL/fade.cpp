@@ -0,0 +1,181 @@
+#include "fade.h"
+#include "palfile.h"
+#include "color.h"
+#include "fileio.h"
+
+#include <algorithm>
+#include <string>
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+#endif
+
+static const char* const modeNames[FADE_MODE_COUNT] = { "black", "white", "cross", "brightness" };
+
+const char* Fade_ModeName(FadeMode mode)
+{
+	return (mode >= 0 && mode < FADE_MODE_COUNT) ? modeNames[mode] : "unknown";
+}
+
+int Fade_GetLevel(const FadeOptions& opt, int frame)
+{
+	int last = std::max(opt.nFrames - 1, 1);
+	int f = opt.bReverse ? (opt.nFrames - 1 - frame) : frame;
+	switch (opt.mode)
+	{
+		case FADE_CROSS:
+			return (0x100 * f + last / 2) / last;
+		case FADE_BRIGHTNESS:
+			return 15 - (15 * f + last / 2) / last;
+		default:
+			return (31 * f + last / 2) / last;
+	}
+}
+
+// One frame of FADE_COLORS colors at level. The divisions by 15 and the
+// signed shift are the exact integer operations the SSE2 kernel performs.
+static void Frame_Scalar(const word* palette, const word* target, FadeMode mode, int level, word* out)
+{
+	for (int i = 0; i < FADE_COLORS; ++i)
+	{
+		int c[3] = { palette[i] & 0x1F, (palette[i] >> 5) & 0x1F, (palette[i] >> 10) & 0x1F };
+		for (int k = 0; k < 3; ++k)
+		{
+			switch (mode)
+			{
+				case FADE_BLACK:
+					c[k] = std::max(c[k] - level, 0);
+					break;
+				case FADE_WHITE:
+					c[k] = std::min(c[k] + level, 31);
+					break;
+				case FADE_CROSS:
+				{
+					int t = (target[i] >> (k * 5)) & 0x1F;
+					c[k] += ((t - c[k]) * level + 0x80) >> 8;
+					break;
+				}
+				case FADE_BRIGHTNESS:
+					c[k] = Color_ApplyBrightness(c[k], level);
+					break;
+				default:
+					break;
+			}
+		}
+		out[i] = static_cast<word>(c[0] | (c[1] << 5) | (c[2] << 10));
+	}
+}
+
+#ifdef SNESPAL_X86
+
+// Eight colors per step, channels split into 16-bit lanes.
+static void Frame_SSE2(const word* palette, const word* target, FadeMode mode, int level, word* out)
+{
+	const __m128i mask = _mm_set1_epi16(0x1F), max = _mm_set1_epi16(31);
+	const __m128i vLevel = _mm_set1_epi16(static_cast<short>(level));
+	const __m128i round = _mm_set1_epi16(0x80), seven = _mm_set1_epi16(7), inv15 = _mm_set1_epi16(COLOR_BRIGHTNESS_INV15);
+
+	for (int i = 0; i < FADE_COLORS; i += 8)
+	{
+		__m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + i));
+		__m128i dst = (mode == FADE_CROSS) ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i)) : _mm_setzero_si128();
+		__m128i result = _mm_setzero_si128();
+		for (int k = 0; k < 3; ++k)
+		{
+			__m128i shift = _mm_cvtsi32_si128(k * 5);
+			__m128i c = _mm_and_si128(_mm_srl_epi16(src, shift), mask);
+			switch (mode)
+			{
+				case FADE_BLACK:
+					c = _mm_subs_epu16(c, vLevel);
+					break;
+				case FADE_WHITE:
+					c = _mm_min_epi16(_mm_add_epi16(c, vLevel), max);
+					break;
+				case FADE_CROSS:
+				{
+					__m128i t = _mm_and_si128(_mm_srl_epi16(dst, shift), mask);
+					__m128i d = _mm_mullo_epi16(_mm_sub_epi16(t, c), vLevel);
+					c = _mm_add_epi16(c, _mm_srai_epi16(_mm_add_epi16(d, round), 8));
+					break;
+				}
+				case FADE_BRIGHTNESS:
+					c = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(c, vLevel), seven), inv15);
+					break;
+				default:
+					break;
+			}
+			result = _mm_or_si128(result, _mm_sll_epi16(c, shift));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+	}
+}
+
+#endif
+
+typedef void (*FrameProc)(const word* palette, const word* target, FadeMode mode, int level, word* out);
+
+static bool Generate(const word* palette, const word* target, const FadeOptions& opt, word* frames, FrameProc proc)
+{
+	if (opt.nFrames < 1 || opt.nFrames > FADE_MAX_FRAMES || opt.mode < 0 || opt.mode >= FADE_MODE_COUNT || (opt.mode == FADE_CROSS && !target))
+		return false;
+	for (int f = 0; f < opt.nFrames; ++f)
+		proc(palette, target, opt.mode, Fade_GetLevel(opt, f), frames + static_cast<std::size_t>(f) * FADE_COLORS);
+	return true;
+}
+
+bool Fade_Generate(const word* palette, const word* target, const FadeOptions& opt, word* frames)
+{
+#ifdef SNESPAL_X86
+	return Generate(palette, target, opt, frames, &Frame_SSE2);
+#else
+	return Generate(palette, target, opt, frames, &Frame_Scalar);
+#endif
+}
+
+bool Fade_GenerateScalar(const word* palette, const word* target, const FadeOptions& opt, word* frames)
+{
+	return Generate(palette, target, opt, frames, &Frame_Scalar);
+}
+
+void Fade_RenderStrip(Framebuffer& fb, const word* frames, int nFrames)
+{
+	if (nFrames < 1 || fb.width < 1)
+		return;
+	for (int f = 0; f < nFrames; ++f)
+	{
+		const word* frame = frames + static_cast<std::size_t>(f) * FADE_COLORS;
+		int top = f * fb.height / nFrames, bottom = (f + 1) * fb.height / nFrames;
+		for (int i = 0; i < FADE_COLORS; ++i)
+			Render_FillRect(fb, i * fb.width / FADE_COLORS, top, (i + 1) * fb.width / FADE_COLORS, bottom, Render_ColorFromSNES(frame[i]));
+	}
+}
+
+bool Fade_WriteSequence(const std::filesystem::path& fn, const word* frames, int nFrames)
+{
+	if (PalFile_FormatFromPath(fn) == PALFMT_TPL)
+	{
+		int nDigits = (nFrames > 100) ? 3 : 2;
+		for (int f = 0; f < nFrames; ++f)
+		{
+			std::string suffix = std::to_string(f);
+			suffix.insert(0, nDigits - suffix.size(), '0');
+			std::filesystem::path frameFn = fn;
+			frameFn.replace_filename(std::filesystem::u8path(fn.stem().u8string() + "_" + suffix + ".tpl"));
+			if (PalFile_Save(frameFn, frames + static_cast<std::size_t>(f) * FADE_COLORS, PALFMT_TPL) != PALERR_OK)
+				return false;
+		}
+		return true;
+	}
+
+	FILE* file = File_Open(fn, "wb");
+	if (!file)
+		return false;
+	bool bOk = true;
+	for (std::size_t i = 0; i < static_cast<std::size_t>(nFrames) * FADE_COLORS && bOk; ++i)
+	{
+		byte bytes[2] = { static_cast<byte>(frames[i] & 0xFF), static_cast<byte>(frames[i] >> 8) };
+		bOk = fwrite(bytes, 1, 2, file) == 2;
+	}
+	return (fclose(file) == 0) && bOk;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Palette fade and flash sequences as the SNES produces them.
+// Frame 0 is the source palette and the last frame the end state; the
+// steps in between follow what the hardware (or a game's fade routine)
+// does per frame rather than a smooth blend in some color space.
+
+#include "types.h"
+#include "render.h"
+
+#include <filesystem>
+
+#define FADE_COLORS			0x100
+#define FADE_MAX_FRAMES		256
+
+enum FadeMode
+{
+	FADE_BLACK = 0,		// Color math subtract: every channel minus the same 5-bit amount.
+	FADE_WHITE,			// Color math add: every channel plus the same amount, clamped to 31.
+	FADE_CROSS,			// Per channel interpolation towards a second palette.
+	FADE_BRIGHTNESS,	// INIDISP master brightness 15 down to 0, channel * level / 15.
+	FADE_MODE_COUNT
+};
+
+struct FadeOptions
+{
+	FadeMode mode = FADE_BLACK;
+	int nFrames = 16;
+	bool bReverse = false;		// Fade in: frames run from the end state back to the palette.
+};
+
+const char* Fade_ModeName(FadeMode mode);
+// Amount applied in frame: 0-31 for black/white, 0-256 for a cross-fade
+// (256 being the target) and the INIDISP brightness 15-0.
+int Fade_GetLevel(const FadeOptions& opt, int frame);
+
+// Fills nFrames * FADE_COLORS colors. target is only read for FADE_CROSS.
+// Bit 15 is cleared. Returns false for a frame count outside 1-FADE_MAX_FRAMES.
+bool Fade_Generate(const word* palette, const word* target, const FadeOptions& opt, word* frames);
+// Same without SIMD, the reference for the vectorized one.
+bool Fade_GenerateScalar(const word* palette, const word* target, const FadeOptions& opt, word* frames);
+
+// Frames top to bottom, each an equal band with the 256 colors left to right.
+void Fade_RenderStrip(Framebuffer& fb, const word* frames, int nFrames);
+// .tpl writes one numbered palette per frame (name_00.tpl, name_01.tpl...),
+// anything else the frames back to back as raw BGR555 words.
+bool Fade_WriteSequence(const std::filesystem::path& fn, const word* frames, int nFrames);
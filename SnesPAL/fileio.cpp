@@ -0,0 +1,51 @@
+#include "fileio.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+FILE* File_Open(const std::filesystem::path& fn, const char* mode)
+{
+#ifdef _WIN32
+	wchar_t wmode[8] = { 0 };
+	for (int i = 0; i < 7 && mode[i]; ++i)
+		wmode[i] = static_cast<wchar_t>(mode[i]);
+	return _wfopen(fn.c_str(), wmode);
+#else
+	return fopen(fn.c_str(), mode);
+#endif
+}
+
+bool File_Sync(FILE* file)
+{
+	if (fflush(file))
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool File_WriteAtomic(const std::filesystem::path& fn, const void* data, std::size_t size)
+{
+	std::filesystem::path temp = fn;
+	temp += ".tmp";
+	FILE* file = File_Open(temp, "wb");
+	if (!file)
+		return false;
+
+	bool bOk = fwrite(data, 1, size, file) == size && File_Sync(file);
+	bOk = (fclose(file) == 0) && bOk;
+	std::error_code ec;
+	if (bOk)
+		std::filesystem::rename(temp, fn, ec);
+	if (!bOk || ec)
+	{
+		std::filesystem::remove(temp, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Portable file helpers for code shared with snespal-cli.
+
+#include <cstdio>
+#include <filesystem>
+
+// fopen() taking a path, wide on Windows so non-ASCII names work.
+FILE* File_Open(const std::filesystem::path& fn, const char* mode);
+// Flushes the stdio buffer and waits until the OS has written the file to disk.
+bool File_Sync(FILE* file);
+// Writes data to a temporary file next to fn, syncs it and renames it over
+// fn, so fn holds either the old or the new contents even after a crash.
+bool File_WriteAtomic(const std::filesystem::path& fn, const void* data, std::size_t size);
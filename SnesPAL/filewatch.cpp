@@ -0,0 +1,509 @@
+#include "filewatch.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <string>
+#include <system_error>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+	#include <cwctype>
+#elif defined(__linux__)
+	#include <cerrno>
+	#include <poll.h>
+	#include <sys/eventfd.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+// Compares size and write time of every file each FILEWATCH_POLL_MS.
+class PollBackend : public FileWatchBackend
+{
+public:
+	const char* GetName() const override { return "poll"; }
+
+	bool Add(const std::filesystem::path& fn) override
+	{
+		files.push_back({ fn, Stat(fn) });
+		return true;
+	}
+
+	void Remove(const std::filesystem::path& fn) override
+	{
+		files.erase(std::remove_if(files.begin(), files.end(), [&fn](const Entry& e) { return e.fn == fn; }), files.end());
+	}
+
+	bool Wait(std::vector<std::filesystem::path>& changed, int timeoutMs) override
+	{
+		int ms = (timeoutMs < 0) ? FILEWATCH_POLL_MS : std::min(timeoutMs, FILEWATCH_POLL_MS);
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			wake.wait_for(lock, std::chrono::milliseconds(ms), [this] { return bWake; });
+			bWake = false;
+		}
+		for (auto& e : files)
+		{
+			State state = Stat(e.fn);
+			if (state.bExists != e.state.bExists || state.size != e.state.size || state.time != e.state.time)
+			{
+				e.state = state;
+				changed.push_back(e.fn);
+			}
+		}
+		return true;
+	}
+
+	void Wake() override
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bWake = true;
+		wake.notify_one();
+	}
+
+private:
+	struct State
+	{
+		std::filesystem::file_time_type time;
+		std::uintmax_t size;
+		bool bExists;
+	};
+	struct Entry
+	{
+		std::filesystem::path fn;
+		State state;
+	};
+
+	static State Stat(const std::filesystem::path& fn)
+	{
+		std::error_code ec;
+		State state;
+		state.size = std::filesystem::file_size(fn, ec);
+		state.bExists = !ec;
+		state.time = std::filesystem::last_write_time(fn, ec);
+		if (ec)
+			state.time = std::filesystem::file_time_type();
+		return state;
+	}
+
+	std::vector<Entry> files;
+	std::mutex mtx;
+	std::condition_variable wake;
+	bool bWake = false;
+};
+
+#if defined(_WIN32)
+
+// One overlapped ReadDirectoryChangesW per directory, waited on together
+// with an event for Wake().
+class Win32Backend : public FileWatchBackend
+{
+public:
+	Win32Backend() { hWake = CreateEventW(nullptr, FALSE, FALSE, nullptr); }
+	~Win32Backend() override
+	{
+		for (auto& d : dirs)
+			Close(*d.second);
+		if (hWake)
+			CloseHandle(hWake);
+	}
+
+	bool IsValid() const { return hWake != nullptr; }
+	const char* GetName() const override { return "ReadDirectoryChangesW"; }
+
+	bool Add(const std::filesystem::path& fn) override
+	{
+		std::filesystem::path dir = fn.parent_path();
+		auto it = dirs.find(dir);
+		if (it == dirs.end())
+		{
+			if (dirs.size() >= MAXIMUM_WAIT_OBJECTS - 1)
+				return false;
+			std::unique_ptr<Dir> d(new Dir);
+			d->hDir = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+			d->ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			if (d->hDir == INVALID_HANDLE_VALUE || !d->ov.hEvent || !Arm(*d))
+			{
+				Close(*d);
+				return false;
+			}
+			it = dirs.emplace(dir, std::move(d)).first;
+		}
+		it->second->names.emplace(NameKey(fn.filename().wstring()), fn);
+		return true;
+	}
+
+	void Remove(const std::filesystem::path& fn) override
+	{
+		auto it = dirs.find(fn.parent_path());
+		if (it == dirs.end())
+			return;
+		it->second->names.erase(NameKey(fn.filename().wstring()));
+		if (it->second->names.empty())
+		{
+			Close(*it->second);
+			dirs.erase(it);
+		}
+	}
+
+	bool Wait(std::vector<std::filesystem::path>& changed, int timeoutMs) override
+	{
+		std::vector<HANDLE> handles(1, hWake);
+		for (auto& d : dirs)
+			handles.push_back(d.second->ov.hEvent);
+		if (WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE,
+			timeoutMs < 0 ? INFINITE : static_cast<DWORD>(timeoutMs)) == WAIT_FAILED)
+			return false;
+
+		for (auto& entry : dirs)
+		{
+			Dir& d = *entry.second;
+			DWORD nBytes = 0;
+			if (!GetOverlappedResult(d.hDir, &d.ov, &nBytes, FALSE))
+				continue;
+			d.bArmed = false;
+
+			if (!nBytes)
+			{
+				// The buffer overflowed, any of the files may have changed.
+				for (auto& name : d.names)
+					changed.push_back(name.second);
+			}
+			else
+			{
+				const BYTE* p = d.buffer;
+				for (;;)
+				{
+					const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+					auto it = d.names.find(NameKey(std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t))));
+					if (it != d.names.end())
+						changed.push_back(it->second);
+					if (!info->NextEntryOffset)
+						break;
+					p += info->NextEntryOffset;
+				}
+			}
+			ResetEvent(d.ov.hEvent);
+			Arm(d);
+		}
+		return true;
+	}
+
+	void Wake() override { SetEvent(hWake); }
+
+private:
+	struct Dir
+	{
+		HANDLE hDir = INVALID_HANDLE_VALUE;
+		OVERLAPPED ov = {};
+		bool bArmed = false;
+		alignas(DWORD) BYTE buffer[0x4000];
+		std::map<std::wstring, std::filesystem::path> names;
+	};
+
+	// Names are matched the way NTFS does, ignoring case.
+	static std::wstring NameKey(std::wstring name)
+	{
+		for (auto& c : name)
+			c = static_cast<wchar_t>(towlower(c));
+		return name;
+	}
+
+	static bool Arm(Dir& d)
+	{
+		d.bArmed = ReadDirectoryChangesW(d.hDir, d.buffer, sizeof(d.buffer), FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr, &d.ov, nullptr) != 0;
+		return d.bArmed;
+	}
+
+	static void Close(Dir& d)
+	{
+		if (d.bArmed)
+		{
+			DWORD nBytes;
+			CancelIoEx(d.hDir, &d.ov);
+			GetOverlappedResult(d.hDir, &d.ov, &nBytes, TRUE);
+		}
+		if (d.hDir != INVALID_HANDLE_VALUE)
+			CloseHandle(d.hDir);
+		if (d.ov.hEvent)
+			CloseHandle(d.ov.hEvent);
+	}
+
+	HANDLE hWake = nullptr;
+	std::map<std::filesystem::path, std::unique_ptr<Dir>> dirs;
+};
+
+#elif defined(__linux__)
+
+// One inotify watch per directory, polled together with an eventfd for Wake().
+class InotifyBackend : public FileWatchBackend
+{
+public:
+	InotifyBackend()
+	{
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+	~InotifyBackend() override
+	{
+		if (fd >= 0)
+			close(fd);
+		if (wakeFd >= 0)
+			close(wakeFd);
+	}
+
+	bool IsValid() const { return fd >= 0 && wakeFd >= 0; }
+	const char* GetName() const override { return "inotify"; }
+
+	bool Add(const std::filesystem::path& fn) override
+	{
+		std::filesystem::path dir = fn.parent_path();
+		auto it = dirs.find(dir);
+		if (it == dirs.end())
+		{
+			int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+			if (wd < 0)
+				return false;
+			it = dirs.emplace(dir, Dir()).first;
+			it->second.wd = wd;
+			wds[wd] = dir;
+		}
+		it->second.names.emplace(fn.filename().native(), fn);
+		return true;
+	}
+
+	void Remove(const std::filesystem::path& fn) override
+	{
+		auto it = dirs.find(fn.parent_path());
+		if (it == dirs.end())
+			return;
+		it->second.names.erase(fn.filename().native());
+		if (it->second.names.empty())
+		{
+			inotify_rm_watch(fd, it->second.wd);
+			wds.erase(it->second.wd);
+			dirs.erase(it);
+		}
+	}
+
+	bool Wait(std::vector<std::filesystem::path>& changed, int timeoutMs) override
+	{
+		pollfd pfd[2] = { { fd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+		if (poll(pfd, 2, timeoutMs) < 0)
+			return errno == EINTR;
+		if (pfd[1].revents & POLLIN)
+		{
+			unsigned long long value;
+			if (read(wakeFd, &value, sizeof(value)) < 0)
+				value = 0;
+		}
+		if (!(pfd[0].revents & POLLIN))
+			return true;
+
+		alignas(inotify_event) char buffer[0x1000];
+		ssize_t len;
+		while ((len = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			for (const char* p = buffer; p < buffer + len;)
+			{
+				const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+				p += sizeof(inotify_event) + ev->len;
+				if (ev->mask & IN_Q_OVERFLOW)
+				{
+					// Events were lost, any of the files may have changed.
+					for (auto& d : dirs)
+						for (auto& name : d.second.names)
+							changed.push_back(name.second);
+					continue;
+				}
+				auto w = wds.find(ev->wd);
+				if (!ev->len || w == wds.end())
+					continue;
+				const Dir& d = dirs[w->second];
+				auto it = d.names.find(ev->name);
+				if (it != d.names.end())
+					changed.push_back(it->second);
+			}
+		}
+		return true;
+	}
+
+	void Wake() override
+	{
+		unsigned long long value = 1;
+		if (write(wakeFd, &value, sizeof(value)) < 0)
+			value = 0;
+	}
+
+private:
+	struct Dir
+	{
+		int wd = -1;
+		std::map<std::string, std::filesystem::path> names;
+	};
+
+	int fd = -1;
+	int wakeFd = -1;
+	std::map<std::filesystem::path, Dir> dirs;
+	std::map<int, std::filesystem::path> wds;
+};
+
+#endif
+
+std::unique_ptr<FileWatchBackend> FileWatch_CreateBackend(FileWatchBackendType type)
+{
+	if (type == FILEWATCH_NATIVE)
+	{
+#if defined(_WIN32)
+		std::unique_ptr<Win32Backend> backend(new Win32Backend);
+		if (backend->IsValid())
+			return backend;
+#elif defined(__linux__)
+		std::unique_ptr<InotifyBackend> backend(new InotifyBackend);
+		if (backend->IsValid())
+			return backend;
+#endif
+	}
+	return std::unique_ptr<FileWatchBackend>(new PollBackend);
+}
+
+FileWatcher::FileWatcher(Callback onChange, FileWatchBackendType type)
+	: onChange(std::move(onChange)), backend(FileWatch_CreateBackend(type))
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bStop = true;
+	}
+	backend->Wake();
+	if (watcher.joinable())
+		watcher.join();
+}
+
+void FileWatcher::Watch(const std::filesystem::path& fn)
+{
+	std::error_code ec;
+	std::filesystem::path path = std::filesystem::absolute(fn, ec).lexically_normal();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (std::find(files.begin(), files.end(), path) != files.end())
+			return;
+		files.push_back(path);
+		bFilesChanged = true;
+		// The watcher starts with the first file.
+		if (!watcher.joinable())
+			watcher = std::thread(&FileWatcher::WatcherLoop, this);
+	}
+	backend->Wake();
+}
+
+void FileWatcher::Unwatch(const std::filesystem::path& fn)
+{
+	std::error_code ec;
+	std::filesystem::path path = std::filesystem::absolute(fn, ec).lexically_normal();
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = std::find(files.begin(), files.end(), path);
+		if (it == files.end())
+			return;
+		files.erase(it);
+		bFilesChanged = true;
+	}
+	backend->Wake();
+}
+
+void FileWatcher::UnwatchAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (files.empty())
+			return;
+		files.clear();
+		bFilesChanged = true;
+	}
+	backend->Wake();
+}
+
+// The backend is only touched here, apart from Wake().
+void FileWatcher::WatcherLoop()
+{
+	using Clock = std::chrono::steady_clock;
+	struct Pending
+	{
+		std::filesystem::path fn;
+		Clock::time_point first;
+		Clock::time_point last;
+	};
+
+	const auto debounce = std::chrono::milliseconds(FILEWATCH_DEBOUNCE_MS);
+	const auto maxDelay = std::chrono::milliseconds(FILEWATCH_MAX_DELAY_MS);
+	std::vector<std::filesystem::path> watched, changed;
+	std::vector<Pending> pending;
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (bStop)
+				break;
+			if (bFilesChanged)
+			{
+				bFilesChanged = false;
+				for (const auto& fn : watched)
+				{
+					if (std::find(files.begin(), files.end(), fn) == files.end())
+					{
+						backend->Remove(fn);
+						pending.erase(std::remove_if(pending.begin(), pending.end(), [&fn](const Pending& p) { return p.fn == fn; }), pending.end());
+					}
+				}
+				for (const auto& fn : files)
+					if (std::find(watched.begin(), watched.end(), fn) == watched.end())
+						backend->Add(fn);
+				watched = files;
+			}
+		}
+
+		// Sleep until the next pending file is due.
+		Clock::time_point now = Clock::now();
+		int timeoutMs = -1;
+		for (const auto& p : pending)
+		{
+			Clock::time_point due = std::min(p.last + debounce, p.first + maxDelay);
+			long long ms = (due > now) ? std::chrono::duration_cast<std::chrono::milliseconds>(due - now + std::chrono::microseconds(999)).count() : 0;
+			if (timeoutMs < 0 || ms < timeoutMs)
+				timeoutMs = static_cast<int>(ms);
+		}
+
+		changed.clear();
+		if (!backend->Wait(changed, timeoutMs))
+			std::this_thread::sleep_for(std::chrono::milliseconds(FILEWATCH_POLL_MS));
+
+		now = Clock::now();
+		for (const auto& fn : changed)
+		{
+			auto it = std::find_if(pending.begin(), pending.end(), [&fn](const Pending& p) { return p.fn == fn; });
+			if (it != pending.end())
+				it->last = now;
+			else
+				pending.push_back({ fn, now, now });
+		}
+		for (auto it = pending.begin(); it != pending.end();)
+		{
+			if (now >= std::min(it->last + debounce, it->first + maxDelay))
+			{
+				if (onChange)
+					onChange(it->fn, it->first);
+				it = pending.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Change notification for files edited by other programs.
+//
+// A backend reports changed files; the native ones watch the parent
+// directories (inotify on Linux, ReadDirectoryChangesW on Windows), so
+// tools that save through a temporary file and a rename are seen as well.
+// The polling backend compares size and write time and works anywhere,
+// network shares included.
+//
+// FileWatcher runs the backend on its own thread and debounces: a file is
+// reported once it has been quiet for FILEWATCH_DEBOUNCE_MS, or at the
+// latest FILEWATCH_MAX_DELAY_MS after its first change, so a burst of
+// writes gives one callback and a steady stream still gets through.
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define FILEWATCH_DEBOUNCE_MS	15
+#define FILEWATCH_MAX_DELAY_MS	40
+#define FILEWATCH_POLL_MS		20
+
+enum FileWatchBackendType
+{
+	FILEWATCH_NATIVE = 0,	// Falls back to polling where there is no native backend.
+	FILEWATCH_POLL
+};
+
+class FileWatchBackend
+{
+public:
+	virtual ~FileWatchBackend() = default;
+
+	virtual const char* GetName() const = 0;
+	virtual bool Add(const std::filesystem::path& fn) = 0;
+	virtual void Remove(const std::filesystem::path& fn) = 0;
+	// Waits up to timeoutMs (-1 for no limit) and appends the watched files
+	// that changed meanwhile. False if the backend cannot wait any more.
+	virtual bool Wait(std::vector<std::filesystem::path>& changed, int timeoutMs) = 0;
+	// Makes a Wait() in progress on another thread return. Thread-safe.
+	virtual void Wake() = 0;
+};
+
+std::unique_ptr<FileWatchBackend> FileWatch_CreateBackend(FileWatchBackendType type);
+
+class FileWatcher
+{
+public:
+	// Called on the watcher thread with the file and the time of its first
+	// change since the last report.
+	using Callback = std::function<void(const std::filesystem::path&, std::chrono::steady_clock::time_point)>;
+
+	explicit FileWatcher(Callback onChange, FileWatchBackendType type = FILEWATCH_NATIVE);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// Paths are made absolute, callbacks receive them that way.
+	void Watch(const std::filesystem::path& fn);
+	void Unwatch(const std::filesystem::path& fn);
+	void UnwatchAll();
+	const char* GetBackendName() const { return backend->GetName(); }
+
+private:
+	void WatcherLoop();
+
+	Callback onChange;
+	std::unique_ptr<FileWatchBackend> backend;
+	std::thread watcher;
+	std::mutex mtx;
+	std::vector<std::filesystem::path> files;	// Wanted by the editor.
+	bool bFilesChanged = false;
+	bool bStop = false;
+};
@@ -0,0 +1,127 @@
+#include "fileworker.h"
+
+#include <cstring>
+
+FileWorker::~FileWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bStop = true;
+	}
+	wake.notify_one();
+	if (worker.joinable())
+		worker.join();
+}
+
+// Called with mtx held. The worker starts with the first job.
+unsigned long long FileWorker::Queue(Job& job)
+{
+	job.id = nextId++;
+	job.nCoalesced = 0;
+	job.tQueued = std::chrono::steady_clock::now();
+	jobs.push_back(std::move(job));
+	if (!worker.joinable())
+		worker = std::thread(&FileWorker::WorkerLoop, this);
+	wake.notify_one();
+	return jobs.back().id;
+}
+
+unsigned long long FileWorker::Load(const std::filesystem::path& fn, const std::filesystem::path& journalFn)
+{
+	Job job;
+	job.type = FILEJOB_LOAD;
+	job.fn = fn;
+	job.journalFn = journalFn;
+	job.fmt = PALFMT_UNKNOWN;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	return Queue(job);
+}
+
+unsigned long long FileWorker::Save(const std::filesystem::path& fn, const word* palette, PalFormat fmt)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	// Only the newest job for the file matters: a load after the queued save
+	// must still see the older snapshot.
+	for (auto it = jobs.rbegin(); it != jobs.rend(); ++it)
+	{
+		if (it->fn != fn)
+			continue;
+		if (it->type != FILEJOB_SAVE || it->fmt != fmt)
+			break;
+		memcpy(it->palette, palette, sizeof(it->palette));
+		++it->nCoalesced;
+		return it->id;
+	}
+
+	Job job;
+	job.type = FILEJOB_SAVE;
+	job.fn = fn;
+	job.fmt = fmt;
+	memcpy(job.palette, palette, sizeof(job.palette));
+	return Queue(job);
+}
+
+void FileWorker::Wait()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	idle.wait(lock, [this] { return jobs.empty() && !bBusy; });
+}
+
+std::size_t FileWorker::GetPendingCount()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return jobs.size() + (bBusy ? 1 : 0);
+}
+
+std::unique_ptr<FileJobResult> FileWorker::Run(const Job& job)
+{
+	std::unique_ptr<FileJobResult> result(new FileJobResult);
+	result->type = job.type;
+	result->id = job.id;
+	result->fn = job.fn;
+	result->nCoalesced = job.nCoalesced;
+	if (job.type == FILEJOB_SAVE)
+	{
+		memcpy(result->palette, job.palette, sizeof(result->palette));
+		result->fmt = job.fmt == PALFMT_UNKNOWN ? PalFile_FormatFromPath(job.fn) : job.fmt;
+		result->err = PalFile_Save(job.fn, job.palette, result->fmt, &result->nBytes);
+	}
+	else
+	{
+		memset(result->palette, 0, sizeof(result->palette));
+		result->err = PalFile_Load(job.fn, result->palette, &result->nBytes, &result->fmt);
+		if (result->err == PALERR_OK && !job.journalFn.empty())
+		{
+			result->pRecovery.reset(new JournalRecovery);
+			if (!Journal_Recover(job.journalFn, *result->pRecovery))
+				result->pRecovery.reset();
+		}
+	}
+	result->elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job.tQueued).count();
+	return result;
+}
+
+void FileWorker::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	for (;;)
+	{
+		wake.wait(lock, [this] { return bStop || !jobs.empty(); });
+		if (jobs.empty())
+			break;
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		bBusy = true;
+		lock.unlock();
+
+		std::unique_ptr<FileJobResult> result = Run(job);
+		if (onComplete)
+			onComplete(std::move(result));
+
+		lock.lock();
+		bBusy = false;
+		idle.notify_all();
+	}
+}
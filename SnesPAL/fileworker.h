@@ -0,0 +1,93 @@
+#pragma once
+
+// Palette file I/O on a background thread.
+//
+// Loads and saves run one after the other on a single worker, so the editor
+// never waits on the disk, however slow. A save carries a snapshot of the
+// palette and replaces the file atomically (see PalFile_Save). A save to a
+// file that already has one queued, with nothing else for that file after
+// it, only updates the queued snapshot. Results are handed to the callback
+// on the worker thread, the editor posts them to its window.
+
+#include "types.h"
+#include "palfile.h"
+#include "journal.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum FileJobType
+{
+	FILEJOB_LOAD = 0,
+	FILEJOB_SAVE
+};
+
+struct FileJobResult
+{
+	FileJobType type = FILEJOB_LOAD;
+	unsigned long long id = 0;
+	std::filesystem::path fn;
+	PalFormat fmt = PALFMT_UNKNOWN;
+	PalError err = PALERR_OK;
+	word palette[PAL_COLORS];		// Loaded, or the snapshot that was saved.
+	std::size_t nBytes = 0;
+	std::size_t nCoalesced = 0;		// Saves merged into this one.
+	long long elapsedUs = 0;		// From queueing to completion.
+	// Loads only: the file's journal, if it holds unsaved changes.
+	std::unique_ptr<JournalRecovery> pRecovery;
+};
+
+class FileWorker
+{
+public:
+	using Callback = std::function<void(std::unique_ptr<FileJobResult>)>;
+
+	explicit FileWorker(Callback onComplete) : onComplete(std::move(onComplete)) {}
+	// Finishes every queued job first.
+	~FileWorker();
+
+	FileWorker(const FileWorker&) = delete;
+	FileWorker& operator=(const FileWorker&) = delete;
+
+	// Both return the id the result will carry. journalFn (optional) is
+	// checked for unsaved changes along with the load.
+	unsigned long long Load(const std::filesystem::path& fn, const std::filesystem::path& journalFn = std::filesystem::path());
+	unsigned long long Save(const std::filesystem::path& fn, const word* palette, PalFormat fmt = PALFMT_UNKNOWN);
+
+	// Blocks until every queued job has completed.
+	void Wait();
+	std::size_t GetPendingCount();
+
+private:
+	struct Job
+	{
+		FileJobType type;
+		unsigned long long id;
+		std::filesystem::path fn;
+		std::filesystem::path journalFn;
+		PalFormat fmt;
+		word palette[PAL_COLORS];
+		std::size_t nCoalesced;
+		std::chrono::steady_clock::time_point tQueued;
+	};
+
+	unsigned long long Queue(Job& job);
+	void WorkerLoop();
+	std::unique_ptr<FileJobResult> Run(const Job& job);
+
+	Callback onComplete;
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<Job> jobs;
+	unsigned long long nextId = 1;
+	bool bBusy = false;
+	bool bStop = false;
+};
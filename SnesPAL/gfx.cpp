@@ -0,0 +1,232 @@
+#include "gfx.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+#endif
+
+bool Gfx_IsValidDepth(int bpp)
+{
+	return bpp == 2 || bpp == 4 || bpp == 8;
+}
+
+std::size_t Gfx_TileBytes(int bpp)
+{
+	return static_cast<std::size_t>(bpp) * GFX_TILE_SIZE;
+}
+
+std::size_t Gfx_TileCount(std::size_t size, int bpp)
+{
+	return Gfx_IsValidDepth(bpp) ? size / Gfx_TileBytes(bpp) : 0;
+}
+
+void Gfx_DecodeTilesScalar(const byte* src, std::size_t nTiles, int bpp, byte* pixels)
+{
+	std::size_t tileBytes = Gfx_TileBytes(bpp);
+	for (std::size_t t = 0; t < nTiles; ++t, src += tileBytes, pixels += GFX_TILE_PIXELS)
+	{
+		std::memset(pixels, 0, GFX_TILE_PIXELS);
+		for (int y = 0; y < GFX_TILE_SIZE; ++y)
+		{
+			for (int plane = 0; plane < bpp; ++plane)
+			{
+				byte bits = src[(plane >> 1) * 16 + y * 2 + (plane & 1)];
+				for (int x = 0; x < GFX_TILE_SIZE; ++x)
+					pixels[y * GFX_TILE_SIZE + x] |= ((bits >> (7 - x)) & 1) << plane;
+			}
+		}
+	}
+}
+
+#ifdef SNESPAL_X86
+
+// Bit transpose with SSE2: every plane byte is broadcast to 8 lanes by three
+// rounds of unpacking, each lane tests its own bit and the results are
+// weighted by the plane value. One 16-byte plane pair covers 8 rows.
+static void DecodeTiles_SSE2(const byte* src, std::size_t nTiles, int bpp, byte* pixels)
+{
+	const __m128i bitMask = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	std::size_t tileBytes = Gfx_TileBytes(bpp);
+	int nPairs = bpp / 2;
+
+	for (std::size_t t = 0; t < nTiles; ++t, src += tileBytes, pixels += GFX_TILE_PIXELS)
+	{
+		__m128i rows[8];
+		for (int y = 0; y < 8; ++y)
+			rows[y] = _mm_setzero_si128();
+
+		for (int pair = 0; pair < nPairs; ++pair)
+		{
+			// Low half gets the even plane, high half the odd one.
+			__m128i weight = _mm_unpacklo_epi64(_mm_set1_epi8(static_cast<char>(1 << (pair * 2))), _mm_set1_epi8(static_cast<char>(1 << (pair * 2 + 1))));
+			__m128i planes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pair * 16));
+
+			// x2: rows 0-3 / 4-7; x4: two rows each; x8: one row per register.
+			__m128i x2[2] = { _mm_unpacklo_epi8(planes, planes), _mm_unpackhi_epi8(planes, planes) };
+			for (int h = 0; h < 2; ++h)
+			{
+				__m128i x4[2] = { _mm_unpacklo_epi16(x2[h], x2[h]), _mm_unpackhi_epi16(x2[h], x2[h]) };
+				for (int q = 0; q < 2; ++q)
+				{
+					__m128i x8[2] = { _mm_unpacklo_epi32(x4[q], x4[q]), _mm_unpackhi_epi32(x4[q], x4[q]) };
+					for (int r = 0; r < 2; ++r)
+					{
+						__m128i set = _mm_cmpeq_epi8(_mm_and_si128(x8[r], bitMask), bitMask);
+						int y = h * 4 + q * 2 + r;
+						rows[y] = _mm_or_si128(rows[y], _mm_and_si128(set, weight));
+					}
+				}
+			}
+		}
+
+		for (int y = 0; y < 8; ++y)
+		{
+			__m128i row = _mm_or_si128(rows[y], _mm_srli_si128(rows[y], 8));
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(pixels + y * GFX_TILE_SIZE), row);
+		}
+	}
+}
+
+#endif
+
+void Gfx_DecodeTiles(const byte* src, std::size_t nTiles, int bpp, byte* pixels)
+{
+	TRACE_SCOPE("Gfx_DecodeTiles");
+	if (!Gfx_IsValidDepth(bpp))
+		return;
+#ifdef SNESPAL_X86
+	DecodeTiles_SSE2(src, nTiles, bpp, pixels);
+#else
+	Gfx_DecodeTilesScalar(src, nTiles, bpp, pixels);
+#endif
+}
+
+void Gfx_BuildColors(const word* palette, int row, int bpp, dword* colors)
+{
+	int nColors = 1 << bpp;
+	int first = (bpp == 8) ? 0 : (row & 0x0F) * 0x10;
+	colors[0] = Render_ColorFromSNES(palette[0]);
+	for (int i = 1; i < nColors; ++i)
+		colors[i] = Render_ColorFromSNES(palette[first + i]);
+}
+
+void Gfx_RenderTiles(Framebuffer& fb, const byte* pixels, std::size_t nTiles, int tilesPerRow, const dword* colors)
+{
+	if (tilesPerRow <= 0)
+		return;
+	for (std::size_t t = 0; t < nTiles; ++t, pixels += GFX_TILE_PIXELS)
+	{
+		int left = static_cast<int>(t % tilesPerRow) * GFX_TILE_SIZE;
+		int top = static_cast<int>(t / tilesPerRow) * GFX_TILE_SIZE;
+		if (top >= fb.height)
+			break;
+		int width = std::min(GFX_TILE_SIZE, fb.width - left);
+		int height = std::min(GFX_TILE_SIZE, fb.height - top);
+		if (width <= 0)
+			continue;
+
+		dword* dst = fb.pixels + static_cast<std::size_t>(top) * fb.stride + left;
+		for (int y = 0; y < height; ++y, dst += fb.stride)
+		{
+			const byte* src = pixels + y * GFX_TILE_SIZE;
+			for (int x = 0; x < width; ++x)
+				dst[x] = colors[src[x]];
+		}
+	}
+}
+
+int Gfx_SlotToIndex(int slot, int row, int bpp)
+{
+	if (slot == 0)
+		return 0;
+	if (bpp == 8)
+		return slot & 0xFF;
+	int color = slot & 0x0F;
+	if ((slot >> 4) != (row & 0x0F) || color == 0 || color >= (1 << bpp))
+		return -1;
+	return color;
+}
+
+void GfxColorIndex::Clear()
+{
+	spans.clear();
+	std::fill(std::begin(first), std::end(first), 0);
+	std::fill(std::begin(pixelCount), std::end(pixelCount), 0);
+}
+
+void GfxColorIndex::Build(const byte* pixels, std::size_t nTiles, int tilesPerRow, const Framebuffer& fb)
+{
+	Clear();
+	if (tilesPerRow <= 0 || !nTiles)
+		return;
+
+	// Runs are collected in scan order, then bucketed by index with a counting sort.
+	struct Run
+	{
+		byte index;
+		Span span;
+	};
+	std::vector<Run> runs;
+	runs.reserve(nTiles * GFX_TILE_SIZE * 2);
+	int width = std::min(tilesPerRow * GFX_TILE_SIZE, fb.width);
+	int height = std::min(static_cast<int>((nTiles + tilesPerRow - 1) / tilesPerRow) * GFX_TILE_SIZE, fb.height);
+
+	for (int y = 0; y < height; ++y)
+	{
+		std::size_t rowTile = static_cast<std::size_t>(y / GFX_TILE_SIZE) * tilesPerRow;
+		const byte* tileRow = pixels + (y % GFX_TILE_SIZE) * GFX_TILE_SIZE;
+		dword lineOffset = static_cast<dword>(y) * fb.stride;
+		int runStart = 0;
+		int runIndex = -1;
+
+		int x = 0;
+		for (; x < width; ++x)
+		{
+			std::size_t tile = rowTile + x / GFX_TILE_SIZE;
+			if (tile >= nTiles)
+				break;
+			int index = tileRow[tile * GFX_TILE_PIXELS + x % GFX_TILE_SIZE];
+			if (index != runIndex)
+			{
+				if (runIndex >= 0)
+					runs.push_back({ static_cast<byte>(runIndex), { lineOffset + runStart, static_cast<dword>(x - runStart) } });
+				runStart = x;
+				runIndex = index;
+			}
+		}
+		if (runIndex >= 0)
+			runs.push_back({ static_cast<byte>(runIndex), { lineOffset + runStart, static_cast<dword>(x - runStart) } });
+	}
+
+	for (const auto& run : runs)
+	{
+		++first[run.index + 1];
+		pixelCount[run.index] += run.span.length;
+	}
+	for (int i = 0; i < 0x100; ++i)
+		first[i + 1] += first[i];
+
+	std::size_t next[0x100];
+	std::copy(first, first + 0x100, next);
+	spans.resize(runs.size());
+	for (const auto& run : runs)
+		spans[next[run.index]++] = run.span;
+}
+
+std::size_t GfxColorIndex::Recolor(Framebuffer& fb, int index, dword color) const
+{
+	index &= 0xFF;
+	const Span* span = spans.data() + first[index];
+	const Span* end = spans.data() + first[index + 1];
+	for (; span != end; ++span)
+	{
+		dword* p = fb.pixels + span->offset;
+		for (dword x = 0; x < span->length; ++x)
+			p[x] = color;
+	}
+	return pixelCount[index];
+}
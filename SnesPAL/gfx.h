@@ -0,0 +1,61 @@
+#pragma once
+
+// SNES planar tile graphics (GFX/ExGFX .bin files).
+// Every 8x8 tile stores its bitplanes in pairs: 16 bytes hold planes 0/1
+// interleaved per row, the next 16 bytes planes 2/3 and so on.
+
+#include "types.h"
+#include "render.h"
+
+#include <vector>
+
+#define GFX_TILE_SIZE		8
+#define GFX_TILE_PIXELS		(GFX_TILE_SIZE * GFX_TILE_SIZE)
+
+bool Gfx_IsValidDepth(int bpp);
+// 16 bytes for 2bpp, 32 for 4bpp, 64 for 8bpp.
+std::size_t Gfx_TileBytes(int bpp);
+// Number of whole tiles in size bytes.
+std::size_t Gfx_TileCount(std::size_t size, int bpp);
+
+// Decodes nTiles into GFX_TILE_PIXELS color indices per tile, row by row.
+void Gfx_DecodeTiles(const byte* src, std::size_t nTiles, int bpp, byte* pixels);
+// Plain bit-by-bit decoder, the reference for the vectorized one.
+void Gfx_DecodeTilesScalar(const byte* src, std::size_t nTiles, int bpp, byte* pixels);
+
+// Index to framebuffer color lookup for one palette row. 8bpp uses the whole
+// palette; index 0 is transparent and shows the backdrop, palette[0].
+void Gfx_BuildColors(const word* palette, int row, int bpp, dword* colors);
+// Draws decoded tiles left to right, tilesPerRow tiles per line; tiles outside fb are clipped.
+void Gfx_RenderTiles(Framebuffer& fb, const byte* pixels, std::size_t nTiles, int tilesPerRow, const dword* colors);
+
+// Color index a palette slot is drawn with when the tiles use palette row
+// row, or -1 if the slot does not show up at all.
+int Gfx_SlotToIndex(int slot, int row, int bpp);
+
+// Reverse map from every color index to the horizontal pixel runs that show
+// it in a framebuffer laid out by Gfx_RenderTiles. Changing one palette slot
+// then rewrites only the pixels using it instead of the whole image.
+class GfxColorIndex
+{
+public:
+	void Build(const byte* pixels, std::size_t nTiles, int tilesPerRow, const Framebuffer& fb);
+	void Clear();
+	bool IsEmpty() const { return spans.empty(); }
+
+	// Writes color into every pixel of index; returns the number of pixels written.
+	std::size_t Recolor(Framebuffer& fb, int index, dword color) const;
+	std::size_t GetPixelCount(int index) const { return pixelCount[index & 0xFF]; }
+	std::size_t GetSpanCount(int index) const { return first[(index & 0xFF) + 1] - first[index & 0xFF]; }
+
+private:
+	struct Span
+	{
+		dword offset;	// Pixel offset into the framebuffer, stride included.
+		dword length;
+	};
+
+	std::vector<Span> spans;			// Grouped by index.
+	std::size_t first[0x101] = { 0 };	// spans[first[i]] .. spans[first[i + 1] - 1] show index i.
+	std::size_t pixelCount[0x100] = { 0 };
+};
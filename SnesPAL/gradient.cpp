@@ -0,0 +1,212 @@
+#include "gradient.h"
+#include "colorspace.h"
+#include "fileio.h"
+
+#include <algorithm>
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+#endif
+
+// Linear RGB per scanline, filled by the interpolation kernels.
+struct LinearLines
+{
+	float r[GRADIENT_LINES_OVERSCAN];
+	float g[GRADIENT_LINES_OVERSCAN];
+	float b[GRADIENT_LINES_OVERSCAN];
+};
+
+// Interpolates from a towards b for lines first + i, i in [begin, end), at t = i * step.
+typedef void (*InterpolateProc)(const Lab& a, const Lab& b, float step, int first, int begin, int end, LinearLines& out);
+
+static void Interpolate_Scalar(const Lab& a, const Lab& b, float step, int first, int begin, int end, LinearLines& out)
+{
+	float dL = b.L - a.L, da = b.a - a.a, db = b.b - a.b;
+	for (int i = begin; i < end; ++i)
+	{
+		float t = static_cast<float>(i) * step;
+		Lab lab = { a.L + t * dL, a.a + t * da, a.b + t * db };
+		ColorSpace_OKLabToLinear(lab, out.r[first + i], out.g[first + i], out.b[first + i]);
+	}
+}
+
+#ifdef SNESPAL_X86
+
+// Four scanlines per step, same operations in the same order as ColorSpace_OKLabToLinear.
+static void Interpolate_SSE2(const Lab& a, const Lab& b, float step, int first, int begin, int end, LinearLines& out)
+{
+	const __m128 aL = _mm_set1_ps(a.L), aA = _mm_set1_ps(a.a), aB = _mm_set1_ps(a.b);
+	const __m128 dL = _mm_set1_ps(b.L - a.L), dA = _mm_set1_ps(b.a - a.a), dB = _mm_set1_ps(b.b - a.b);
+	const __m128 vStep = _mm_set1_ps(step);
+
+	int i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(i, i + 1, i + 2, i + 3)), vStep);
+		__m128 L = _mm_add_ps(aL, _mm_mul_ps(t, dL));
+		__m128 A = _mm_add_ps(aA, _mm_mul_ps(t, dA));
+		__m128 B = _mm_add_ps(aB, _mm_mul_ps(t, dB));
+
+		__m128 r, g, bl;
+		ColorSpace_OKLabToLinear_SSE2(L, A, B, r, g, bl);
+		_mm_storeu_ps(out.r + first + i, r);
+		_mm_storeu_ps(out.g + first + i, g);
+		_mm_storeu_ps(out.b + first + i, bl);
+	}
+	Interpolate_Scalar(a, b, step, first, i, end, out);
+}
+
+#endif
+
+static bool Generate(const GradientKey* keys, std::size_t nKeys, const GradientOptions& opt, word* colors, InterpolateProc proc)
+{
+	if (!nKeys || opt.nLines < 1 || opt.nLines > GRADIENT_LINES_OVERSCAN)
+		return false;
+	std::vector<GradientKey> sorted(keys, keys + nKeys);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const GradientKey& a, const GradientKey& b) { return a.line < b.line; });
+	if (sorted.front().line < 0 || sorted.back().line >= opt.nLines)
+		return false;
+
+	const Lab* okLab = ColorSpace_GetOKLabTable();
+	std::vector<Lab> labs(sorted.size());
+	for (std::size_t k = 0; k < sorted.size(); ++k)
+		labs[k] = okLab[sorted[k].color & 0x7FFF];
+
+	LinearLines lines;
+	proc(labs.front(), labs.front(), 0.0f, 0, 0, sorted.front().line, lines);
+	for (std::size_t k = 0; k + 1 < sorted.size(); ++k)
+	{
+		int length = sorted[k + 1].line - sorted[k].line;
+		if (length > 0)
+			proc(labs[k], labs[k + 1], 1.0f / length, sorted[k].line, 0, length, lines);
+	}
+	proc(labs.back(), labs.back(), 0.0f, sorted.back().line, 0, opt.nLines - sorted.back().line, lines);
+
+	// 1D Bayer thresholds, the dither pattern runs down the scanlines. The
+	// threshold splits each step between two levels of the expansion mode.
+	const float* levels = ColorSpace_GetLevelTable().position;
+	static const float bayer[8] = { 0.0625f, 0.5625f, 0.3125f, 0.8125f, 0.1875f, 0.6875f, 0.4375f, 0.9375f };
+	for (int y = 0; y < opt.nLines; ++y)
+	{
+		float threshold = opt.bDither ? bayer[y & 7] : 0.5f;
+		float channels[3] = { lines.r[y], lines.g[y], lines.b[y] };
+		word color = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			int v5 = std::min(static_cast<int>(levels[ColorSpace_LevelIndex(channels[c])] + threshold), 31);
+			color |= static_cast<word>(v5 << (c * 5));
+		}
+		colors[y] = color;
+	}
+	return true;
+}
+
+bool Gradient_Generate(const GradientKey* keys, std::size_t nKeys, const GradientOptions& opt, word* colors)
+{
+#ifdef SNESPAL_X86
+	return Generate(keys, nKeys, opt, colors, &Interpolate_SSE2);
+#else
+	return Generate(keys, nKeys, opt, colors, &Interpolate_Scalar);
+#endif
+}
+
+bool Gradient_GenerateScalar(const GradientKey* keys, std::size_t nKeys, const GradientOptions& opt, word* colors)
+{
+	return Generate(keys, nKeys, opt, colors, &Interpolate_Scalar);
+}
+
+// Appends (count, data) entries for runs of equal values, count <= GRADIENT_HDMA_MAX_RUN.
+template <typename T, typename Emit>
+static void CollapseRuns(const T* values, int nLines, Emit emit)
+{
+	int y = 0;
+	while (y < nLines)
+	{
+		int run = 1;
+		while (y + run < nLines && run < GRADIENT_HDMA_MAX_RUN && values[y + run] == values[y])
+			++run;
+		emit(run, values[y]);
+		y += run;
+	}
+}
+
+void Gradient_BuildHDMA(const word* colors, int nLines, GradientTable type, std::vector<std::vector<byte>>& tables)
+{
+	tables.clear();
+	if (type == GRADIENT_TABLE_CGRAM)
+	{
+		std::vector<byte> table;
+		CollapseRuns(colors, nLines, [&](int run, word color) {
+			byte entry[5] = { static_cast<byte>(run), 0x00, 0x00, static_cast<byte>(color & 0xFF), static_cast<byte>(color >> 8) };
+			table.insert(table.end(), entry, entry + 5);
+		});
+		table.push_back(0x00);
+		tables.push_back(std::move(table));
+		return;
+	}
+
+	// COLDATA selects the channel with bits 5-7 and takes the intensity in bits 0-4.
+	static const byte channelBits[3] = { 0x20, 0x40, 0x80 };
+	std::vector<byte> values(nLines);
+	for (int c = 0; c < 3; ++c)
+	{
+		for (int y = 0; y < nLines; ++y)
+			values[y] = static_cast<byte>(channelBits[c] | ((colors[y] >> (c * 5)) & 0x1F));
+		std::vector<byte> table;
+		CollapseRuns(values.data(), nLines, [&](int run, byte value) {
+			table.push_back(static_cast<byte>(run));
+			table.push_back(value);
+		});
+		table.push_back(0x00);
+		tables.push_back(std::move(table));
+	}
+}
+
+std::size_t Gradient_GetEntryCount(const std::vector<byte>& table, GradientTable type)
+{
+	std::size_t entrySize = (type == GRADIENT_TABLE_CGRAM) ? 5 : 2;
+	return table.empty() ? 0 : (table.size() - 1) / entrySize;
+}
+
+bool Gradient_WriteBinary(const std::filesystem::path& fn, const std::vector<std::vector<byte>>& tables)
+{
+	FILE* file = File_Open(fn, "wb");
+	if (!file)
+		return false;
+	bool bOk = true;
+	for (const auto& table : tables)
+		bOk = bOk && fwrite(table.data(), 1, table.size(), file) == table.size();
+	return (fclose(file) == 0) && bOk;
+}
+
+bool Gradient_WriteAsm(const std::filesystem::path& fn, const std::vector<std::vector<byte>>& tables, GradientTable type, const char* label)
+{
+	FILE* file = File_Open(fn, "w");
+	if (!file)
+		return false;
+
+	static const char* channelNames[3] = { "Red", "Green", "Blue" };
+	if (type == GRADIENT_TABLE_CGRAM)
+		fprintf(file, "; HDMA mode 3 to $2121: line count, CGRAM index twice, BGR555 color.\n");
+	else
+		fprintf(file, "; HDMA mode 0 to $2132 (COLDATA): line count, channel and intensity.\n");
+
+	for (std::size_t t = 0; t < tables.size(); ++t)
+	{
+		const std::vector<byte>& table = tables[t];
+		if (type == GRADIENT_TABLE_CGRAM)
+		{
+			fprintf(file, "%s:\n", label);
+			for (std::size_t i = 0; i + 5 <= table.size(); i += 5)
+				fprintf(file, "\tdb $%02X : dw $%02X%02X, $%04X\n", table[i], table[i + 2], table[i + 1], table[i + 3] | (table[i + 4] << 8));
+		}
+		else
+		{
+			fprintf(file, "%s%s:\n", label, channelNames[t % 3]);
+			for (std::size_t i = 0; i + 2 <= table.size(); i += 2)
+				fprintf(file, "\tdb $%02X, $%02X\n", table[i], table[i + 1]);
+		}
+		fprintf(file, "\tdb $00\n");
+	}
+	return fclose(file) == 0;
+}
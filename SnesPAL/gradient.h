@@ -0,0 +1,50 @@
+#pragma once
+
+// Per-scanline background gradients for HDMA.
+// Key colors are interpolated in OKLab, quantized to BGR555 (optionally with
+// ordered dithering down the scanlines) and collapsed into HDMA tables.
+
+#include "types.h"
+
+#include <filesystem>
+#include <vector>
+
+#define GRADIENT_LINES				224
+#define GRADIENT_LINES_OVERSCAN		239
+// Longest run a non-repeat HDMA entry can hold.
+#define GRADIENT_HDMA_MAX_RUN		0x7F
+
+struct GradientKey
+{
+	int line;
+	word color;		// BGR555
+};
+
+struct GradientOptions
+{
+	int nLines = GRADIENT_LINES;
+	bool bDither = false;
+};
+
+enum GradientTable
+{
+	// One table, HDMA mode 3 to $2121/$2122: CGRAM index twice, then the color. Sets color 0.
+	GRADIENT_TABLE_CGRAM = 0,
+	// Three tables (red, green, blue), HDMA mode 0 to $2132 COLDATA, collapsed per channel.
+	GRADIENT_TABLE_COLDATA
+};
+
+// Fills nLines colors. Keys may come in any order; lines before the first and
+// after the last key repeat its color. Returns false for no keys or a key outside the lines.
+bool Gradient_Generate(const GradientKey* keys, std::size_t nKeys, const GradientOptions& opt, word* colors);
+// Same without SIMD, the reference for the vectorized interpolation.
+bool Gradient_GenerateScalar(const GradientKey* keys, std::size_t nKeys, const GradientOptions& opt, word* colors);
+
+// Every table is a list of (line count, data) entries ending with a 0 byte.
+void Gradient_BuildHDMA(const word* colors, int nLines, GradientTable type, std::vector<std::vector<byte>>& tables);
+std::size_t Gradient_GetEntryCount(const std::vector<byte>& table, GradientTable type);
+
+// Tables back to back as they go into the ROM.
+bool Gradient_WriteBinary(const std::filesystem::path& fn, const std::vector<std::vector<byte>>& tables);
+// Assembler source with one labelled db/dw table per HDMA table.
+bool Gradient_WriteAsm(const std::filesystem::path& fn, const std::vector<std::vector<byte>>& tables, GradientTable type, const char* label);
@@ -0,0 +1,255 @@
+#include "history.h"
+#include "trace.h"
+
+#include <cstring>
+#include <vector>
+
+History::History(std::size_t budget, HistoryPolicy policy)
+	: budget(budget), policy(policy)
+{
+	memset(current, 0, sizeof(current));
+}
+
+void History::Reset(const word* palette, bool bDrawMode)
+{
+	memcpy(current, palette, sizeof(current));
+	bCurrentDrawMode = bDrawMode;
+	entries.clear();
+	deltas.clear();
+	deltaBase = 0;
+	position = 0;
+	strings.clear();
+	stringIds.clear();
+	stringBytes = 0;
+}
+
+dword History::Intern(const wchar_t* pInfo)
+{
+	std::wstring info = pInfo ? pInfo : L"";
+	auto it = stringIds.find(info);
+	if (it != stringIds.end())
+		return it->second;
+
+	dword id = static_cast<dword>(strings.size());
+	stringBytes += sizeof(std::wstring) + (info.size() + 1) * sizeof(wchar_t);
+	strings.push_back(info);
+	stringIds.emplace(std::move(info), id);
+	return id;
+}
+
+std::size_t History::EntryMemory(const Entry& entry) const
+{
+	return sizeof(Entry) + entry.count * sizeof(HistoryDelta);
+}
+
+std::size_t History::GetMemoryUsage() const
+{
+	return entries.size() * sizeof(Entry) + deltas.size() * sizeof(HistoryDelta) + stringBytes;
+}
+
+std::size_t History::GetUndoStepMemory() const
+{
+	return CanUndo() ? EntryMemory(entries[position - 1]) : 0;
+}
+
+std::size_t History::GetRedoStepMemory() const
+{
+	return CanRedo() ? EntryMemory(entries[position]) : 0;
+}
+
+const wchar_t* History::GetStep(std::size_t step, std::vector<HistoryDelta>& stepDeltas, bool& bDrawModeBefore, bool& bDrawModeAfter) const
+{
+	const Entry& entry = entries[step];
+	auto first = deltas.begin() + (entry.first - deltaBase);
+	stepDeltas.assign(first, first + entry.count);
+	bDrawModeBefore = entry.bDrawModeBefore;
+	bDrawModeAfter = entry.bDrawModeAfter;
+	return strings[entry.infoId].c_str();
+}
+
+void History::TruncateRedo()
+{
+	while (entries.size() > position)
+	{
+		deltas.erase(deltas.end() - entries.back().count, deltas.end());
+		entries.pop_back();
+	}
+}
+
+bool History::Record(const word* palette, bool bDrawMode, const wchar_t* pInfo)
+{
+	TRACE_SCOPE("History::Record");
+	std::size_t count = 0;
+	for (int i = 0; i < HISTORY_COLORS; ++i)
+		if (palette[i] != current[i])
+			++count;
+
+	if (!count && bDrawMode == bCurrentDrawMode)
+		return false;
+
+	TruncateRedo();
+
+	Entry entry;
+	entry.first = deltaBase + deltas.size();
+	entry.count = count;
+	entry.infoId = Intern(pInfo);
+	entry.bDrawModeBefore = bCurrentDrawMode;
+	entry.bDrawModeAfter = bDrawMode;
+
+	for (int i = 0; i < HISTORY_COLORS; ++i)
+	{
+		if (palette[i] != current[i])
+		{
+			deltas.push_back({ current[i], palette[i], static_cast<byte>(i) });
+			current[i] = palette[i];
+		}
+	}
+	bCurrentDrawMode = bDrawMode;
+
+	entries.push_back(entry);
+	++position;
+	EnforceBudget();
+	return true;
+}
+
+const wchar_t* History::Undo(word* palette, bool& bDrawMode)
+{
+	TRACE_SCOPE("History::Undo");
+	if (!CanUndo())
+		return nullptr;
+
+	const Entry& entry = entries[--position];
+	for (std::size_t i = 0; i < entry.count; ++i)
+	{
+		const HistoryDelta& d = deltas[entry.first - deltaBase + i];
+		palette[d.index] = current[d.index] = d.oldColor;
+	}
+	bDrawMode = bCurrentDrawMode = entry.bDrawModeBefore;
+	return strings[entry.infoId].c_str();
+}
+
+const wchar_t* History::Redo(word* palette, bool& bDrawMode)
+{
+	TRACE_SCOPE("History::Redo");
+	if (!CanRedo())
+		return nullptr;
+
+	const Entry& entry = entries[position++];
+	for (std::size_t i = 0; i < entry.count; ++i)
+	{
+		const HistoryDelta& d = deltas[entry.first - deltaBase + i];
+		palette[d.index] = current[d.index] = d.newColor;
+	}
+	bDrawMode = bCurrentDrawMode = entry.bDrawModeAfter;
+	return strings[entry.infoId].c_str();
+}
+
+void History::SetBudget(std::size_t bytes)
+{
+	budget = bytes;
+	EnforceBudget();
+}
+
+void History::EnforceBudget()
+{
+	// The newest step always stays, even when it alone is over budget.
+	while (GetMemoryUsage() > budget && entries.size() > 1)
+	{
+		if (policy == HISTORY_COMPACT_OLDEST && CompactOldest())
+			continue;
+		DropOldest();
+	}
+	if (strings.size() > entries.size() * 2 + 16)
+		CollectStrings();
+}
+
+void History::CollectStrings()
+{
+	std::vector<dword> remap(strings.size(), 0xFFFFFFFF);
+	std::deque<std::wstring> kept;
+	stringIds.clear();
+	stringBytes = 0;
+
+	for (auto& entry : entries)
+	{
+		if (remap[entry.infoId] == 0xFFFFFFFF)
+		{
+			remap[entry.infoId] = static_cast<dword>(kept.size());
+			stringBytes += sizeof(std::wstring) + (strings[entry.infoId].size() + 1) * sizeof(wchar_t);
+			stringIds.emplace(strings[entry.infoId], remap[entry.infoId]);
+			kept.push_back(std::move(strings[entry.infoId]));
+		}
+		entry.infoId = remap[entry.infoId];
+	}
+	strings.swap(kept);
+}
+
+void History::DropOldest()
+{
+	// With every step undone, the oldest one is the next redo and cannot go,
+	// so give up the furthest redo step instead.
+	if (position == 0)
+	{
+		deltas.erase(deltas.end() - entries.back().count, deltas.end());
+		entries.pop_back();
+		return;
+	}
+
+	const Entry& oldest = entries.front();
+	deltas.erase(deltas.begin(), deltas.begin() + oldest.count);
+	deltaBase += oldest.count;
+	entries.pop_front();
+	--position;
+}
+
+// Merges the two oldest steps into one. Colors changed by both keep the
+// first old value and the second new value. Only worth it if it saves memory.
+bool History::CompactOldest()
+{
+	if (entries.size() < 3 || position < 2)
+		return false;
+
+	Entry& a = entries[0];
+	const Entry& b = entries[1];
+
+	int slot[HISTORY_COLORS];
+	for (int i = 0; i < HISTORY_COLORS; ++i)
+		slot[i] = -1;
+
+	std::vector<HistoryDelta> merged;
+	merged.reserve(a.count + b.count);
+	for (std::size_t i = 0; i < a.count + b.count; ++i)
+	{
+		const HistoryDelta& d = deltas[i];
+		if (slot[d.index] < 0)
+		{
+			slot[d.index] = static_cast<int>(merged.size());
+			merged.push_back(d);
+		}
+		else
+			merged[slot[d.index]].newColor = d.newColor;
+	}
+
+	// Pairs that ended up unchanged are dropped entirely.
+	std::size_t n = 0;
+	for (const auto& d : merged)
+		if (d.oldColor != d.newColor)
+			merged[n++] = d;
+	merged.resize(n);
+
+	// Only the second description survives, so intern savings are not counted.
+	if (merged.size() == a.count + b.count && GetMemoryUsage() - sizeof(Entry) > budget)
+		return false;
+
+	deltas.erase(deltas.begin(), deltas.begin() + (a.count + b.count));
+	deltas.insert(deltas.begin(), merged.begin(), merged.end());
+	deltaBase += (a.count + b.count) - merged.size();
+
+	a.count = merged.size();
+	a.first = deltaBase;
+	a.infoId = b.infoId;
+	a.bDrawModeAfter = b.bDrawModeAfter;
+	entries.erase(entries.begin() + 1);
+	--position;
+	return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+// Undo/redo history storing only the colors each operation changed.
+//
+// The history keeps a copy of the last recorded palette; Record() diffs the
+// working palette against it and stores (index, old, new) triplets, so undo
+// and redo cost O(changed colors). Descriptions are interned, and once the
+// memory budget is exceeded the oldest entries are compacted or dropped.
+
+#include "types.h"
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define HISTORY_COLORS			0x100
+#define HISTORY_DEFAULT_BUDGET	(256 * 1024)
+
+enum HistoryPolicy
+{
+	HISTORY_DROP_OLDEST = 0,	// Forget the oldest steps.
+	HISTORY_COMPACT_OLDEST		// Merge the two oldest steps, drop only if that does not help.
+};
+
+struct HistoryDelta
+{
+	word oldColor;
+	word newColor;
+	byte index;
+};
+
+class History
+{
+public:
+	explicit History(std::size_t budget = HISTORY_DEFAULT_BUDGET, HistoryPolicy policy = HISTORY_COMPACT_OLDEST);
+
+	// Starts a new history with palette as the base state.
+	void Reset(const word* palette, bool bDrawMode);
+	// Records palette as a new step. Returns false if nothing changed.
+	bool Record(const word* palette, bool bDrawMode, const wchar_t* pInfo);
+	// Apply the previous/next step to palette. Return the step description, or nullptr.
+	const wchar_t* Undo(word* palette, bool& bDrawMode);
+	const wchar_t* Redo(word* palette, bool& bDrawMode);
+
+	std::size_t GetUndoCount() const { return position; }
+	std::size_t GetRedoCount() const { return entries.size() - position; }
+	bool CanUndo() const { return position > 0; }
+	bool CanRedo() const { return position < entries.size(); }
+
+	void SetBudget(std::size_t bytes);
+	std::size_t GetBudget() const { return budget; }
+	// Memory used by all steps, deltas and interned strings.
+	std::size_t GetMemoryUsage() const;
+	// Memory used by the step that Undo()/Redo() would apply next.
+	std::size_t GetUndoStepMemory() const;
+	std::size_t GetRedoStepMemory() const;
+
+	// Steps oldest first, applied or not, for writing the history elsewhere.
+	// Returns the step description and its (index, old, new) triplets.
+	std::size_t GetStepCount() const { return entries.size(); }
+	const wchar_t* GetStep(std::size_t step, std::vector<HistoryDelta>& stepDeltas, bool& bDrawModeBefore, bool& bDrawModeAfter) const;
+
+private:
+	struct Entry
+	{
+		std::size_t first;		// Absolute index into deltas.
+		std::size_t count;
+		dword infoId;
+		bool bDrawModeBefore;
+		bool bDrawModeAfter;
+	};
+
+	dword Intern(const wchar_t* pInfo);
+	std::size_t EntryMemory(const Entry& entry) const;
+	void TruncateRedo();
+	void EnforceBudget();
+	void CollectStrings();
+	bool CompactOldest();
+	void DropOldest();
+
+	word current[HISTORY_COLORS];
+	bool bCurrentDrawMode = false;
+
+	std::deque<Entry> entries;
+	std::deque<HistoryDelta> deltas;
+	std::size_t deltaBase = 0;		// Absolute index of deltas.front().
+	std::size_t position = 0;		// Number of applied entries.
+
+	std::deque<std::wstring> strings;
+	std::unordered_map<std::wstring, dword> stringIds;
+	std::size_t stringBytes = 0;
+
+	std::size_t budget;
+	HistoryPolicy policy;
+};
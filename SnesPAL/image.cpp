@@ -0,0 +1,193 @@
+#include "image.h"
+#include "fileio.h"
+
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static void PutLE(std::vector<byte>& out, dword value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+		out.push_back(static_cast<byte>(value >> (i * 8)));
+}
+
+static dword GetLE(const byte* p, int bytes)
+{
+	dword value = 0;
+	for (int i = 0; i < bytes; ++i)
+		value |= static_cast<dword>(p[i]) << (i * 8);
+	return value;
+}
+
+static bool ReadPPM(const std::vector<byte>& data, Image& img)
+{
+	std::size_t pos = 2;
+	int fields[3] = { 0 };
+	for (int f = 0; f < 3; ++f)
+	{
+		// Whitespace and comments between header fields.
+		while (pos < data.size() && (isspace(data[pos]) || data[pos] == '#'))
+		{
+			if (data[pos] == '#')
+				while (pos < data.size() && data[pos] != '\n')
+					++pos;
+			else
+				++pos;
+		}
+		if (pos >= data.size() || !isdigit(data[pos]))
+			return false;
+		while (pos < data.size() && isdigit(data[pos]) && fields[f] < 0x10000)
+			fields[f] = fields[f] * 10 + (data[pos++] - '0');
+	}
+	++pos;		// Single whitespace before the samples.
+
+	int width = fields[0], height = fields[1], maxVal = fields[2];
+	if (width < 1 || height < 1 || maxVal < 1 || maxVal > 0xFF)
+		return false;
+	std::size_t nPixels = static_cast<std::size_t>(width) * height;
+	if (pos > data.size() || data.size() - pos < nPixels * 3)
+		return false;
+
+	img.width = width;
+	img.height = height;
+	img.pixels.resize(nPixels);
+	const byte* p = data.data() + pos;
+	for (std::size_t i = 0; i < nPixels; ++i, p += 3)
+	{
+		dword r = p[0] * 255 / maxVal, g = p[1] * 255 / maxVal, b = p[2] * 255 / maxVal;
+		img.pixels[i] = RENDER_XRGB(r, g, b);
+	}
+	return true;
+}
+
+static bool ReadBMP(const std::vector<byte>& data, Image& img)
+{
+	if (data.size() < 54)
+		return false;
+	dword dataOffset = GetLE(&data[10], 4);
+	dword headerSize = GetLE(&data[14], 4);
+	int width = static_cast<int>(GetLE(&data[18], 4));
+	int height = static_cast<int>(GetLE(&data[22], 4));
+	int bpp = static_cast<int>(GetLE(&data[28], 2));
+	dword compression = GetLE(&data[30], 4);
+	dword nPalette = GetLE(&data[46], 4);
+
+	bool bTopDown = height < 0;
+	if (bTopDown)
+		height = -height;
+	if (width < 1 || height < 1 || width > 0x8000 || height > 0x8000)
+		return false;
+	// BI_BITFIELDS is only accepted for 32-bit images, assuming the usual masks.
+	if (!(compression == 0 || (compression == 3 && bpp == 32)) || (bpp != 8 && bpp != 24 && bpp != 32))
+		return false;
+
+	dword palette[0x100] = { 0 };
+	if (bpp == 8)
+	{
+		if (!nPalette || nPalette > 0x100)
+			nPalette = 0x100;
+		std::size_t palOffset = 14 + static_cast<std::size_t>(headerSize);
+		if (palOffset + nPalette * 4 > data.size())
+			return false;
+		for (dword i = 0; i < nPalette; ++i)
+			palette[i] = GetLE(&data[palOffset + i * 4], 3);
+	}
+
+	std::size_t rowSize = (static_cast<std::size_t>(width) * bpp / 8 + 3) & ~static_cast<std::size_t>(3);
+	if (dataOffset > data.size() || (data.size() - dataOffset) / rowSize < static_cast<std::size_t>(height))
+		return false;
+
+	img.width = width;
+	img.height = height;
+	img.pixels.resize(static_cast<std::size_t>(width) * height);
+	for (int y = 0; y < height; ++y)
+	{
+		const byte* src = data.data() + dataOffset + rowSize * (bTopDown ? y : height - 1 - y);
+		dword* dst = img.pixels.data() + static_cast<std::size_t>(y) * width;
+		for (int x = 0; x < width; ++x)
+		{
+			if (bpp == 8)
+				dst[x] = palette[src[x]];
+			else
+				dst[x] = GetLE(src + x * (bpp / 8), 3);
+		}
+	}
+	return true;
+}
+
+bool Image_Read(const std::filesystem::path& fn, Image& img)
+{
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return false;
+	std::vector<byte> data;
+	byte buffer[0x4000];
+	std::size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(file);
+
+	if (data.size() >= 2 && data[0] == 'P' && data[1] == '6')
+		return ReadPPM(data, img);
+	if (data.size() >= 2 && data[0] == 'B' && data[1] == 'M')
+		return ReadBMP(data, img);
+	return false;
+}
+
+bool Image_Write(const std::filesystem::path& fn, const Framebuffer& fb)
+{
+	std::vector<byte> out;
+	bool bPPM = (fn.extension() == ".ppm");
+
+	if (bPPM)
+	{
+		std::string header = "P6\n" + std::to_string(fb.width) + " " + std::to_string(fb.height) + "\n255\n";
+		out.assign(header.begin(), header.end());
+		out.reserve(out.size() + static_cast<std::size_t>(fb.width) * fb.height * 3);
+		for (int y = 0; y < fb.height; ++y)
+		{
+			const dword* row = fb.pixels + static_cast<std::size_t>(y) * fb.stride;
+			for (int x = 0; x < fb.width; ++x)
+			{
+				out.push_back(static_cast<byte>(row[x] >> 16));
+				out.push_back(static_cast<byte>(row[x] >> 8));
+				out.push_back(static_cast<byte>(row[x]));
+			}
+		}
+	}
+	else
+	{
+		dword rowSize = (fb.width * 3 + 3) & ~3u;
+		dword dataSize = rowSize * fb.height;
+		out.push_back('B'); out.push_back('M');
+		PutLE(out, 54 + dataSize, 4);
+		PutLE(out, 0, 4);
+		PutLE(out, 54, 4);
+		PutLE(out, 40, 4);
+		PutLE(out, fb.width, 4);
+		PutLE(out, fb.height, 4);
+		PutLE(out, 1, 2);
+		PutLE(out, 24, 2);
+		PutLE(out, 0, 4);
+		PutLE(out, dataSize, 4);
+		PutLE(out, 2835, 4);
+		PutLE(out, 2835, 4);
+		PutLE(out, 0, 4);
+		PutLE(out, 0, 4);
+		for (int y = fb.height - 1; y >= 0; --y)
+		{
+			const dword* row = fb.pixels + static_cast<std::size_t>(y) * fb.stride;
+			for (int x = 0; x < fb.width; ++x)
+				PutLE(out, row[x], 3);
+			for (dword pad = fb.width * 3; pad < rowSize; ++pad)
+				out.push_back(0);
+		}
+	}
+
+	FILE* file = File_Open(fn, "wb");
+	if (!file)
+		return false;
+	bool bOk = fwrite(out.data(), 1, out.size(), file) == out.size();
+	return (fclose(file) == 0) && bOk;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Minimal image file support for headless rendering.
+
+#include "types.h"
+#include "render.h"
+
+#include <filesystem>
+#include <vector>
+
+// Image owning its pixels, same 0x00RRGGBB layout as Framebuffer.
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	std::vector<dword> pixels;
+};
+
+// Reads binary PPM (P6, 8 bits per channel) or an uncompressed 8, 24 or
+// 32-bit BMP, told apart by content. PNG is not supported.
+bool Image_Read(const std::filesystem::path& fn, Image& img);
+// Writes a framebuffer as binary PPM (.ppm) or 24-bit BMP (any other extension).
+bool Image_Write(const std::filesystem::path& fn, const Framebuffer& fb);
@@ -0,0 +1,506 @@
+#include "journal.h"
+#include "fileio.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstring>
+
+static_assert(sizeof(JournalHeader) == 24 + JOURNAL_COLORS * sizeof(word), "Journal header layout changed.");
+static_assert(sizeof(JournalRecordHeader) == 8, "Journal record layout changed.");
+
+// Descriptions beyond this many code units are cut.
+#define JOURNAL_MAX_INFO		0x400
+// Edits whose description did not get an id replay without one.
+#define JOURNAL_NO_INFO			0xFFFF
+
+// CRC-32 (IEEE), table driven.
+static dword Crc32(const byte* data, std::size_t size, dword crc = 0)
+{
+	static const struct Table
+	{
+		dword t[0x100];
+		Table()
+		{
+			for (dword i = 0; i < 0x100; ++i)
+			{
+				dword c = i;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				t[i] = c;
+			}
+		}
+	} table;
+
+	crc = ~crc;
+	for (std::size_t i = 0; i < size; ++i)
+		crc = table.t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static dword HeaderCrc(const JournalHeader& header)
+{
+	dword crc = Crc32(reinterpret_cast<const byte*>(&header.address), sizeof(header.address) + sizeof(header.flags));
+	return Crc32(reinterpret_cast<const byte*>(header.base), sizeof(header.base), crc);
+}
+
+std::filesystem::path Journal_GetPath(const std::filesystem::path& fn, dword address)
+{
+	std::filesystem::path result = fn;
+	if (address != JOURNAL_NO_ADDRESS)
+	{
+		char suffix[16];
+		snprintf(suffix, sizeof(suffix), ".%06X", address);
+		result += suffix;
+	}
+	result += ".spj";
+	return result;
+}
+
+bool Journal_Replay(const std::filesystem::path& fn, word* palette, bool& bDrawMode, History& history, JournalReplayInfo* pInfo)
+{
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return false;
+	std::vector<byte> data;
+	if (!fseek(file, 0, SEEK_END))
+	{
+		long size = ftell(file);
+		if (size > 0 && !fseek(file, 0, SEEK_SET))
+		{
+			data.resize(static_cast<std::size_t>(size));
+			data.resize(fread(data.data(), 1, data.size(), file));
+		}
+	}
+	fclose(file);
+
+	JournalHeader header;
+	if (data.size() < sizeof(header))
+		return false;
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, JOURNAL_MAGIC, 4) || header.version != JOURNAL_VERSION || header.crc != HeaderCrc(header))
+		return false;
+
+	JournalReplayInfo info;
+	info.address = header.address;
+	memcpy(palette, header.base, sizeof(header.base));
+	bDrawMode = (header.flags & JOURNAL_FLAG_DRAW_MODE) != 0;
+	history.Reset(palette, bDrawMode);
+
+	std::vector<std::wstring> infos;
+	std::size_t pos = sizeof(header);
+	while (pos < data.size())
+	{
+		JournalRecordHeader rh;
+		if (data.size() - pos < sizeof(rh))
+		{
+			info.bTorn = true;
+			break;
+		}
+		memcpy(&rh, data.data() + pos, sizeof(rh));
+		const byte* p = data.data() + pos + sizeof(rh);
+		if (rh.size > data.size() - pos - sizeof(rh) ||
+			rh.crc != Crc32(data.data() + pos + sizeof(rh.crc), sizeof(rh) - sizeof(rh.crc) + rh.size))
+		{
+			info.bTorn = true;
+			break;
+		}
+
+		bool bValid = true;
+		switch (rh.type)
+		{
+			case JOURNAL_INFO:
+			{
+				std::wstring text(rh.size / 2, L'\0');
+				for (std::size_t i = 0; i < text.size(); ++i)
+					text[i] = static_cast<wchar_t>(p[i * 2] | (p[i * 2 + 1] << 8));
+				infos.push_back(std::move(text));
+				break;
+			}
+			case JOURNAL_EDIT:
+			{
+				if (rh.size < 2)
+				{
+					bValid = false;
+					break;
+				}
+				std::size_t id = p[0] | (p[1] << 8);
+				std::size_t q = 2;
+				while (bValid && q < rh.size)
+				{
+					if (rh.size - q < 2)
+					{
+						bValid = false;
+						break;
+					}
+					std::size_t first = p[q], count = p[q + 1] + 1u;
+					if (rh.size - q < 2 + count * 2 || first + count > JOURNAL_COLORS)
+					{
+						bValid = false;
+						break;
+					}
+					q += 2;
+					for (std::size_t i = 0; i < count; ++i, q += 2)
+						palette[first + i] = static_cast<word>(p[q] | (p[q + 1] << 8));
+				}
+				if (!bValid)
+					break;
+				bDrawMode = (rh.flags & JOURNAL_FLAG_DRAW_MODE) != 0;
+				history.Record(palette, bDrawMode, id < infos.size() ? infos[id].c_str() : L"");
+				++info.nEdits;
+				break;
+			}
+			case JOURNAL_UNDO:
+				history.Undo(palette, bDrawMode);
+				break;
+			case JOURNAL_REDO:
+				history.Redo(palette, bDrawMode);
+				break;
+			default:
+				// Unknown records from a newer version only carry extra data.
+				break;
+		}
+		// A record with a good CRC but bad contents is damage all the same.
+		if (!bValid)
+		{
+			info.bTorn = true;
+			break;
+		}
+		if (rh.type != JOURNAL_INFO)
+			info.bSaved = rh.type == JOURNAL_SAVED;
+		++info.nRecords;
+		pos += sizeof(rh) + rh.size;
+	}
+
+	if (pInfo)
+		*pInfo = info;
+	return true;
+}
+
+bool Journal_Recover(const std::filesystem::path& fn, JournalRecovery& recovery)
+{
+	std::error_code ec;
+	if (!std::filesystem::exists(fn, ec))
+		return false;
+	auto tStart = std::chrono::steady_clock::now();
+	if (!Journal_Replay(fn, recovery.palette, recovery.bDrawMode, recovery.history, &recovery.info))
+		return false;
+	recovery.replayUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+	return recovery.info.nRecords && !recovery.info.bSaved;
+}
+
+void Journal::Open(const std::filesystem::path& fn, dword address, const History& history, const word* palette, bool bDrawMode, bool bSaved)
+{
+	Close(false);
+	path = fn;
+	this->address = address;
+	bOpen = true;
+	StartWriter();
+	Rewrite(history, palette, bDrawMode, bSaved);
+}
+
+void Journal::Close(bool bRemove)
+{
+	if (!bOpen)
+		return;
+	if (bRemove)
+	{
+		// Nothing pending is worth writing into a journal about to go.
+		std::lock_guard<std::mutex> lock(mtx);
+		pending.clear();
+		rewrite.clear();
+		bRewrite = false;
+	}
+	StopWriter();
+	if (bRemove)
+	{
+		std::error_code ec;
+		std::filesystem::remove(path, ec);
+	}
+	bOpen = false;
+	path.clear();
+	infoIds.clear();
+}
+
+void Journal::AppendRecord(std::vector<byte>& out, byte type, byte flags, const byte* payload, std::size_t size)
+{
+	JournalRecordHeader rh;
+	rh.size = static_cast<word>(size);
+	rh.type = type;
+	rh.flags = flags;
+	rh.crc = Crc32(reinterpret_cast<const byte*>(&rh) + sizeof(rh.crc), sizeof(rh) - sizeof(rh.crc));
+	rh.crc = Crc32(payload, size, rh.crc);
+
+	const byte* pHeader = reinterpret_cast<const byte*>(&rh);
+	out.insert(out.end(), pHeader, pHeader + sizeof(rh));
+	out.insert(out.end(), payload, payload + size);
+}
+
+// Encodes the change from one palette to the other as runs of changed colors.
+void Journal::AppendEdit(std::vector<byte>& out, const word* from, const word* to, bool bDrawMode, const wchar_t* pInfo)
+{
+	std::wstring info = pInfo ? pInfo : L"";
+	if (info.size() > JOURNAL_MAX_INFO)
+		info.resize(JOURNAL_MAX_INFO);
+
+	word id = JOURNAL_NO_INFO;
+	auto it = infoIds.find(info);
+	if (it != infoIds.end())
+		id = it->second;
+	else if (infoIds.size() < JOURNAL_NO_INFO)
+	{
+		id = static_cast<word>(infoIds.size());
+		record.clear();
+		for (wchar_t c : info)
+		{
+			record.push_back(static_cast<byte>(c));
+			record.push_back(static_cast<byte>(c >> 8));
+		}
+		AppendRecord(out, JOURNAL_INFO, 0, record.data(), record.size());
+		infoIds.emplace(std::move(info), id);
+	}
+
+	record.clear();
+	record.push_back(static_cast<byte>(id));
+	record.push_back(static_cast<byte>(id >> 8));
+	for (int i = 0; i < JOURNAL_COLORS;)
+	{
+		if (from[i] == to[i])
+		{
+			++i;
+			continue;
+		}
+		int first = i;
+		while (i < JOURNAL_COLORS && from[i] != to[i])
+			++i;
+		record.push_back(static_cast<byte>(first));
+		record.push_back(static_cast<byte>(i - first - 1));
+		for (int k = first; k < i; ++k)
+		{
+			record.push_back(static_cast<byte>(to[k]));
+			record.push_back(static_cast<byte>(to[k] >> 8));
+		}
+	}
+	AppendRecord(out, JOURNAL_EDIT, bDrawMode ? JOURNAL_FLAG_DRAW_MODE : 0, record.data(), record.size());
+}
+
+void Journal::Submit(const std::vector<byte>& bytes)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	pending.insert(pending.end(), bytes.begin(), bytes.end());
+	++nSubmitted;
+	stats.nBytes += bytes.size();
+	++stats.nOperations;
+	wake.notify_one();
+}
+
+bool Journal::RecordEdit(const word* palette, bool bDrawMode, const wchar_t* pInfo)
+{
+	if (!bOpen || (!memcmp(current, palette, sizeof(current)) && bDrawMode == bCurrentDrawMode))
+		return false;
+
+	staged.clear();
+	AppendEdit(staged, current, palette, bDrawMode, pInfo);
+	Submit(staged);
+	memcpy(current, palette, sizeof(current));
+	bCurrentDrawMode = bDrawMode;
+	return true;
+}
+
+void Journal::RecordUndo(const word* palette, bool bDrawMode)
+{
+	if (!bOpen)
+		return;
+	staged.clear();
+	AppendRecord(staged, JOURNAL_UNDO, 0, nullptr, 0);
+	Submit(staged);
+	memcpy(current, palette, sizeof(current));
+	bCurrentDrawMode = bDrawMode;
+}
+
+void Journal::RecordRedo(const word* palette, bool bDrawMode)
+{
+	if (!bOpen)
+		return;
+	staged.clear();
+	AppendRecord(staged, JOURNAL_REDO, 0, nullptr, 0);
+	Submit(staged);
+	memcpy(current, palette, sizeof(current));
+	bCurrentDrawMode = bDrawMode;
+}
+
+bool Journal::Compact(const History& history, const word* palette, bool bDrawMode, bool bSaved)
+{
+	if (!bOpen)
+		return false;
+	Rewrite(history, palette, bDrawMode, bSaved);
+	return true;
+}
+
+// Encodes base state, steps and undos reproducing history and hands them to
+// the writer, which replaces the journal with them atomically.
+void Journal::Rewrite(const History& history, const word* palette, bool bDrawMode, bool bSaved)
+{
+	// The base state is the palette with every applied step undone.
+	JournalHeader header;
+	memcpy(header.magic, JOURNAL_MAGIC, 4);
+	header.version = JOURNAL_VERSION;
+	header.address = address;
+	header.reserved = 0;
+	memcpy(header.base, palette, sizeof(header.base));
+	bool bBaseDrawMode = bDrawMode;
+	std::vector<HistoryDelta> deltas;
+	bool bBefore, bAfter;
+	std::size_t nSteps = history.GetStepCount(), position = history.GetUndoCount();
+	for (std::size_t i = position; i-- > 0;)
+	{
+		history.GetStep(i, deltas, bBefore, bAfter);
+		for (const auto& d : deltas)
+			header.base[d.index] = d.oldColor;
+		bBaseDrawMode = bBefore;
+	}
+	header.flags = bBaseDrawMode ? JOURNAL_FLAG_DRAW_MODE : 0;
+	header.crc = HeaderCrc(header);
+
+	std::vector<byte> out(reinterpret_cast<const byte*>(&header), reinterpret_cast<const byte*>(&header) + sizeof(header));
+	JournalStats newStats;
+	infoIds.clear();
+	memcpy(current, header.base, sizeof(current));
+	word next[JOURNAL_COLORS];
+	for (std::size_t i = 0; i < nSteps; ++i)
+	{
+		const wchar_t* pInfo = history.GetStep(i, deltas, bBefore, bAfter);
+		memcpy(next, current, sizeof(next));
+		for (const auto& d : deltas)
+			next[d.index] = d.newColor;
+		AppendEdit(out, current, next, bAfter, pInfo);
+		memcpy(current, next, sizeof(current));
+		++newStats.nOperations;
+	}
+	for (std::size_t i = position; i < nSteps; ++i, ++newStats.nOperations)
+		AppendRecord(out, JOURNAL_UNDO, 0, nullptr, 0);
+	if (bSaved)
+		AppendRecord(out, JOURNAL_SAVED, 0, nullptr, 0);
+	memcpy(current, palette, sizeof(current));
+	bCurrentDrawMode = bDrawMode;
+	newStats.nBytes = out.size();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	// Appends not written yet are steps of history, already in the rewrite.
+	pending.clear();
+	rewrite.swap(out);
+	bRewrite = true;
+	++nSubmitted;
+	newStats.nWrites = stats.nWrites;
+	stats = newStats;
+	wake.notify_one();
+}
+
+bool Journal::Sync()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!writer.joinable())
+		return !bFailed;
+	bSyncRequested = true;
+	wake.notify_one();
+	written.wait(lock, [this] { return nSynced >= nSubmitted; });
+	return !bFailed;
+}
+
+bool Journal::HasFailed()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return bFailed;
+}
+
+JournalStats Journal::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return stats;
+}
+
+void Journal::StartWriter()
+{
+	bStop = false;
+	bFailed = false;
+	bSyncRequested = false;
+	bRewrite = false;
+	nSubmitted = nSynced = 0;
+	pending.clear();
+	rewrite.clear();
+	stats = JournalStats();
+	writer = std::thread(&Journal::WriterLoop, this);
+}
+
+void Journal::StopWriter()
+{
+	if (!writer.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		bStop = true;
+	}
+	wake.notify_one();
+	writer.join();
+}
+
+// Group commit: the first record opens a window, everything submitted until
+// it closes (or until the batch is big enough) goes out in one write + sync.
+// Rewrites go out right away. The writer owns the journal file.
+void Journal::WriterLoop()
+{
+	FILE* file = nullptr;
+	std::vector<byte> image, batch;
+	std::unique_lock<std::mutex> lock(mtx);
+	for (;;)
+	{
+		wake.wait(lock, [this] { return bStop || bSyncRequested || bRewrite || !pending.empty(); });
+		if (!bStop && !bSyncRequested && !bRewrite)
+		{
+			wake.wait_for(lock, std::chrono::milliseconds(JOURNAL_SYNC_WINDOW_MS),
+				[this] { return bStop || bSyncRequested || bRewrite || pending.size() >= JOURNAL_SYNC_BYTES; });
+		}
+		bSyncRequested = false;
+		bool bDoRewrite = bRewrite;
+		bRewrite = false;
+		image.swap(rewrite);
+		batch.swap(pending);
+		unsigned long long target = nSubmitted;
+		lock.unlock();
+
+		bool bRewritten = true, bAppended = true;
+		if (bDoRewrite)
+		{
+			TRACE_SCOPE("Journal rewrite");
+			if (file)
+				fclose(file);
+			bRewritten = File_WriteAtomic(path, image.data(), image.size());
+			// Appends after a failed rewrite would not match the journal on
+			// disk, so they are dropped until the next rewrite succeeds.
+			file = bRewritten ? File_Open(path, "ab") : nullptr;
+			bRewritten = bRewritten && file != nullptr;
+			image.clear();
+		}
+		bool bAppend = !batch.empty();
+		if (bAppend)
+		{
+			TRACE_SCOPE("Journal append");
+			bAppended = file && fwrite(batch.data(), 1, batch.size(), file) == batch.size() && File_Sync(file);
+			batch.clear();
+		}
+
+		lock.lock();
+		if (bDoRewrite)
+			bFailed = !bRewritten;
+		if (!bAppended)
+			bFailed = true;
+		if (bDoRewrite || bAppend)
+			++stats.nWrites;
+		nSynced = target;
+		written.notify_all();
+		if (bStop)
+			break;
+	}
+	lock.unlock();
+	if (file)
+		fclose(file);
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+// Write-ahead journal of palette edits for crash recovery.
+//
+// Every recorded operation, undo and redo is appended to a journal next to
+// the open file as a small record holding only the runs of colors it
+// changed. Records are handed to a writer thread, which waits for a short
+// window and then writes and syncs everything that arrived meanwhile at
+// once, so a painting stroke costs a memcpy on the UI thread and a whole
+// burst of strokes a single sync.
+//
+// Saving rewrites the journal from the undo history, which drops steps that
+// were undone and replaced, and marks it as saved. A journal left behind by
+// a session that did not end cleanly is replayed into the palette and the
+// undo history.
+//
+// Layout, little-endian: JournalHeader, then records of JournalRecordHeader
+// and payload. A record whose CRC does not match ends the journal; it was
+// torn by the crash.
+
+#include "types.h"
+#include "history.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define JOURNAL_MAGIC			"SPJL"
+#define JOURNAL_VERSION			1
+#define JOURNAL_COLORS			0x100
+#define JOURNAL_NO_ADDRESS		0xFFFFFFFF
+// Records arriving within this window share one write and sync.
+#define JOURNAL_SYNC_WINDOW_MS	250
+// A batch this large is written right away.
+#define JOURNAL_SYNC_BYTES		0x10000
+
+enum JournalRecordType
+{
+	JOURNAL_INFO = 1,	// Defines the next description id, UTF-16 payload.
+	JOURNAL_EDIT,		// word description id, then runs of (byte first, byte count - 1, colors).
+	JOURNAL_UNDO,
+	JOURNAL_REDO,
+	JOURNAL_SAVED		// The palette was saved; nothing after the last one needs recovery.
+};
+
+#define JOURNAL_FLAG_DRAW_MODE	0x01
+
+struct JournalHeader
+{
+	char magic[4];
+	dword version;
+	dword address;			// ROM address the palette came from, or JOURNAL_NO_ADDRESS.
+	dword flags;			// Draw mode of the base state.
+	dword crc;				// Of address, flags and base.
+	dword reserved;
+	word base[JOURNAL_COLORS];
+};
+
+struct JournalRecordHeader
+{
+	dword crc;				// Of everything after this field, payload included.
+	word size;				// Payload bytes.
+	byte type;
+	byte flags;				// Draw mode after an edit.
+};
+
+struct JournalStats
+{
+	std::size_t nOperations = 0;	// Edits, undos and redos in the journal.
+	std::size_t nBytes = 0;
+	std::size_t nWrites = 0;		// Batches written and synced.
+};
+
+struct JournalReplayInfo
+{
+	dword address = JOURNAL_NO_ADDRESS;
+	std::size_t nRecords = 0;
+	std::size_t nEdits = 0;
+	bool bSaved = false;		// Ends with JOURNAL_SAVED, the file holds the last state.
+	bool bTorn = false;			// Stopped at a damaged record.
+};
+
+// Journal path for a palette file, or for a palette at a ROM address.
+std::filesystem::path Journal_GetPath(const std::filesystem::path& fn, dword address = JOURNAL_NO_ADDRESS);
+
+// State of a session that ended without saving its last changes.
+struct JournalRecovery
+{
+	word palette[JOURNAL_COLORS];
+	bool bDrawMode = false;
+	History history;
+	JournalReplayInfo info;
+	long long replayUs = 0;
+};
+
+// Rebuilds palette, draw mode and history from a journal.
+bool Journal_Replay(const std::filesystem::path& fn, word* palette, bool& bDrawMode, History& history, JournalReplayInfo* pInfo = nullptr);
+// Replays fn if it exists and holds changes that were never saved.
+bool Journal_Recover(const std::filesystem::path& fn, JournalRecovery& recovery);
+
+class Journal
+{
+public:
+	Journal() = default;
+	~Journal() { Close(false); }
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Starts a journal holding history, which must end at palette, and
+	// appends to it from then on. bSaved marks palette as the state on disk,
+	// as Compact() does. Like every write this happens on the writer thread;
+	// HasFailed() tells if any of them did not make it.
+	void Open(const std::filesystem::path& fn, dword address, const History& history, const word* palette, bool bDrawMode, bool bSaved);
+	// Syncs what is pending and stops; bRemove deletes the journal.
+	void Close(bool bRemove);
+	bool IsOpen() const { return bOpen; }
+	const std::filesystem::path& GetPath() const { return path; }
+
+	// Appends the colors changed since the last record. False if nothing changed.
+	bool RecordEdit(const word* palette, bool bDrawMode, const wchar_t* pInfo);
+	// Undo/redo are replayed on the history, palette is only tracked here.
+	void RecordUndo(const word* palette, bool bDrawMode);
+	void RecordRedo(const word* palette, bool bDrawMode);
+	// Rewrites the journal from history after a save. bSaved marks palette
+	// as the state on disk; it is not if the user kept editing meanwhile.
+	bool Compact(const History& history, const word* palette, bool bDrawMode, bool bSaved = true);
+
+	// Blocks until everything appended so far is on disk.
+	bool Sync();
+	bool HasFailed();
+	JournalStats GetStats();
+
+private:
+	void WriterLoop();
+	void StartWriter();
+	void StopWriter();
+	void Rewrite(const History& history, const word* palette, bool bDrawMode, bool bSaved);
+	void AppendRecord(std::vector<byte>& out, byte type, byte flags, const byte* payload, std::size_t size);
+	void AppendEdit(std::vector<byte>& out, const word* from, const word* to, bool bDrawMode, const wchar_t* pInfo);
+	void Submit(const std::vector<byte>& bytes);
+
+	std::filesystem::path path;
+	dword address = JOURNAL_NO_ADDRESS;
+	bool bOpen = false;
+
+	// UI thread state: palette after the last record and description ids.
+	word current[JOURNAL_COLORS];
+	bool bCurrentDrawMode = false;
+	std::unordered_map<std::wstring, word> infoIds;
+	std::vector<byte> record;		// Payload being encoded.
+	std::vector<byte> staged;		// Records of one operation.
+
+	std::thread writer;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::condition_variable written;
+	std::vector<byte> pending;
+	std::vector<byte> rewrite;			// Whole new journal, replaces pending.
+	unsigned long long nSubmitted = 0;	// Operations and rewrites handed to the writer.
+	unsigned long long nSynced = 0;		// Of those, written and synced.
+	bool bRewrite = false;
+	bool bSyncRequested = false;
+	bool bStop = false;
+	bool bFailed = false;
+	JournalStats stats;
+};
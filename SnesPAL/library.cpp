@@ -0,0 +1,370 @@
+#include "library.h"
+#include "palfile.h"
+#include "fileio.h"
+#include "threadpool.h"
+
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+static_assert(sizeof(LibraryHeader) == 72, "Pack header layout changed.");
+static_assert(sizeof(LibrarySlot) == 16, "Pack slot layout changed.");
+static_assert(sizeof(LibraryEntry) == 32, "Pack entry layout changed.");
+static_assert(sizeof(LibrarySourceRecord) == 8, "Pack source layout changed.");
+
+#define LIBRARY_ROWS	(PAL_COLORS / LIBRARY_ROW_COLORS)
+
+unsigned long long Library_Hash(const word* colors, std::size_t nColors)
+{
+	// FNV-1a over the colors, then a final mix so the low bits used for the
+	// slot index depend on every color.
+	unsigned long long h = 0xCBF29CE484222325ull ^ nColors;
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		h ^= colors[i] & 0x7FFF;
+		h *= 0x100000001B3ull;
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
+
+bool PaletteLibrary::Open(const std::filesystem::path& fn)
+{
+	Close();
+	if (!file.Open(fn, false) || file.Size() < sizeof(LibraryHeader))
+	{
+		Close();
+		return false;
+	}
+
+	const byte* base = file.Data();
+	std::size_t size = file.Size();
+	const LibraryHeader* h = reinterpret_cast<const LibraryHeader*>(base);
+	auto fits = [size](unsigned long long offset, unsigned long long bytes) {
+		return offset <= size && bytes <= size - offset && offset % 8 == 0;
+	};
+	if (memcmp(h->magic, LIBRARY_MAGIC, 4) || h->version != LIBRARY_VERSION ||
+		!h->nSlots || (h->nSlots & (h->nSlots - 1)) || h->nSlots <= h->nEntries ||
+		!fits(h->slotsOffset, static_cast<unsigned long long>(h->nSlots) * sizeof(LibrarySlot)) ||
+		!fits(h->entriesOffset, static_cast<unsigned long long>(h->nEntries) * sizeof(LibraryEntry)) ||
+		!fits(h->sourcesOffset, static_cast<unsigned long long>(h->nSources) * sizeof(LibrarySourceRecord)) ||
+		!fits(h->colorsOffset, h->namesOffset - h->colorsOffset) || h->namesOffset < h->colorsOffset ||
+		h->namesOffset > size || h->namesSize > size - h->namesOffset ||
+		(h->namesSize && base[h->namesOffset + h->namesSize - 1] != '\0'))
+	{
+		Close();
+		return false;
+	}
+
+	header = h;
+	slots = reinterpret_cast<const LibrarySlot*>(base + h->slotsOffset);
+	entries = reinterpret_cast<const LibraryEntry*>(base + h->entriesOffset);
+	sources = reinterpret_cast<const LibrarySourceRecord*>(base + h->sourcesOffset);
+	colorData = base + h->colorsOffset;
+	names = reinterpret_cast<const char*>(base + h->namesOffset);
+	return true;
+}
+
+void PaletteLibrary::Close()
+{
+	file.Close();
+	header = nullptr;
+	slots = nullptr;
+	entries = nullptr;
+	sources = nullptr;
+	colorData = nullptr;
+	names = nullptr;
+}
+
+// Entries are checked when used rather than on open, which has to stay O(1).
+std::size_t PaletteLibrary::GetColors(std::size_t entry, word* colors) const
+{
+	const LibraryEntry& e = entries[entry];
+	unsigned long long nTotal = (header->namesOffset - header->colorsOffset) / 2;
+	if (e.nColors > PAL_COLORS || e.colorOffset > nTotal || e.nColors > nTotal - e.colorOffset)
+		return 0;
+	const byte* p = colorData + e.colorOffset * 2;
+	for (std::size_t i = 0; i < e.nColors; ++i, p += 2)
+		colors[i] = static_cast<word>(p[0] | (p[1] << 8));
+	return e.nColors;
+}
+
+void PaletteLibrary::GetSources(std::size_t entry, std::vector<LibrarySource>& out) const
+{
+	out.clear();
+	const LibraryEntry& e = entries[entry];
+	if (e.firstSource > header->nSources || e.nSources > header->nSources - e.firstSource)
+		return;
+	for (dword s = 0; s < e.nSources; ++s)
+	{
+		const LibrarySourceRecord& record = sources[e.firstSource + s];
+		if (record.nameOffset < header->namesSize)
+			out.push_back({ std::string(names + record.nameOffset), record.row });
+	}
+}
+
+long long PaletteLibrary::Find(unsigned long long hash) const
+{
+	if (!header)
+		return -1;
+	// A damaged pack may have no empty slot, so the probe visits each slot once at most.
+	dword mask = header->nSlots - 1;
+	dword i = static_cast<dword>(hash) & mask;
+	for (dword n = 0; n < header->nSlots && slots[i].entry; ++n, i = (i + 1) & mask)
+	{
+		if (slots[i].hash == hash && slots[i].entry <= header->nEntries)
+			return slots[i].entry - 1;
+	}
+	return -1;
+}
+
+bool PaletteLibrary::SameColors(std::size_t entry, const word* colors, std::size_t nColors) const
+{
+	if (entries[entry].nColors != nColors)
+		return false;
+	word stored[PAL_COLORS];
+	if (GetColors(entry, stored) != nColors)
+		return false;
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		if ((stored[i] ^ colors[i]) & 0x7FFF)
+			return false;
+	}
+	return true;
+}
+
+long long PaletteLibrary::Find(const word* colors, std::size_t nColors) const
+{
+	if (!header || nColors > PAL_COLORS)
+		return -1;
+	unsigned long long hash = Library_Hash(colors, nColors);
+	dword mask = header->nSlots - 1;
+	dword i = static_cast<dword>(hash) & mask;
+	for (dword n = 0; n < header->nSlots && slots[i].entry; ++n, i = (i + 1) & mask)
+	{
+		dword entry = slots[i].entry - 1;
+		if (slots[i].hash == hash && entry < header->nEntries && SameColors(entry, colors, nColors))
+			return entry;
+	}
+	return -1;
+}
+
+struct SourceKey
+{
+	dword entry;
+	dword nameOffset;
+	int row;
+
+	bool operator==(const SourceKey& other) const
+	{
+		return entry == other.entry && nameOffset == other.nameOffset && row == other.row;
+	}
+};
+
+struct SourceKeyHash
+{
+	std::size_t operator()(const SourceKey& key) const
+	{
+		unsigned long long h = (static_cast<unsigned long long>(key.entry) << 32) ^ (static_cast<unsigned long long>(key.nameOffset) << 5) ^ static_cast<unsigned>(key.row + 1);
+		return static_cast<std::size_t>(h * 0x9E3779B97F4A7C15ull >> 16);
+	}
+};
+
+// In-memory pack under construction, entries in the order they were added.
+class PackBuilder
+{
+public:
+	dword AddName(const std::string& name)
+	{
+		auto it = nameOffsets.find(name);
+		if (it != nameOffsets.end())
+			return it->second;
+		dword offset = static_cast<dword>(names.size());
+		names.append(name);
+		names.push_back('\0');
+		nameOffsets.emplace(name, offset);
+		return offset;
+	}
+
+	// Returns true if the contents were not in the pack yet.
+	bool Add(const word* colors, std::size_t nColors, unsigned long long hash, const LibrarySourceRecord& source)
+	{
+		dword entry = 0;
+		bool bNew = true;
+		auto range = index.equal_range(hash);
+		for (auto it = range.first; it != range.second && bNew; ++it)
+		{
+			const LibraryEntry& e = entries[it->second];
+			if (e.nColors == nColors && !memcmp(&this->colors[e.colorOffset], colors, nColors * sizeof(word)))
+			{
+				entry = it->second;
+				bNew = false;
+			}
+		}
+
+		if (bNew)
+		{
+			LibraryEntry e = {};
+			e.hash = hash;
+			e.colorOffset = this->colors.size();
+			e.nColors = static_cast<word>(nColors);
+			entry = static_cast<dword>(entries.size());
+			entries.push_back(e);
+			this->colors.insert(this->colors.end(), colors, colors + nColors);
+			sources.emplace_back();
+			index.emplace(hash, entry);
+		}
+
+		// Importing the same file again does not repeat its provenance.
+		if (seen.insert({ entry, source.nameOffset, source.row }).second)
+			sources[entry].push_back(source);
+		return bNew;
+	}
+
+	bool Write(const std::filesystem::path& fn)
+	{
+		LibraryHeader h = {};
+		memcpy(h.magic, LIBRARY_MAGIC, 4);
+		h.version = LIBRARY_VERSION;
+		h.nEntries = static_cast<dword>(entries.size());
+		h.nSlots = 16;
+		while (h.nSlots < entries.size() * 2)
+			h.nSlots <<= 1;
+
+		std::vector<LibrarySlot> slots(h.nSlots);
+		std::vector<LibrarySourceRecord> records;
+		for (std::size_t e = 0; e < entries.size(); ++e)
+		{
+			dword i = static_cast<dword>(entries[e].hash) & (h.nSlots - 1);
+			while (slots[i].entry)
+				i = (i + 1) & (h.nSlots - 1);
+			slots[i].hash = entries[e].hash;
+			slots[i].entry = static_cast<dword>(e + 1);
+
+			entries[e].firstSource = static_cast<dword>(records.size());
+			entries[e].nSources = static_cast<dword>(sources[e].size());
+			records.insert(records.end(), sources[e].begin(), sources[e].end());
+		}
+		h.nSources = static_cast<dword>(records.size());
+
+		auto align8 = [](unsigned long long offset) { return (offset + 7) & ~7ull; };
+		h.slotsOffset = align8(sizeof(LibraryHeader));
+		h.entriesOffset = align8(h.slotsOffset + slots.size() * sizeof(LibrarySlot));
+		h.sourcesOffset = align8(h.entriesOffset + entries.size() * sizeof(LibraryEntry));
+		h.colorsOffset = align8(h.sourcesOffset + records.size() * sizeof(LibrarySourceRecord));
+		h.namesOffset = h.colorsOffset + colors.size() * sizeof(word);
+		h.namesSize = names.size();
+
+		FILE* file = File_Open(fn, "wb");
+		if (!file)
+			return false;
+		static const byte padding[8] = {};
+		unsigned long long position = 0;
+		bool bOk = true;
+		auto write = [&](unsigned long long offset, const void* data, std::size_t size) {
+			bOk = bOk && fwrite(padding, 1, static_cast<std::size_t>(offset - position), file) == offset - position;
+			bOk = bOk && fwrite(data, 1, size, file) == size;
+			position = offset + size;
+		};
+		write(0, &h, sizeof(h));
+		write(h.slotsOffset, slots.data(), slots.size() * sizeof(LibrarySlot));
+		write(h.entriesOffset, entries.data(), entries.size() * sizeof(LibraryEntry));
+		write(h.sourcesOffset, records.data(), records.size() * sizeof(LibrarySourceRecord));
+		write(h.colorsOffset, colors.data(), colors.size() * sizeof(word));
+		write(h.namesOffset, names.data(), names.size());
+		return (fclose(file) == 0) && bOk;
+	}
+
+private:
+	std::vector<LibraryEntry> entries;
+	std::vector<word> colors;
+	std::vector<std::vector<LibrarySourceRecord>> sources;
+	std::unordered_set<SourceKey, SourceKeyHash> seen;
+	std::unordered_multimap<unsigned long long, dword> index;
+	std::string names;
+	std::unordered_map<std::string, dword> nameOffsets;
+};
+
+// A palette file as read on a worker, hashed and ready to merge.
+struct ImportedFile
+{
+	PalError err = PALERR_OK;
+	word palette[PAL_COLORS];
+	unsigned long long tableHash = 0;
+	unsigned long long rowHashes[LIBRARY_ROWS];
+};
+
+bool Library_Import(const std::filesystem::path& pack, const std::vector<std::filesystem::path>& files, ThreadPool& pool,
+	LibraryImportStats& stats, std::vector<std::pair<std::filesystem::path, std::string>>* pErrors)
+{
+	PackBuilder builder;
+	std::error_code ec;
+	if (std::filesystem::exists(pack, ec))
+	{
+		PaletteLibrary old;
+		if (!old.Open(pack))
+			return false;
+		word colors[PAL_COLORS];
+		std::vector<LibrarySource> sources;
+		for (std::size_t e = 0; e < old.GetEntryCount(); ++e)
+		{
+			const LibraryEntry& entry = old.GetEntry(e);
+			// Damaged entries are dropped from the rewritten pack.
+			if (!entry.nColors || old.GetColors(e, colors) != entry.nColors)
+				continue;
+			old.GetSources(e, sources);
+			for (const auto& source : sources)
+				builder.Add(colors, entry.nColors, entry.hash, { builder.AddName(source.file), source.row });
+		}
+	}
+
+	std::vector<ImportedFile> imported(files.size());
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		pool.Submit([&files, &imported, i] {
+			ImportedFile& f = imported[i];
+			f.err = PalFile_Load(files[i], f.palette);
+			if (f.err != PALERR_OK)
+				return;
+			for (word& color : f.palette)
+				color &= 0x7FFF;
+			f.tableHash = Library_Hash(f.palette, PAL_COLORS);
+			for (int r = 0; r < LIBRARY_ROWS; ++r)
+				f.rowHashes[r] = Library_Hash(f.palette + r * LIBRARY_ROW_COLORS, LIBRARY_ROW_COLORS);
+		});
+	}
+	pool.Wait();
+
+	// Merged in file order, so the pack does not depend on the thread count.
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		const ImportedFile& f = imported[i];
+		++stats.nFiles;
+		if (f.err != PALERR_OK)
+		{
+			++stats.nFailed;
+			if (pErrors)
+				pErrors->emplace_back(files[i], PalFile_ErrorString(f.err));
+			continue;
+		}
+		dword name = builder.AddName(files[i].u8string());
+		stats.nNewEntries += builder.Add(f.palette, PAL_COLORS, f.tableHash, { name, LIBRARY_WHOLE_TABLE });
+		++stats.nTables;
+		for (int r = 0; r < LIBRARY_ROWS; ++r)
+			stats.nNewEntries += builder.Add(f.palette + r * LIBRARY_ROW_COLORS, LIBRARY_ROW_COLORS, f.rowHashes[r], { name, r });
+		stats.nRows += LIBRARY_ROWS;
+	}
+
+	// Written next to the pack and renamed over it, readers never see half a pack.
+	std::filesystem::path temp = pack;
+	temp += ".tmp";
+	if (!builder.Write(temp))
+	{
+		std::filesystem::remove(temp, ec);
+		return false;
+	}
+	std::filesystem::rename(temp, pack, ec);
+	return !ec;
+}
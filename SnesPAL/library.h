@@ -0,0 +1,121 @@
+#pragma once
+
+// Content-addressed palette library.
+//
+// Whole 256-color tables and their 16-color rows are stored once per
+// distinct content in a single pack file, each with the list of files (and
+// rows) it was found in. The pack starts with an open-addressed hash table,
+// so opening it only maps the file and checks the header, and a lookup by
+// hash is a probe or two into the mapping whatever the pack size.
+//
+// Layout, all little-endian: LibraryHeader, slots, entries, sources, color
+// data (BGR555 words), then the NUL-terminated source file names.
+
+#include "types.h"
+#include "mmap.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+#define LIBRARY_MAGIC		"SPLB"
+#define LIBRARY_VERSION		1
+#define LIBRARY_ROW_COLORS	0x10
+#define LIBRARY_WHOLE_TABLE	-1
+
+struct LibraryHeader
+{
+	char magic[4];
+	dword version;
+	dword nEntries;
+	dword nSlots;			// Power of two, at least twice nEntries.
+	dword nSources;
+	dword reserved;
+	unsigned long long slotsOffset;
+	unsigned long long entriesOffset;
+	unsigned long long sourcesOffset;
+	unsigned long long colorsOffset;
+	unsigned long long namesOffset;
+	unsigned long long namesSize;
+};
+
+struct LibrarySlot
+{
+	unsigned long long hash;
+	dword entry;			// Entry index + 1, 0 for an empty slot.
+	dword reserved;
+};
+
+struct LibraryEntry
+{
+	unsigned long long hash;
+	unsigned long long colorOffset;	// In colors from the start of the color data.
+	dword firstSource;
+	dword nSources;
+	word nColors;
+	word reserved[3];
+};
+
+struct LibrarySourceRecord
+{
+	dword nameOffset;
+	int row;				// LIBRARY_WHOLE_TABLE or 0-15.
+};
+
+struct LibrarySource
+{
+	std::string file;		// UTF-8, as given to the import.
+	int row;
+};
+
+struct LibraryImportStats
+{
+	std::size_t nFiles = 0;
+	std::size_t nFailed = 0;
+	std::size_t nTables = 0;		// Tables and rows seen, duplicates included.
+	std::size_t nRows = 0;
+	std::size_t nNewEntries = 0;	// Distinct contents not in the pack before.
+};
+
+// Colors are hashed without bit 15, so the same CGRAM contents always match.
+unsigned long long Library_Hash(const word* colors, std::size_t nColors);
+
+class PaletteLibrary
+{
+public:
+	// Maps the pack read-only; false if it is missing or not a valid pack.
+	bool Open(const std::filesystem::path& fn);
+	void Close();
+	bool IsOpen() const { return file.IsOpen(); }
+
+	std::size_t GetEntryCount() const { return header ? header->nEntries : 0; }
+	std::size_t GetSourceCount() const { return header ? header->nSources : 0; }
+	const LibraryEntry& GetEntry(std::size_t entry) const { return entries[entry]; }
+	// Up to PAL_COLORS colors. Returns how many, 0 if the entry is damaged.
+	std::size_t GetColors(std::size_t entry, word* colors) const;
+	void GetSources(std::size_t entry, std::vector<LibrarySource>& sources) const;
+
+	// First entry with the hash, -1 if there is none.
+	long long Find(unsigned long long hash) const;
+	// Entry with exactly these colors (bit 15 ignored), -1 if there is none.
+	long long Find(const word* colors, std::size_t nColors) const;
+
+private:
+	bool SameColors(std::size_t entry, const word* colors, std::size_t nColors) const;
+
+	MappedFile file;
+	const LibraryHeader* header = nullptr;
+	const LibrarySlot* slots = nullptr;
+	const LibraryEntry* entries = nullptr;
+	const LibrarySourceRecord* sources = nullptr;
+	const byte* colorData = nullptr;
+	const char* names = nullptr;
+};
+
+// Reads every palette file on the pool, then merges them and the contents of
+// the existing pack (if any) into a new pack that replaces it atomically.
+// Files that fail to load are counted and skipped, pErrors receives them.
+bool Library_Import(const std::filesystem::path& pack, const std::vector<std::filesystem::path>& files, ThreadPool& pool,
+	LibraryImportStats& stats, std::vector<std::pair<std::filesystem::path, std::string>>* pErrors = nullptr);
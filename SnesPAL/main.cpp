@@ -8,6 +8,24 @@
 
 #include "util.h"
 #include "resource.h"
+#include "color.h"
+#include "colortable.h"
+#include "palfile.h"
+#include "history.h"
+#include "document.h"
+#include "journal.h"
+#include "fileworker.h"
+#include "filewatch.h"
+#include "render.h"
+#include "rom.h"
+#include "gfx.h"
+#include "fileio.h"
+#include "image.h"
+#include "quantize.h"
+#include "transform.h"
+#include "fade.h"
+#include "threadpool.h"
+#include "trace.h"
 
 #define ID_FILE_NEW					10100
 #define ID_FILE_OPEN				10101
@@ -15,7 +33,15 @@
 #define ID_FILE_SAVE				10103
 #define ID_FILE_SAS					10104
 #define ID_FILE_EXIT				10105
+#define ID_FILE_OPEN_ROM			10106
+#define ID_FILE_IMPORT_IMAGE		10107
+#define ID_FILE_EXPORT_FADE			10108
+#define ID_GFX_OPEN					10200
+#define ID_GFX_BPP					10210	// + 2, 4 or 8
 #define ID_HELP_ABOUT				10301
+#define ID_HELP_TRACE				10302
+#define ID_EDIT_ADJUST				10400
+#define ID_WINDOW_DOCUMENT			10500	// + index of the document
 
 #define ID_BUTTON_CLOSE				20001
 #define ID_BUTTON_SHOW_GRID			20002
@@ -29,8 +55,37 @@
 #define ID_BUTTON_SIDE_PLUS			20200
 #define ID_BUTTON_SIDE_MINUS		20300
 
+// Posted by the file worker, lParam is the FileJobResult to take over.
+#define WM_FILE_DONE				(WM_APP + 1)
+// Posted by the file watcher, lParam is the FileChange to take over.
+#define WM_FILE_CHANGED				(WM_APP + 2)
+
+// OKLab lightness added or removed by the side +/- buttons.
+#define SIDE_BRIGHTNESS_STEP		0.05f
+
+// Open palettes listed in the Window menu.
+#define WINDOW_MAX_DOCUMENTS		0x100
+
+// Formats are detected from the contents, so any file may be opened.
+#define PALETTE_OPEN_FILTER			TEXT("Palette Files\0*.tpl;*.pal;*.mw3;*.act;*.gpl;*.jasc;*.cgr\0All Files\0*.*\0")
+#define PALETTE_SAVE_FILTER			TEXT("TPL File\0*.tpl\0PAL File\0*.pal\0Lunar Magic MW3\0*.mw3\0Adobe Color Table\0*.act\0GIMP Palette\0*.gpl\0JASC-PAL\0*.jasc\0Raw CGRAM\0*.cgr\0")
+
+// Next to the executable, names the palette whose journal is being written.
+#define SESSION_FILENAME			L"SnesPAL.session"
+// Also next to the executable, written when latency tracing is turned off.
+#define TRACE_FILENAME				L"SnesPAL.trace.json"
+#define TRACE_SUMMARY_FILENAME		L"SnesPAL.trace.txt"
+
+#define PREVIEW_SIZE				256
+#define PREVIEW_TILES				((PREVIEW_SIZE / GFX_TILE_SIZE) * (PREVIEW_SIZE / GFX_TILE_SIZE))
+
 // Working palette in editor.
 word pPaletteTable[0x100] = { 0x0000 };
+// Palette as last read from or written to the opened file. Changes made by
+// other programs are merged against it.
+word diskPalette[0x100] = { 0x0000 };
+// Last clicked cell, target of cell-wide adjustments.
+int selectedCell = 0;
 // Picked color RGB.
 COLORREF preservedCol = RGB(0x00, 0x00, 0x00);
 // Picked color in SNES format.
@@ -45,11 +100,43 @@ bool bDrawMode = false;
 bool bRecord = false;
 bool bDrawnOneClick = false; // Used as flag to prevent running record per each LBUTTONDOWN message.
 wchar_t pOpenedFilename[MAX_PATH] = { 0 };
+// ROM being edited in place, palette is read from and saved to romAddress.
+Rom openedRom;
+dword romAddress = 0x000000;
+
+// Editor back buffer, a DIB section sized to the editor view.
+Framebuffer editorFB = { nullptr, 0, 0, 0 };
+RenderOptions editorView;
+// Cells that have to be repainted into the editor back buffer on next WM_PAINT.
+bool bDirtyCells[0x100] = { false };
+bool bRedrawAll = true;
+// Number of cells repainted by the last WM_PAINT.
+int nCellsRepainted = 0;
+
+// Graphics in the preview pane. Tiles are decoded once on load and only
+// recolored when the palette changes.
+std::vector<byte> gfxData;
+std::vector<byte> gfxPixels;
+std::size_t gfxTiles = 0;
+int gfxDepth = 4;
+// Palette row used by the preview, follows the last clicked cell.
+int previewRow = 0;
+Framebuffer previewFB = { nullptr, 0, 0, 0 };
+bool bPreviewDirty = true;
+// Pixel runs of every color index in the preview, for single-color edits.
+GfxColorIndex previewIndex;
+// Time of the last full preview repaint, shown next to incremental recolors.
+long long previewFullNs = 0;
+// The preview shows the last exported fade instead of the graphics.
+bool bPreviewStrip = false;
+// Settings of the last fade export.
+FadeOptions fadeOptions;
 
 bool bCursorInEditor = false;
 bool bCursorInCustom = false;
 HWND hMainWindow = nullptr;
 HWND hPALEditor = nullptr;
+HWND hPreview = nullptr;
 HWND hGridCBX = nullptr;
 HWND hStatusBar = nullptr;
 HWND hCustomCol = nullptr;
@@ -61,38 +148,133 @@ HWND hToolTip = nullptr; wchar_t pTooltipText[7] = TEXT("FFFFFF");
 LRESULT __stdcall WndProc(HWND, UINT, WPARAM, LPARAM);
 LRESULT __stdcall SubclassProc_Editor(HWND, UINT, WPARAM, LPARAM, UINT_PTR, DWORD_PTR);
 LRESULT __stdcall SubclassProc_CustomCol(HWND, UINT, WPARAM, LPARAM, UINT_PTR, DWORD_PTR);
+LRESULT __stdcall SubclassProc_Preview(HWND, UINT, WPARAM, LPARAM, UINT_PTR, DWORD_PTR);
 LRESULT __stdcall DlgProc_CopyPAL(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
 LRESULT __stdcall DlgProc_About(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
+LRESULT __stdcall DlgProc_RomPAL(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
+LRESULT __stdcall DlgProc_Adjust(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
+LRESULT __stdcall DlgProc_Fade(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
 
 BOOL __stdcall EnumProc_Main(HWND hWnd, LPARAM lParam);
 void DrawToEditor(HDC);
+void DrawToPreview();
+void RedrawPreview();
+void RecolorPreviewSlot(int slot);
+HBITMAP CreateFramebufferDIB(HDC hdc, int width, int height, Framebuffer& fb);
 void RedrawPalettes(bool bChanged = false);
+void InvalidateCell(int index);
+void GetCellRect(int index, RECT* pRect);
 int Loop();
 bool OpenPAL(const wchar_t* fn);
 bool SavePAL(const wchar_t* fn);
+void OnPaletteLoaded(FileJobResult& result);
+void OnPaletteSaved(FileJobResult& result);
+bool OpenROMPAL(const wchar_t* fn, dword address);
+bool SaveROMPAL();
+bool OpenGFX(const wchar_t* fn);
+bool ImportImage(const wchar_t* fn);
+bool ExportFade(HWND hWnd);
+void SetPreviewDepth(int bpp);
+void SetTitle(const wchar_t* fn);
 void ShowGrid(bool bShow);
 void UpdateStatusInfo(const wchar_t* _1, const wchar_t* _2, const wchar_t* _3, const wchar_t* _4 = nullptr);
 void Undo(); void Redo();
 
-word Color_ConvertToSNES(byte r, byte g, byte b);
-COLORREF Color_ConvertFromSNES(word rgb);
 word GetEditorPositionIndex(POINTS& pts);
 
-struct SnesPAL_Operation
+// Working palette record using for undo/redo.
+History history;
+// Crash recovery journal of the opened palette.
+Journal journal;
+// Palette files are read and written off the UI thread.
+FileWorker fileWorker([](std::unique_ptr<FileJobResult> result) {
+	if (PostMessage(hMainWindow, WM_FILE_DONE, 0, reinterpret_cast<LPARAM>(result.get())))
+		result.release();
+});
+// Only the newest open is applied, closing the palette cancels it.
+unsigned long long lastLoadId = 0;
+
+// Every palette open in the editor. The active one is edited through the
+// globals above and its entry is brought up to date when another one is
+// activated; the others keep their colors as copy-on-write rows, so they
+// share what they have in common with each other and with the disk state.
+struct OpenDocument
+{
+	PaletteDocument doc;
+	Rom rom;
+	unsigned long long serial;
+};
+std::vector<std::unique_ptr<OpenDocument>> documents;
+std::size_t activeDocument = 0;
+unsigned long long lastDocumentSerial = 0;
+// Counts documents made active, a document opened or switched to.
+unsigned long long nActivations = 0;
+// Saves in flight by job id, for the document they write: its serial, or 0
+// for an untitled palette, which is adopted only if nothing was activated since.
+struct SaveOwner
+{
+	unsigned long long serial;
+	unsigned long long activation;
+};
+std::unordered_map<unsigned long long, SaveOwner> saveOwners;
+HMENU hWindowMenu = nullptr;
+
+// Contents of a watched file that another program changed.
+struct FileChange
 {
-	unsigned int n;
-	word palette[0x100];
-	std::wstring info;
-	bool bDrawMode;
+	std::filesystem::path fn;
+	std::vector<byte> data;
+	std::chrono::steady_clock::time_point firstChange;
 };
+// The opened palette file and graphics are reloaded when they change on disk.
+// Files are read on the watcher thread, the window merges them.
+FileWatcher fileWatcher([](const std::filesystem::path& fn, std::chrono::steady_clock::time_point firstChange) {
+	std::unique_ptr<FileChange> change(new FileChange);
+	change->fn = fn;
+	change->firstChange = firstChange;
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return;
+	byte buffer[0x4000];
+	std::size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		change->data.insert(change->data.end(), buffer, buffer + n);
+	fclose(file);
+	if (PostMessage(hMainWindow, WM_FILE_CHANGED, 0, reinterpret_cast<LPARAM>(change.get())))
+		change.release();
+});
+// Absolute, as the watcher reports them. ROM palettes are not watched.
+std::filesystem::path watchedPalette;
+std::filesystem::path watchedGfx;
+// Snapshots being saved by job id, so our own writes are told from others'.
+struct PendingSave
+{
+	std::filesystem::path fn;	// Absolute, like watchedPalette.
+	word palette[PAL_COLORS];
+};
+std::unordered_map<unsigned long long, PendingSave> pendingSaves;
 
-// Working palette record using for undo/redo.
-std::deque<SnesPAL_Operation> lastOperations, lastOperationsRedo;
-// Current index in records. Using to draw undid/redid palettes.
-std::size_t historyIndex = 0;
-std::size_t operationNumber = 0;
+void UpdateWatches();
+void OnPaletteChanged(FileChange& change);
+void OnGfxChanged(FileChange& change);
+
+void AddDocument(const wchar_t* fn, dword address);
+void StashDocument();
+void ActivateDocument(std::size_t index);
+void SwitchDocument(std::size_t index);
+int FindDocument(const wchar_t* fn, dword address);
+void UpdateWindowMenu();
+void UpdateTitle();
 
 void RecordOperation(const wchar_t* pInfo);
+void StopTrace();
+BOOL PickColor(CHOOSECOLOR* pCC);
+std::filesystem::path GetRecoveryPath(const wchar_t* fn, dword address);
+void OpenJournal(const wchar_t* fn, dword address, bool bSaved);
+void StartJournal(const wchar_t* fn, dword address, JournalRecovery* pRecovery);
+void CompactJournal(const wchar_t* fn, dword address, bool bSaved);
+void EndJournal();
+void RecoverLastSession();
 bool CheckUndo();
 bool CheckRedo();
 
@@ -144,6 +326,7 @@ int __stdcall wWinMain(HINSTANCE hInst, HINSTANCE, wchar_t*, int)
 		ERROR_MBX(nullptr, TEXT("Cannot create window."))
 		return -1;
 	}
+	RecoverLastSession();
 
 	return Loop();
 }
@@ -151,30 +334,24 @@ int __stdcall wWinMain(HINSTANCE hInst, HINSTANCE, wchar_t*, int)
 LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
 	static HBRUSH hBrush = nullptr;
-	static HDC hdcMem;
-	static BITMAPINFOHEADER bi;
-	static HBITMAP hBitmap;
+	static HDC hdcMem, hdcPreview;
+	static HBITMAP hBitmap, hPreviewBitmap;
 	static RECT rect;
 	static int cxClient = 256, cyClient = 256;
+	TRACE_SCOPE("WndProc");
 
 	switch (Msg)
 	{
 		case WM_CREATE:
 		{
-			hdcMem = CreateCompatibleDC(GetDC(hWnd));
-			bi.biSize = sizeof(BITMAPINFOHEADER);
-			bi.biWidth = cxClient = GetSystemMetrics(SM_CXSCREEN);
-			bi.biHeight = cyClient = GetSystemMetrics(SM_CYSCREEN);
-			bi.biPlanes = 1;
-			bi.biBitCount = 32;
-			bi.biCompression = BI_RGB;
-			bi.biSizeImage = 0;
-			bi.biXPelsPerMeter = 0;
-			bi.biYPelsPerMeter = 0;
-			bi.biClrUsed = 0;
-			bi.biClrImportant = 0;
-			hBitmap = CreateDIBSection(hdcMem, (BITMAPINFO*)&bi, DIB_RGB_COLORS, NULL, NULL, 0);
-			SelectObject(hdcMem, hBitmap);
+			HDC hdcWnd = GetDC(hWnd);
+			hdcMem = CreateCompatibleDC(hdcWnd);
+			hdcPreview = CreateCompatibleDC(hdcWnd);
+			ReleaseDC(hWnd, hdcWnd);
+			// Only the editor view is ever blitted, so the back buffer is exactly that big.
+			cxClient = cyClient = Render_GetGridSize(editorView);
+			hBitmap = CreateFramebufferDIB(hdcMem, cxClient, cyClient, editorFB);
+			hPreviewBitmap = CreateFramebufferDIB(hdcPreview, PREVIEW_SIZE, PREVIEW_SIZE, previewFB);
 
 			RECT clRect;
 			GetClientRect(hWnd, &clRect);
@@ -184,10 +361,15 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 			HMENU hMb = CreateMenu();
 			HMENU hFile = CreateMenu();
 			HMENU hEdit = CreateMenu();
+			HMENU hGfx = CreateMenu();
 			HMENU hHelp = CreateMenu();
+			hWindowMenu = CreateMenu();
 
 			AppendMenu(hFile, MF_STRING, (UINT_PTR)1, TEXT("&New Palette"));
 			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_OPEN, TEXT("&Open Palette"));
+			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_OPEN_ROM, TEXT("Open &ROM Palette"));
+			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_IMPORT_IMAGE, TEXT("&Import Image"));
+			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_EXPORT_FADE, TEXT("Export &Fade..."));
 			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_SAVE, TEXT("&Save"));
 			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_SAS, TEXT("&Save As"));
 			AppendMenu(hFile, MF_STRING, (UINT_PTR)ID_FILE_EXIT, TEXT("E&xit"));
@@ -195,15 +377,29 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 			AppendMenu(hEdit, MF_STRING, (UINT_PTR)3, TEXT("&Copy Color"));
 			AppendMenu(hEdit, MF_STRING, (UINT_PTR)4, TEXT("&Paste Color"));
 			AppendMenu(hEdit, MF_STRING, (UINT_PTR)5, TEXT("&Delete Color"));
-
+			AppendMenu(hEdit, MF_SEPARATOR, 0, nullptr);
+			AppendMenu(hEdit, MF_STRING, (UINT_PTR)ID_EDIT_ADJUST, TEXT("&Adjust Colors..."));
+
+			AppendMenu(hGfx, MF_STRING, (UINT_PTR)ID_GFX_OPEN, TEXT("&Open GFX"));
+			AppendMenu(hGfx, MF_SEPARATOR, 0, nullptr);
+			AppendMenu(hGfx, MF_STRING, (UINT_PTR)(ID_GFX_BPP + 2), TEXT("&2bpp"));
+			AppendMenu(hGfx, MF_STRING, (UINT_PTR)(ID_GFX_BPP + 4), TEXT("&4bpp"));
+			AppendMenu(hGfx, MF_STRING, (UINT_PTR)(ID_GFX_BPP + 8), TEXT("&8bpp"));
+			CheckMenuRadioItem(hGfx, ID_GFX_BPP + 2, ID_GFX_BPP + 8, ID_GFX_BPP + gfxDepth, MF_BYCOMMAND);
+
+			AppendMenu(hHelp, MF_STRING, (UINT_PTR)ID_HELP_TRACE, TEXT("&Trace Latency"));
+			AppendMenu(hHelp, MF_SEPARATOR, 0, nullptr);
 			AppendMenu(hHelp, MF_STRING, (UINT_PTR)ID_HELP_ABOUT, TEXT("&About"));
 
 			AppendMenu(hMb, MF_POPUP, (UINT_PTR)hFile, TEXT("&File"));
 			AppendMenu(hMb, MF_POPUP, (UINT_PTR)hEdit, TEXT("E&dit"));
+			AppendMenu(hMb, MF_POPUP, (UINT_PTR)hGfx, TEXT("&Graphics"));
+			AppendMenu(hMb, MF_POPUP, (UINT_PTR)hWindowMenu, TEXT("&Window"));
 			AppendMenu(hMb, MF_POPUP, (UINT_PTR)hHelp, TEXT("&Help"));
 			SetMenu(hWnd, hMb);
 
 			hPALEditor = CreateWindow(WC_STATIC, nullptr, WS_VISIBLE | WS_CHILD, 0, 0, 256, 256, hWnd, nullptr, nullptr, nullptr);
+			hPreview = CreateWindowEx(WS_EX_CLIENTEDGE, WC_STATIC, nullptr, WS_VISIBLE | WS_CHILD, 312, 0, PREVIEW_SIZE + 4, PREVIEW_SIZE + 4, hWnd, nullptr, nullptr, nullptr);
 			CreateWindow(WC_BUTTON, TEXT("Close"), WS_VISIBLE | WS_CHILD, 0, 256, 85, 30, hWnd, (HMENU)ID_BUTTON_CLOSE, nullptr, nullptr);
 			hGridCBX = CreateWindow(WC_BUTTON, TEXT("Show Grid"), WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 5, 286, 85, 30, hWnd, (HMENU)ID_BUTTON_SHOW_GRID, nullptr, nullptr);
 			hCbxDraw = CreateWindow(WC_BUTTON, TEXT("Draw Mode"), WS_VISIBLE | WS_CHILD | BS_AUTOCHECKBOX, 90, 286, 85, 30, hWnd, (HMENU)ID_BUTTON_DRAW_MODE, nullptr, nullptr);
@@ -236,6 +432,8 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 
 			SetWindowSubclass(hPALEditor, &SubclassProc_Editor, 0u, 0u);
 			SetWindowSubclass(hCustomCol, &SubclassProc_CustomCol, 0u, 0u);
+			SetWindowLongPtr(hPreview, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(hdcPreview));
+			SetWindowSubclass(hPreview, &SubclassProc_Preview, 0u, 0u);
 			
 			std::vector<HWND> vecWindows;
 			EnumChildWindows(hWnd, &EnumProc_Main, reinterpret_cast<LPARAM>(&vecWindows));
@@ -275,27 +473,25 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 					for (int j = 0; j < 0x0D; ++j)
 						pFirst[j] = pFirst[j+1];
 					*pLast = firstVal;
+					RecordOperation(TEXT("Rotated palette."));
 					RedrawPalettes();
 					break;
 				}
 				else if (bMinus || bPlus)
 				{
-					for (int j = 0; j < 0x0E; ++j)
-					{
-						COLORREF rgb = Color_ConvertFromSNES(pFirst[j]);
-						byte r = (bPlus ? min(GetRValue(rgb) + 0x0F, 0xFF) : max(GetRValue(rgb) + 0x0F, 0x01));
-						byte g = (bPlus ? min(GetGValue(rgb) + 0x0F, 0xFF) : max(GetGValue(rgb) + 0x0F, 0x01));
-						byte b = (bPlus ? min(GetBValue(rgb) + 0x0F, 0xFF) : max(GetBValue(rgb) + 0x0F, 0x01));
-						word newSnesCol = Color_ConvertToSNES(r, g, b);
-						if(newSnesCol == 0xFFFF)
-							pFirst[j] = 0x0000;
-						else
-							pFirst[j] = (word)min(newSnesCol, 0x7FFF);
-					}
-					RecordOperation(TEXT("Increased brightness."));
+					TransformStep step = { TRANSFORM_BRIGHTNESS, bPlus ? SIDE_BRIGHTNESS_STEP : -SIDE_BRIGHTNESS_STEP, 0x0000 };
+					ColorTransform xf;
+					Transform_Compile(&step, 1, xf);
+					Transform_Apply(xf, pFirst, 0x0E);
+					RecordOperation(bPlus ? TEXT("Increased brightness.") : TEXT("Decreased brightness."));
 					RedrawPalettes();
 				}
 			}
+			if (LOWORD(wParam) >= ID_WINDOW_DOCUMENT && LOWORD(wParam) < ID_WINDOW_DOCUMENT + WINDOW_MAX_DOCUMENTS)
+			{
+				SwitchDocument(LOWORD(wParam) - ID_WINDOW_DOCUMENT);
+				break;
+			}
 
 			switch (LOWORD(wParam))
 			{
@@ -310,25 +506,71 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 					ofn.nMaxFile = MAX_PATH;
 					ofn.lpstrFile = buffer;
 					ofn.lpstrFile[0] = '\0';
-					ofn.lpstrFilter = TEXT("TPL Palette\0*.tpl\0PAL Palette\0*.pal\0");
+					ofn.lpstrFilter = PALETTE_OPEN_FILTER;
 					ofn.nFilterIndex = -1;
 					ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
 
 					if (GetOpenFileName(&ofn))
+						OpenPAL(buffer);
+
+					delete[] buffer;
+					break;
+				}
+				case ID_FILE_OPEN_ROM:
+				{
+					wchar_t* buffer = new wchar_t[MAX_PATH];
+					OPENFILENAME ofn = { };
+					ofn.lStructSize = sizeof(ofn);
+					ofn.hwndOwner = hWnd;
+					ofn.hInstance = ::hInstance;
+					ofn.lpstrInitialDir = L".";
+					ofn.nMaxFile = MAX_PATH;
+					ofn.lpstrFile = buffer;
+					ofn.lpstrFile[0] = '\0';
+					ofn.lpstrFilter = TEXT("SNES ROM\0*.smc;*.sfc\0");
+					ofn.nFilterIndex = -1;
+					ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
+
+					if (GetOpenFileName(&ofn) && DialogBox(hInstance, MAKEINTRESOURCE(IDD_ROMPAL), hWnd, &DlgProc_RomPAL) == IDOK)
 					{
-						if (!OpenPAL(buffer))
-						{
-							ERROR_MBX(hWnd, TEXT("Cannot open requested file."))
-						}
-						else
-						{
-							SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("File opened successfully."));
-						}
+						if (OpenROMPAL(buffer, ::romAddress))
+							SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("ROM palette opened."));
+					}
+
+					delete[] buffer;
+					break;
+				}
+				case ID_FILE_IMPORT_IMAGE:
+				{
+					wchar_t* buffer = new wchar_t[MAX_PATH];
+					OPENFILENAME ofn = { };
+					ofn.lStructSize = sizeof(ofn);
+					ofn.hwndOwner = hWnd;
+					ofn.hInstance = ::hInstance;
+					ofn.lpstrInitialDir = L".";
+					ofn.nMaxFile = MAX_PATH;
+					ofn.lpstrFile = buffer;
+					ofn.lpstrFile[0] = '\0';
+					ofn.lpstrFilter = TEXT("Image\0*.bmp;*.ppm\0");
+					ofn.nFilterIndex = -1;
+					ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
+
+					if (GetOpenFileName(&ofn) && !ImportImage(buffer))
+					{
+						ERROR_MBX(hWnd, TEXT("Cannot read image. Only BMP and binary PPM are supported."))
 					}
 
 					delete[] buffer;
 					break;
 				}
+				case ID_FILE_EXPORT_FADE:
+				{
+					if (DialogBox(hInstance, MAKEINTRESOURCE(IDD_FADE), hWnd, &DlgProc_Fade) == IDOK && !ExportFade(hWnd))
+					{
+						ERROR_MBX(hWnd, TEXT("Cannot export fade sequence."))
+					}
+					break;
+				}
 				case ID_FILE_SAVE:
 				{
 					if (!bFileOpened)
@@ -342,35 +584,18 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 						ofn.nMaxFile = MAX_PATH;
 						ofn.lpstrFile = buffer;
 						ofn.lpstrFile[0] = '\0';
-						ofn.lpstrFilter = L"TPL File\0*.tpl\0PAL File\0*.pal\0";
+						ofn.lpstrFilter = PALETTE_SAVE_FILTER;
+						ofn.lpstrDefExt = L"tpl";
 						ofn.nFilterIndex = -1;
 						ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
 						if (GetSaveFileName(&ofn))
-						{
-							if (!::SavePAL(buffer))
-							{
-								ERROR_MBX(hWnd, TEXT("Cannot save requested file."))
-							}
-							else
-							{
-								SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("File saved."));
-							}
-						}
+							::SavePAL(buffer);
 
 						delete[] buffer;
 						break;
 					}
 					else
-					{
-						if (!::SavePAL(nullptr))
-						{
-							ERROR_MBX(hWnd, TEXT("Cannot save requested file."))
-						}
-						else
-						{
-							SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("File saved."));
-						}
-					}
+						::SavePAL(nullptr);
 					
 					break;
 				}
@@ -385,16 +610,12 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 					ofn.nMaxFile = MAX_PATH;
 					ofn.lpstrFile = buffer;
 					ofn.lpstrFile[0] = '\0';
-					ofn.lpstrFilter = L"TPL File\0*.tpl\0PAL File\0*.pal\0";
+					ofn.lpstrFilter = PALETTE_SAVE_FILTER;
+					ofn.lpstrDefExt = L"tpl";
 					ofn.nFilterIndex = -1;
 					ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
 					if (GetSaveFileName(&ofn))
-					{
-						if (!::SavePAL(buffer))
-						{
-							ERROR_MBX(hWnd, TEXT("Cannot save requested file."))
-						}
-					}
+						::SavePAL(buffer);
 					delete[] buffer;
 					break;
 				}
@@ -403,25 +624,87 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 					DestroyWindow(hWnd);
 					break;
 				}
+				case ID_GFX_OPEN:
+				{
+					wchar_t* buffer = new wchar_t[MAX_PATH];
+					OPENFILENAME ofn = { };
+					ofn.lStructSize = sizeof(ofn);
+					ofn.hwndOwner = hWnd;
+					ofn.hInstance = ::hInstance;
+					ofn.lpstrInitialDir = L".";
+					ofn.nMaxFile = MAX_PATH;
+					ofn.lpstrFile = buffer;
+					ofn.lpstrFile[0] = '\0';
+					ofn.lpstrFilter = TEXT("SNES Graphics\0*.bin\0All Files\0*.*\0");
+					ofn.nFilterIndex = -1;
+					ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
+
+					if (GetOpenFileName(&ofn) && !OpenGFX(buffer))
+					{
+						ERROR_MBX(hWnd, TEXT("Cannot open requested graphics."))
+					}
+
+					delete[] buffer;
+					break;
+				}
+				case ID_GFX_BPP + 2:
+				case ID_GFX_BPP + 4:
+				case ID_GFX_BPP + 8:
+				{
+					CheckMenuRadioItem(GetMenu(hWnd), ID_GFX_BPP + 2, ID_GFX_BPP + 8, LOWORD(wParam), MF_BYCOMMAND);
+					SetPreviewDepth(LOWORD(wParam) - ID_GFX_BPP);
+					break;
+				}
 				case ID_HELP_ABOUT:
 				{
 					DialogBox(hInstance, MAKEINTRESOURCE(IDD_ABOUT), hWnd, &::DlgProc_About);
 					break;
 				}
+				case ID_HELP_TRACE:
+				{
+					bool bTrace = !Trace_IsEnabled();
+					CheckMenuItem(GetMenu(hWnd), ID_HELP_TRACE, MF_BYCOMMAND | (bTrace ? MF_CHECKED : MF_UNCHECKED));
+					if (bTrace)
+					{
+						Trace_Clear();
+						Trace_SetEnabled(true);
+						UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("Tracing latency..."));
+					}
+					else
+						StopTrace();
+					break;
+				}
 
 				case ID_BUTTON_CLOSE:
 				{
 					if (bFileOpened)
 					{
 						bFileOpened = false;
+						::lastLoadId = 0;
+						EndJournal();
+						Rom_Close(openedRom);
 						ZeroMemory(pOpenedFilename, sizeof(char)* MAX_PATH);
 						ZeroMemory(pPaletteTable, sizeof(word) * 256);
+						history.Reset(pPaletteTable, ::bDrawMode);
+						CheckUndo(); CheckRedo();
+						UpdateWatches();
 						SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("File closed."));
 						SetWindowText(hWnd, TEXT("SnesPAL v1.00"));
 						RedrawPalettes();
+
+						// The next open palette takes over.
+						if (::activeDocument < documents.size())
+							documents.erase(documents.begin() + ::activeDocument);
+						if (!documents.empty())
+							ActivateDocument(::activeDocument < documents.size() ? ::activeDocument : documents.size() - 1);
 					}
 					break;
 				}
+				case ID_EDIT_ADJUST:
+				{
+					DialogBox(hInstance, MAKEINTRESOURCE(IDD_ADJUST), hWnd, &DlgProc_Adjust);
+					break;
+				}
 				case ID_BUTTON_SHOW_GRID:
 				{
 					ShowGrid(!bDisplayGrid);
@@ -449,39 +732,12 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 				}
 				case ID_BUTTON_UNDO:
 				{
-					if (!lastOperations.empty())
-					{
-						auto oper = lastOperations.back();
-						memcpy(pPaletteTable, oper.palette, sizeof(word) * 0x100);
-						::bDrawMode = oper.bDrawMode;
-						Button_SetCheck(hCbxDraw, ::bDrawMode);
-						lastOperations.pop_back();
-						lastOperationsRedo.push_back(oper);
-						std::wstring statMsg = std::to_wstring(lastOperations.size()).append(TEXT(" step(s) back.")).append(TEXT(" => ")).append(oper.info);
-						UpdateStatusInfo(nullptr, nullptr, nullptr, statMsg.c_str());
-						Button_Enable(hRedo, TRUE);
-						if (lastOperations.empty()) Button_Enable(hUndo, FALSE);
-						RedrawPalettes();
-					}
+					Undo();
 					break;
 				}
 				case ID_BUTTON_REDO:
 				{
-					if (!lastOperationsRedo.empty())
-					{
-						auto oper = lastOperationsRedo.back();
-						memcpy(pPaletteTable, oper.palette, sizeof(word) * 0x100);
-						UpdateStatusInfo(nullptr, nullptr, nullptr, oper.info.c_str());
-						::bDrawMode = oper.bDrawMode;
-						Button_SetCheck(hCbxDraw, ::bDrawMode);
-						lastOperationsRedo.pop_back();
-						lastOperations.push_back(oper);
-						std::wstring statMsg = std::to_wstring(lastOperationsRedo.size()).append(TEXT(" step(s) forward.")).append(TEXT(" => ")).append(oper.info);
-						UpdateStatusInfo(nullptr, nullptr, nullptr, statMsg.c_str());
-						Button_Enable(hUndo, TRUE);
-						if (lastOperationsRedo.empty()) Button_Enable(hRedo, FALSE);
-						RedrawPalettes();
-					}
+					Redo();
 					break;
 				}
 			}
@@ -529,15 +785,19 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 					wsprintf(pStatusInfo + 100, TEXT("PAL-Index: [%02X]"), singleIndex);
 					UpdateStatusInfo(pStatusInfo, pStatusInfo + 50, pStatusInfo + 100);
 
-					wsprintf(pTooltipText, L"%06X", Color_ConvertFromSNES(pPaletteTable[singleIndex]));
+					wsprintf(pTooltipText, L"%06X", Color_LookupFromSNES(pPaletteTable[singleIndex]));
 
 					if (wParam & MK_LBUTTON)
 					{
 						if (bDrawMode)
 						{
 							bRecord = true;
-							pPaletteTable[singleIndex] = ::preservedColw;
-							RedrawPalettes();
+							if (pPaletteTable[singleIndex] != ::preservedColw)
+							{
+								pPaletteTable[singleIndex] = ::preservedColw;
+								// Repainted with the next WM_PAINT, together with other cells changed meanwhile.
+								InvalidateCell(singleIndex);
+							}
 						}
 					}
 				}
@@ -569,6 +829,13 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 				word indexes = GetEditorPositionIndex(cursorPos);
 				byte col = indexes, row = (indexes >> 8);
 				int index = row * 16 + col;
+				::selectedCell = index;
+
+				if (::previewRow != row)
+				{
+					::previewRow = row;
+					RedrawPreview();
+				}
 
 				word currCol = 0x0000;
 				
@@ -588,13 +855,14 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 
 				if (!bDrawMode)
 				{
-					cc.rgbResult = Color_ConvertFromSNES(pPaletteTable[index]);
-					if (ChooseColor(&cc))
+					cc.rgbResult = Color_LookupFromSNES(pPaletteTable[index]);
+					if (PickColor(&cc))
 					{
 						COLORREF tempCol = cc.rgbResult;
-						word tempColw = Color_ConvertToSNES(GetRValue(tempCol), GetGValue(tempCol), GetBValue(tempCol));
+						word tempColw = Color_LookupToSNES(GetRValue(tempCol), GetGValue(tempCol), GetBValue(tempCol));
 						pPaletteTable[index] = tempColw;
-						RedrawPalettes();
+						InvalidateCell(index);
+						UpdateWindow(hPALEditor);
 						RecordOperation(TEXT("Change color."));
 					}
 				}
@@ -602,10 +870,10 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 			}
 			if (bCursorInCustom)
 			{
-				if (ChooseColor(&cc))
+				if (PickColor(&cc))
 				{
 					::preservedCol = cc.rgbResult;
-					::preservedColw = Color_ConvertToSNES(GetRValue(cc.rgbResult), GetGValue(cc.rgbResult), GetBValue(cc.rgbResult));
+					::preservedColw = Color_LookupToSNES(GetRValue(cc.rgbResult), GetGValue(cc.rgbResult), GetBValue(cc.rgbResult));
 					InvalidateRect(hCustomCol, nullptr, TRUE);
 					UpdateWindow(hCustomCol);
 
@@ -634,8 +902,15 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 				word indexes = GetEditorPositionIndex(cursorPos);
 				byte col = indexes, row = (indexes >> 8);
 				int index = row * 16 + col;
+				::selectedCell = index;
 
-				preservedCol = Color_ConvertFromSNES(pPaletteTable[index]);
+				if (::previewRow != row)
+				{
+					::previewRow = row;
+					RedrawPreview();
+				}
+
+				preservedCol = Color_LookupFromSNES(pPaletteTable[index]);
 				preservedColw = pPaletteTable[index];
 
 				InvalidateRect(hCustomCol, nullptr, TRUE);
@@ -662,13 +937,74 @@ LRESULT __stdcall WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 			MoveWindow(hStatusBar, 0, wHeight - (sbRect.bottom - sbRect.top), wWidth, 30, TRUE);
 			break;
 		}
+		case WM_FILE_DONE:
+		{
+			std::unique_ptr<FileJobResult> result(reinterpret_cast<FileJobResult*>(lParam));
+			if (result->type == FILEJOB_LOAD)
+				OnPaletteLoaded(*result);
+			else
+				OnPaletteSaved(*result);
+			break;
+		}
+		case WM_INITMENUPOPUP:
+		{
+			if (reinterpret_cast<HMENU>(wParam) == hWindowMenu)
+				UpdateWindowMenu();
+			break;
+		}
+		case WM_FILE_CHANGED:
+		{
+			std::unique_ptr<FileChange> change(reinterpret_cast<FileChange*>(lParam));
+			if (change->fn == ::watchedPalette)
+				OnPaletteChanged(*change);
+			else if (change->fn == ::watchedGfx)
+				OnGfxChanged(*change);
+			break;
+		}
 		case WM_CLOSE:
 			DestroyWindow(hWnd);
 			break;
 		case WM_DESTROY:
 		{
+			DeleteDC(hdcMem);
+			DeleteObject(hBitmap);
+			DeleteDC(hdcPreview);
+			DeleteObject(hPreviewBitmap);
+			editorFB.pixels = nullptr;
+			previewFB.pixels = nullptr;
 			RemoveWindowSubclass(hPALEditor, &SubclassProc_Editor, 0u);
 			RemoveWindowSubclass(hCustomCol, &SubclassProc_CustomCol, 0u);
+			RemoveWindowSubclass(hPreview, &SubclassProc_Preview, 0u);
+			// Saves still queued are finished and their results taken here, the
+			// loop does not run again. The journals go only if all of them made it.
+			fileWorker.Wait();
+			bool bSaved = true;
+			MSG msg;
+			while (PeekMessage(&msg, hWnd, WM_FILE_DONE, WM_FILE_DONE, PM_REMOVE))
+			{
+				std::unique_ptr<FileJobResult> result(reinterpret_cast<FileJobResult*>(msg.lParam));
+				if (result->type != FILEJOB_SAVE || result->err == PALERR_OK)
+					continue;
+				bSaved = false;
+				std::string err = PalFile_ErrorString(result->err);
+				ERROR_MBX(nullptr, (L"Cannot save " + result->fn.wstring() + L".\n" + std::wstring(err.begin(), err.end()) +
+					L"\nThe changes are kept for recovery on the next start.").c_str())
+			}
+			if (!bSaved)
+				journal.Close(false);
+			else
+			{
+				EndJournal();
+				// Unsaved changes of the other palettes are discarded as well.
+				for (std::size_t i = 0; i < documents.size(); ++i)
+				{
+					std::error_code ec;
+					if (i != ::activeDocument)
+						std::filesystem::remove(documents[i]->doc.GetJournalPath(), ec);
+				}
+			}
+			if (Trace_IsEnabled())
+				StopTrace();
 			PostQuitMessage(0);
 			break;
 		}
@@ -692,8 +1028,16 @@ LRESULT __stdcall SubclassProc_Editor(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM
 			PAINTSTRUCT ps;
 			BeginPaint(hWnd, &ps);
 			DrawToEditor(hdcMem);
-			BitBlt(ps.hdc, 0, 0, 256, 256, hdcMem, 0, 0, SRCCOPY);
+			BitBlt(ps.hdc, ps.rcPaint.left, ps.rcPaint.top, ps.rcPaint.right - ps.rcPaint.left, ps.rcPaint.bottom - ps.rcPaint.top,
+				hdcMem, ps.rcPaint.left, ps.rcPaint.top, SRCCOPY);
 			EndPaint(hWnd, &ps);
+
+			if (bDrawMode && bRecord && nCellsRepainted)
+			{
+				wchar_t pStr[40];
+				wsprintf(pStr, L"Repainted %d cell(s).", nCellsRepainted);
+				UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+			}
 			break;
 		}
 		default:
@@ -712,7 +1056,7 @@ LRESULT __stdcall SubclassProc_CustomCol(HWND hWnd, UINT Msg, WPARAM wParam, LPA
 			GetClientRect(hWnd, &clRect);
 			PAINTSTRUCT ps;
 			BeginPaint(hWnd, &ps);
-			word snesCol = Color_ConvertToSNES(GetRValue(preservedCol), GetGValue(preservedCol), GetBValue(preservedCol));
+			word snesCol = Color_LookupToSNES(GetRValue(preservedCol), GetGValue(preservedCol), GetBValue(preservedCol));
 			HBRUSH hbr = CreateSolidBrush(preservedCol);
 			HBRUSH hbrOld = (HBRUSH)SelectObject(ps.hdc, hbr);
 			FillRect(ps.hdc, &clRect, hbr);
@@ -726,6 +1070,26 @@ LRESULT __stdcall SubclassProc_CustomCol(HWND hWnd, UINT Msg, WPARAM wParam, LPA
 	}
 }
 
+LRESULT __stdcall SubclassProc_Preview(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam, UINT_PTR, DWORD_PTR)
+{
+	HDC hdcMem = (HDC)GetWindowLongPtr(hWnd, GWLP_USERDATA);
+	switch (Msg)
+	{
+		case WM_PAINT:
+		{
+			PAINTSTRUCT ps;
+			BeginPaint(hWnd, &ps);
+			DrawToPreview();
+			BitBlt(ps.hdc, 0, 0, PREVIEW_SIZE, PREVIEW_SIZE, hdcMem, 0, 0, SRCCOPY);
+			EndPaint(hWnd, &ps);
+			break;
+		}
+		default:
+			return DefSubclassProc(hWnd, Msg, wParam, lParam);
+	}
+	return 0;
+}
+
 LRESULT __stdcall DlgProc_CopyPAL(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
 	HWND hSrcEdit = GetDlgItem(hDlg, IDC_EDIT_SRC_PAL);
@@ -805,175 +1169,765 @@ LRESULT __stdcall DlgProc_About(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lPara
 	return 0;
 }
 
-BOOL __stdcall EnumProc_Main(HWND hWnd, LPARAM lParam)
+LRESULT __stdcall DlgProc_RomPAL(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
-	std::vector<HWND>* pVec = reinterpret_cast<std::vector<HWND>*>(lParam);
-	if (!pVec)
-		return FALSE;
-	pVec->push_back(hWnd);
-	return TRUE;
-}
+	HWND hAddrEdit = GetDlgItem(hDlg, IDC_EDIT_ROM_ADDR);
 
-int Loop()
-{
-	MSG Msg = { };
-	while (GetMessage(&Msg, nullptr, 0, 0) > 0)
+	switch (Msg)
 	{
-		TranslateMessage(&Msg);
-		DispatchMessage(&Msg);
+		case WM_INITDIALOG:
+		{
+			wchar_t addrStr[7];
+			wsprintf(addrStr, L"%06X", ::romAddress);
+			SetWindowText(hAddrEdit, addrStr);
+			break;
+		}
+		case WM_COMMAND:
+		{
+			switch (LOWORD(wParam))
+			{
+				case IDOK:
+				{
+					wchar_t addrStr[8];
+					GetWindowText(hAddrEdit, addrStr, 8);
+					wchar_t* pEnd;
+					unsigned long address = wcstoul(addrStr, &pEnd, 16);
+					if (*pEnd != '\0' || !addrStr[0] || address > 0xFFFFFF)
+					{
+						MessageBox(hDlg, TEXT("Address must be [$000000-$FFFFFF]"), TEXT("ROM Palette"), MB_OK | MB_ICONEXCLAMATION);
+						break;
+					}
+					::romAddress = address;
+					EndDialog(hDlg, IDOK);
+					break;
+				}
+				case IDCANCEL:
+				{
+					EndDialog(hDlg, IDCANCEL);
+					break;
+				}
+			}
+			break;
+		}
 	}
 	return 0;
 }
 
-bool OpenPAL(const wchar_t* fn)
+LRESULT __stdcall DlgProc_Adjust(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
-	if (!fn) return false;
-
-	const wchar_t* ext = nullptr;
-	const wchar_t* del = wcschr(fn, '.');
-	if (del || del != fn)
-		ext = del + 1;
-
-	if (!ext)
+	// Edit boxes in the order their steps are applied, with the value that leaves colors unchanged.
+	static const struct { int id; TransformOp op; int identity; float scale; } fields[] =
 	{
-		ERROR_MBX(nullptr, TEXT("Invalid File"))
-		return false;
-	}
-
-	if (wcscmp(ext, L"pal") && wcscmp(ext, L"tpl"))
-	{
-		ERROR_MBX(nullptr, TEXT("Unknown extension."))
-		return false;
-	}
+		{ IDC_ADJUST_HUE, TRANSFORM_HUE, 0, 1.0f },
+		{ IDC_ADJUST_SATURATION, TRANSFORM_SATURATION, 100, 0.01f },
+		{ IDC_ADJUST_CONTRAST, TRANSFORM_CONTRAST, 100, 0.01f },
+		{ IDC_ADJUST_BRIGHTNESS, TRANSFORM_BRIGHTNESS, 0, 0.01f },
+		{ IDC_ADJUST_TINT, TRANSFORM_TINT, 0, 0.01f }
+	};
 
-	FILE* file = _wfopen(fn, L"rb");
-	if (file)
+	switch (Msg)
 	{
-		if (!wcscmp(ext, L"pal"))
+		case WM_INITDIALOG:
 		{
-			// Load PAL...
-			byte rgb_curr[0x100 * 3];
-			fread(rgb_curr, sizeof(byte), 0x100 * 0x03, file);
-
-			int currPalIndex = 0;
-			for (int i = 0; i < 0x300; i += 3)
-			{
-				pPaletteTable[i/0x03] = Color_ConvertToSNES(rgb_curr[i], rgb_curr[i + 1], rgb_curr[i + 2]);
-			}
-
-			CheckUndo(); CheckRedo();
-			RedrawPalettes();
-			lastOperations.clear();
-			lastOperationsRedo.clear();
-			operationNumber = 0ull;
-			RecordOperation(TEXT("Loaded palette."));
-
-			wchar_t* titleBuff = new wchar_t[MAX_PATH + 17];
-			wcscpy(titleBuff, TEXT("SnesPAL v1.00"));
-			wcscat(titleBuff, TEXT(" - "));
-			wcscat(titleBuff, fn);
-			SetWindowText(hMainWindow, titleBuff);
-			delete[] titleBuff;
-			::bFileOpened = true;
-			wcscpy(::pOpenedFilename, fn);
-			return true;
+			for (const auto& field : fields)
+				SetDlgItemInt(hDlg, field.id, field.identity, TRUE);
+			CheckRadioButton(hDlg, IDC_ADJUST_CELL, IDC_ADJUST_ALL, IDC_ADJUST_ROW);
+			break;
 		}
-		else if (!wcscmp(ext, L"tpl"))
+		case WM_COMMAND:
 		{
-			// Load TPL...
-			byte signature[4];
-			fread(signature, sizeof(byte) * 4, 1, file);
-			word palData[256];
-			ZeroMemory(palData, sizeof(word) * 256);
-			fread(pPaletteTable, sizeof(word), 256, file);
-			
-			CheckUndo(); CheckRedo();
-			RedrawPalettes();
-			lastOperations.clear();
-			lastOperationsRedo.clear();
-			operationNumber = 0ull;
-			RecordOperation(TEXT("Loaded palette."));
-
-			::bFileOpened = true;
-			wcscpy(::pOpenedFilename, fn);
+			switch (LOWORD(wParam))
+			{
+				case IDOK:
+				{
+					TransformStep steps[6];
+					int nSteps = 0;
+					for (const auto& field : fields)
+					{
+						wchar_t str[8];
+						GetDlgItemText(hDlg, field.id, str, 8);
+						wchar_t* pEnd;
+						long value = wcstol(str, &pEnd, 10);
+						if (*pEnd != '\0' || !str[0])
+						{
+							MessageBox(hDlg, TEXT("Values must be whole numbers."), TEXT("Adjust Colors"), MB_OK | MB_ICONEXCLAMATION);
+							return 0;
+						}
+						if (value == field.identity)
+							continue;
+						steps[nSteps++] = { field.op, value * field.scale, ::preservedColw };
+					}
+					if (IsDlgButtonChecked(hDlg, IDC_ADJUST_GRAYSCALE) == BST_CHECKED)
+						steps[nSteps++] = { TRANSFORM_GRAYSCALE, 1.0f, 0x0000 };
+
+					int first = 0, count = 0x100;
+					if (IsDlgButtonChecked(hDlg, IDC_ADJUST_CELL) == BST_CHECKED)
+						first = ::selectedCell, count = 1;
+					else if (IsDlgButtonChecked(hDlg, IDC_ADJUST_ROW) == BST_CHECKED)
+						first = ::selectedCell & 0xF0, count = 0x10;
+
+					ColorTransform xf;
+					Transform_Compile(steps, nSteps, xf);
+					Transform_Apply(xf, pPaletteTable + first, count);
+					RedrawPalettes();
+					SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("Colors adjusted."));
+					RecordOperation(TEXT("Adjusted colors."));
+					EndDialog(hDlg, IDOK);
+					break;
+				}
+				case IDCANCEL:
+				{
+					EndDialog(hDlg, IDCANCEL);
+					break;
+				}
+			}
+			break;
 		}
-		fclose(file);
-		return true;
-	}
-	else
-	{
-		ERROR_MBX(nullptr, TEXT("Cannot open requested file."))
-		return false;
 	}
-
-	return false;
+	return 0;
 }
 
-bool SavePAL(const wchar_t* fn)
+LRESULT __stdcall DlgProc_Fade(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
-	if (!fn)
-		fn = pOpenedFilename;
-
-	const wchar_t* ext = nullptr;
-	const wchar_t* del = wcschr(fn, '.');
-	if (del || del != fn)
-		ext = del + 1;
+	HWND hFramesEdit = GetDlgItem(hDlg, IDC_FADE_FRAMES);
 
-	if (!ext)
+	switch (Msg)
 	{
-		ERROR_MBX(nullptr, TEXT("Invalid File"))
-		return false;
+		case WM_INITDIALOG:
+		{
+			CheckRadioButton(hDlg, IDC_FADE_BLACK, IDC_FADE_BRIGHTNESS, IDC_FADE_BLACK + ::fadeOptions.mode);
+			CheckDlgButton(hDlg, IDC_FADE_IN, ::fadeOptions.bReverse ? BST_CHECKED : BST_UNCHECKED);
+			SetDlgItemInt(hDlg, IDC_FADE_FRAMES, ::fadeOptions.nFrames, FALSE);
+			break;
+		}
+		case WM_COMMAND:
+		{
+			switch (LOWORD(wParam))
+			{
+				case IDOK:
+				{
+					wchar_t framesStr[5];
+					GetWindowText(hFramesEdit, framesStr, 5);
+					wchar_t* pEnd;
+					long nFrames = wcstol(framesStr, &pEnd, 10);
+					if (*pEnd != '\0' || !framesStr[0] || nFrames < 1 || nFrames > FADE_MAX_FRAMES)
+					{
+						MessageBox(hDlg, TEXT("Frame count must be [1-256]"), TEXT("Export Fade"), MB_OK | MB_ICONEXCLAMATION);
+						break;
+					}
+					for (int mode = 0; mode < FADE_MODE_COUNT; ++mode)
+					{
+						if (IsDlgButtonChecked(hDlg, IDC_FADE_BLACK + mode) == BST_CHECKED)
+							::fadeOptions.mode = static_cast<FadeMode>(mode);
+					}
+					::fadeOptions.nFrames = static_cast<int>(nFrames);
+					::fadeOptions.bReverse = (IsDlgButtonChecked(hDlg, IDC_FADE_IN) == BST_CHECKED);
+					EndDialog(hDlg, IDOK);
+					break;
+				}
+				case IDCANCEL:
+				{
+					EndDialog(hDlg, IDCANCEL);
+					break;
+				}
+			}
+			break;
+		}
 	}
+	return 0;
+}
+
+BOOL __stdcall EnumProc_Main(HWND hWnd, LPARAM lParam)
+{
+	std::vector<HWND>* pVec = reinterpret_cast<std::vector<HWND>*>(lParam);
+	if (!pVec)
+		return FALSE;
+	pVec->push_back(hWnd);
+	return TRUE;
+}
 
-	if (wcscmp(ext, L"pal") && wcscmp(ext, L"tpl"))
+int Loop()
+{
+	MSG Msg = { };
+	while (GetMessage(&Msg, nullptr, 0, 0) > 0)
 	{
-		ERROR_MBX(nullptr, TEXT("Unknown extension."))
-		return false;
+		TranslateMessage(&Msg);
+		DispatchMessage(&Msg);
 	}
+	return 0;
+}
 
-	FILE* file = _wfopen(fn, L"wb");
-	if (file)
+// Reads the palette on the file worker, OnPaletteLoaded() takes it from there.
+bool OpenPAL(const wchar_t* fn)
+{
+	if (!fn) return false;
+
+	// Opening a palette open in the background switches to it and keeps its
+	// edits; opening the active one again reloads it (see GetRecoveryPath).
+	int index = FindDocument(fn, JOURNAL_NO_ADDRESS);
+	if (index >= 0 && !(::bFileOpened && index == static_cast<int>(::activeDocument)))
+	{
+		SwitchDocument(index);
+		return true;
+	}
+	::lastLoadId = fileWorker.Load(fn, GetRecoveryPath(fn, JOURNAL_NO_ADDRESS));
+	UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("Opening file..."));
+	return true;
+}
+
+void OnPaletteLoaded(FileJobResult& result)
+{
+	if (result.id != ::lastLoadId)
+		return;
+	if (result.err != PALERR_OK)
+	{
+		std::string msg = PalFile_ErrorString(result.err);
+		ERROR_MBX(hMainWindow, (L"Cannot open requested file.\n" + std::wstring(msg.begin(), msg.end())).c_str())
+		UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT(""));
+		return;
+	}
+
+	const wchar_t* fn = result.fn.c_str();
+	// A palette open already is reloaded in place.
+	int index = FindDocument(fn, JOURNAL_NO_ADDRESS);
+	if (index >= 0)
+		SwitchDocument(index);
+	else
+		StashDocument();
+	memcpy(pPaletteTable, result.palette, sizeof(word) * PAL_COLORS);
+	memcpy(diskPalette, result.palette, sizeof(word) * PAL_COLORS);
+	Rom_Close(openedRom);
+
+	history.Reset(pPaletteTable, ::bDrawMode);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("File opened successfully."));
+	StartJournal(fn, JOURNAL_NO_ADDRESS, result.pRecovery.get());
+	CheckUndo(); CheckRedo();
+	RedrawPalettes();
+
+	::bFileOpened = true;
+	wcscpy(::pOpenedFilename, fn);
+	if (index < 0)
+		AddDocument(fn, JOURNAL_NO_ADDRESS);
+	UpdateTitle();
+	UpdateWatches();
+}
+
+// Writes a snapshot of the palette on the file worker, so editing goes on
+// meanwhile; OnPaletteSaved() finishes up.
+bool SavePAL(const wchar_t* fn)
+{
+	if (!fn && openedRom.file.IsOpen())
+		return SaveROMPAL();
+	if (!fn)
+		fn = pOpenedFilename;
+
+	unsigned long long id = fileWorker.Save(fn, pPaletteTable);
+	// A save merged into a queued one replaces its snapshot there as well.
+	std::error_code ec;
+	PendingSave& pending = pendingSaves[id];
+	pending.fn = std::filesystem::absolute(fn, ec).lexically_normal();
+	memcpy(pending.palette, pPaletteTable, sizeof(pending.palette));
+	bool bDocument = ::bFileOpened && ::activeDocument < documents.size();
+	saveOwners[id] = { bDocument ? documents[::activeDocument]->serial : 0, ::nActivations };
+	UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("Saving file..."));
+	return true;
+}
+
+void OnPaletteSaved(FileJobResult& result)
+{
+	pendingSaves.erase(result.id);
+	SaveOwner saveOwner = { 0, ::nActivations };
+	auto owner = saveOwners.find(result.id);
+	if (owner != saveOwners.end())
 	{
-		if (!wcscmp(ext, L"pal"))
+		saveOwner = owner->second;
+		saveOwners.erase(owner);
+	}
+	unsigned long long serial = saveOwner.serial;
+	if (result.err != PALERR_OK)
+	{
+		std::string msg = PalFile_ErrorString(result.err);
+		ERROR_MBX(hMainWindow, (L"Cannot save requested file.\n" + std::wstring(msg.begin(), msg.end())).c_str())
+		UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT(""));
+		return;
+	}
+
+	const wchar_t* fn = result.fn.c_str();
+	if (!serial && saveOwner.activation != ::nActivations)
+	{
+		// An untitled palette, replaced by an opened one meanwhile.
+		UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("File saved."));
+		return;
+	}
+	if (serial && (!::bFileOpened || ::activeDocument >= documents.size() || documents[::activeDocument]->serial != serial))
+	{
+		// Made while another palette was active; closed since, if not found.
+		for (auto& d : documents)
 		{
-			byte pPaletteTableConv[768];
-			for (int i = 0; i < 256; ++i)
-			{
-				COLORREF rgb = Color_ConvertFromSNES(pPaletteTable[i]);
-				byte r = GetRValue(rgb);
-				byte g = GetGValue(rgb);
-				byte b = GetBValue(rgb);
-				byte rgb_b[3] = { r, g, b };
-				memcpy(pPaletteTableConv+(i*3), rgb_b, sizeof(byte) * 3);
-			}
-			fwrite(pPaletteTableConv, sizeof(byte) * 768, 1, file);
+			if (d->serial != serial)
+				continue;
+			std::filesystem::path journalFn = d->doc.GetJournalPath();
+			Rom_Close(d->rom);
+			d->doc.fn = fn;
+			d->doc.address = JOURNAL_NO_ADDRESS;
+			d->doc.saved = Palette(result.palette);
+			// The journal is rewritten when the palette is activated again.
+			std::error_code ec;
+			if (!d->doc.IsModified() || journalFn != d->doc.GetJournalPath())
+				std::filesystem::remove(journalFn, ec);
 		}
-		fclose(file);
+		UpdateStatusInfo(nullptr, nullptr, nullptr, TEXT("File saved."));
+		return;
+	}
 
-		wcscpy(pOpenedFilename, fn);
-		bFileOpened = true;
-		wchar_t* titleBuff = new wchar_t[MAX_PATH + 17];
-		wcscpy(titleBuff, TEXT("SnesPAL v1.00"));
-		wcscat(titleBuff, TEXT(" - "));
-		wcscat(titleBuff, fn);
-		SetWindowText(hMainWindow, titleBuff);
-		delete[] titleBuff;
-		return true;
+	// Saving as a palette file detaches the editor from the ROM.
+	Rom_Close(openedRom);
+	wcscpy(pOpenedFilename, fn);
+	if (::bFileOpened && ::activeDocument < documents.size())
+	{
+		documents[::activeDocument]->doc.fn = fn;
+		documents[::activeDocument]->doc.address = JOURNAL_NO_ADDRESS;
 	}
 	else
+		AddDocument(fn, JOURNAL_NO_ADDRESS);
+	bFileOpened = true;
+	UpdateTitle();
+	memcpy(diskPalette, result.palette, sizeof(word) * PAL_COLORS);
+	UpdateWatches();
+	// Edits made while the save was in flight are not in the file yet.
+	CompactJournal(fn, JOURNAL_NO_ADDRESS, !memcmp(result.palette, pPaletteTable, sizeof(word) * PAL_COLORS));
+
+	wchar_t pStr[96];
+	wsprintf(pStr, L"File saved in %u ms.%s", (unsigned)(result.elapsedUs / 1000),
+		journal.HasFailed() ? L" Recovery journal cannot be written." : L"");
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+}
+
+bool OpenROMPAL(const wchar_t* fn, dword address)
+{
+	if (!fn) return false;
+
+	// Like OpenPAL(): switches to a palette open in the background, reloads the active one.
+	int index = FindDocument(fn, address);
+	if (index >= 0 && !(::bFileOpened && index == static_cast<int>(::activeDocument)))
+	{
+		SwitchDocument(index);
+		return true;
+	}
+	Rom rom;
+	if (!Rom_Open(rom, fn, true))
+	{
+		ERROR_MBX(nullptr, TEXT("Cannot open requested ROM."))
+		return false;
+	}
+
+	word palData[PAL_COLORS] = { 0x0000 };
+	if (!Rom_ReadPalette(rom, address, palData, PAL_COLORS))
+	{
+		ERROR_MBX(nullptr, TEXT("Palette address is outside of the ROM."))
+		return false;
+	}
+	if (index < 0)
+		StashDocument();
+	memcpy(pPaletteTable, palData, sizeof(word) * PAL_COLORS);
+	memcpy(diskPalette, palData, sizeof(word) * PAL_COLORS);
+	openedRom = std::move(rom);
+	::romAddress = address;
+	::lastLoadId = 0;
+
+	history.Reset(pPaletteTable, ::bDrawMode);
+	JournalRecovery recovery;
+	std::filesystem::path journalFn = GetRecoveryPath(fn, address);
+	StartJournal(fn, address, !journalFn.empty() && Journal_Recover(journalFn, recovery) ? &recovery : nullptr);
+	CheckUndo(); CheckRedo();
+	RedrawPalettes();
+
+	::bFileOpened = true;
+	wcscpy(::pOpenedFilename, fn);
+	if (index < 0)
+		AddDocument(fn, address);
+	UpdateTitle();
+	UpdateWatches();
+	return true;
+}
+
+// Patches the palette in place and fixes the ROM checksum.
+bool SaveROMPAL()
+{
+	if (!Rom_WritePalette(openedRom, ::romAddress, pPaletteTable, PAL_COLORS) || !Rom_Save(openedRom))
 	{
-		ERROR_MBX(nullptr, TEXT("Cannot open requested file."))
+		ERROR_MBX(nullptr, TEXT("Cannot write palette to ROM."))
 		return false;
 	}
+	memcpy(diskPalette, pPaletteTable, sizeof(word) * PAL_COLORS);
+	CompactJournal(pOpenedFilename, ::romAddress, true);
+	SendMessage(hStatusBar, SB_SETTEXT, (WPARAM)LOBYTE(3), (LPARAM)TEXT("File saved."));
+	return true;
+}
+
+// The palette just opened into the globals becomes the active document.
+void AddDocument(const wchar_t* fn, dword address)
+{
+	std::unique_ptr<OpenDocument> d(new OpenDocument);
+	d->doc.fn = fn;
+	d->doc.address = address;
+	d->serial = ++::lastDocumentSerial;
+	documents.push_back(std::move(d));
+	::activeDocument = documents.size() - 1;
+	++::nActivations;
+}
 
-	return false;
+// Moves the active palette out of the globals into its document. Only the
+// rows changed since it was last stashed are copied.
+void StashDocument()
+{
+	if (!::bFileOpened || ::activeDocument >= documents.size())
+		return;
+	OpenDocument& d = *documents[::activeDocument];
+	d.doc.palette.Assign(pPaletteTable);
+	d.doc.saved.Assign(diskPalette);
+	d.doc.history = std::move(history);
+	d.doc.bDrawMode = ::bDrawMode;
+	d.rom = std::move(openedRom);
+	// Unsaved changes keep their journal in case the session does not end cleanly.
+	journal.Close(!d.doc.IsModified());
+	::bFileOpened = false;
+}
+
+// Loads a document into the globals, the active one must be stashed first.
+void ActivateDocument(std::size_t index)
+{
+	OpenDocument& d = *documents[index];
+	bool bSaved = !d.doc.IsModified();
+	::activeDocument = index;
+	++::nActivations;
+	d.doc.palette.Read(pPaletteTable);
+	d.doc.saved.Read(diskPalette);
+	history = std::move(d.doc.history);
+	::bDrawMode = d.doc.bDrawMode;
+	Button_SetCheck(hCbxDraw, ::bDrawMode);
+	openedRom = std::move(d.rom);
+	if (d.doc.address != JOURNAL_NO_ADDRESS)
+		::romAddress = d.doc.address;
+	::bFileOpened = true;
+	wcscpy(::pOpenedFilename, d.doc.fn.c_str());
+
+	OpenJournal(::pOpenedFilename, d.doc.address, bSaved);
+	CheckUndo(); CheckRedo();
+	RedrawPalettes(true);
+	UpdateTitle();
+	UpdateWatches();
+}
+
+void SwitchDocument(std::size_t index)
+{
+	if (index >= documents.size() || (::bFileOpened && index == ::activeDocument))
+		return;
+	StashDocument();
+	ActivateDocument(index);
+
+	// Every document is up to date now.
+	std::vector<const Palette*> palettes;
+	for (const auto& d : documents)
+	{
+		palettes.push_back(&d->doc.palette);
+		palettes.push_back(&d->doc.saved);
+	}
+	std::size_t nRows = Palette_CountRows(palettes);
+	wchar_t pStr[96];
+	wsprintf(pStr, L"%u palette(s) open share %u row(s), %u KB.", (unsigned)documents.size(), (unsigned)nRows,
+		(unsigned)((nRows * sizeof(PaletteRow) + 1023) / 1024));
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+}
+
+// Index of the open document for a file (and ROM address), or -1.
+int FindDocument(const wchar_t* fn, dword address)
+{
+	for (std::size_t i = 0; i < documents.size(); ++i)
+	{
+		std::error_code ec;
+		const PaletteDocument& doc = documents[i]->doc;
+		if (doc.address == address && std::filesystem::equivalent(doc.fn, fn, ec))
+			return static_cast<int>(i);
+	}
+	return -1;
+}
+
+// Lists the open palettes, the active one checked and unsaved ones starred.
+void UpdateWindowMenu()
+{
+	while (GetMenuItemCount(hWindowMenu) > 0)
+		DeleteMenu(hWindowMenu, 0, MF_BYPOSITION);
+	if (documents.empty())
+	{
+		AppendMenu(hWindowMenu, MF_STRING | MF_GRAYED, 0, TEXT("No Palettes Open"));
+		return;
+	}
+
+	for (std::size_t i = 0; i < documents.size() && i < WINDOW_MAX_DOCUMENTS; ++i)
+	{
+		const PaletteDocument& doc = documents[i]->doc;
+		bool bActive = ::bFileOpened && i == ::activeDocument;
+		bool bModified = bActive ? memcmp(pPaletteTable, diskPalette, sizeof(word) * PAL_COLORS) != 0 : doc.IsModified();
+		std::wstring name = doc.fn.filename().wstring();
+		wchar_t pLabel[MAX_PATH + 32];
+		if (doc.address == JOURNAL_NO_ADDRESS)
+			wsprintf(pLabel, L"%s%s", name.c_str(), bModified ? L" *" : L"");
+		else
+			wsprintf(pLabel, L"%s @ $%06X%s", name.c_str(), doc.address, bModified ? L" *" : L"");
+		AppendMenu(hWindowMenu, MF_STRING | (bActive ? MF_CHECKED : MF_UNCHECKED), (UINT_PTR)(ID_WINDOW_DOCUMENT + i), pLabel);
+	}
+}
+
+bool OpenGFX(const wchar_t* fn)
+{
+	if (!fn) return false;
+
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return false;
+	std::vector<byte> data;
+	byte buffer[0x4000];
+	std::size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(file);
+
+	if (!Gfx_TileCount(data.size(), 2))
+		return false;
+	::gfxData.swap(data);
+	SetPreviewDepth(::gfxDepth);
+
+	std::error_code ec;
+	::watchedGfx = std::filesystem::absolute(fn, ec).lexically_normal();
+	UpdateWatches();
+	return true;
+}
+
+// Watches the opened palette file, unless it comes from a ROM, and the graphics.
+void UpdateWatches()
+{
+	std::error_code ec;
+	::watchedPalette.clear();
+	if (::bFileOpened && !openedRom.file.IsOpen())
+		::watchedPalette = std::filesystem::absolute(pOpenedFilename, ec).lexically_normal();
+
+	fileWatcher.UnwatchAll();
+	if (!::watchedPalette.empty())
+		fileWatcher.Watch(::watchedPalette);
+	if (!::watchedGfx.empty())
+		fileWatcher.Watch(::watchedGfx);
+}
+
+// Takes the colors another program changed in the palette file; edits to
+// the other colors stay. The merge is one undoable operation.
+void OnPaletteChanged(FileChange& change)
+{
+	word palette[PAL_COLORS];
+	// A file caught mid-write fails here, the rest of the write brings another change.
+	if (PalFile_Parse(change.data.data(), change.data.size(), palette, PalFile_Detect(change.data.data(), change.data.size(), change.fn)) != PALERR_OK)
+		return;
+	// Saves of our own are seen as well. They match diskPalette once done,
+	// or the snapshot of a save still in flight.
+	for (const auto& pending : pendingSaves)
+	{
+		if (pending.second.fn == change.fn && !memcmp(pending.second.palette, palette, sizeof(palette)))
+			return;
+	}
+
+	int nChanged = 0;
+	for (int i = 0; i < PAL_COLORS; ++i)
+	{
+		if (palette[i] == diskPalette[i])
+			continue;
+		diskPalette[i] = palette[i];
+		if (pPaletteTable[i] == palette[i])
+			continue;
+		pPaletteTable[i] = palette[i];
+		InvalidateCell(i);
+		++nChanged;
+	}
+	if (!nChanged)
+		return;
+	RecordOperation(TEXT("Reloaded external changes."));
+
+	long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - change.firstChange).count();
+	wchar_t pStr[96];
+	wsprintf(pStr, L"Reloaded %d color(s) changed by another program in %u ms.", nChanged, (unsigned)ms);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+}
+
+// Decodes again only the tiles whose bytes changed, other sizes reload all.
+void OnGfxChanged(FileChange& change)
+{
+	if (!Gfx_TileCount(change.data.size(), 2))
+		return;
+	if (change.data.size() != gfxData.size())
+	{
+		::gfxData.swap(change.data);
+		SetPreviewDepth(::gfxDepth);
+		return;
+	}
+
+	std::size_t tileBytes = Gfx_TileBytes(::gfxDepth);
+	std::size_t nChanged = 0;
+	for (std::size_t t = 0; t < gfxTiles; ++t)
+	{
+		const byte* src = change.data.data() + t * tileBytes;
+		if (!memcmp(src, gfxData.data() + t * tileBytes, tileBytes))
+			continue;
+		Gfx_DecodeTiles(src, 1, ::gfxDepth, gfxPixels.data() + t * GFX_TILE_PIXELS);
+		++nChanged;
+	}
+	::gfxData.swap(change.data);
+	if (!nChanged)
+		return;
+	previewIndex.Build(gfxPixels.data(), min(gfxTiles, (std::size_t)PREVIEW_TILES), PREVIEW_SIZE / GFX_TILE_SIZE, previewFB);
+	RedrawPreview();
+
+	long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - change.firstChange).count();
+	wchar_t pStr[96];
+	wsprintf(pStr, L"GFX: %u tile(s) changed by another program reloaded in %u ms.", (unsigned)nChanged, (unsigned)ms);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+}
+
+// Quantizes an image into rows 0-7, the top-left pixel gives the transparent color 0.
+bool ImportImage(const wchar_t* fn)
+{
+	if (!fn) return false;
+
+	Image img;
+	if (!Image_Read(fn, img))
+		return false;
+
+	QuantizeOptions opt;
+	QuantizeResult result;
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool;
+		if (!Quantize_Image(img, opt, pool, result))
+			return false;
+	}
+	long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tStart).count();
+
+	for (int p = 0; p < result.nPalettes; ++p)
+		memcpy(pPaletteTable + p * 0x10, result.palettes[p], sizeof(word) * 0x10);
+	RecordOperation(TEXT("Imported image palettes."));
+	RedrawPalettes();
+
+	wchar_t pStr[64];
+	wsprintf(pStr, L"Imported %d sub-palette(s) in %u ms.", result.nPalettes, (unsigned)ms);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+	return true;
+}
+
+// Builds fadeOptions.nFrames palettes from the working palette, writes them
+// and shows the frames in the preview until the palette changes.
+bool ExportFade(HWND hWnd)
+{
+	word target[FADE_COLORS] = { 0x0000 };
+	wchar_t buffer[MAX_PATH];
+	OPENFILENAME ofn = { };
+	ofn.lStructSize = sizeof(ofn);
+	ofn.hwndOwner = hWnd;
+	ofn.hInstance = ::hInstance;
+	ofn.lpstrInitialDir = L".";
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrFile = buffer;
+	ofn.nFilterIndex = -1;
+
+	if (::fadeOptions.mode == FADE_CROSS)
+	{
+		buffer[0] = '\0';
+		ofn.lpstrTitle = TEXT("Cross-fade To");
+		ofn.lpstrFilter = PALETTE_OPEN_FILTER;
+		ofn.Flags = OFN_FILEMUSTEXIST | OFN_EXPLORER;
+		if (!GetOpenFileName(&ofn))
+			return true;
+		if (PalFile_Load(buffer, target) != PALERR_OK)
+			return false;
+	}
+
+	buffer[0] = '\0';
+	ofn.lpstrTitle = nullptr;
+	ofn.lpstrFilter = TEXT("Packed BIN\0*.bin\0TPL Sequence\0*.tpl\0");
+	ofn.lpstrDefExt = L"bin";
+	ofn.Flags = OFN_OVERWRITEPROMPT | OFN_EXPLORER;
+	if (!GetSaveFileName(&ofn))
+		return true;
+
+	std::vector<word> frames(static_cast<std::size_t>(::fadeOptions.nFrames) * FADE_COLORS);
+	auto tStart = std::chrono::steady_clock::now();
+	if (!Fade_Generate(pPaletteTable, target, ::fadeOptions, frames.data()))
+		return false;
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+	if (!Fade_WriteSequence(buffer, frames.data(), ::fadeOptions.nFrames))
+		return false;
+
+	if (previewFB.pixels)
+	{
+		GdiFlush();
+		Fade_RenderStrip(previewFB, frames.data(), ::fadeOptions.nFrames);
+		bPreviewStrip = true;
+		bPreviewDirty = false;
+		InvalidateRect(hPreview, nullptr, FALSE);
+	}
+
+	wchar_t pStr[64];
+	wsprintf(pStr, L"Fade: %d frame(s) built in %u us.", ::fadeOptions.nFrames, (unsigned)us);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+	return true;
+}
+
+// Decodes the loaded graphics again with another bit depth.
+void SetPreviewDepth(int bpp)
+{
+	::gfxDepth = bpp;
+	::gfxTiles = Gfx_TileCount(gfxData.size(), bpp);
+	gfxPixels.resize(gfxTiles * GFX_TILE_PIXELS);
+
+	auto tStart = std::chrono::steady_clock::now();
+	Gfx_DecodeTiles(gfxData.data(), gfxTiles, bpp, gfxPixels.data());
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tStart).count();
+	previewIndex.Build(gfxPixels.data(), min(gfxTiles, (std::size_t)PREVIEW_TILES), PREVIEW_SIZE / GFX_TILE_SIZE, previewFB);
+
+	if (!gfxData.empty())
+	{
+		wchar_t pStr[64];
+		wsprintf(pStr, L"GFX: %u %dbpp tile(s) decoded in %u us.", (unsigned)gfxTiles, bpp, (unsigned)us);
+		UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+	}
+	RedrawPreview();
+}
+
+void SetTitle(const wchar_t* fn)
+{
+	wchar_t* titleBuff = new wchar_t[MAX_PATH + 64];
+	wcscpy(titleBuff, TEXT("SnesPAL v1.00"));
+	wcscat(titleBuff, TEXT(" - "));
+	wcsncat(titleBuff, fn, MAX_PATH + 31);
+	SetWindowText(hMainWindow, titleBuff);
+	delete[] titleBuff;
+}
+
+// Title of the active palette, with the address for one in a ROM.
+void UpdateTitle()
+{
+	if (!openedRom.file.IsOpen())
+	{
+		SetTitle(::pOpenedFilename);
+		return;
+	}
+	wchar_t titleBuff[MAX_PATH + 32];
+	wsprintf(titleBuff, L"%s @ $%06X (%S)", ::pOpenedFilename, ::romAddress, Rom_MappingName(openedRom.mapping));
+	SetTitle(titleBuff);
 }
 
 void ShowGrid(bool bShow)
 {
 	::bDisplayGrid = bShow;
-	InvalidateRect(hPALEditor, nullptr, TRUE);
-	UpdateWindow(hPALEditor);
+	editorView.bGrid = bShow;
+	RedrawPalettes();
 	return;
 }
 
@@ -992,102 +1946,176 @@ void UpdateStatusInfo(const wchar_t* _1, const wchar_t* _2, const wchar_t* _3, c
 
 void Undo()
 {
+	const wchar_t* pInfo = history.Undo(pPaletteTable, ::bDrawMode);
+	if (!pInfo)
+		return;
+	journal.RecordUndo(pPaletteTable, ::bDrawMode);
+
+	Button_SetCheck(hCbxDraw, ::bDrawMode);
+	wchar_t pMemInfo[64];
+	wsprintf(pMemInfo, L" (%u bytes, %u KB total)", (unsigned)history.GetRedoStepMemory(), (unsigned)(history.GetMemoryUsage() / 1024));
+	std::wstring statMsg = std::to_wstring(history.GetUndoCount()).append(TEXT(" step(s) back.")).append(TEXT(" => ")).append(pInfo).append(pMemInfo);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, statMsg.c_str());
+	CheckUndo(); CheckRedo();
 	RedrawPalettes();
 	return;
 }
 
 void Redo()
 {
+	const wchar_t* pInfo = history.Redo(pPaletteTable, ::bDrawMode);
+	if (!pInfo)
+		return;
+	journal.RecordRedo(pPaletteTable, ::bDrawMode);
+
+	Button_SetCheck(hCbxDraw, ::bDrawMode);
+	wchar_t pMemInfo[64];
+	wsprintf(pMemInfo, L" (%u bytes, %u KB total)", (unsigned)history.GetUndoStepMemory(), (unsigned)(history.GetMemoryUsage() / 1024));
+	std::wstring statMsg = std::to_wstring(history.GetRedoCount()).append(TEXT(" step(s) forward.")).append(TEXT(" => ")).append(pInfo).append(pMemInfo);
+	UpdateStatusInfo(nullptr, nullptr, nullptr, statMsg.c_str());
+	CheckUndo(); CheckRedo();
 	RedrawPalettes();
 	return;
 }
 
-bool UndoCheck()
+// Paints the dirty cells into the editor back buffer.
+void DrawToEditor(HDC hdc)
 {
-	if (historyIndex > 0)
+	TRACE_SCOPE("DrawToEditor");
+	nCellsRepainted = 0;
+	if (!editorFB.pixels)
+		return;
+
+	// Finish pending GDI work before touching the DIB bits directly.
+	GdiFlush();
+	if (bRedrawAll)
 	{
-		Button_Enable(hUndo, TRUE);
-		return true;
+		Render_PaletteGrid(editorFB, pPaletteTable, editorView);
+		for (int i = 0; i < 0x100; ++i)
+			bDirtyCells[i] = false;
+		bRedrawAll = false;
+		nCellsRepainted = 0x100;
+		return;
 	}
-	else
+
+	for (int i = 0; i < 0x100; ++i)
 	{
-		Button_Enable(hUndo, FALSE);
+		if (!bDirtyCells[i])
+			continue;
+		bDirtyCells[i] = false;
+		Render_PaletteCell(editorFB, pPaletteTable, i, editorView);
+		++nCellsRepainted;
 	}
-	return false;
+	return;
+}
+
+// Marks the whole editor for repainting and repaints it right away.
+void RedrawPalettes(bool bChanged)
+{
+	bRedrawAll = true;
+	InvalidateRect(hPALEditor, nullptr, FALSE);
+	UpdateWindow(hPALEditor);
+	RedrawPreview();
+	return;
 }
 
-bool RedoCheck()
+// Recolors the preview tiles with the current palette row.
+void DrawToPreview()
 {
-	if (historyIndex <= lastOperations.size() - 1)
+	TRACE_SCOPE("DrawToPreview");
+	if (!previewFB.pixels || !bPreviewDirty)
+		return;
+
+	GdiFlush();
+	auto tStart = std::chrono::steady_clock::now();
+	Render_FillRect(previewFB, 0, 0, previewFB.width, previewFB.height, RENDER_XRGB(0x00, 0x00, 0x00));
+	if (gfxTiles)
 	{
-		Button_Enable(hUndo, TRUE);
-		return true;
+		dword colors[0x100];
+		Gfx_BuildColors(pPaletteTable, ::previewRow, ::gfxDepth, colors);
+		Gfx_RenderTiles(previewFB, gfxPixels.data(), min(gfxTiles, (std::size_t)PREVIEW_TILES), PREVIEW_SIZE / GFX_TILE_SIZE, colors);
 	}
-	else
-		Button_Enable(hUndo, FALSE);
-	return false;
+	previewFullNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+	bPreviewDirty = false;
+	bPreviewStrip = false;
+	return;
 }
 
-void DrawToEditor(HDC hdc)
+// Rewrites only the preview pixels drawn with one palette slot.
+void RecolorPreviewSlot(int slot)
 {
-	word rowDown = 0;
-	RECT edRect;
-	edRect.left = 0;
-	edRect.top = 0;
-	edRect.bottom = 256;
-	edRect.right = 256;
-	
-	HBRUSH hbrt = CreateSolidBrush(RGB(0xFF, 0xFF, 0xFF));
-	FillRect(hdc, &edRect, hbrt);
-	DeleteObject(hbrt);
-
-	for (word y = 0x00; y < 0x10; ++y)
+	// The fade strip goes away with the first edit.
+	if (bPreviewStrip)
 	{
-		for (word x = 0x00; x < 0x10; ++x)
-		{
-			// Get current color from table.
-			word currCol = pPaletteTable[y * 0x10 + x];
-			if (x == 0)
-				currCol = 0x0000;
-
-			// Create brush based on that color.
-			HBRUSH hbr = CreateSolidBrush(Color_ConvertFromSNES(currCol));
-			// Calculate each palette color rect dimensions.
-			RECT colRect;
-			colRect.left = (x * 0x10) + (bDisplayGrid ? 0x01 : 0x00);
-			colRect.right = (colRect.left + 0x10) - (bDisplayGrid ? 0x01 : 0x00);
-			colRect.top = (y * 0x10) + (bDisplayGrid ? 0x01 : 0x00);
-			colRect.bottom = (colRect.top + 0x10) - (bDisplayGrid ? 0x01 : 0x00);
-
-			// Draw color squares.
-			FillRect(hdc, &colRect, hbr);
-			// Release Brush
-			DeleteObject(hbr);
-		}
+		RedrawPreview();
+		return;
+	}
+
+	// A full repaint is pending anyway, or the slot is not visible in the preview.
+	int index = Gfx_SlotToIndex(slot, ::previewRow, ::gfxDepth);
+	if (bPreviewDirty || index < 0 || !gfxTiles || !previewFB.pixels)
+		return;
+
+	GdiFlush();
+	auto tStart = std::chrono::steady_clock::now();
+	std::size_t nPixels = previewIndex.Recolor(previewFB, index, Render_ColorFromSNES(pPaletteTable[slot]));
+	long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+	InvalidateRect(hPreview, nullptr, FALSE);
+
+	// Drag painting reports repainted cells instead.
+	if (!bRecord)
+	{
+		wchar_t pStr[96];
+		wsprintf(pStr, L"Preview: %u px recolored in %u ns (full repaint %u ns).", (unsigned)nPixels, (unsigned)ns, (unsigned)previewFullNs);
+		UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
 	}
 	return;
 }
 
-void RedrawPalettes(bool bChanged)
+// The preview is cheap to recolor, so any palette change repaints all of it.
+void RedrawPreview()
 {
-	InvalidateRect(hPALEditor, nullptr, TRUE);
-	UpdateWindow(hPALEditor);
+	bPreviewDirty = true;
+	InvalidateRect(hPreview, nullptr, FALSE);
 	return;
 }
 
-word Color_ConvertToSNES(byte r, byte g, byte b)
+// 32bpp top-down DIB section selected into hdc, with fb pointing at its bits.
+HBITMAP CreateFramebufferDIB(HDC hdc, int width, int height, Framebuffer& fb)
+{
+	BITMAPINFOHEADER bi = { };
+	bi.biSize = sizeof(BITMAPINFOHEADER);
+	bi.biWidth = width;
+	bi.biHeight = -height; // Top-down rows.
+	bi.biPlanes = 1;
+	bi.biBitCount = 32;
+	bi.biCompression = BI_RGB;
+	void* pBits = nullptr;
+	HBITMAP hBitmap = CreateDIBSection(hdc, (BITMAPINFO*)&bi, DIB_RGB_COLORS, &pBits, NULL, 0);
+	SelectObject(hdc, hBitmap);
+	fb.pixels = static_cast<dword*>(pBits);
+	fb.width = fb.stride = width;
+	fb.height = height;
+	return hBitmap;
+}
+
+// Marks a single cell dirty. Invalid regions are merged by Windows until the
+// next WM_PAINT, so several changes within a frame are painted at once.
+void InvalidateCell(int index)
 {
-	word outCol = min((b >> 3) << 10 | (g >> 3) << 5 | (r >> 3), 0x7FFF);
-	return outCol;
+	RECT colRect;
+	GetCellRect(index, &colRect);
+	bDirtyCells[index & 0xFF] = true;
+	InvalidateRect(hPALEditor, &colRect, FALSE);
+	RecolorPreviewSlot(index & 0xFF);
+	return;
 }
 
-COLORREF Color_ConvertFromSNES(word rgb)
+void GetCellRect(int index, RECT* pRect)
 {
-	byte blue = (rgb >> 10) & 0x1F;
-	byte green = (rgb >> 5) & 0x1F;
-	byte red = rgb & 0x1F;
-	COLORREF rgbout = RGB((red * 255) / 31, (green * 255) / 31, (blue * 255) / 31);
-	return rgbout;
+	int left, top, right, bottom;
+	Render_GetCellRect(editorView, index, &left, &top, &right, &bottom);
+	SetRect(pRect, left, top, right, bottom);
 }
 
 word GetEditorPositionIndex(POINTS& pts)
@@ -1103,23 +2131,145 @@ word GetEditorPositionIndex(POINTS& pts)
 	return resPair;
 }
 
+// ChooseColor, traced from opening the dialog until it returns.
+BOOL PickColor(CHOOSECOLOR* pCC)
+{
+	TRACE_SCOPE("ChooseColor");
+	return ChooseColor(pCC);
+}
+
 void RecordOperation(const wchar_t* pInfo)
 {
-	SnesPAL_Operation lastOper;
-	memcpy(&lastOper.palette, pPaletteTable, sizeof(word) * 0x100);
-	lastOper.bDrawMode = ::bDrawMode;
-	lastOper.info = pInfo;
-	operationNumber = 0; lastOper.n = operationNumber;
-	lastOperations.push_back(lastOper);
-	lastOperationsRedo.clear();
-	Button_Enable(hUndo, TRUE);
-	Button_Enable(hRedo, FALSE);
+	TRACE_SCOPE("RecordOperation");
+	if (!history.Record(pPaletteTable, ::bDrawMode, pInfo))
+		return;
+	journal.RecordEdit(pPaletteTable, ::bDrawMode, pInfo);
+	CheckUndo(); CheckRedo();
 	return;
 }
 
+std::filesystem::path GetAppFilePath(const wchar_t* fn)
+{
+	wchar_t pExe[MAX_PATH] = { 0 };
+	GetModuleFileName(nullptr, pExe, MAX_PATH);
+	return std::filesystem::path(pExe).replace_filename(fn);
+}
+
+std::filesystem::path GetSessionPath()
+{
+	return GetAppFilePath(SESSION_FILENAME);
+}
+
+// Writes what was traced as Chrome trace_event JSON and a p50/p99 summary.
+void StopTrace()
+{
+	Trace_SetEnabled(false);
+	bool bOk = Trace_WriteChrome(GetAppFilePath(TRACE_FILENAME));
+	FILE* file = File_Open(GetAppFilePath(TRACE_SUMMARY_FILENAME), "w");
+	if (file)
+	{
+		Trace_PrintSummary(file);
+		bOk = (fclose(file) == 0) && bOk;
+	}
+	UpdateStatusInfo(nullptr, nullptr, nullptr, (file && bOk) ? TEXT("Trace written to ") TRACE_FILENAME TEXT(".") : TEXT("Cannot write trace."));
+}
+
+// Journals the palette from here on and names it in the session file, so the
+// next start can find the journal if this session does not end cleanly.
+// bSaved: the palette matches the file, so the history needs no recovery.
+void OpenJournal(const wchar_t* fn, dword address, bool bSaved)
+{
+	journal.Open(Journal_GetPath(fn, address), address, history, pPaletteTable, ::bDrawMode, bSaved);
+
+	FILE* file = File_Open(GetSessionPath(), "wb");
+	if (file)
+	{
+		fwrite(&address, sizeof(address), 1, file);
+		fwrite(fn, sizeof(wchar_t), wcslen(fn), file);
+		fclose(file);
+	}
+}
+
+// Journal of a palette to check for unsaved changes, none if it is the one
+// being written: reopening the active palette reloads it and discards its
+// changes on purpose.
+std::filesystem::path GetRecoveryPath(const wchar_t* fn, dword address)
+{
+	std::filesystem::path journalFn = Journal_GetPath(fn, address);
+	return journalFn == journal.GetPath() ? std::filesystem::path() : journalFn;
+}
+
+// Called right after a palette was opened. If an earlier session left
+// unsaved changes to it, they are offered before journaling starts over.
+void StartJournal(const wchar_t* fn, dword address, JournalRecovery* pRecovery)
+{
+	journal.Close(true);
+	if (pRecovery)
+	{
+		wchar_t pMsg[MAX_PATH + 128];
+		wsprintf(pMsg, L"%s was not closed properly.\nRecover the unsaved changes (%u step(s) of history)?", fn, (unsigned)pRecovery->history.GetStepCount());
+		if (MessageBox(hMainWindow, pMsg, TEXT("Recover"), MB_YESNO | MB_ICONQUESTION) == IDYES)
+		{
+			memcpy(pPaletteTable, pRecovery->palette, sizeof(pRecovery->palette));
+			::bDrawMode = pRecovery->bDrawMode;
+			Button_SetCheck(hCbxDraw, ::bDrawMode);
+			history = std::move(pRecovery->history);
+
+			wchar_t pStr[64];
+			wsprintf(pStr, L"Recovered %u operation(s) in %u ms.", (unsigned)pRecovery->info.nRecords, (unsigned)(pRecovery->replayUs / 1000));
+			UpdateStatusInfo(nullptr, nullptr, nullptr, pStr);
+		}
+	}
+	OpenJournal(fn, address, !memcmp(pPaletteTable, diskPalette, sizeof(word) * PAL_COLORS));
+}
+
+// Saving makes the file the recovery point, the journal only keeps the history.
+void CompactJournal(const wchar_t* fn, dword address, bool bSaved)
+{
+	if (journal.GetPath() != Journal_GetPath(fn, address))
+	{
+		journal.Close(true);
+		OpenJournal(fn, address, bSaved);
+	}
+	journal.Compact(history, pPaletteTable, ::bDrawMode, bSaved);
+}
+
+// The palette is closed on purpose, unsaved changes included.
+void EndJournal()
+{
+	journal.Close(true);
+	std::error_code ec;
+	std::filesystem::remove(GetSessionPath(), ec);
+}
+
+// Reopens the palette of a session that did not end cleanly; opening it
+// offers to replay the journal.
+void RecoverLastSession()
+{
+	std::filesystem::path sessionFn = GetSessionPath();
+	FILE* file = File_Open(sessionFn, "rb");
+	if (!file)
+		return;
+	dword address = JOURNAL_NO_ADDRESS;
+	wchar_t pFn[MAX_PATH] = { 0 };
+	bool bValid = fread(&address, sizeof(address), 1, file) == 1 && fread(pFn, sizeof(wchar_t), MAX_PATH - 1, file) > 0;
+	fclose(file);
+
+	std::error_code ec;
+	if (!bValid || !std::filesystem::exists(Journal_GetPath(pFn, address), ec))
+	{
+		std::filesystem::remove(sessionFn, ec);
+		return;
+	}
+	if (address == JOURNAL_NO_ADDRESS)
+		OpenPAL(pFn);
+	else
+		OpenROMPAL(pFn, address);
+}
+
 bool CheckUndo()
 {
-	if (lastOperations.empty())
+	if (!history.CanUndo())
 	{
 		Button_Enable(hUndo, FALSE);
 		return false;
@@ -1130,7 +2280,7 @@ bool CheckUndo()
 
 bool CheckRedo()
 {
-	if (lastOperationsRedo.empty())
+	if (!history.CanRedo())
 	{
 		Button_Enable(hRedo, FALSE);
 		return false;
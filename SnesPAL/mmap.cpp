@@ -0,0 +1,153 @@
+#include "mmap.h"
+
+#include <utility>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		std::swap(pData, other.pData);
+		std::swap(size, other.size);
+		std::swap(bWritable, other.bWritable);
+		std::swap(bOpen, other.bOpen);
+#ifdef _WIN32
+		std::swap(hFile, other.hFile);
+		std::swap(hMapping, other.hMapping);
+#else
+		std::swap(fd, other.fd);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::filesystem::path& fn, bool bWrite)
+{
+	Close();
+	HANDLE file = CreateFileW(fn.c_str(), GENERIC_READ | (bWrite ? GENERIC_WRITE : 0), FILE_SHARE_READ,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	hFile = file;
+	bWritable = bWrite;
+	bOpen = true;
+	size = static_cast<std::size_t>(fileSize.QuadPart);
+	if (size == 0)
+		return true;
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, bWrite ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		Close();
+		return false;
+	}
+	hMapping = mapping;
+	pData = static_cast<byte*>(MapViewOfFile(mapping, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+	if (!pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::Flush()
+{
+	if (!pData || !bWritable)
+		return bOpen;
+	return FlushViewOfFile(pData, 0) && FlushFileBuffers(static_cast<HANDLE>(hFile));
+}
+
+void MappedFile::Close()
+{
+	if (pData)
+		UnmapViewOfFile(pData);
+	if (hMapping)
+		CloseHandle(static_cast<HANDLE>(hMapping));
+	if (hFile)
+		CloseHandle(static_cast<HANDLE>(hFile));
+	pData = nullptr;
+	hMapping = hFile = nullptr;
+	size = 0;
+	bWritable = bOpen = false;
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path& fn, bool bWrite)
+{
+	Close();
+	int file = open(fn.c_str(), bWrite ? O_RDWR : O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(file, &st) != 0)
+	{
+		close(file);
+		return false;
+	}
+
+	fd = file;
+	bWritable = bWrite;
+	bOpen = true;
+	size = static_cast<std::size_t>(st.st_size);
+	if (size == 0)
+		return true;
+
+	void* p = mmap(nullptr, size, PROT_READ | (bWrite ? PROT_WRITE : 0), MAP_SHARED, file, 0);
+	if (p == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	pData = static_cast<byte*>(p);
+	return true;
+}
+
+bool MappedFile::Flush()
+{
+	if (!pData || !bWritable)
+		return bOpen;
+	return msync(pData, size, MS_SYNC) == 0;
+}
+
+void MappedFile::Close()
+{
+	if (pData)
+		munmap(pData, size);
+	if (fd >= 0)
+		close(fd);
+	pData = nullptr;
+	fd = -1;
+	size = 0;
+	bWritable = bOpen = false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+// Memory-mapped file, Win32 and POSIX.
+
+#include "types.h"
+
+#include <filesystem>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	// Maps the whole file. Writable mappings write straight back to the file.
+	bool Open(const std::filesystem::path& fn, bool bWritable);
+	// Writes dirty pages back to disk.
+	bool Flush();
+	void Close();
+
+	bool IsOpen() const { return bOpen; }
+	bool IsWritable() const { return bWritable; }
+	byte* Data() { return pData; }
+	const byte* Data() const { return pData; }
+	std::size_t Size() const { return size; }
+
+private:
+	byte* pData = nullptr;
+	std::size_t size = 0;
+	bool bWritable = false;
+	bool bOpen = false;
+#ifdef _WIN32
+	void* hFile = nullptr;
+	void* hMapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
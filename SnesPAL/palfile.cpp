@@ -0,0 +1,457 @@
+#include "palfile.h"
+#include "fileio.h"
+#include "color.h"
+#include "trace.h"
+
+#include <cstring>
+#include <cctype>
+
+// Reads RGB triplets from count colors, the rest of the palette stays black.
+static void ReadRGB24(const byte* rgb, std::size_t count, word* palette)
+{
+	Color_ConvertToSNESBatchRGB24(rgb, palette, count < PAL_COLORS ? count : PAL_COLORS);
+}
+
+static void ReadBGR555(const byte* p, std::size_t count, word* palette)
+{
+	if (count > PAL_COLORS)
+		count = PAL_COLORS;
+	for (std::size_t i = 0; i < count; ++i, p += 2)
+		palette[i] = static_cast<word>((p[0] | (p[1] << 8)) & 0x7FFF);
+}
+
+static void WriteBGR555(const word* palette, std::vector<byte>& out)
+{
+	for (int i = 0; i < PAL_COLORS; ++i)
+	{
+		out.push_back(static_cast<byte>(palette[i] & 0xFF));
+		out.push_back(static_cast<byte>((palette[i] >> 8) & 0x7F));
+	}
+}
+
+static bool HasPrefix(const byte* data, std::size_t size, const char* prefix)
+{
+	std::size_t length = strlen(prefix);
+	if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+		data += 3, size -= 3;
+	return size >= length && !memcmp(data, prefix, length);
+}
+
+// Line-based reader for the text formats, no allocations and no locale.
+struct TextReader
+{
+	const byte* p;
+	const byte* end;
+
+	TextReader(const byte* data, std::size_t size) : p(data), end(data + size)
+	{
+		if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+			p += 3;
+	}
+
+	bool AtEnd() const { return p == end; }
+	bool AtLineEnd() const { return p == end || *p == '\r' || *p == '\n'; }
+
+	void SkipSpaces()
+	{
+		while (p != end && (*p == ' ' || *p == '\t'))
+			++p;
+	}
+
+	void NextLine()
+	{
+		while (p != end && *p++ != '\n')
+			;
+	}
+
+	bool ReadInt(int& value, int max)
+	{
+		SkipSpaces();
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		value = 0;
+		while (p != end && *p >= '0' && *p <= '9')
+		{
+			value = value * 10 + (*p++ - '0');
+			if (value > max)
+				return false;
+		}
+		return true;
+	}
+
+	// "r g b", anything after the blue value (a color name) is ignored.
+	bool ReadColor(byte* rgb)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			int value = 0;
+			if (!ReadInt(value, 255))
+				return false;
+			rgb[c] = static_cast<byte>(value);
+		}
+		return p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n';
+	}
+};
+
+static void AppendText(std::vector<byte>& out, const char* text)
+{
+	out.insert(out.end(), text, text + strlen(text));
+}
+
+static void AppendColorLines(const word* palette, std::vector<byte>& out, const char* format)
+{
+	byte rgb[PAL_FILE_SIZE];
+	Color_ConvertFromSNESBatchRGB24(palette, rgb, PAL_COLORS);
+	char line[32];
+	for (int i = 0; i < PAL_COLORS; ++i)
+	{
+		snprintf(line, sizeof(line), format, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+		AppendText(out, line);
+	}
+}
+
+static int Probe_PAL(const byte*, std::size_t size)
+{
+	return (size == PAL_FILE_SIZE) ? 50 : 0;
+}
+
+static PalError Read_PAL(const byte* data, std::size_t size, word* palette)
+{
+	if (size < PAL_FILE_SIZE)
+		return PALERR_READ;
+	ReadRGB24(data, PAL_COLORS, palette);
+	return PALERR_OK;
+}
+
+static void Write_PAL(const word* palette, std::vector<byte>& out)
+{
+	out.resize(PAL_FILE_SIZE);
+	Color_ConvertFromSNESBatchRGB24(palette, out.data(), PAL_COLORS);
+}
+
+// TPL files may hold less than 256 colors.
+static int Probe_TPL(const byte* data, std::size_t size)
+{
+	return (size >= 3 && !memcmp(data, "TPL", 3)) ? 100 : 0;
+}
+
+static PalError Read_TPL(const byte* data, std::size_t size, word* palette)
+{
+	if (size < TPL_HEADER_SIZE || memcmp(data, "TPL", 3) || data[3] != 0x02)
+		return PALERR_SIGNATURE;
+	ReadBGR555(data + TPL_HEADER_SIZE, (size - TPL_HEADER_SIZE) / 2, palette);
+	return PALERR_OK;
+}
+
+static void Write_TPL(const word* palette, std::vector<byte>& out)
+{
+	AppendText(out, "TPL\x02");
+	WriteBGR555(palette, out);
+}
+
+static int Probe_MW3(const byte*, std::size_t size)
+{
+	return (size == MW3_FILE_SIZE) ? 50 : 0;
+}
+
+static PalError Read_MW3(const byte* data, std::size_t size, word* palette)
+{
+	if (size < MW3_FILE_SIZE)
+		return PALERR_READ;
+	ReadBGR555(data, PAL_COLORS, palette);
+	return PALERR_OK;
+}
+
+// The back area color is written as color 0, which is what the SNES shows there.
+static void Write_MW3(const word* palette, std::vector<byte>& out)
+{
+	WriteBGR555(palette, out);
+	out.push_back(static_cast<byte>(palette[0] & 0xFF));
+	out.push_back(static_cast<byte>((palette[0] >> 8) & 0x7F));
+}
+
+// Same layout as PAL, with a big-endian color count and transparent index
+// when saved from newer versions.
+static int Probe_ACT(const byte* data, std::size_t size)
+{
+	if (size == ACT_FILE_SIZE)
+	{
+		int count = (data[PAL_FILE_SIZE] << 8) | data[PAL_FILE_SIZE + 1];
+		return (count <= PAL_COLORS) ? 60 : 0;
+	}
+	return (size == PAL_FILE_SIZE) ? 50 : 0;
+}
+
+static PalError Read_ACT(const byte* data, std::size_t size, word* palette)
+{
+	if (size < PAL_FILE_SIZE)
+		return PALERR_READ;
+	std::size_t count = PAL_COLORS;
+	if (size >= ACT_FILE_SIZE)
+	{
+		count = (data[PAL_FILE_SIZE] << 8) | data[PAL_FILE_SIZE + 1];
+		if (!count || count > PAL_COLORS)
+			count = PAL_COLORS;
+	}
+	ReadRGB24(data, count, palette);
+	return PALERR_OK;
+}
+
+static void Write_ACT(const word* palette, std::vector<byte>& out)
+{
+	Write_PAL(palette, out);
+	const byte trailer[4] = { PAL_COLORS >> 8, PAL_COLORS & 0xFF, 0xFF, 0xFF };
+	out.insert(out.end(), trailer, trailer + 4);
+}
+
+static int Probe_GPL(const byte* data, std::size_t size)
+{
+	return HasPrefix(data, size, "GIMP Palette") ? 100 : 0;
+}
+
+// Header line, then "Name:"/"Columns:" lines, '#' comments and "r g b name" colors.
+static PalError Read_GPL(const byte* data, std::size_t size, word* palette)
+{
+	TextReader in(data, size);
+	in.NextLine();
+	byte rgb[PAL_FILE_SIZE] = {};
+	std::size_t count = 0;
+	while (!in.AtEnd())
+	{
+		in.SkipSpaces();
+		if (!in.AtLineEnd() && *in.p >= '0' && *in.p <= '9')
+		{
+			byte color[3];
+			if (!in.ReadColor(color))
+				return PALERR_SYNTAX;
+			if (count < PAL_COLORS)
+				memcpy(rgb + count * 3, color, 3);
+			++count;
+		}
+		else if (!in.AtLineEnd() && *in.p != '#' && !HasPrefix(in.p, in.end - in.p, "Name:") && !HasPrefix(in.p, in.end - in.p, "Columns:"))
+			return PALERR_SYNTAX;
+		in.NextLine();
+	}
+	ReadRGB24(rgb, count, palette);
+	return PALERR_OK;
+}
+
+static void Write_GPL(const word* palette, std::vector<byte>& out)
+{
+	AppendText(out, "GIMP Palette\nColumns: 16\n#\n");
+	AppendColorLines(palette, out, "%3d %3d %3d\n");
+}
+
+static int Probe_JASC(const byte* data, std::size_t size)
+{
+	return HasPrefix(data, size, "JASC-PAL") ? 100 : 0;
+}
+
+// Header, version "0100", color count, then one "r g b" line per color.
+static PalError Read_JASC(const byte* data, std::size_t size, word* palette)
+{
+	TextReader in(data, size);
+	in.NextLine();
+	int version = 0, count = 0;
+	if (!in.ReadInt(version, 9999) || version != 100)
+		return PALERR_SIGNATURE;
+	in.NextLine();
+	if (!in.ReadInt(count, 0xFFFF))
+		return PALERR_SYNTAX;
+	in.NextLine();
+
+	byte rgb[PAL_FILE_SIZE] = {};
+	int nRead = (count < PAL_COLORS) ? count : PAL_COLORS;
+	for (int i = 0; i < nRead; ++i)
+	{
+		if (in.AtEnd())
+			return PALERR_READ;
+		if (!in.ReadColor(rgb + i * 3))
+			return PALERR_SYNTAX;
+		in.NextLine();
+	}
+	ReadRGB24(rgb, nRead, palette);
+	return PALERR_OK;
+}
+
+static void Write_JASC(const word* palette, std::vector<byte>& out)
+{
+	AppendText(out, "JASC-PAL\r\n0100\r\n256\r\n");
+	AppendColorLines(palette, out, "%d %d %d\r\n");
+}
+
+static int Probe_CGRAM(const byte*, std::size_t size)
+{
+	return (size == CGRAM_FILE_SIZE) ? 50 : 0;
+}
+
+static PalError Read_CGRAM(const byte* data, std::size_t size, word* palette)
+{
+	if (size < CGRAM_FILE_SIZE)
+		return PALERR_READ;
+	ReadBGR555(data, PAL_COLORS, palette);
+	return PALERR_OK;
+}
+
+static const PalFormatInfo formats[PALFMT_COUNT] = {
+	{ PALFMT_UNKNOWN, "", "", "", nullptr, nullptr, nullptr },
+	{ PALFMT_PAL, "pal", ".pal", "RGB palette (YY-CHR, raw 768 bytes)", &Probe_PAL, &Read_PAL, &Write_PAL },
+	{ PALFMT_TPL, "tpl", ".tpl", "Tile Layer Pro palette", &Probe_TPL, &Read_TPL, &Write_TPL },
+	{ PALFMT_MW3, "mw3", ".mw3", "Lunar Magic palette", &Probe_MW3, &Read_MW3, &Write_MW3 },
+	{ PALFMT_ACT, "act", ".act", "Adobe color table", &Probe_ACT, &Read_ACT, &Write_ACT },
+	{ PALFMT_GPL, "gpl", ".gpl", "GIMP palette", &Probe_GPL, &Read_GPL, &Write_GPL },
+	{ PALFMT_JASC, "jasc", ".jasc", "JASC-PAL (Paint Shop Pro)", &Probe_JASC, &Read_JASC, &Write_JASC },
+	{ PALFMT_CGRAM, "cgram", ".cgr", "Raw CGRAM dump", &Probe_CGRAM, &Read_CGRAM, &WriteBGR555 }
+};
+
+const PalFormatInfo* PalFile_GetFormatInfo(PalFormat fmt)
+{
+	return (fmt > PALFMT_UNKNOWN && fmt < PALFMT_COUNT) ? &formats[fmt] : nullptr;
+}
+
+static bool EqualsNoCase(const char* a, const char* b)
+{
+	for (; *a && *b; ++a, ++b)
+	{
+		if (tolower(static_cast<unsigned char>(*a)) != tolower(static_cast<unsigned char>(*b)))
+			return false;
+	}
+	return *a == *b;
+}
+
+PalFormat PalFile_FormatFromName(const char* name)
+{
+	if (EqualsNoCase(name, "yychr"))
+		return PALFMT_PAL;
+	for (int f = PALFMT_UNKNOWN + 1; f < PALFMT_COUNT; ++f)
+	{
+		if (EqualsNoCase(name, formats[f].name) || EqualsNoCase(name, formats[f].extension + 1))
+			return static_cast<PalFormat>(f);
+	}
+	return PALFMT_UNKNOWN;
+}
+
+PalFormat PalFile_FormatFromPath(const std::filesystem::path& fn)
+{
+	std::wstring ext = fn.extension().wstring();
+	if (ext.size() < 2 || ext.size() > 8)
+		return PALFMT_UNKNOWN;
+
+	char name[8] = {};
+	for (std::size_t i = 1; i < ext.size(); ++i)
+	{
+		if (ext[i] >= 0x80)
+			return PALFMT_UNKNOWN;
+		name[i - 1] = static_cast<char>(ext[i]);
+	}
+	return PalFile_FormatFromName(name);
+}
+
+const char* PalFile_FormatExtension(PalFormat fmt)
+{
+	const PalFormatInfo* info = PalFile_GetFormatInfo(fmt);
+	return info ? info->extension : "";
+}
+
+const char* PalFile_ErrorString(PalError err)
+{
+	switch (err)
+	{
+		case PALERR_OK: return "OK";
+		case PALERR_EXTENSION: return "Unknown extension.";
+		case PALERR_OPEN: return "Cannot open requested file.";
+		case PALERR_READ: return "File is truncated or unreadable.";
+		case PALERR_WRITE: return "Cannot write to requested file.";
+		case PALERR_SIGNATURE: return "Invalid or unsupported file signature.";
+		case PALERR_FORMAT: return "Not a palette file in any known format.";
+		case PALERR_SYNTAX: return "Malformed color entry.";
+		default: return "Unknown error.";
+	}
+}
+
+PalFormat PalFile_Detect(const byte* data, std::size_t size, const std::filesystem::path& fn)
+{
+	PalFormat hint = fn.empty() ? PALFMT_UNKNOWN : PalFile_FormatFromPath(fn);
+	PalFormat best = PALFMT_UNKNOWN;
+	int bestScore = 0;
+	for (int f = PALFMT_UNKNOWN + 1; f < PALFMT_COUNT; ++f)
+	{
+		int score = formats[f].probe(data, size);
+		if (score > bestScore || (score && score == bestScore && f == hint))
+		{
+			best = static_cast<PalFormat>(f);
+			bestScore = score;
+		}
+	}
+	return best;
+}
+
+PalError PalFile_Parse(const byte* data, std::size_t size, word* palette, PalFormat fmt, PalFormat* pFmt)
+{
+	if (fmt == PALFMT_UNKNOWN)
+		fmt = PalFile_Detect(data, size);
+	if (pFmt)
+		*pFmt = fmt;
+	const PalFormatInfo* info = PalFile_GetFormatInfo(fmt);
+	if (!info)
+		return PALERR_FORMAT;
+
+	memset(palette, 0, sizeof(word) * PAL_COLORS);
+	return info->read(data, size, palette);
+}
+
+PalError PalFile_Serialize(const word* palette, PalFormat fmt, std::vector<byte>& out)
+{
+	const PalFormatInfo* info = PalFile_GetFormatInfo(fmt);
+	if (!info)
+		return PALERR_EXTENSION;
+	out.clear();
+	info->write(palette, out);
+	return PALERR_OK;
+}
+
+PalError PalFile_Load(const std::filesystem::path& fn, word* palette, std::size_t* pBytes, PalFormat* pFmt)
+{
+	TRACE_SCOPE("PalFile_Load");
+	if (pFmt)
+		*pFmt = PALFMT_UNKNOWN;
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return PALERR_OPEN;
+
+	// One read of the whole file, then a single pass of the format's reader.
+	long length = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+	if (length < 0 || length > PAL_MAX_FILE_SIZE || fseek(file, 0, SEEK_SET) != 0)
+	{
+		fclose(file);
+		return (length > PAL_MAX_FILE_SIZE) ? PALERR_FORMAT : PALERR_READ;
+	}
+	std::vector<byte> buffer(static_cast<std::size_t>(length));
+	std::size_t size = fread(buffer.data(), sizeof(byte), buffer.size(), file);
+	fclose(file);
+	if (pBytes)
+		*pBytes = size;
+	if (size != buffer.size())
+		return PALERR_READ;
+
+	PalFormat fmt = PalFile_Detect(buffer.data(), size, fn);
+	return PalFile_Parse(buffer.data(), size, palette, fmt, pFmt);
+}
+
+PalError PalFile_Save(const std::filesystem::path& fn, const word* palette, PalFormat fmt, std::size_t* pBytes)
+{
+	TRACE_SCOPE("PalFile_Save");
+	if (fmt == PALFMT_UNKNOWN)
+		fmt = PalFile_FormatFromPath(fn);
+
+	std::vector<byte> buffer;
+	PalError err = PalFile_Serialize(palette, fmt, buffer);
+	if (err != PALERR_OK)
+		return err;
+
+	// Never truncate the target in place, a failed write would destroy it.
+	bool bWritten = File_WriteAtomic(fn, buffer.data(), buffer.size());
+	if (pBytes)
+		*pBytes = bWritten ? buffer.size() : 0;
+	return bWritten ? PALERR_OK : PALERR_WRITE;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// Palette file loading and saving.
+// Shared by the editor and snespal-cli, so nothing in here may depend on Win32.
+
+#include "types.h"
+#include <filesystem>
+#include <vector>
+
+#define PAL_COLORS			0x100
+#define PAL_FILE_SIZE		(PAL_COLORS * 3)
+#define TPL_HEADER_SIZE		4
+#define TPL_FILE_SIZE		(TPL_HEADER_SIZE + PAL_COLORS * 2)
+#define MW3_FILE_SIZE		(PAL_COLORS * 2 + 2)
+#define ACT_FILE_SIZE		(PAL_FILE_SIZE + 4)
+#define CGRAM_FILE_SIZE		(PAL_COLORS * 2)
+// Larger files are not palettes, text formats with long color names included.
+#define PAL_MAX_FILE_SIZE	0x40000
+
+enum PalFormat
+{
+	PALFMT_UNKNOWN = 0,
+	PALFMT_PAL,		// 768 bytes, 8-bit RGB triplets. YY-CHR palettes use the same layout.
+	PALFMT_TPL,		// "TPL" + type byte, followed by BGR555 words.
+	PALFMT_MW3,		// Lunar Magic: 256 BGR555 words and the back area color.
+	PALFMT_ACT,		// Adobe color table: RGB triplets, optional color count and transparent index.
+	PALFMT_GPL,		// GIMP palette, text.
+	PALFMT_JASC,	// JASC-PAL (Paint Shop Pro), text.
+	PALFMT_CGRAM,	// Raw CGRAM dump, 512 bytes of BGR555 words.
+	PALFMT_COUNT
+};
+
+enum PalError
+{
+	PALERR_OK = 0,
+	PALERR_EXTENSION,
+	PALERR_OPEN,
+	PALERR_READ,
+	PALERR_WRITE,
+	PALERR_SIGNATURE,
+	PALERR_FORMAT,
+	PALERR_SYNTAX
+};
+
+// One entry of the format registry. Readers and writers work on whole files
+// in memory and make a single pass over them; missing colors stay black.
+struct PalFormatInfo
+{
+	PalFormat fmt;
+	const char* name;			// Also accepted wherever a format is named.
+	const char* extension;
+	const char* description;
+	// How sure the format is about data, 0 if it cannot be read as this format.
+	int (*probe)(const byte* data, std::size_t size);
+	PalError (*read)(const byte* data, std::size_t size, word* palette);
+	void (*write)(const word* palette, std::vector<byte>& out);
+};
+
+const PalFormatInfo* PalFile_GetFormatInfo(PalFormat fmt);
+// By name or extension (without the dot), case insensitive. "yychr" is PALFMT_PAL.
+PalFormat PalFile_FormatFromName(const char* name);
+PalFormat PalFile_FormatFromPath(const std::filesystem::path& fn);
+const char* PalFile_FormatExtension(PalFormat fmt);
+const char* PalFile_ErrorString(PalError err);
+
+// Picks the format from the contents. The extension of fn only decides
+// between formats that are equally sure, like .pal and .act at 768 bytes.
+PalFormat PalFile_Detect(const byte* data, std::size_t size, const std::filesystem::path& fn = std::filesystem::path());
+// Detects (or uses fmt when given) and reads data. pFmt receives the format used.
+PalError PalFile_Parse(const byte* data, std::size_t size, word* palette, PalFormat fmt = PALFMT_UNKNOWN, PalFormat* pFmt = nullptr);
+PalError PalFile_Serialize(const word* palette, PalFormat fmt, std::vector<byte>& out);
+
+// Palette buffers always hold PAL_COLORS entries. pBytes (optional) receives
+// the number of bytes read or written. Loading detects the format from the
+// contents; saving takes it from the extension unless fmt is given, and
+// replaces the file atomically.
+PalError PalFile_Load(const std::filesystem::path& fn, word* palette, std::size_t* pBytes = nullptr, PalFormat* pFmt = nullptr);
+PalError PalFile_Save(const std::filesystem::path& fn, const word* palette, PalFormat fmt = PALFMT_UNKNOWN, std::size_t* pBytes = nullptr);
@@ -0,0 +1,304 @@
+#include "ppu.h"
+#include "gfx.h"
+#include "color.h"
+
+#include <algorithm>
+#include <cstring>
+
+// One layer of a line: CGRAM index and depth per pixel, depth 0 is transparent.
+struct LayerLine
+{
+	byte index[PPU_WIDTH];
+	byte z[PPU_WIDTH];
+};
+
+// Depth of every layer and priority bit, larger is in front; 0 is the backdrop.
+struct DepthTable
+{
+	byte bg[PPU_BG_COUNT][2];
+	byte obj[4];
+};
+
+static DepthTable BuildDepths(int mode, bool bBG3Priority)
+{
+	enum { OBJ = 8 };
+	// Back to front, BG n as n * 2 + priority bit, OBJ + priority.
+	static const int mode0[] = { 6, 4, OBJ + 0, 7, 5, OBJ + 1, 2, 0, OBJ + 2, 3, 1, OBJ + 3 };
+	static const int mode1[] = { 4, OBJ + 0, 5, OBJ + 1, 2, 0, OBJ + 2, 3, 1, OBJ + 3 };
+	static const int mode1High[] = { 4, OBJ + 0, OBJ + 1, 2, 0, OBJ + 2, 3, 1, OBJ + 3, 5 };
+
+	const int* order = mode0;
+	std::size_t count = sizeof(mode0) / sizeof(mode0[0]);
+	if (mode == 1)
+	{
+		order = bBG3Priority ? mode1High : mode1;
+		count = sizeof(mode1) / sizeof(mode1[0]);
+	}
+
+	DepthTable depths = {};
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		byte z = static_cast<byte>(i + 1);
+		if (order[i] >= OBJ)
+			depths.obj[order[i] - OBJ] = z;
+		else
+			depths.bg[order[i] >> 1][order[i] & 1] = z;
+	}
+	return depths;
+}
+
+int Ppu_GetBGDepth(int mode, int bg)
+{
+	if (bg < 0 || bg >= PPU_BG_COUNT)
+		return 0;
+	if (mode == 0)
+		return 2;
+	return (bg < 2) ? 4 : (bg == 2 ? 2 : 0);
+}
+
+static void FetchBG(const PpuState& state, const DepthTable& depths, int n, int y, LayerLine& out)
+{
+	const PpuBackground& bg = state.bg[n];
+	int bpp = Ppu_GetBGDepth(state.mode, n);
+	if (!bg.tiles || !bpp)
+	{
+		memset(out.z, 0, sizeof(out.z));
+		return;
+	}
+
+	int colors = 1 << bpp;
+	int base = (state.mode == 0) ? n * 0x20 : 0;
+	int vy = (y + bg.scrollY) & 0xFF;
+	int fine = vy & 7;
+	const word* mapRow = bg.tilemap ? bg.tilemap + (vy >> 3) * PPU_MAP_SIZE : nullptr;
+
+	for (int x = 0; x < PPU_WIDTH; )
+	{
+		int vx = (x + bg.scrollX) & 0xFF;
+		int col = vx >> 3;
+		word entry = mapRow ? mapRow[col] : static_cast<word>((vy >> 3) * PPU_MAP_SIZE + col);
+		std::size_t tile = entry & 0x3FF;
+		int tx = vx & 7, run = std::min(8 - tx, PPU_WIDTH - x);
+		if (tile >= bg.nTiles)
+		{
+			memset(out.z + x, 0, run);
+			x += run;
+			continue;
+		}
+
+		int ty = (entry & 0x8000) ? 7 - fine : fine;
+		const byte* row = bg.tiles + tile * GFX_TILE_PIXELS + ty * GFX_TILE_SIZE;
+		int first = base + ((entry >> 10) & 7) * colors;
+		byte z = depths.bg[n][(entry >> 13) & 1];
+		bool bFlip = (entry & 0x4000) != 0;
+		for (int i = 0; i < run; ++i, ++x, ++tx)
+		{
+			byte pixel = row[bFlip ? 7 - tx : tx] & (colors - 1);
+			out.index[x] = static_cast<byte>(first + pixel);
+			out.z[x] = pixel ? z : 0;
+		}
+	}
+}
+
+// OBJ line in OAM order: lower numbered sprites win, whatever their priority.
+// objPalette keeps the palette so color math can skip palettes 0-3.
+static void FetchOBJ(const PpuState& state, const DepthTable& depths, int y, LayerLine& out, byte* objPalette)
+{
+	memset(out.z, 0, sizeof(out.z));
+	if (!state.objTiles)
+		return;
+
+	int visible[PPU_LINE_SPRITES];
+	int nVisible = 0;
+	std::size_t nSprites = std::min(state.sprites.size(), static_cast<std::size_t>(PPU_MAX_SPRITES));
+	for (std::size_t i = 0; i < nSprites && nVisible < PPU_LINE_SPRITES; ++i)
+	{
+		const PpuSprite& sprite = state.sprites[i];
+		int size = sprite.bLarge ? state.objLarge : state.objSmall;
+		if (((y - sprite.y) & 0xFF) < size)
+			visible[nVisible++] = static_cast<int>(i);
+	}
+
+	for (int v = nVisible - 1; v >= 0; --v)
+	{
+		const PpuSprite& sprite = state.sprites[visible[v]];
+		int size = sprite.bLarge ? state.objLarge : state.objSmall;
+		int row = (y - sprite.y) & 0xFF;
+		if (sprite.bVFlip)
+			row = size - 1 - row;
+		byte z = depths.obj[sprite.priority & 3];
+		int first = 0x80 + (sprite.palette & 7) * 0x10;
+
+		for (int sx = 0; sx < size; ++sx)
+		{
+			int x = (sprite.x + sx) & 0x1FF;
+			if (x >= PPU_WIDTH)
+				continue;
+			int col = sprite.bHFlip ? size - 1 - sx : sx;
+			// Tile columns wrap inside a row of 16 OBJ tiles.
+			std::size_t tile = ((sprite.tile & ~0x0F) + ((sprite.tile + (col >> 3)) & 0x0F) + (row >> 3) * 0x10) & 0x1FF;
+			if (tile >= state.nObjTiles)
+				continue;
+			byte pixel = state.objTiles[tile * GFX_TILE_PIXELS + (row & 7) * GFX_TILE_SIZE + (col & 7)] & 0x0F;
+			if (!pixel)
+				continue;
+			out.index[x] = static_cast<byte>(first + pixel);
+			out.z[x] = z;
+			objPalette[x] = sprite.palette & 7;
+		}
+	}
+}
+
+// 1 where the mask puts the pixel inside its window area.
+static void BuildWindow(const PpuState& state, const PpuWindowMask& mask, int y, byte* out)
+{
+	if (!mask.bW1 && !mask.bW2)
+	{
+		memset(out, 0, PPU_WIDTH);
+		return;
+	}
+	int l1 = state.windowLeft[0][y], r1 = state.windowRight[0][y];
+	int l2 = state.windowLeft[1][y], r2 = state.windowRight[1][y];
+	for (int x = 0; x < PPU_WIDTH; ++x)
+	{
+		bool w1 = ((x >= l1 && x <= r1) != mask.bW1Invert);
+		bool w2 = ((x >= l2 && x <= r2) != mask.bW2Invert);
+		bool inside;
+		if (!mask.bW2)
+			inside = w1;
+		else if (!mask.bW1)
+			inside = w2;
+		else switch (mask.logic)
+		{
+			case PPU_WINDOW_AND: inside = w1 && w2; break;
+			case PPU_WINDOW_XOR: inside = w1 != w2; break;
+			case PPU_WINDOW_XNOR: inside = w1 == w2; break;
+			default: inside = w1 || w2; break;
+		}
+		out[x] = inside ? 1 : 0;
+	}
+}
+
+static bool InRegion(PpuRegion region, bool bInside)
+{
+	switch (region)
+	{
+		case PPU_REGION_OUTSIDE: return !bInside;
+		case PPU_REGION_INSIDE: return bInside;
+		case PPU_REGION_ALWAYS: return true;
+		default: return false;
+	}
+}
+
+void Ppu_SetWindow(PpuState& state, int window, int left, int right, int firstLine, int lastLine)
+{
+	if (window < 0 || window > 1)
+		return;
+	for (int y = std::max(firstLine, 0); y <= std::min(lastLine, PPU_HEIGHT - 1); ++y)
+	{
+		state.windowLeft[window][y] = static_cast<byte>(std::min(std::max(left, 0), 0xFF));
+		state.windowRight[window][y] = static_cast<byte>(std::min(std::max(right, 0), 0xFF));
+	}
+}
+
+void Ppu_RenderLine(const PpuState& state, const word* palette, int y, word* line)
+{
+	DepthTable depths = BuildDepths(state.mode, state.bBG3Priority);
+	LayerLine layers[PPU_OBJ + 1];
+	byte objPalette[PPU_WIDTH];
+	byte windows[PPU_LAYER_COUNT][PPU_WIDTH];
+	byte used = state.mainLayers | state.subLayers;
+
+	for (int n = 0; n < PPU_BG_COUNT; ++n)
+	{
+		if (used & PPU_LAYER_BIT(n))
+			FetchBG(state, depths, n, y, layers[n]);
+		else
+			memset(layers[n].z, 0, sizeof(layers[n].z));
+	}
+	if (used & PPU_LAYER_BIT(PPU_OBJ))
+		FetchOBJ(state, depths, y, layers[PPU_OBJ], objPalette);
+	else
+		memset(layers[PPU_OBJ].z, 0, sizeof(layers[PPU_OBJ].z));
+	for (int l = 0; l < PPU_LAYER_COUNT; ++l)
+		BuildWindow(state, state.windows[l], y, windows[l]);
+
+	bool bMath = state.mathLayers != 0 && state.preventMath != PPU_REGION_ALWAYS;
+	word fixed = state.fixedColor & 0x7FFF;
+	for (int x = 0; x < PPU_WIDTH; ++x)
+	{
+		// Front-most visible pixel of the main and sub screen.
+		int mainLayer = PPU_BACKDROP, subLayer = PPU_BACKDROP;
+		byte mainZ = 0, subZ = 0;
+		for (int l = 0; l <= PPU_OBJ; ++l)
+		{
+			byte z = layers[l].z[x];
+			if (!z)
+				continue;
+			bool bMasked = windows[l][x] != 0;
+			if ((state.mainLayers & PPU_LAYER_BIT(l)) && z > mainZ && !(bMasked && (state.mainWindowLayers & PPU_LAYER_BIT(l))))
+				mainZ = z, mainLayer = l;
+			if ((state.subLayers & PPU_LAYER_BIT(l)) && z > subZ && !(bMasked && (state.subWindowLayers & PPU_LAYER_BIT(l))))
+				subZ = z, subLayer = l;
+		}
+
+		word color = palette[mainLayer == PPU_BACKDROP ? 0 : layers[mainLayer].index[x]] & 0x7FFF;
+		bool bInColorWindow = windows[PPU_BACKDROP][x] != 0;
+		bool bClip = InRegion(state.clipToBlack, bInColorWindow);
+		if (bClip)
+			color = 0x0000;
+
+		if (bMath && (state.mathLayers & PPU_LAYER_BIT(mainLayer)) && !InRegion(state.preventMath, bInColorWindow) &&
+			(mainLayer != PPU_OBJ || objPalette[x] >= 4))
+		{
+			// The sub screen backdrop is the fixed color and is never halved,
+			// neither is a main screen clipped to black.
+			word operand = fixed;
+			bool bHalf = state.bHalf && !bClip;
+			if (state.bMathSubscreen)
+			{
+				if (subLayer == PPU_BACKDROP)
+					bHalf = false;
+				else
+					operand = palette[layers[subLayer].index[x]] & 0x7FFF;
+			}
+
+			word result = 0;
+			for (int shift = 0; shift < 15; shift += 5)
+			{
+				int a = (color >> shift) & 0x1F, b = (operand >> shift) & 0x1F;
+				int v = state.bSubtract ? std::max(a - b, 0) : a + b;
+				if (bHalf)
+					v >>= 1;
+				result |= static_cast<word>(std::min(v, 31) << shift);
+			}
+			color = result;
+		}
+		line[x] = color;
+	}
+
+	if (state.brightness < 15)
+	{
+		int level = std::max(state.brightness, 0);
+		for (int x = 0; x < PPU_WIDTH; ++x)
+		{
+			word c = line[x], result = 0;
+			for (int shift = 0; shift < 15; shift += 5)
+				result |= static_cast<word>(Color_ApplyBrightness((c >> shift) & 0x1F, level) << shift);
+			line[x] = result;
+		}
+	}
+}
+
+void Ppu_RenderFrame(const PpuState& state, const word* palette, Framebuffer& fb)
+{
+	word line[PPU_WIDTH];
+	int width = std::min(fb.width, PPU_WIDTH), height = std::min(fb.height, PPU_HEIGHT);
+	for (int y = 0; y < height; ++y)
+	{
+		Ppu_RenderLine(state, palette, y, line);
+		dword* row = fb.pixels + static_cast<std::size_t>(y) * fb.stride;
+		for (int x = 0; x < width; ++x)
+			row[x] = Render_ColorFromSNES(line[x]);
+	}
+}
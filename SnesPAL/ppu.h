@@ -0,0 +1,119 @@
+#pragma once
+
+// Scanline compositor modelled on the SNES PPU, for previewing palettes the
+// way the hardware shows them: BG and OBJ layers on the main and sub screen,
+// window masks, color math against the sub screen or the fixed color, and
+// master brightness. Modes 0 and 1 are supported, without mosaic or offset
+// per tile.
+
+#include "types.h"
+#include "render.h"
+
+#include <vector>
+
+#define PPU_WIDTH			256
+#define PPU_HEIGHT			224
+#define PPU_BG_COUNT		4
+// Tilemaps are a single 32x32 screen that wraps around.
+#define PPU_MAP_SIZE		32
+#define PPU_MAX_SPRITES		128
+// Sprites the hardware draws on one line, later ones are dropped.
+#define PPU_LINE_SPRITES	32
+
+enum PpuLayer
+{
+	PPU_BG1 = 0,
+	PPU_BG2,
+	PPU_BG3,
+	PPU_BG4,
+	PPU_OBJ,
+	PPU_BACKDROP,
+	PPU_LAYER_COUNT
+};
+
+#define PPU_LAYER_BIT(layer)	(1 << (layer))
+#define PPU_ALL_LAYERS			0x1F
+
+enum PpuWindowLogic
+{
+	PPU_WINDOW_OR = 0,
+	PPU_WINDOW_AND,
+	PPU_WINDOW_XOR,
+	PPU_WINDOW_XNOR
+};
+
+// Where a color window effect applies (CGWSEL clip/prevent fields).
+enum PpuRegion
+{
+	PPU_REGION_NEVER = 0,
+	PPU_REGION_OUTSIDE,
+	PPU_REGION_INSIDE,
+	PPU_REGION_ALWAYS
+};
+
+// W12SEL/W34SEL/WOBJSEL and WBGLOG/WOBJLOG for one layer or the color window.
+struct PpuWindowMask
+{
+	bool bW1 = false, bW1Invert = false;
+	bool bW2 = false, bW2Invert = false;
+	PpuWindowLogic logic = PPU_WINDOW_OR;
+};
+
+struct PpuBackground
+{
+	const byte* tiles = nullptr;	// Decoded at Ppu_GetBGDepth(), GFX_TILE_PIXELS indices each.
+	std::size_t nTiles = 0;
+	// PPU_MAP_SIZE^2 entries, vhopppcc cccccccc. nullptr lays the tiles out in order with palette 0.
+	const word* tilemap = nullptr;
+	int scrollX = 0, scrollY = 0;
+};
+
+struct PpuSprite
+{
+	int x = 0, y = 0;
+	word tile = 0;				// Top-left tile, OBJ tiles are 16 per row.
+	byte palette = 0;			// 0-7, CGRAM $80 + palette * 16.
+	byte priority = 0;			// 0-3
+	bool bHFlip = false, bVFlip = false;
+	bool bLarge = false;
+};
+
+struct PpuState
+{
+	int mode = 1;
+	bool bBG3Priority = false;		// Mode 1 BG3 high priority tiles in front of everything.
+	PpuBackground bg[PPU_BG_COUNT];
+
+	const byte* objTiles = nullptr;	// Decoded 4bpp tiles.
+	std::size_t nObjTiles = 0;
+	int objSmall = 8, objLarge = 16;
+	std::vector<PpuSprite> sprites;	// OAM order, at most PPU_MAX_SPRITES used.
+
+	byte mainLayers = PPU_ALL_LAYERS;		// TM
+	byte subLayers = 0;						// TS
+	byte mainWindowLayers = 0;				// TMW
+	byte subWindowLayers = 0;				// TSW
+	PpuWindowMask windows[PPU_LAYER_COUNT];	// PPU_BACKDROP holds the color window.
+	// Window edges per line, inclusive; left > right is an empty window.
+	byte windowLeft[2][PPU_HEIGHT] = {};
+	byte windowRight[2][PPU_HEIGHT] = {};
+
+	PpuRegion clipToBlack = PPU_REGION_NEVER;
+	PpuRegion preventMath = PPU_REGION_NEVER;
+	bool bMathSubscreen = false;	// Math with the sub screen, otherwise with the fixed color.
+	byte mathLayers = 0;			// CGADSUB layers, PPU_BACKDROP included.
+	bool bSubtract = false;
+	bool bHalf = false;
+	word fixedColor = 0x0000;		// COLDATA
+	int brightness = 15;			// INIDISP
+};
+
+// Bits per pixel of a BG in mode, 0 if the mode has no such BG.
+int Ppu_GetBGDepth(int mode, int bg);
+// Sets the edges of window 0 or 1 on lines firstLine to lastLine.
+void Ppu_SetWindow(PpuState& state, int window, int left, int right, int firstLine = 0, int lastLine = PPU_HEIGHT - 1);
+
+// One line of BGR555 output.
+void Ppu_RenderLine(const PpuState& state, const word* palette, int y, word* line);
+// The whole frame, PPU_WIDTH x PPU_HEIGHT, into the top-left corner of fb.
+void Ppu_RenderFrame(const PpuState& state, const word* palette, Framebuffer& fb);
@@ -0,0 +1,416 @@
+#include "quantize.h"
+#include "colorspace.h"
+#include "colortable.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// Tiles handed to one pool task while reassigning.
+#define QUANTIZE_TILE_CHUNK		256
+#define QUANTIZE_KMEANS_PASSES	16
+
+namespace
+{
+	struct ColorCount
+	{
+		word color;
+		dword count;
+	};
+
+	// Opaque colors of every tile, tile t owns colors[first[t]] .. colors[first[t + 1] - 1].
+	struct TileColors
+	{
+		std::vector<std::size_t> first;
+		std::vector<ColorCount> colors;
+		std::vector<Lab> means;			// Weighted mean color, used for the first clustering.
+		std::vector<dword> weights;		// Opaque pixels.
+	};
+
+	struct SubPalette
+	{
+		int nColors = 0;
+		word colors[QUANTIZE_MAX_COLORS];
+		Lab labs[QUANTIZE_MAX_COLORS];
+	};
+}
+
+static float NearestDistance(const Lab& lab, const SubPalette& pal, int* pIndex = nullptr)
+{
+	float best = FLT_MAX;
+	int bestIndex = 0;
+	for (int i = 0; i < pal.nColors; ++i)
+	{
+		float d = ColorSpace_Distance(lab, pal.labs[i]);
+		if (d < best)
+		{
+			best = d;
+			bestIndex = i;
+		}
+	}
+	if (pIndex)
+		*pIndex = bestIndex;
+	return best;
+}
+
+static double TileError(const TileColors& tiles, std::size_t t, const SubPalette& pal, const Lab* okLab)
+{
+	double error = 0.0;
+	for (std::size_t i = tiles.first[t]; i < tiles.first[t + 1]; ++i)
+		error += static_cast<double>(NearestDistance(okLab[tiles.colors[i].color], pal)) * tiles.colors[i].count;
+	return error;
+}
+
+// Weighted k-means over a color histogram. Seeds are picked farthest-first,
+// so the result does not depend on a random generator; the final colors are
+// the histogram colors nearest to the centroids, which are valid BGR555.
+static void FitPalette(const std::vector<ColorCount>& hist, int nColors, const Lab* okLab, SubPalette& pal)
+{
+	pal.nColors = 0;
+	if (hist.empty())
+		return;
+	if (static_cast<int>(hist.size()) <= nColors)
+	{
+		for (const auto& c : hist)
+		{
+			pal.colors[pal.nColors] = c.color;
+			pal.labs[pal.nColors++] = okLab[c.color];
+		}
+		return;
+	}
+
+	std::vector<Lab> centers;
+	std::vector<float> nearest(hist.size(), FLT_MAX);
+	std::size_t seed = 0;
+	for (std::size_t i = 1; i < hist.size(); ++i)
+		if (hist[i].count > hist[seed].count)
+			seed = i;
+	while (static_cast<int>(centers.size()) < nColors)
+	{
+		centers.push_back(okLab[hist[seed].color]);
+		double bestScore = -1.0;
+		for (std::size_t i = 0; i < hist.size(); ++i)
+		{
+			nearest[i] = std::min(nearest[i], ColorSpace_Distance(okLab[hist[i].color], centers.back()));
+			double score = static_cast<double>(nearest[i]) * hist[i].count;
+			if (score > bestScore)
+			{
+				bestScore = score;
+				seed = i;
+			}
+		}
+	}
+
+	std::vector<int> assign(hist.size(), 0);
+	for (int pass = 0; pass < QUANTIZE_KMEANS_PASSES; ++pass)
+	{
+		bool bMoved = false;
+		for (std::size_t i = 0; i < hist.size(); ++i)
+		{
+			const Lab& lab = okLab[hist[i].color];
+			int best = 0;
+			float bestDist = FLT_MAX;
+			for (int c = 0; c < nColors; ++c)
+			{
+				float d = ColorSpace_Distance(lab, centers[c]);
+				if (d < bestDist)
+				{
+					bestDist = d;
+					best = c;
+				}
+			}
+			bMoved |= (assign[i] != best);
+			assign[i] = best;
+		}
+		if (!bMoved && pass)
+			break;
+
+		std::vector<double> sum(nColors * 4, 0.0);
+		for (std::size_t i = 0; i < hist.size(); ++i)
+		{
+			const Lab& lab = okLab[hist[i].color];
+			double w = hist[i].count;
+			double* s = &sum[assign[i] * 4];
+			s[0] += lab.L * w;
+			s[1] += lab.a * w;
+			s[2] += lab.b * w;
+			s[3] += w;
+		}
+		for (int c = 0; c < nColors; ++c)
+		{
+			const double* s = &sum[c * 4];
+			if (s[3] > 0.0)
+				centers[c] = { static_cast<float>(s[0] / s[3]), static_cast<float>(s[1] / s[3]), static_cast<float>(s[2] / s[3]) };
+		}
+	}
+
+	for (int c = 0; c < nColors; ++c)
+	{
+		std::size_t best = 0;
+		float bestDist = FLT_MAX;
+		for (std::size_t i = 0; i < hist.size(); ++i)
+		{
+			float d = ColorSpace_Distance(okLab[hist[i].color], centers[c]);
+			if (d < bestDist)
+			{
+				bestDist = d;
+				best = i;
+			}
+		}
+		// Two centroids may settle on the same color, keep it once.
+		if (std::find(pal.colors, pal.colors + pal.nColors, hist[best].color) == pal.colors + pal.nColors)
+		{
+			pal.colors[pal.nColors] = hist[best].color;
+			pal.labs[pal.nColors++] = okLab[hist[best].color];
+		}
+	}
+}
+
+// First clustering: plain k-means over the mean colors of the tiles.
+static void ClusterTiles(const TileColors& tiles, int nPalettes, std::vector<byte>& assign)
+{
+	std::size_t nTiles = tiles.means.size();
+	std::vector<Lab> centers;
+	std::vector<float> nearest(nTiles, FLT_MAX);
+	std::size_t seed = std::max_element(tiles.weights.begin(), tiles.weights.end()) - tiles.weights.begin();
+	while (static_cast<int>(centers.size()) < nPalettes)
+	{
+		centers.push_back(tiles.means[seed]);
+		double bestScore = -1.0;
+		for (std::size_t t = 0; t < nTiles; ++t)
+		{
+			if (!tiles.weights[t])
+				continue;
+			nearest[t] = std::min(nearest[t], ColorSpace_Distance(tiles.means[t], centers.back()));
+			double score = static_cast<double>(nearest[t]) * tiles.weights[t];
+			if (score > bestScore)
+			{
+				bestScore = score;
+				seed = t;
+			}
+		}
+	}
+
+	for (int pass = 0; pass < QUANTIZE_KMEANS_PASSES; ++pass)
+	{
+		for (std::size_t t = 0; t < nTiles; ++t)
+		{
+			float bestDist = FLT_MAX;
+			for (int p = 0; p < nPalettes; ++p)
+			{
+				float d = ColorSpace_Distance(tiles.means[t], centers[p]);
+				if (d < bestDist)
+				{
+					bestDist = d;
+					assign[t] = static_cast<byte>(p);
+				}
+			}
+		}
+		std::vector<double> sum(nPalettes * 4, 0.0);
+		for (std::size_t t = 0; t < nTiles; ++t)
+		{
+			double w = tiles.weights[t];
+			double* s = &sum[assign[t] * 4];
+			s[0] += tiles.means[t].L * w;
+			s[1] += tiles.means[t].a * w;
+			s[2] += tiles.means[t].b * w;
+			s[3] += w;
+		}
+		for (int p = 0; p < nPalettes; ++p)
+		{
+			const double* s = &sum[p * 4];
+			if (s[3] > 0.0)
+				centers[p] = { static_cast<float>(s[0] / s[3]), static_cast<float>(s[1] / s[3]), static_cast<float>(s[2] / s[3]) };
+		}
+	}
+}
+
+bool Quantize_Image(const Image& img, const QuantizeOptions& opt, ThreadPool& pool, QuantizeResult& result)
+{
+	TRACE_SCOPE("Quantize_Image");
+	if (img.width < 1 || img.height < 1 || img.pixels.size() < static_cast<std::size_t>(img.width) * img.height)
+		return false;
+	if (opt.nPalettes < 1 || opt.nPalettes > QUANTIZE_MAX_PALETTES || opt.nColors < 1 || opt.nColors > QUANTIZE_MAX_COLORS)
+		return false;
+
+	const Lab* okLab = ColorSpace_GetOKLabTable();
+	dword transparentRGB = opt.bTransparentAuto ? img.pixels[0] : opt.transparent;
+	word transparent = Color_LookupToSNES((transparentRGB >> 16) & 0xFF, (transparentRGB >> 8) & 0xFF, transparentRGB & 0xFF);
+
+	// 0x8000 marks transparent pixels, every other value is BGR555.
+	std::size_t nPixels = static_cast<std::size_t>(img.width) * img.height;
+	std::vector<word> snes(nPixels);
+	for (std::size_t i = 0; i < nPixels; ++i)
+	{
+		dword rgb = img.pixels[i];
+		word c = Color_LookupToSNES((rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF);
+		snes[i] = (opt.bTransparent && c == transparent) ? 0x8000 : c;
+	}
+
+	result.nPalettes = opt.nPalettes;
+	result.tilesX = (img.width + QUANTIZE_TILE_SIZE - 1) / QUANTIZE_TILE_SIZE;
+	result.tilesY = (img.height + QUANTIZE_TILE_SIZE - 1) / QUANTIZE_TILE_SIZE;
+	std::size_t nTiles = static_cast<std::size_t>(result.tilesX) * result.tilesY;
+
+	TileColors tiles;
+	tiles.first.assign(nTiles + 1, 0);
+	tiles.means.assign(nTiles, { 0.0f, 0.0f, 0.0f });
+	tiles.weights.assign(nTiles, 0);
+	std::size_t nOpaque = 0;
+	for (std::size_t t = 0; t < nTiles; ++t)
+	{
+		int tx = static_cast<int>(t % result.tilesX) * QUANTIZE_TILE_SIZE;
+		int ty = static_cast<int>(t / result.tilesX) * QUANTIZE_TILE_SIZE;
+		word block[QUANTIZE_TILE_SIZE * QUANTIZE_TILE_SIZE];
+		int n = 0;
+		for (int y = ty; y < std::min(ty + QUANTIZE_TILE_SIZE, img.height); ++y)
+			for (int x = tx; x < std::min(tx + QUANTIZE_TILE_SIZE, img.width); ++x)
+				if (snes[static_cast<std::size_t>(y) * img.width + x] != 0x8000)
+					block[n++] = snes[static_cast<std::size_t>(y) * img.width + x];
+
+		std::sort(block, block + n);
+		double sum[3] = { 0.0, 0.0, 0.0 };
+		for (int i = 0; i < n; ++i)
+		{
+			if (!i || block[i] != block[i - 1])
+				tiles.colors.push_back({ block[i], 0 });
+			++tiles.colors.back().count;
+			sum[0] += okLab[block[i]].L;
+			sum[1] += okLab[block[i]].a;
+			sum[2] += okLab[block[i]].b;
+		}
+		tiles.first[t + 1] = tiles.colors.size();
+		tiles.weights[t] = n;
+		if (n)
+			tiles.means[t] = { static_cast<float>(sum[0] / n), static_cast<float>(sum[1] / n), static_cast<float>(sum[2] / n) };
+		nOpaque += n;
+	}
+
+	result.tilePalettes.assign(nTiles, 0);
+	SubPalette pals[QUANTIZE_MAX_PALETTES];
+	double totalError = 0.0;
+	if (nOpaque)
+	{
+		ClusterTiles(tiles, opt.nPalettes, result.tilePalettes);
+
+		std::vector<double> tileErrors(nTiles, 0.0);
+		for (result.nIterations = 1; result.nIterations <= opt.nIterations; ++result.nIterations)
+		{
+			// Refit every sub-palette to the tiles it draws.
+			for (int p = 0; p < opt.nPalettes; ++p)
+			{
+				pool.Submit([&, p] {
+					std::vector<dword> counts(0x8000, 0);
+					for (std::size_t t = 0; t < nTiles; ++t)
+						if (result.tilePalettes[t] == p)
+							for (std::size_t i = tiles.first[t]; i < tiles.first[t + 1]; ++i)
+								counts[tiles.colors[i].color] += tiles.colors[i].count;
+					std::vector<ColorCount> hist;
+					for (dword c = 0; c < 0x8000; ++c)
+						if (counts[c])
+							hist.push_back({ static_cast<word>(c), counts[c] });
+					FitPalette(hist, opt.nColors, okLab, pals[p]);
+				});
+			}
+			pool.Wait();
+
+			// Move every tile to the sub-palette that draws it best.
+			std::vector<byte> moved((nTiles + QUANTIZE_TILE_CHUNK - 1) / QUANTIZE_TILE_CHUNK, 0);
+			for (std::size_t begin = 0; begin < nTiles; begin += QUANTIZE_TILE_CHUNK)
+			{
+				pool.Submit([&, begin] {
+					std::size_t end = std::min(begin + QUANTIZE_TILE_CHUNK, nTiles);
+					for (std::size_t t = begin; t < end; ++t)
+					{
+						if (!tiles.weights[t])
+							continue;
+						double best = DBL_MAX;
+						int bestPal = result.tilePalettes[t];
+						for (int p = 0; p < opt.nPalettes; ++p)
+						{
+							if (!pals[p].nColors)
+								continue;
+							double error = TileError(tiles, t, pals[p], okLab);
+							if (error < best)
+							{
+								best = error;
+								bestPal = p;
+							}
+						}
+						tileErrors[t] = best;
+						if (bestPal != result.tilePalettes[t])
+						{
+							result.tilePalettes[t] = static_cast<byte>(bestPal);
+							moved[begin / QUANTIZE_TILE_CHUNK] = 1;
+						}
+					}
+				});
+			}
+			pool.Wait();
+
+			// A sub-palette left without tiles takes over the worst drawn tile,
+			// unless there is no pass left to fit it.
+			bool bMoved = std::find(moved.begin(), moved.end(), 1) != moved.end();
+			for (int p = 0; p < opt.nPalettes && result.nIterations < opt.nIterations; ++p)
+			{
+				if (std::find(result.tilePalettes.begin(), result.tilePalettes.end(), p) != result.tilePalettes.end())
+					continue;
+				std::size_t worst = std::max_element(tileErrors.begin(), tileErrors.end()) - tileErrors.begin();
+				if (tileErrors[worst] <= 0.0)
+					break;
+				result.tilePalettes[worst] = static_cast<byte>(p);
+				tileErrors[worst] = 0.0;
+				bMoved = true;
+			}
+			if (!bMoved)
+				break;
+		}
+		result.nIterations = std::min(result.nIterations, opt.nIterations);
+	}
+
+	// Sub-palettes go out sorted dark to light.
+	for (int p = 0; p < QUANTIZE_MAX_PALETTES; ++p)
+	{
+		SubPalette& pal = pals[p];
+		for (int i = 1; i < pal.nColors; ++i)
+		{
+			for (int j = i; j > 0 && pal.labs[j].L < pal.labs[j - 1].L; --j)
+			{
+				std::swap(pal.labs[j], pal.labs[j - 1]);
+				std::swap(pal.colors[j], pal.colors[j - 1]);
+			}
+		}
+
+		result.palettes[p][0] = opt.bTransparent ? transparent : 0x0000;
+		for (int i = 0; i < QUANTIZE_MAX_COLORS; ++i)
+			result.palettes[p][i + 1] = (i < pal.nColors && p < opt.nPalettes) ? pal.colors[i] : 0x0000;
+	}
+
+	result.indices.assign(nPixels, 0);
+	for (std::size_t i = 0; i < nPixels; ++i)
+	{
+		if (snes[i] == 0x8000)
+			continue;
+		int x = static_cast<int>(i % img.width), y = static_cast<int>(i / img.width);
+		const SubPalette& pal = pals[result.tilePalettes[(y / QUANTIZE_TILE_SIZE) * result.tilesX + x / QUANTIZE_TILE_SIZE]];
+		int index = 0;
+		totalError += NearestDistance(okLab[snes[i]], pal, &index);
+		result.indices[i] = static_cast<byte>(pal.nColors ? index + 1 : 0);
+	}
+	result.meanError = nOpaque ? totalError / nOpaque : 0.0;
+	return true;
+}
+
+void Quantize_Render(const QuantizeResult& result, Framebuffer& fb)
+{
+	for (int y = 0; y < fb.height; ++y)
+	{
+		dword* row = fb.pixels + static_cast<std::size_t>(y) * fb.stride;
+		for (int x = 0; x < fb.width; ++x)
+		{
+			int pal = result.tilePalettes[(y / QUANTIZE_TILE_SIZE) * result.tilesX + x / QUANTIZE_TILE_SIZE];
+			row[x] = Render_ColorFromSNES(result.palettes[pal][result.indices[static_cast<std::size_t>(y) * fb.width + x]]);
+		}
+	}
+}
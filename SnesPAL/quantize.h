@@ -0,0 +1,46 @@
+#pragma once
+
+// Truecolor image to SNES sub-palettes.
+// The image is cut into 8x8 tiles. Tiles are clustered into sub-palettes,
+// every sub-palette is fitted to the pixels of its tiles with k-means in
+// OKLab and tiles then move to the sub-palette that draws them best; the two
+// steps alternate until no tile moves. Color 0 is shared and transparent.
+
+#include "types.h"
+#include "image.h"
+#include "render.h"
+
+#include <vector>
+
+class ThreadPool;
+
+#define QUANTIZE_TILE_SIZE		8
+#define QUANTIZE_MAX_PALETTES	16
+#define QUANTIZE_MAX_COLORS		15
+
+struct QuantizeOptions
+{
+	int nPalettes = 8;
+	int nColors = QUANTIZE_MAX_COLORS;		// Per sub-palette, color 0 excluded.
+	int nIterations = 10;
+	// Pixels of the transparent color map to color 0. Without one, color 0 is black and unused.
+	bool bTransparent = true;
+	bool bTransparentAuto = true;			// Use the top-left pixel.
+	dword transparent = 0;					// 0x00RRGGBB
+};
+
+struct QuantizeResult
+{
+	int nPalettes = 0;
+	word palettes[QUANTIZE_MAX_PALETTES][0x10] = { { 0 } };	// Color 0 is the same in every row.
+	int tilesX = 0;
+	int tilesY = 0;
+	std::vector<byte> tilePalettes;		// Sub-palette of every tile, row by row.
+	std::vector<byte> indices;			// Color 0-15 of every pixel.
+	double meanError = 0.0;				// Mean squared OKLab distance per opaque pixel.
+	int nIterations = 0;				// Passes until no tile moved.
+};
+
+bool Quantize_Image(const Image& img, const QuantizeOptions& opt, ThreadPool& pool, QuantizeResult& result);
+// Draws the quantized image, fb must have the size of the source image.
+void Quantize_Render(const QuantizeResult& result, Framebuffer& fb);
@@ -0,0 +1,88 @@
+#include "render.h"
+#include "colortable.h"
+#include "trace.h"
+
+#include <algorithm>
+
+static int CellSize(const RenderOptions& opt)
+{
+	int zoom = std::min(std::max(opt.zoom, 1), RENDER_MAX_ZOOM);
+	return RENDER_CELL_SIZE * zoom;
+}
+
+int Render_GetGridSize(const RenderOptions& opt)
+{
+	return CellSize(opt) * RENDER_CELLS;
+}
+
+void Render_GetCellRect(const RenderOptions& opt, int index, int* pLeft, int* pTop, int* pRight, int* pBottom)
+{
+	int size = CellSize(opt);
+	int x = index & 0x0F, y = (index >> 4) & 0x0F;
+	int line = opt.bGrid ? 1 : 0;
+	*pLeft = x * size + line;
+	*pTop = y * size + line;
+	*pRight = (x + 1) * size;
+	*pBottom = (y + 1) * size;
+}
+
+int Render_HitTest(const RenderOptions& opt, int x, int y)
+{
+	int size = CellSize(opt);
+	if (x < 0 || y < 0 || x >= size * RENDER_CELLS || y >= size * RENDER_CELLS)
+		return -1;
+	return (y / size) * RENDER_CELLS + (x / size);
+}
+
+void Render_FillRect(Framebuffer& fb, int left, int top, int right, int bottom, dword color)
+{
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, fb.width);
+	bottom = std::min(bottom, fb.height);
+	if (left >= right || top >= bottom)
+		return;
+
+	dword* row = fb.pixels + static_cast<std::size_t>(top) * fb.stride + left;
+	for (int y = top; y < bottom; ++y, row += fb.stride)
+		std::fill_n(row, right - left, color);
+}
+
+dword Render_ColorFromSNES(word color)
+{
+	// Tables hold 0x00BBGGRR, the framebuffer wants 0x00RRGGBB.
+	dword rgb = Color_LookupFromSNES(color);
+	return ((rgb & 0xFF) << 16) | (rgb & 0xFF00) | ((rgb >> 16) & 0xFF);
+}
+
+static dword CellColor(const word* palette, int index, const RenderOptions& opt)
+{
+	if (opt.bTransparentFirst && (index & 0x0F) == 0)
+		return RENDER_XRGB(0x00, 0x00, 0x00);
+	return Render_ColorFromSNES(palette[index]);
+}
+
+void Render_PaletteCell(Framebuffer& fb, const word* palette, int index, const RenderOptions& opt)
+{
+	TRACE_SCOPE("Render_PaletteCell");
+	int left, top, right, bottom;
+	Render_GetCellRect(opt, index, &left, &top, &right, &bottom);
+	Render_FillRect(fb, left, top, right, bottom, CellColor(palette, index, opt));
+}
+
+void Render_PaletteGrid(Framebuffer& fb, const word* palette, const RenderOptions& opt)
+{
+	TRACE_SCOPE("Render_PaletteGrid");
+	// With the grid on, the background shows through as the grid lines.
+	if (opt.bGrid)
+		Render_FillRect(fb, 0, 0, fb.width, fb.height, opt.background);
+	else
+	{
+		int size = Render_GetGridSize(opt);
+		Render_FillRect(fb, size, 0, fb.width, fb.height, opt.background);
+		Render_FillRect(fb, 0, size, size, fb.height, opt.background);
+	}
+
+	for (int i = 0; i < RENDER_CELLS * RENDER_CELLS; ++i)
+		Render_PaletteCell(fb, palette, i, opt);
+}
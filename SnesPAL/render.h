@@ -0,0 +1,47 @@
+#pragma once
+
+// Software renderer for the palette grid.
+// Draws into a caller-owned 32bpp buffer, so the same code paints the editor
+// (through a DIB section) and runs headless for golden images and benchmarks.
+
+#include "types.h"
+
+// Pixels use the 32bpp DIB layout: 0x00RRGGBB.
+#define RENDER_XRGB(r,g,b)	((dword)(((dword)(byte)(r) << 16) | ((dword)(byte)(g) << 8) | (dword)(byte)(b)))
+
+#define RENDER_CELLS		0x10
+#define RENDER_CELL_SIZE	0x10
+#define RENDER_MAX_ZOOM		8
+
+struct Framebuffer
+{
+	dword* pixels;
+	int width;
+	int height;
+	int stride;		// In pixels.
+};
+
+struct RenderOptions
+{
+	int zoom = 1;
+	bool bGrid = false;
+	// Color 0 of every row is transparent on the SNES and drawn black.
+	bool bTransparentFirst = true;
+	dword background = RENDER_XRGB(0xFF, 0xFF, 0xFF);
+};
+
+// Size of the full 16x16 grid for the given options.
+int Render_GetGridSize(const RenderOptions& opt);
+// Position of a palette index in the grid, without the grid line.
+void Render_GetCellRect(const RenderOptions& opt, int index, int* pLeft, int* pTop, int* pRight, int* pBottom);
+// Palette index under a pixel, or -1.
+int Render_HitTest(const RenderOptions& opt, int x, int y);
+
+// BGR555 color in the framebuffer layout, through the active color tables.
+dword Render_ColorFromSNES(word color);
+
+void Render_FillRect(Framebuffer& fb, int left, int top, int right, int bottom, dword color);
+// Clears the background and draws all 256 cells.
+void Render_PaletteGrid(Framebuffer& fb, const word* palette, const RenderOptions& opt);
+// Redraws one cell only.
+void Render_PaletteCell(Framebuffer& fb, const word* palette, int index, const RenderOptions& opt);
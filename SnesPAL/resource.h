@@ -5,16 +5,35 @@
 #define IDD_COPYPAL                     101
 #define IDD_DIALOG1                     103
 #define IDD_ABOUT                       103
+#define IDD_ROMPAL                      105
+#define IDD_ADJUST                      106
+#define IDD_FADE                        107
 #define IDC_EDIT_SRC_PAL                1002
 #define IDC_EDIT_DEST_PAL               1003
+#define IDC_EDIT_ROM_ADDR               1004
+#define IDC_ADJUST_BRIGHTNESS           1005
+#define IDC_ADJUST_CONTRAST             1006
+#define IDC_ADJUST_SATURATION           1007
+#define IDC_ADJUST_HUE                  1008
+#define IDC_ADJUST_TINT                 1009
+#define IDC_ADJUST_GRAYSCALE            1010
+#define IDC_ADJUST_CELL                 1011
+#define IDC_ADJUST_ROW                  1012
+#define IDC_ADJUST_ALL                  1013
+#define IDC_FADE_BLACK                  1014
+#define IDC_FADE_WHITE                  1015
+#define IDC_FADE_CROSS                  1016
+#define IDC_FADE_BRIGHTNESS             1017
+#define IDC_FADE_FRAMES                 1018
+#define IDC_FADE_IN                     1019
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
-#define _APS_NEXT_RESOURCE_VALUE        105
+#define _APS_NEXT_RESOURCE_VALUE        108
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1003
+#define _APS_NEXT_CONTROL_VALUE         1020
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
@@ -0,0 +1,257 @@
+#include "rom.h"
+
+#include <cwctype>
+#include <string>
+
+// Offsets of the internal header fields, relative to the header start.
+#define HDR_MAP_MODE		0x15
+#define HDR_COMPLEMENT		0x1C
+#define HDR_CHECKSUM		0x1E
+#define HDR_RESET_VECTOR	0x3C
+#define HDR_LOROM			0x7FC0
+#define HDR_HIROM			0xFFC0
+
+static word ReadWord(const byte* p)
+{
+	return static_cast<word>(p[0] | (p[1] << 8));
+}
+
+static void WriteWord(byte* p, word value)
+{
+	p[0] = static_cast<byte>(value);
+	p[1] = static_cast<byte>(value >> 8);
+}
+
+static const byte* RomData(const Rom& rom)
+{
+	return rom.file.Data() + rom.headerSize;
+}
+
+static std::size_t HeaderOffset(RomMapping mapping)
+{
+	return mapping == ROM_MAP_HIROM ? HDR_HIROM : HDR_LOROM;
+}
+
+// Scores how much the bytes at a header location look like a real header.
+static int ScoreHeader(const Rom& rom, RomMapping mapping)
+{
+	std::size_t offset = HeaderOffset(mapping);
+	if (Rom_GetDataSize(rom) < offset + 0x40)
+		return -1;
+
+	const byte* hdr = RomData(rom) + offset;
+	int score = 0;
+	if ((ReadWord(hdr + HDR_CHECKSUM) ^ ReadWord(hdr + HDR_COMPLEMENT)) == 0xFFFF)
+		score += 4;
+
+	byte mode = hdr[HDR_MAP_MODE] & 0xEF;
+	if ((mapping == ROM_MAP_LOROM && mode == 0x20) || (mapping == ROM_MAP_HIROM && mode == 0x21))
+		score += 2;
+	if (ReadWord(hdr + HDR_RESET_VECTOR) >= 0x8000)
+		score += 1;
+
+	// Title should be printable ASCII.
+	int printable = 0;
+	for (int i = 0; i < 21; ++i)
+		if (hdr[i] >= 0x20 && hdr[i] < 0x7F)
+			++printable;
+	if (printable == 21)
+		score += 1;
+	return score;
+}
+
+bool Rom_IsRomPath(const std::filesystem::path& fn)
+{
+	std::wstring ext = fn.extension().wstring();
+	for (auto& c : ext)
+		c = static_cast<wchar_t>(towlower(c));
+	return ext == L".smc" || ext == L".sfc";
+}
+
+const char* Rom_MappingName(RomMapping mapping)
+{
+	switch (mapping)
+	{
+		case ROM_MAP_LOROM: return "LoROM";
+		case ROM_MAP_HIROM: return "HiROM";
+		default: return "Unknown";
+	}
+}
+
+bool Rom_Open(Rom& rom, const std::filesystem::path& fn, bool bWritable, RomMapping mapping)
+{
+	Rom_Close(rom);
+	if (!rom.file.Open(fn, bWritable))
+		return false;
+
+	// Copier headers make the size 512 bytes over a multiple of 1 KB.
+	rom.headerSize = ((rom.file.Size() & 0x3FF) == ROM_COPIER_HEADER) ? ROM_COPIER_HEADER : 0;
+	if (Rom_GetDataSize(rom) < 0x8000)
+	{
+		Rom_Close(rom);
+		return false;
+	}
+
+	if (mapping == ROM_MAP_UNKNOWN)
+		mapping = ScoreHeader(rom, ROM_MAP_HIROM) > ScoreHeader(rom, ROM_MAP_LOROM) ? ROM_MAP_HIROM : ROM_MAP_LOROM;
+	rom.mapping = mapping;
+	return true;
+}
+
+void Rom_Close(Rom& rom)
+{
+	rom.file.Close();
+	rom.headerSize = 0;
+	rom.mapping = ROM_MAP_UNKNOWN;
+}
+
+std::size_t Rom_GetDataSize(const Rom& rom)
+{
+	return rom.file.Size() > rom.headerSize ? rom.file.Size() - rom.headerSize : 0;
+}
+
+std::size_t Rom_SNESToOffset(const Rom& rom, dword address)
+{
+	byte bank = (address >> 16) & 0xFF;
+	word addr = address & 0xFFFF;
+	std::size_t pc = ROM_INVALID_OFFSET;
+
+	// Banks $7E-$7F are WRAM in both maps.
+	if (bank == 0x7E || bank == 0x7F)
+		return ROM_INVALID_OFFSET;
+
+	if (rom.mapping == ROM_MAP_LOROM)
+	{
+		if (addr >= 0x8000)
+			pc = static_cast<std::size_t>(bank & 0x7F) * 0x8000 + (addr & 0x7FFF);
+	}
+	else if (rom.mapping == ROM_MAP_HIROM)
+	{
+		if (bank >= 0x40 && (bank < 0x80 || bank >= 0xC0))
+			pc = address & 0x3FFFFF;
+		else if (addr >= 0x8000)
+			pc = (static_cast<std::size_t>(bank & 0x3F) << 16) | addr;
+	}
+
+	if (pc == ROM_INVALID_OFFSET || pc >= Rom_GetDataSize(rom))
+		return ROM_INVALID_OFFSET;
+	return pc + rom.headerSize;
+}
+
+bool Rom_OffsetToSNES(const Rom& rom, std::size_t offset, dword& address)
+{
+	if (offset < rom.headerSize)
+		return false;
+	std::size_t pc = offset - rom.headerSize;
+	if (pc >= Rom_GetDataSize(rom))
+		return false;
+
+	if (rom.mapping == ROM_MAP_LOROM)
+	{
+		if (pc >= 0x400000)
+			return false;
+		dword bank = static_cast<dword>(pc >> 15);
+		// Banks $7E-$7F are WRAM, their ROM is only visible in $FE-$FF.
+		if (bank >= 0x7E)
+			bank |= 0x80;
+		address = (bank << 16) | 0x8000 | static_cast<dword>(pc & 0x7FFF);
+		return true;
+	}
+	if (rom.mapping == ROM_MAP_HIROM)
+	{
+		if (pc >= 0x400000)
+			return false;
+		address = 0xC00000 | static_cast<dword>(pc);
+		return true;
+	}
+	return false;
+}
+
+// Palettes are contiguous in the file even when the SNES address crosses a bank.
+static std::size_t PaletteOffset(const Rom& rom, dword address, std::size_t count)
+{
+	std::size_t offset = Rom_SNESToOffset(rom, address);
+	if (offset == ROM_INVALID_OFFSET || offset + count * 2 > rom.file.Size())
+		return ROM_INVALID_OFFSET;
+	return offset;
+}
+
+bool Rom_ReadPalette(const Rom& rom, dword address, word* palette, std::size_t count)
+{
+	std::size_t offset = PaletteOffset(rom, address, count);
+	if (offset == ROM_INVALID_OFFSET)
+		return false;
+
+	const byte* p = rom.file.Data() + offset;
+	for (std::size_t i = 0; i < count; ++i)
+		palette[i] = ReadWord(p + i * 2) & 0x7FFF;
+	return true;
+}
+
+bool Rom_WritePalette(Rom& rom, dword address, const word* palette, std::size_t count)
+{
+	if (!rom.file.IsWritable())
+		return false;
+	std::size_t offset = PaletteOffset(rom, address, count);
+	if (offset == ROM_INVALID_OFFSET)
+		return false;
+
+	byte* p = rom.file.Data() + offset;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		// Keep bit 15 as it was, some games store flags there.
+		word value = (palette[i] & 0x7FFF) | (ReadWord(p + i * 2) & 0x8000);
+		WriteWord(p + i * 2, value);
+	}
+	return true;
+}
+
+// Byte sum of size bytes mirrored up to the next power of two, as the
+// emulators compute it: the part above the largest power of two is itself
+// mirrored to its own next power of two, then repeated to fill the rest.
+// A 3 MB ROM counts its last MB twice, a 3.5 MB one its last 512 KB twice.
+static dword SumMirrored(const byte* data, std::size_t size, std::size_t* pMirrored)
+{
+	std::size_t base = 1;
+	while (base * 2 <= size)
+		base *= 2;
+
+	dword sum = 0;
+	for (std::size_t i = 0; i < base; ++i)
+		sum += data[i];
+	*pMirrored = base;
+	if (size > base)
+	{
+		std::size_t restMirrored = 0;
+		dword restSum = SumMirrored(data + base, size - base, &restMirrored);
+		sum += restSum * static_cast<dword>(base / restMirrored);
+		*pMirrored = base * 2;
+	}
+	return sum;
+}
+
+bool Rom_UpdateChecksum(Rom& rom)
+{
+	std::size_t size = Rom_GetDataSize(rom);
+	std::size_t hdrOffset = HeaderOffset(rom.mapping);
+	if (!rom.file.IsWritable() || size < hdrOffset + 0x40)
+		return false;
+
+	byte* data = rom.file.Data() + rom.headerSize;
+	byte* hdr = data + hdrOffset;
+	// The checksum is computed with checksum = $0000 and complement = $FFFF.
+	WriteWord(hdr + HDR_COMPLEMENT, 0xFFFF);
+	WriteWord(hdr + HDR_CHECKSUM, 0x0000);
+
+	std::size_t mirrored = 0;
+	dword sum = SumMirrored(data, size, &mirrored);
+	word checksum = static_cast<word>(sum);
+	WriteWord(hdr + HDR_CHECKSUM, checksum);
+	WriteWord(hdr + HDR_COMPLEMENT, checksum ^ 0xFFFF);
+	return true;
+}
+
+bool Rom_Save(Rom& rom)
+{
+	return Rom_UpdateChecksum(rom) && rom.file.Flush();
+}
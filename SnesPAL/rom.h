@@ -0,0 +1,48 @@
+#pragma once
+
+// SNES ROM images (.smc/.sfc) opened through a memory mapping.
+// Palettes are read and patched in place; nothing is copied into memory.
+
+#include "types.h"
+#include "mmap.h"
+
+#include <filesystem>
+
+#define ROM_COPIER_HEADER	0x200
+#define ROM_INVALID_OFFSET	((std::size_t)-1)
+
+enum RomMapping
+{
+	ROM_MAP_UNKNOWN = 0,
+	ROM_MAP_LOROM,
+	ROM_MAP_HIROM
+};
+
+struct Rom
+{
+	MappedFile file;
+	std::size_t headerSize = 0;		// Copier header in front of the ROM data.
+	RomMapping mapping = ROM_MAP_UNKNOWN;
+};
+
+// Detects the copier header and the memory map. mapping forces LoROM/HiROM.
+bool Rom_Open(Rom& rom, const std::filesystem::path& fn, bool bWritable, RomMapping mapping = ROM_MAP_UNKNOWN);
+void Rom_Close(Rom& rom);
+bool Rom_IsRomPath(const std::filesystem::path& fn);
+const char* Rom_MappingName(RomMapping mapping);
+
+// Size of the ROM data without the copier header.
+std::size_t Rom_GetDataSize(const Rom& rom);
+// SNES bus address to file offset (copier header included), or ROM_INVALID_OFFSET.
+std::size_t Rom_SNESToOffset(const Rom& rom, dword address);
+// File offset to the canonical SNES address, or false if the offset is not in the ROM data.
+bool Rom_OffsetToSNES(const Rom& rom, std::size_t offset, dword& address);
+
+// count colors starting at a SNES address. The range must be in the ROM.
+bool Rom_ReadPalette(const Rom& rom, dword address, word* palette, std::size_t count);
+bool Rom_WritePalette(Rom& rom, dword address, const word* palette, std::size_t count);
+
+// Recomputes the internal header checksum and complement.
+bool Rom_UpdateChecksum(Rom& rom);
+// Updates the checksum and flushes the mapping to disk.
+bool Rom_Save(Rom& rom);
@@ -0,0 +1,186 @@
+#include "search.h"
+#include "mmap.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <mutex>
+
+#define HASH_BASE		0x100000001B3ull
+#define FILTER_BITS		16
+#define FILTER_MASK		((1ull << FILTER_BITS) - 1)
+// Bytes searched by one pool task.
+#define SEARCH_CHUNK	(1 << 20)
+
+word PaletteSearch::ReadColor(const byte* p) const
+{
+	word value = static_cast<word>(p[0] | (p[1] << 8));
+	return q.bIgnoreBit15 ? (value & 0x7FFF) : value;
+}
+
+unsigned long long PaletteSearch::HashWords(const word* p, std::size_t n) const
+{
+	unsigned long long h = 0;
+	for (std::size_t i = 0; i < n; ++i)
+		h = h * HASH_BASE + p[i];
+	return h;
+}
+
+bool PaletteSearch::Prepare(const SearchQuery& query)
+{
+	q = query;
+	blockHashes.clear();
+	filter.assign((1ull << FILTER_BITS) / 64, 0);
+
+	if (q.patterns.empty() || q.patterns[0].empty() || q.maxDiffs < 0)
+		return false;
+	length = q.patterns[0].size();
+	for (auto& pattern : q.patterns)
+	{
+		if (pattern.size() != length)
+			return false;
+		if (q.bIgnoreBit15)
+			for (auto& c : pattern)
+				c &= 0x7FFF;
+	}
+	if (static_cast<std::size_t>(q.maxDiffs) >= length)
+		return false;
+
+	nBlocks = q.maxDiffs + 1;
+	blockLength = length / nBlocks;
+	power = 1;
+	for (std::size_t i = 1; i < blockLength; ++i)
+		power *= HASH_BASE;
+
+	for (int p = 0; p < static_cast<int>(q.patterns.size()); ++p)
+	{
+		for (int b = 0; b < nBlocks; ++b)
+		{
+			unsigned long long h = HashWords(q.patterns[p].data() + b * blockLength, blockLength);
+			blockHashes.push_back({ h, p, b });
+			filter[(h & FILTER_MASK) >> 6] |= 1ull << (h & 63);
+		}
+	}
+	std::sort(blockHashes.begin(), blockHashes.end(), [](const BlockHash& a, const BlockHash& b) { return a.hash < b.hash; });
+	return true;
+}
+
+int PaletteSearch::CountDiffs(const byte* data, std::size_t offset, int pattern, int limit) const
+{
+	const word* pat = q.patterns[pattern].data();
+	int nDiffs = 0;
+	for (std::size_t i = 0; i < length; ++i)
+	{
+		if (ReadColor(data + offset + i * 2) != pat[i] && ++nDiffs > limit)
+			break;
+	}
+	return nDiffs;
+}
+
+bool PaletteSearch::BlockMatches(const byte* data, std::size_t offset, int pattern, int block) const
+{
+	const word* pat = q.patterns[pattern].data() + block * blockLength;
+	const byte* p = data + offset + block * blockLength * 2;
+	for (std::size_t i = 0; i < blockLength; ++i)
+		if (ReadColor(p + i * 2) != pat[i])
+			return false;
+	return true;
+}
+
+void PaletteSearch::SearchRange(const byte* data, std::size_t size, std::size_t begin, std::size_t end, std::vector<SearchMatch>& out) const
+{
+	if (!nBlocks || size < length * 2)
+		return;
+	std::size_t lastStart = size - length * 2;		// Last possible byte offset of a match.
+	end = std::min(end, lastStart + 1);
+	if (begin >= end)
+		return;
+
+	// Colors can sit at even or odd offsets, so both word streams are scanned.
+	for (std::size_t align = 0; align < 2; ++align)
+	{
+		// Word indices of match starts in this stream that fall into [begin, end).
+		std::size_t sBegin = (begin <= align) ? 0 : (begin - align + 1) / 2;
+		if (align + sBegin * 2 >= end)
+			continue;
+		std::size_t sEnd = (end - align + 1) / 2;
+		std::size_t nWords = (size - align) / 2;
+
+		// Block windows that can belong to one of those starts.
+		std::size_t qBegin = sBegin;
+		std::size_t qEnd = std::min(sEnd + (nBlocks - 1) * blockLength, nWords - blockLength + 1);
+		const byte* stream = data + align;
+
+		unsigned long long h = 0;
+		for (std::size_t i = 0; i < blockLength; ++i)
+			h = h * HASH_BASE + ReadColor(stream + (qBegin + i) * 2);
+
+		for (std::size_t qi = qBegin; qi < qEnd; ++qi)
+		{
+			if (qi > qBegin)
+				h = (h - ReadColor(stream + (qi - 1) * 2) * power) * HASH_BASE + ReadColor(stream + (qi + blockLength - 1) * 2);
+
+			if (!(filter[(h & FILTER_MASK) >> 6] & (1ull << (h & 63))))
+				continue;
+
+			auto it = std::lower_bound(blockHashes.begin(), blockHashes.end(), h, [](const BlockHash& a, unsigned long long v) { return a.hash < v; });
+			for (; it != blockHashes.end() && it->hash == h; ++it)
+			{
+				std::size_t blockStart = it->block * blockLength;
+				if (qi < blockStart)
+					continue;
+				std::size_t s = qi - blockStart;
+				if (s < sBegin || s >= sEnd || s + length > nWords)
+					continue;
+
+				std::size_t offset = align + s * 2;
+				if (!BlockMatches(data, offset, it->pattern, it->block))
+					continue;
+				// Every match is reported only by its first exactly matching block.
+				bool bEarlier = false;
+				for (int b = 0; b < it->block && !bEarlier; ++b)
+					bEarlier = BlockMatches(data, offset, it->pattern, b);
+				if (bEarlier)
+					continue;
+
+				int nDiffs = CountDiffs(data, offset, it->pattern, q.maxDiffs);
+				if (nDiffs <= q.maxDiffs)
+					out.push_back({ offset, it->pattern, nDiffs });
+			}
+		}
+	}
+}
+
+void PaletteSearch::SearchFiles(std::vector<SearchFileResult>& files, ThreadPool& pool) const
+{
+	std::vector<MappedFile> mapped(files.size());
+	std::vector<std::mutex> locks(files.size());
+
+	for (std::size_t f = 0; f < files.size(); ++f)
+	{
+		files[f].matches.clear();
+		files[f].bOpened = mapped[f].Open(files[f].fn, false);
+		if (!files[f].bOpened)
+			continue;
+		files[f].size = mapped[f].Size();
+
+		for (std::size_t begin = 0; begin < files[f].size; begin += SEARCH_CHUNK)
+		{
+			pool.Submit([&, f, begin] {
+				std::vector<SearchMatch> local;
+				SearchRange(mapped[f].Data(), files[f].size, begin, std::min(begin + SEARCH_CHUNK, files[f].size), local);
+				if (local.empty())
+					return;
+				std::lock_guard<std::mutex> lock(locks[f]);
+				files[f].matches.insert(files[f].matches.end(), local.begin(), local.end());
+			});
+		}
+	}
+	pool.Wait();
+
+	for (auto& file : files)
+	{
+		std::sort(file.matches.begin(), file.matches.end(), [](const SearchMatch& a, const SearchMatch& b) {
+			return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+		});
+	}
+}
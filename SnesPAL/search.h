@@ -0,0 +1,76 @@
+#pragma once
+
+// Palette search in arbitrary binaries (ROMs, RAM dumps).
+//
+// Every pattern is a run of BGR555 colors, for example one 16-color row of
+// the editor palette. Near matches with up to maxDiffs differing colors are
+// found through the pigeonhole principle: the pattern is cut into
+// maxDiffs + 1 blocks, at least one of which has to match exactly. Block
+// occurrences are found with a Rabin-Karp rolling hash over the data and
+// every candidate is then verified color by color.
+
+#include "types.h"
+
+#include <filesystem>
+#include <vector>
+
+class ThreadPool;
+
+struct SearchMatch
+{
+	std::size_t offset;		// Byte offset of the first color.
+	int pattern;			// Index into SearchQuery::patterns.
+	int nDiffs;				// Number of differing colors.
+};
+
+struct SearchFileResult
+{
+	std::filesystem::path fn;
+	bool bOpened = false;
+	std::size_t size = 0;
+	std::vector<SearchMatch> matches;	// Sorted by offset.
+};
+
+struct SearchQuery
+{
+	// All patterns must have the same number of colors.
+	std::vector<std::vector<word>> patterns;
+	int maxDiffs = 0;
+	// Compare only the low 15 bits, as the PPU does.
+	bool bIgnoreBit15 = true;
+};
+
+class PaletteSearch
+{
+public:
+	// Returns false if the query is unusable (empty or mismatched patterns,
+	// or maxDiffs not smaller than the pattern length).
+	bool Prepare(const SearchQuery& query);
+
+	// Finds all matches starting at a byte offset in [begin, end).
+	void SearchRange(const byte* data, std::size_t size, std::size_t begin, std::size_t end, std::vector<SearchMatch>& out) const;
+	// Memory-maps every file and searches all of them on the pool; large
+	// files are split in chunks so a single ROM still uses every thread.
+	void SearchFiles(std::vector<SearchFileResult>& files, ThreadPool& pool) const;
+
+private:
+	struct BlockHash
+	{
+		unsigned long long hash;
+		int pattern;
+		int block;
+	};
+
+	word ReadColor(const byte* p) const;
+	unsigned long long HashWords(const word* p, std::size_t n) const;
+	int CountDiffs(const byte* data, std::size_t offset, int pattern, int limit) const;
+	bool BlockMatches(const byte* data, std::size_t offset, int pattern, int block) const;
+
+	SearchQuery q;
+	std::size_t length = 0;			// Colors per pattern.
+	std::size_t blockLength = 0;
+	int nBlocks = 0;
+	unsigned long long power = 1;	// HASH_BASE^(blockLength - 1)
+	std::vector<BlockHash> blockHashes;		// Sorted by hash.
+	std::vector<unsigned long long> filter;	// Bitmap of hash & FILTER_MASK.
+};
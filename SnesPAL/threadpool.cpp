@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned nThreads)
+{
+	if (nThreads == 0)
+		nThreads = std::thread::hardware_concurrency();
+	if (nThreads == 0)
+		nThreads = 1;
+
+	for (unsigned i = 0; i < nThreads; ++i)
+		queues.push_back(std::make_unique<Queue>());
+	for (unsigned i = 0; i < nThreads; ++i)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMtx);
+		bStop = true;
+	}
+	cvWork.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+void ThreadPool::Submit(Task task)
+{
+	unsigned index = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+	pending.fetch_add(1, std::memory_order_acq_rel);
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mtx);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		// Taking the lock orders the push against a worker about to sleep.
+		std::lock_guard<std::mutex> lock(sleepMtx);
+	}
+	cvWork.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(sleepMtx);
+	cvDone.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+}
+
+bool ThreadPool::PopTask(unsigned index, Task& task)
+{
+	{
+		Queue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (std::size_t i = 1; i < queues.size(); ++i)
+	{
+		Queue& victim = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mtx);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(unsigned index)
+{
+	for (;;)
+	{
+		Task task;
+		if (PopTask(index, task))
+		{
+			task();
+			if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::lock_guard<std::mutex> lock(sleepMtx);
+				cvDone.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMtx);
+		if (bStop)
+			return;
+		// Re-check under the lock so a Submit() between PopTask() and here is not missed.
+		cvWork.wait(lock, [&] {
+			if (bStop)
+				return true;
+			for (auto& q : queues)
+			{
+				std::lock_guard<std::mutex> qlock(q->mtx);
+				if (!q->tasks.empty())
+					return true;
+			}
+			return false;
+		});
+	}
+}
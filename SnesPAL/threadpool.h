@@ -0,0 +1,50 @@
+#pragma once
+
+// Work-stealing thread pool.
+// Every worker owns a task deque; it pops its own tasks from the back and,
+// when empty, steals from the front of the other workers' deques.
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	// nThreads == 0 uses std::thread::hardware_concurrency().
+	explicit ThreadPool(unsigned nThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Submit(Task task);
+	// Blocks until every submitted task has finished.
+	void Wait();
+	unsigned GetThreadCount() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+	struct Queue
+	{
+		std::mutex mtx;
+		std::deque<Task> tasks;
+	};
+
+	void WorkerLoop(unsigned index);
+	bool PopTask(unsigned index, Task& task);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> nextQueue{ 0 };
+	std::atomic<std::size_t> pending{ 0 };
+	std::mutex sleepMtx;
+	std::condition_variable cvWork, cvDone;
+	bool bStop = false;
+};
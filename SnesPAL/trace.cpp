@@ -0,0 +1,188 @@
+#include "trace.h"
+#include "fileio.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+std::atomic<bool> bTraceEnabled{ false };
+
+struct TraceEvent
+{
+	std::atomic<const char*> name;
+	std::atomic<long long> startNs;
+	std::atomic<long long> endNs;
+	std::atomic<int> tid;	// Of the thread that owned the ring at the time.
+};
+
+// Written by its thread only. Readers copy it and then drop whatever the
+// thread may have overwritten in the meantime.
+struct TraceRing
+{
+	TraceEvent events[TRACE_RING_SIZE];
+	std::atomic<unsigned long long> head{ 0 };	// Events ever recorded.
+	std::atomic<bool> bInUse{ true };
+	int tid = 0;	// Current owner, a new one each time the ring is handed over.
+};
+
+struct TraceCopy
+{
+	const char* name;
+	long long startNs;
+	long long endNs;
+	int tid;
+};
+
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+static std::atomic<long long> clearNs{ 0 };
+static std::mutex ringsMtx;
+static std::vector<std::unique_ptr<TraceRing>> rings;
+static int nThreads = 0;
+
+// Hands the ring over to the next new thread once its own thread exits, so
+// short-lived worker threads do not keep adding rings.
+struct TraceRingOwner
+{
+	TraceRing* ring = nullptr;
+	~TraceRingOwner()
+	{
+		if (ring)
+			ring->bInUse.store(false, std::memory_order_release);
+	}
+};
+static thread_local TraceRingOwner ringOwner;
+
+static TraceRing* AcquireRing()
+{
+	std::lock_guard<std::mutex> lock(ringsMtx);
+	for (auto& ring : rings)
+	{
+		bool bInUse = false;
+		if (ring->bInUse.compare_exchange_strong(bInUse, true, std::memory_order_acquire))
+		{
+			// Events the previous thread left keep its tid.
+			ring->tid = ++nThreads;
+			return ring.get();
+		}
+	}
+	rings.emplace_back(new TraceRing);
+	rings.back()->tid = ++nThreads;
+	return rings.back().get();
+}
+
+void Trace_SetEnabled(bool bEnable)
+{
+	bTraceEnabled.store(bEnable, std::memory_order_relaxed);
+}
+
+long long Trace_Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+void Trace_Record(const char* name, long long startNs, long long endNs)
+{
+	TraceRing* ring = ringOwner.ring;
+	if (!ring)
+		ring = ringOwner.ring = AcquireRing();
+
+	unsigned long long i = ring->head.load(std::memory_order_relaxed);
+	// Readers that see any of the stores below also see head == i.
+	std::atomic_thread_fence(std::memory_order_release);
+	TraceEvent& ev = ring->events[i & (TRACE_RING_SIZE - 1)];
+	ev.name.store(name, std::memory_order_relaxed);
+	ev.startNs.store(startNs, std::memory_order_relaxed);
+	ev.endNs.store(endNs, std::memory_order_relaxed);
+	ev.tid.store(ring->tid, std::memory_order_relaxed);
+	ring->head.store(i + 1, std::memory_order_release);
+}
+
+void Trace_Clear()
+{
+	clearNs.store(Trace_Now(), std::memory_order_relaxed);
+}
+
+static void CopyEvents(std::vector<TraceCopy>& events)
+{
+	long long since = clearNs.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(ringsMtx);
+	for (auto& ring : rings)
+	{
+		unsigned long long head = ring->head.load(std::memory_order_acquire);
+		unsigned long long first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		std::size_t base = events.size();
+		for (unsigned long long i = first; i < head; ++i)
+		{
+			const TraceEvent& ev = ring->events[i & (TRACE_RING_SIZE - 1)];
+			events.push_back({ ev.name.load(std::memory_order_relaxed), ev.startNs.load(std::memory_order_relaxed),
+				ev.endNs.load(std::memory_order_relaxed), ev.tid.load(std::memory_order_relaxed) });
+		}
+
+		// The event being written over the oldest slot counts as well.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned long long headAfter = ring->head.load(std::memory_order_relaxed);
+		unsigned long long valid = headAfter >= TRACE_RING_SIZE ? headAfter - TRACE_RING_SIZE + 1 : 0;
+		if (valid > first)
+			events.erase(events.begin() + base, events.begin() + base + static_cast<std::size_t>(std::min(valid, head) - first));
+	}
+	events.erase(std::remove_if(events.begin(), events.end(), [since](const TraceCopy& ev) { return ev.startNs < since; }), events.end());
+}
+
+bool Trace_WriteChrome(const std::filesystem::path& fn)
+{
+	std::vector<TraceCopy> events;
+	CopyEvents(events);
+	std::sort(events.begin(), events.end(), [](const TraceCopy& a, const TraceCopy& b) { return a.startNs < b.startNs; });
+
+	FILE* file = File_Open(fn, "wb");
+	if (!file)
+		return false;
+	// Complete ("X") events, times in microseconds.
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (std::size_t i = 0; i < events.size(); ++i)
+	{
+		const TraceCopy& ev = events[i];
+		fprintf(file, "{\"name\":\"%s\",\"cat\":\"snespal\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			ev.name, ev.tid, ev.startNs / 1000.0, (ev.endNs - ev.startNs) / 1000.0, i + 1 < events.size() ? "," : "");
+	}
+	fprintf(file, "]}\n");
+	bool bOk = !ferror(file);
+	return (fclose(file) == 0) && bOk;
+}
+
+void Trace_Summarize(std::vector<TraceSummary>& summary)
+{
+	std::vector<TraceCopy> events;
+	CopyEvents(events);
+	std::map<std::string, std::vector<double>> durations;
+	for (const auto& ev : events)
+		durations[ev.name].push_back((ev.endNs - ev.startNs) / 1000.0);
+
+	summary.clear();
+	for (auto& entry : durations)
+	{
+		std::vector<double>& us = entry.second;
+		std::sort(us.begin(), us.end());
+		TraceSummary s;
+		s.name = entry.first;
+		s.count = us.size();
+		s.totalUs = 0.0;
+		for (double d : us)
+			s.totalUs += d;
+		s.p50Us = us[(us.size() - 1) / 2];
+		s.p99Us = us[static_cast<std::size_t>((us.size() - 1) * 0.99 + 0.5)];
+		s.maxUs = us.back();
+		summary.push_back(s);
+	}
+	std::sort(summary.begin(), summary.end(), [](const TraceSummary& a, const TraceSummary& b) { return a.totalUs > b.totalUs; });
+}
+
+void Trace_PrintSummary(FILE* file)
+{
+	std::vector<TraceSummary> summary;
+	Trace_Summarize(summary);
+	fprintf(file, "%-24s %8s %12s %10s %10s %10s\n", "event", "count", "total ms", "p50 us", "p99 us", "max us");
+	for (const auto& s : summary)
+		fprintf(file, "%-24s %8zu %12.2f %10.1f %10.1f %10.1f\n", s.name.c_str(), s.count, s.totalUs / 1000.0, s.p50Us, s.p99Us, s.maxUs);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// Latency tracing.
+//
+// TRACE_SCOPE(name) times the rest of the enclosing block and, while tracing
+// is enabled, records it into a ring buffer owned by the calling thread, so
+// recording takes no lock; the oldest events are overwritten once a ring is
+// full. Names must be string literals, only the pointer is kept. The events
+// can be written as Chrome trace_event JSON (chrome://tracing, Perfetto) or
+// summarized per name.
+//
+// Tracing starts disabled and costs one relaxed load per scope until it is
+// enabled. Defining TRACE_DISABLED compiles every scope out.
+
+#include "types.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define TRACE_RING_SIZE		0x4000	// Events per thread, a power of two.
+
+struct TraceSummary
+{
+	std::string name;
+	std::size_t count;
+	double totalUs;
+	double p50Us;
+	double p99Us;
+	double maxUs;
+};
+
+extern std::atomic<bool> bTraceEnabled;
+
+inline bool Trace_IsEnabled() { return bTraceEnabled.load(std::memory_order_relaxed); }
+void Trace_SetEnabled(bool bEnable);
+// Nanoseconds since the process started tracing.
+long long Trace_Now();
+void Trace_Record(const char* name, long long startNs, long long endNs);
+// Forgets every recorded event.
+void Trace_Clear();
+
+// Both take a consistent copy of the rings; threads may keep recording.
+bool Trace_WriteChrome(const std::filesystem::path& fn);
+// Sorted by total time, longest first.
+void Trace_Summarize(std::vector<TraceSummary>& summary);
+// The summary as a table: count, total, p50, p99 and max per name.
+void Trace_PrintSummary(FILE* file);
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) : name(Trace_IsEnabled() ? name : nullptr), startNs(this->name ? Trace_Now() : 0) {}
+	~TraceScope()
+	{
+		if (name)
+			Trace_Record(name, startNs, Trace_Now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	long long startNs;
+};
+
+#define TRACE_JOIN2(a,b)	a##b
+#define TRACE_JOIN(a,b)		TRACE_JOIN2(a,b)
+
+#ifdef TRACE_DISABLED
+#define TRACE_SCOPE(name)	((void)0)
+#else
+#define TRACE_SCOPE(name)	TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+#endif
@@ -0,0 +1,145 @@
+#include "transform.h"
+#include "colorspace.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef SNESPAL_X86
+	#include <emmintrin.h>
+#endif
+
+static const char* const opNames[TRANSFORM_OP_COUNT] =
+{
+	"brightness", "contrast", "saturation", "hue", "tint", "grayscale"
+};
+
+const char* Transform_OpName(TransformOp op)
+{
+	return (op >= 0 && op < TRANSFORM_OP_COUNT) ? opNames[op] : "unknown";
+}
+
+void Transform_Compile(const TransformStep* steps, std::size_t nSteps, ColorTransform& xf)
+{
+	xf = ColorTransform();
+	for (std::size_t i = 0; i < nSteps; ++i)
+	{
+		float amount = steps[i].amount;
+		switch (steps[i].op)
+		{
+			case TRANSFORM_BRIGHTNESS:
+				xf.cL += amount;
+				break;
+			case TRANSFORM_CONTRAST:
+				xf.kL *= amount;
+				xf.cL = (xf.cL - 0.5f) * amount + 0.5f;
+				break;
+			case TRANSFORM_SATURATION:
+			case TRANSFORM_GRAYSCALE:
+			{
+				float k = (steps[i].op == TRANSFORM_SATURATION) ? std::max(amount, 0.0f) : 1.0f - std::min(std::max(amount, 0.0f), 1.0f);
+				for (float& v : xf.m)
+					v *= k;
+				xf.ta *= k;
+				xf.tb *= k;
+				break;
+			}
+			case TRANSFORM_HUE:
+			{
+				double rad = amount * 3.14159265358979323846 / 180.0;
+				float c = static_cast<float>(std::cos(rad)), s = static_cast<float>(std::sin(rad));
+				float m[4] = { c * xf.m[0] - s * xf.m[2], c * xf.m[1] - s * xf.m[3], s * xf.m[0] + c * xf.m[2], s * xf.m[1] + c * xf.m[3] };
+				float ta = c * xf.ta - s * xf.tb, tb = s * xf.ta + c * xf.tb;
+				std::copy(m, m + 4, xf.m);
+				xf.ta = ta;
+				xf.tb = tb;
+				break;
+			}
+			case TRANSFORM_TINT:
+			{
+				float t = std::min(std::max(amount, 0.0f), 1.0f), k = 1.0f - t;
+				const Lab& tint = ColorSpace_GetOKLabTable()[steps[i].color & 0x7FFF];
+				xf.kL *= k;
+				xf.cL = xf.cL * k + tint.L * t;
+				for (float& v : xf.m)
+					v *= k;
+				xf.ta = xf.ta * k + tint.a * t;
+				xf.tb = xf.tb * k + tint.b * t;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
+
+static void Apply_Scalar(const ColorTransform& xf, const Lab* okLab, const byte* levels, word* colors, std::size_t begin, std::size_t end)
+{
+	for (std::size_t i = begin; i < end; ++i)
+	{
+		const Lab& in = okLab[colors[i] & 0x7FFF];
+		Lab lab = {
+			xf.kL * in.L + xf.cL,
+			xf.m[0] * in.a + xf.m[1] * in.b + xf.ta,
+			xf.m[2] * in.a + xf.m[3] * in.b + xf.tb
+		};
+		float r, g, b;
+		ColorSpace_OKLabToLinear(lab, r, g, b);
+		colors[i] = static_cast<word>((colors[i] & 0x8000) | levels[ColorSpace_LevelIndex(r)] | (levels[ColorSpace_LevelIndex(g)] << 5) | (levels[ColorSpace_LevelIndex(b)] << 10));
+	}
+}
+
+#ifdef SNESPAL_X86
+
+// Four colors per step, same operations in the same order as Apply_Scalar.
+static void Apply_SSE2(const ColorTransform& xf, const Lab* okLab, const byte* levels, word* colors, std::size_t count)
+{
+	const __m128 kL = _mm_set1_ps(xf.kL), cL = _mm_set1_ps(xf.cL);
+	const __m128 m0 = _mm_set1_ps(xf.m[0]), m1 = _mm_set1_ps(xf.m[1]), m2 = _mm_set1_ps(xf.m[2]), m3 = _mm_set1_ps(xf.m[3]);
+	const __m128 ta = _mm_set1_ps(xf.ta), tb = _mm_set1_ps(xf.tb);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(static_cast<float>(COLORSPACE_LEVEL_LUT_SIZE)), half = _mm_set1_ps(0.5f);
+	#define INDEX(v)	_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale), half))
+
+	std::size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const Lab& c0 = okLab[colors[i] & 0x7FFF];
+		const Lab& c1 = okLab[colors[i + 1] & 0x7FFF];
+		const Lab& c2 = okLab[colors[i + 2] & 0x7FFF];
+		const Lab& c3 = okLab[colors[i + 3] & 0x7FFF];
+		__m128 inL = _mm_setr_ps(c0.L, c1.L, c2.L, c3.L);
+		__m128 inA = _mm_setr_ps(c0.a, c1.a, c2.a, c3.a);
+		__m128 inB = _mm_setr_ps(c0.b, c1.b, c2.b, c3.b);
+
+		__m128 L = _mm_add_ps(_mm_mul_ps(kL, inL), cL);
+		__m128 A = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, inA), _mm_mul_ps(m1, inB)), ta);
+		__m128 B = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, inA), _mm_mul_ps(m3, inB)), tb);
+
+		__m128 linR, linG, linB;
+		ColorSpace_OKLabToLinear_SSE2(L, A, B, linR, linG, linB);
+		alignas(16) int r[4], g[4], b[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(r), INDEX(linR));
+		_mm_store_si128(reinterpret_cast<__m128i*>(g), INDEX(linG));
+		_mm_store_si128(reinterpret_cast<__m128i*>(b), INDEX(linB));
+		for (int k = 0; k < 4; ++k)
+			colors[i + k] = static_cast<word>((colors[i + k] & 0x8000) | levels[r[k]] | (levels[g[k]] << 5) | (levels[b[k]] << 10));
+	}
+	#undef INDEX
+	Apply_Scalar(xf, okLab, levels, colors, i, count);
+}
+
+#endif
+
+void Transform_Apply(const ColorTransform& xf, word* colors, std::size_t count)
+{
+#ifdef SNESPAL_X86
+	Apply_SSE2(xf, ColorSpace_GetOKLabTable(), ColorSpace_GetLevelTable().nearest, colors, count);
+#else
+	Apply_Scalar(xf, ColorSpace_GetOKLabTable(), ColorSpace_GetLevelTable().nearest, colors, 0, count);
+#endif
+}
+
+void Transform_ApplyScalar(const ColorTransform& xf, word* colors, std::size_t count)
+{
+	Apply_Scalar(xf, ColorSpace_GetOKLabTable(), ColorSpace_GetLevelTable().nearest, colors, 0, count);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Color adjustments applied to palette ranges in OKLab.
+// A chain of steps is compiled into one affine map of (L, a, b), so any
+// number of steps costs a single pass: BGR555 -> OKLab -> map -> BGR555.
+
+#include "types.h"
+
+enum TransformOp
+{
+	TRANSFORM_BRIGHTNESS = 0,	// Adds amount to L, -1 to 1.
+	TRANSFORM_CONTRAST,			// Scales L around 0.5 by amount, 1 keeps it.
+	TRANSFORM_SATURATION,		// Scales a and b by amount, 0 is gray.
+	TRANSFORM_HUE,				// Rotates the hue by amount degrees.
+	TRANSFORM_TINT,				// Mixes amount (0 to 1) of color in.
+	TRANSFORM_GRAYSCALE,		// Removes amount (0 to 1) of the chroma.
+	TRANSFORM_OP_COUNT
+};
+
+struct TransformStep
+{
+	TransformOp op;
+	float amount;
+	word color;		// BGR555, TRANSFORM_TINT only.
+};
+
+// L' = kL * L + cL, (a', b') = m * (a, b) + (ta, tb).
+struct ColorTransform
+{
+	float kL = 1.0f, cL = 0.0f;
+	float m[4] = { 1.0f, 0.0f, 0.0f, 1.0f };
+	float ta = 0.0f, tb = 0.0f;
+};
+
+const char* Transform_OpName(TransformOp op);
+// Folds the steps, in order, into one transform.
+void Transform_Compile(const TransformStep* steps, std::size_t nSteps, ColorTransform& xf);
+
+// Transforms colors in place under the active expansion mode. Bit 15 is kept,
+// and the identity transform leaves every color unchanged.
+void Transform_Apply(const ColorTransform& xf, word* colors, std::size_t count);
+// Same without SIMD, the reference for the vectorized kernel.
+void Transform_ApplyScalar(const ColorTransform& xf, word* colors, std::size_t count);
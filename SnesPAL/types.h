@@ -0,0 +1,15 @@
+#pragma once
+
+// Basic types shared by the editor and the portable (non-Win32) code.
+
+#include <cstdint>
+#include <cstddef>
+
+// x86 and x64 builds, which compile the SSE2 (and AVX2) kernels.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define SNESPAL_X86
+#endif
+
+typedef unsigned char byte;
+typedef unsigned short word;
+typedef unsigned int dword;
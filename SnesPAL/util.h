@@ -18,6 +18,7 @@
 
 #pragma warning(disable: 4996)
 
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -27,9 +28,7 @@
 #include <vector>
 #include <deque>
 
-#define LP_CLASS_NAME TEXT("SnesPAL")
-#define ERROR_MBX(parent,msg) MessageBox(parent, msg, L"ERROR", MB_OK | MB_ICONERROR);
+#include "types.h"
 
-typedef unsigned char byte;
-typedef unsigned short word;
-typedef unsigned int dword;
\ No newline at end of file
+#define LP_CLASS_NAME TEXT("SnesPAL")
+#define ERROR_MBX(parent,msg) MessageBox(parent, msg, L"ERROR", MB_OK | MB_ICONERROR);
\ No newline at end of file
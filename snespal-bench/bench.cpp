@@ -0,0 +1,366 @@
+/*
+ * snespal-bench - benchmark suite of the portable core.
+ *
+ * Times color conversion, transforms, CIEDE2000, palette loading/saving,
+ * undo history and grid rendering through snespal-core, the same code the editor runs, and writes
+ * the results as JSON so runs can be compared between releases.
+ *
+*/
+
+#include "types.h"
+#include "color.h"
+#include "colortable.h"
+#include "palfile.h"
+#include "history.h"
+#include "render.h"
+#include "transform.h"
+#include "diff.h"
+#include "fileio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+#define BENCH_SCHEMA_VERSION	1
+
+struct BenchResult
+{
+	std::string name;
+	const char* unit;
+	double value;
+	bool bHigherIsBetter;
+};
+
+static std::vector<BenchResult> results;
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: snespal-bench [--rounds n] [--out results.json]\n"
+		"\n"
+		"  Runs every benchmark, best of --rounds (default 5) where a round is\n"
+		"  short, and writes JSON to --out or stdout. A readable summary goes\n"
+		"  to stderr. Disk benchmarks use a directory under the system temp path.\n");
+}
+
+static void Report(const std::string& name, const char* unit, double value, bool bHigherIsBetter)
+{
+	results.push_back({ name, unit, value, bHigherIsBetter });
+	fprintf(stderr, "%-28s %12.3f %s\n", name.c_str(), value, unit);
+}
+
+static double Seconds(std::chrono::steady_clock::time_point tStart)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+// Shortest time of nRounds calls of proc.
+template<class Proc>
+static double BestOf(int nRounds, Proc proc)
+{
+	double best = 0.0;
+	for (int round = 0; round < nRounds; ++round)
+	{
+		auto tStart = std::chrono::steady_clock::now();
+		proc();
+		double seconds = Seconds(tStart);
+		if (!round || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+static double Percentile(std::vector<double>& samples, double p)
+{
+	if (samples.empty())
+		return 0.0;
+	std::sort(samples.begin(), samples.end());
+	std::size_t i = static_cast<std::size_t>(p * (samples.size() - 1) + 0.5);
+	return samples[i];
+}
+
+static void FillPalette(word* palette, dword seed)
+{
+	for (int i = 0; i < PAL_COLORS; ++i)
+		palette[i] = static_cast<word>(((i + seed) * 2654435761u) >> 9) & 0x7FFF;
+}
+
+// Every kernel the CPU has, then the active one under each expansion mode.
+static void BenchConversion(int nRounds)
+{
+	const std::size_t nColors = 1 << 20;
+	std::vector<word> snes(nColors), snesOut(nColors);
+	std::vector<dword> rgb(nColors), rgbIn(nColors);
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		dword hash = static_cast<dword>(i * 2654435761u);
+		snes[i] = static_cast<word>(hash >> 8) & 0x7FFF;
+		rgbIn[i] = hash & 0xFFFFFF;
+	}
+
+	ColorKernel active = Color_GetKernel();
+	for (int k = 0; k < COLOR_KERNEL_COUNT; ++k)
+	{
+		ColorKernel kernel = static_cast<ColorKernel>(k);
+		if (!Color_SetKernel(kernel))
+			continue;
+		std::string name = std::string("convert.") + Color_KernelName(kernel);
+		double seconds = BestOf(nRounds, [&] { Color_ConvertFromSNESBatch(snes.data(), rgb.data(), nColors); });
+		Report(name + ".from_snes", "Mcolors/s", nColors / seconds / 1e6, true);
+		seconds = BestOf(nRounds, [&] { Color_ConvertToSNESBatch(rgbIn.data(), snesOut.data(), nColors); });
+		Report(name + ".to_snes", "Mcolors/s", nColors / seconds / 1e6, true);
+	}
+	Color_SetKernel(active);
+
+	ColorExpand mode = Color_GetExpandMode();
+	for (int m = 0; m < COLOR_EXPAND_COUNT; ++m)
+	{
+		Color_SetExpandMode(static_cast<ColorExpand>(m));
+		std::string name = std::string("convert.expand.") + Color_ExpandModeName(static_cast<ColorExpand>(m));
+		double seconds = BestOf(nRounds, [&] { Color_ConvertFromSNESBatch(snes.data(), rgb.data(), nColors); });
+		Report(name + ".from_snes", "Mcolors/s", nColors / seconds / 1e6, true);
+		seconds = BestOf(nRounds, [&] { Color_ConvertToSNESBatch(rgbIn.data(), snesOut.data(), nColors); });
+		Report(name + ".to_snes", "Mcolors/s", nColors / seconds / 1e6, true);
+	}
+	Color_SetExpandMode(mode);
+}
+
+// Color adjustment and CIEDE2000, the vectorized kernels and the scalar ones.
+static void BenchKernels(int nRounds)
+{
+	const std::size_t nColors = 1 << 20;
+	std::vector<word> snes(nColors), other(nColors);
+	std::vector<float> deltaE(nColors);
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		// Half the pairs are near each other, where the hue terms matter most.
+		snes[i] = static_cast<word>(static_cast<dword>(i * 2654435761u) >> 8) & 0x7FFF;
+		dword hash = static_cast<dword>(i * 40503u + 0x9E37u) * 2654435761u;
+		other[i] = (i & 1) ? static_cast<word>(snes[i] ^ (hash & 0x0421)) : static_cast<word>(hash >> 9) & 0x7FFF;
+	}
+
+	const TransformStep steps[] = {
+		{ TRANSFORM_HUE, 40.0f, 0 }, { TRANSFORM_SATURATION, 1.3f, 0 }, { TRANSFORM_CONTRAST, 1.1f, 0 },
+		{ TRANSFORM_TINT, 0.2f, 0x7C1F }, { TRANSFORM_BRIGHTNESS, -0.05f, 0 }
+	};
+	ColorTransform xf;
+	Transform_Compile(steps, sizeof(steps) / sizeof(steps[0]), xf);
+	std::vector<word> out = snes;
+	double seconds = BestOf(nRounds, [&] { Transform_Apply(xf, out.data(), nColors); });
+	Report("transform.vectorized", "Mcolors/s", nColors / seconds / 1e6, true);
+	seconds = BestOf(nRounds, [&] { Transform_ApplyScalar(xf, out.data(), nColors); });
+	Report("transform.scalar", "Mcolors/s", nColors / seconds / 1e6, true);
+
+	seconds = BestOf(nRounds, [&] { Diff_DeltaE(snes.data(), other.data(), deltaE.data(), nColors); });
+	Report("deltae2000.vectorized", "Mcolors/s", nColors / seconds / 1e6, true);
+	seconds = BestOf(nRounds, [&] { Diff_DeltaEScalar(snes.data(), other.data(), deltaE.data(), nColors); });
+	Report("deltae2000.scalar", "Mcolors/s", nColors / seconds / 1e6, true);
+}
+
+// Parsing and writing in memory, then whole files through the atomic save.
+static bool BenchPaletteIO(int nRounds, const fs::path& dir)
+{
+	const int nFiles = 64;
+	const int nRepeats = 2000;
+	word palette[PAL_COLORS], loaded[PAL_COLORS];
+	FillPalette(palette, 1);
+
+	for (int f = PALFMT_UNKNOWN + 1; f < PALFMT_COUNT; ++f)
+	{
+		PalFormat fmt = static_cast<PalFormat>(f);
+		std::string name = std::string("palfile.") + PalFile_GetFormatInfo(fmt)->name;
+		std::vector<byte> data;
+		if (PalFile_Serialize(palette, fmt, data) != PALERR_OK)
+		{
+			fprintf(stderr, "error: cannot write %s.\n", name.c_str());
+			return false;
+		}
+		double mb = static_cast<double>(data.size()) * nRepeats / 1e6;
+
+		double seconds = BestOf(nRounds, [&] {
+			for (int i = 0; i < nRepeats; ++i)
+				PalFile_Parse(data.data(), data.size(), loaded);
+		});
+		Report(name + ".parse", "MB/s", mb / seconds, true);
+		seconds = BestOf(nRounds, [&] {
+			std::vector<byte> out;
+			for (int i = 0; i < nRepeats; ++i)
+				PalFile_Serialize(palette, fmt, out);
+		});
+		Report(name + ".serialize", "MB/s", mb / seconds, true);
+
+		// Disk rounds are slow, one is enough.
+		std::vector<fs::path> files;
+		for (int i = 0; i < nFiles; ++i)
+			files.push_back(dir / (std::to_string(i) + "." + PalFile_FormatExtension(fmt)));
+		std::size_t nBytes = 0, n = 0;
+		auto tStart = std::chrono::steady_clock::now();
+		for (const auto& fn : files)
+		{
+			if (PalFile_Save(fn, palette, fmt, &n) != PALERR_OK)
+			{
+				fprintf(stderr, "error: cannot save %s.\n", fn.u8string().c_str());
+				return false;
+			}
+			nBytes += n;
+		}
+		Report(name + ".save", "MB/s", nBytes / Seconds(tStart) / 1e6, true);
+		nBytes = 0;
+		tStart = std::chrono::steady_clock::now();
+		for (const auto& fn : files)
+		{
+			if (PalFile_Load(fn, loaded, &n) != PALERR_OK)
+			{
+				fprintf(stderr, "error: cannot load %s.\n", fn.u8string().c_str());
+				return false;
+			}
+			nBytes += n;
+		}
+		Report(name + ".load", "MB/s", nBytes / Seconds(tStart) / 1e6, true);
+	}
+	return true;
+}
+
+// Latency of single operations as the editor makes them: strokes of one to
+// a few cells, then undoing and redoing all of them.
+static void BenchHistory()
+{
+	const std::size_t nOps = 20000;
+	word palette[PAL_COLORS];
+	FillPalette(palette, 2);
+	bool bDrawMode = true;
+	History history;
+	history.Reset(palette, bDrawMode);
+
+	std::vector<double> record, undo, redo;
+	for (std::size_t op = 0; op < nOps; ++op)
+	{
+		dword r = static_cast<dword>((op + 1) * 2654435761u);
+		int cell = r >> 24, nCells = 1 + (r & 3);
+		for (int c = 0; c < nCells; ++c)
+			palette[(cell + c) & 0xFF] = static_cast<word>((r >> 5) + c * 0x421) & 0x7FFF;
+		auto tStart = std::chrono::steady_clock::now();
+		history.Record(palette, bDrawMode, L"Draw to palette.");
+		record.push_back(Seconds(tStart) * 1e6);
+	}
+	while (history.CanUndo())
+	{
+		auto tStart = std::chrono::steady_clock::now();
+		history.Undo(palette, bDrawMode);
+		undo.push_back(Seconds(tStart) * 1e6);
+	}
+	while (history.CanRedo())
+	{
+		auto tStart = std::chrono::steady_clock::now();
+		history.Redo(palette, bDrawMode);
+		redo.push_back(Seconds(tStart) * 1e6);
+	}
+
+	Report("history.record.p50", "us", Percentile(record, 0.50), false);
+	Report("history.record.p99", "us", Percentile(record, 0.99), false);
+	Report("history.undo.p50", "us", Percentile(undo, 0.50), false);
+	Report("history.undo.p99", "us", Percentile(undo, 0.99), false);
+	Report("history.redo.p50", "us", Percentile(redo, 0.50), false);
+	Report("history.redo.p99", "us", Percentile(redo, 0.99), false);
+}
+
+// A full editor frame at zoom 1 and 4, and the single cell repaint of an edit.
+static void BenchRender(int nRounds)
+{
+	const int nFrames = 200;
+	word palette[PAL_COLORS];
+	FillPalette(palette, 3);
+
+	for (int zoom : { 1, 4 })
+	{
+		RenderOptions opt;
+		opt.zoom = zoom;
+		opt.bGrid = true;
+		int size = Render_GetGridSize(opt);
+		std::vector<dword> pixels(static_cast<std::size_t>(size) * size);
+		Framebuffer fb = { pixels.data(), size, size, size };
+
+		double seconds = BestOf(nRounds, [&] {
+			for (int i = 0; i < nFrames; ++i)
+				Render_PaletteGrid(fb, palette, opt);
+		});
+		Report("render.grid.zoom" + std::to_string(zoom), "us/frame", seconds * 1e6 / nFrames, false);
+		seconds = BestOf(nRounds, [&] {
+			for (int i = 0; i < nFrames; ++i)
+				Render_PaletteCell(fb, palette, i & 0xFF, opt);
+		});
+		Report("render.cell.zoom" + std::to_string(zoom), "us/cell", seconds * 1e6 / nFrames, false);
+	}
+}
+
+static bool WriteJson(FILE* file)
+{
+	fprintf(file, "{\n  \"schema\": %d,\n  \"kernel\": \"%s\",\n  \"results\": [\n", BENCH_SCHEMA_VERSION, Color_KernelName(Color_GetKernel()));
+	for (std::size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchResult& result = results[i];
+		fprintf(file, "    { \"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, \"better\": \"%s\" }%s\n",
+			result.name.c_str(), result.unit, result.value, result.bHigherIsBetter ? "higher" : "lower",
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	return !ferror(file);
+}
+
+int main(int argc, char** argv)
+{
+	int nRounds = 5;
+	const char* out = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+			nRounds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+			out = argv[++i];
+		else
+		{
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (nRounds < 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::error_code ec;
+	fs::path dir = fs::temp_directory_path(ec) / ("snespal-bench-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+	if (ec || !fs::create_directories(dir, ec))
+	{
+		fprintf(stderr, "error: cannot create %s.\n", dir.u8string().c_str());
+		return 1;
+	}
+
+	BenchConversion(nRounds);
+	BenchKernels(nRounds);
+	bool bOk = BenchPaletteIO(nRounds, dir);
+	BenchHistory();
+	BenchRender(nRounds);
+	fs::remove_all(dir, ec);
+	if (!bOk)
+		return 1;
+
+	FILE* file = out ? File_Open(fs::u8path(out), "w") : stdout;
+	if (!file || !WriteJson(file))
+	{
+		fprintf(stderr, "error: cannot write %s.\n", out ? out : "results");
+		return 1;
+	}
+	if (out)
+		fclose(file);
+	return 0;
+}
@@ -0,0 +1,2759 @@
+/*
+ * snespal-cli - headless palette converter.
+ *
+ * Shares palette I/O with the editor, but has no Win32 dependency so it can
+ * run on build machines.
+ *
+*/
+
+#include "types.h"
+#include "color.h"
+#include "colortable.h"
+#include "palfile.h"
+#include "render.h"
+#include "image.h"
+#include "fileio.h"
+#include "rom.h"
+#include "threadpool.h"
+#include "search.h"
+#include "gfx.h"
+#include "gradient.h"
+#include "quantize.h"
+#include "colormap.h"
+#include "transform.h"
+#include "fade.h"
+#include "ppu.h"
+#include "library.h"
+#include "diff.h"
+#include "colorspace.h"
+#include "history.h"
+#include "document.h"
+#include "journal.h"
+#include "filewatch.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct ConvertJob
+{
+	fs::path src;
+	fs::path dest;
+};
+
+struct ConvertStats
+{
+	std::atomic<std::size_t> nFiles{ 0 };
+	std::atomic<std::size_t> nFailed{ 0 };
+	std::atomic<std::size_t> nBytes{ 0 };
+};
+
+static std::mutex logMtx;
+
+static void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: snespal-cli convert <input> <output> [--to format] [--expand mode] [-j threads]\n"
+		"       snespal-cli render <palette> <image.bmp|ppm> [--zoom n] [--grid] [--frames n] [--golden file]\n"
+		"       snespal-cli rom-read <rom> <address> <palette> [--colors n] [--lorom|--hirom]\n"
+		"       snespal-cli rom-write <palette> <address> <rom>... [--colors n] [--lorom|--hirom] [-j threads]\n"
+		"       snespal-cli search <palette> <file|dir>... [--row n] [--diffs n] [-j threads]\n"
+		"       snespal-cli gfx <graphics.bin> <palette> <image.bmp|ppm> [--bpp 2|4|8] [--row n] [--width tiles] [--frames n]\n"
+		"       snespal-cli gradient <output.bin|asm> <line:color>... [--lines n] [--dither] [--coldata]\n"
+		"       snespal-cli gradient --batch <list> [--lines n] [--dither] [--coldata] [-j threads]\n"
+		"       snespal-cli quantize <image.bmp|ppm> <palette> [--palettes n] [--colors n] [--row n]\n"
+		"                   [--transparent auto|none|#RRGGBB] [--preview image] [-j threads]\n"
+		"       snespal-cli adjust <input> <output> <step>... [--row n | --cells first-last] [-j threads]\n"
+		"       snespal-cli fade <palette|dir> <output.bin|tpl|dir> [--mode black|white|cross|brightness]\n"
+		"                   [--to palette] [--frames n] [--in] [--strip image] [--tpl] [-j threads]\n"
+		"       snespal-cli compose <scene> <palette> <image.bmp|ppm> [--frames n] [--golden file]\n"
+		"       snespal-cli remap <image.bmp|ppm> <palette> <output.bmp|ppm> [--row n] [--updates n] [-j threads]\n"
+		"       snespal-cli library <pack> import <file|dir>... [-j threads]\n"
+		"       snespal-cli library <pack> find <palette> [--row n]\n"
+		"       snespal-cli diff <old> <new> [--threshold deltaE] [--grid image|dir] [--zoom n] [-j threads]\n"
+		"       snespal-cli parse <dir> [--generate n] [--rounds n]\n"
+		"       snespal-cli journal <palette> <journal> [--ops n] [--rate ops/s]\n"
+		"       snespal-cli watch <palette> [--writes n] [--poll]\n"
+		"       snespal-cli documents <dir> [--edits n]\n"
+		"       snespal-cli verify\n"
+		"       snespal-cli <command> ... --trace <trace.json>\n"
+		"\n"
+		"  convert: <input> may be a palette file or a directory, which is converted\n"
+		"           recursively into the same tree layout under <output>.\n"
+		"           --expand picks the 5-bit -> 8-bit expansion used for RGB\n"
+		"           formats: divide (default), replicate or gamma. Input formats\n"
+		"           are detected from the contents; --to takes pal (also yychr),\n"
+		"           tpl, mw3, act, gpl, jasc or cgram.\n"
+		"  render:  draws the editor grid headless, reports the frame time and\n"
+		"           optionally compares the image with a golden file.\n"
+		"  rom-read/rom-write: read or patch palettes in place inside .smc/.sfc\n"
+		"           images; <address> is a SNES address such as $0EF600.\n"
+		"  search:  finds the 16-color rows of <palette> (or only --row n) in ROMs\n"
+		"           and binary dumps, allowing up to --diffs differing colors.\n"
+		"  gfx:     decodes planar SNES tiles, draws them with one palette row\n"
+		"           and reports the decode and recolor time.\n"
+		"  gradient: builds HDMA gradient tables from key colors ($BGR555 or\n"
+		"           #RRGGBB) interpolated in OKLab over 224 or 239 lines. A batch\n"
+		"           list holds one '<output> <line:color>...' gradient per line.\n"
+		"  quantize: computes up to 8 sub-palettes of 15 colors plus a shared\n"
+		"           transparent color 0 for an image, picking one per 8x8 tile,\n"
+		"           and stores them from palette row --row on.\n"
+		"  adjust:  applies color steps to all colors, one row or a range of cells\n"
+		"           of a palette file or directory tree. Steps run in order in OKLab:\n"
+		"           brightness:d (-1 to 1), contrast:k, saturation:k, hue:degrees,\n"
+		"           tint:color:t (0 to 1) and grayscale[:t].\n"
+		"  fade:    builds --frames palettes fading to black or white through color\n"
+		"           math, to the --to palette, or through INIDISP brightness; --in\n"
+		"           reverses them. A directory is processed file by file into\n"
+		"           <output>, as .bin or with --tpl as numbered .tpl files.\n"
+		"  compose: renders a 256x224 frame of a scene file (BG/OBJ graphics,\n"
+		"           sprites, main/sub screen, windows, color math) scanline by\n"
+		"           scanline, reports frames/s and optionally compares the image.\n"
+		"  remap:   redraws an image with the nearest palette colors (or only row\n"
+		"           --row n) through an inverse colormap, and times full builds\n"
+		"           against --updates single-color updates.\n"
+		"  library: adds palettes and each of their 16-color rows to a deduplicated\n"
+		"           pack file with the files and rows they came from; find looks\n"
+		"           a palette (or row --row n) up by content.\n"
+		"  diff:    compares two palettes, or two trees matched by relative path,\n"
+		"           with CIEDE2000. Prints tab-separated file, row and color lines\n"
+		"           (colors above --threshold, default 1.0) and exits with 1 if\n"
+		"           any file changed. --grid draws old, new and deltaE side by side.\n"
+		"  parse:   detects and parses every file under <dir> and reports the\n"
+		"           throughput per format. --generate first writes n palettes\n"
+		"           cycling through all formats and checks that they read back.\n"
+		"  journal: records --ops draw-mode edits, undos and redos of <palette>\n"
+		"           in a crash-recovery journal (at --rate per second, default as\n"
+		"           fast as possible), then times replaying and compacting it.\n"
+		"  watch:   rewrites <palette> --writes times, one color each, and reports\n"
+		"           how long the file watcher takes to see each write (--poll uses\n"
+		"           the polling backend). The palette is restored afterwards.\n"
+		"  documents: opens every palette under <dir> as an editor document and\n"
+		"           makes --edits single-color edits across them, keeping a\n"
+		"           snapshot after each, then reports how many 16-color rows they\n"
+		"           share and how long a snapshot takes. Nothing is written.\n"
+		"  verify:  checks that every conversion kernel and the lookup tables match\n"
+		"           the scalar conversion, that constant gradients and identity\n"
+		"           transforms keep every color in every expansion mode, and that\n"
+		"           the vectorized transform and CIEDE2000 kernels match the scalar\n"
+		"           and reference ones (published pairs); exits with 1 on a\n"
+		"           mismatch. Timings are in snespal-bench.\n"
+		"  --trace: records the latency of palette I/O, undo history, rendering,\n"
+		"           decoding and journal writes while the command runs, writes\n"
+		"           them as Chrome trace_event JSON and prints p50/p99 per event.\n");
+}
+
+static void LogError(const fs::path& fn, const char* msg)
+{
+	std::lock_guard<std::mutex> lock(logMtx);
+	fprintf(stderr, "error: %s: %s\n", fn.u8string().c_str(), msg);
+}
+
+static void ConvertFile(const ConvertJob& job, PalFormat fmt, ConvertStats& stats)
+{
+	word palette[PAL_COLORS] = { 0x0000 };
+	std::size_t nRead = 0, nWritten = 0;
+
+	PalError err = PalFile_Load(job.src, palette, &nRead);
+	if (err == PALERR_OK)
+	{
+		std::error_code ec;
+		fs::create_directories(job.dest.parent_path(), ec);
+		err = PalFile_Save(job.dest, palette, fmt, &nWritten);
+	}
+
+	stats.nFiles.fetch_add(1, std::memory_order_relaxed);
+	stats.nBytes.fetch_add(nRead + nWritten, std::memory_order_relaxed);
+	if (err != PALERR_OK)
+	{
+		stats.nFailed.fetch_add(1, std::memory_order_relaxed);
+		LogError(job.src, PalFile_ErrorString(err));
+	}
+}
+
+static fs::path MakeDestPath(fs::path dest, PalFormat fmt)
+{
+	if (fmt != PALFMT_UNKNOWN)
+		dest.replace_extension(PalFile_FormatExtension(fmt));
+	return dest;
+}
+
+static bool CollectJobs(const fs::path& input, const fs::path& output, PalFormat fmt, std::vector<ConvertJob>& jobs)
+{
+	std::error_code ec;
+	if (!fs::is_directory(input, ec))
+	{
+		if (!fs::exists(input, ec))
+		{
+			LogError(input, "No such file or directory.");
+			return false;
+		}
+		fs::path dest = fs::is_directory(output, ec) ? output / input.filename() : output;
+		jobs.push_back({ input, MakeDestPath(dest, fmt) });
+		return true;
+	}
+
+	fs::recursive_directory_iterator it(input, fs::directory_options::skip_permission_denied, ec), end;
+	for (; !ec && it != end; it.increment(ec))
+	{
+		if (!it->is_regular_file(ec) || PalFile_FormatFromPath(it->path()) == PALFMT_UNKNOWN)
+			continue;
+		fs::path rel = it->path().lexically_relative(input);
+		jobs.push_back({ it->path(), MakeDestPath(output / rel, fmt) });
+	}
+	if (ec)
+		LogError(input, ec.message().c_str());
+	return true;
+}
+
+static int Command_Convert(int argc, char** argv)
+{
+	const char* input = nullptr;
+	const char* output = nullptr;
+	PalFormat fmt = PALFMT_UNKNOWN;
+	unsigned nThreads = 0;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--to") && i + 1 < argc)
+		{
+			fmt = PalFile_FormatFromName(argv[++i]);
+			if (fmt == PALFMT_UNKNOWN)
+			{
+				fprintf(stderr, "Unknown format '%s'.\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "--expand") && i + 1 < argc)
+		{
+			int mode = 0;
+			while (mode < COLOR_EXPAND_COUNT && strcmp(argv[i + 1], Color_ExpandModeName(static_cast<ColorExpand>(mode))))
+				++mode;
+			if (mode == COLOR_EXPAND_COUNT)
+			{
+				fprintf(stderr, "Unknown expansion mode '%s'.\n", argv[i + 1]);
+				return 2;
+			}
+			Color_SetExpandMode(static_cast<ColorExpand>(mode));
+			++i;
+		}
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else if (!input)
+			input = argv[i];
+		else if (!output)
+			output = argv[i];
+		else
+		{
+			PrintUsage();
+			return 2;
+		}
+	}
+
+	if (!input || !output)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::vector<ConvertJob> jobs;
+	if (!CollectJobs(fs::u8path(input), fs::u8path(output), fmt, jobs))
+		return 1;
+
+	ConvertStats stats;
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		for (const auto& job : jobs)
+			pool.Submit([&job, fmt, &stats] { ConvertFile(job, fmt, stats); });
+		pool.Wait();
+		nThreads = pool.GetThreadCount();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	std::size_t nFiles = stats.nFiles.load();
+	std::size_t nFailed = stats.nFailed.load();
+	double mb = stats.nBytes.load() / (1024.0 * 1024.0);
+	printf("Converted %zu file(s), %zu failed, %u thread(s), %.3f s: %.1f files/s, %.2f MB/s\n",
+		nFiles - nFailed, nFailed, nThreads, seconds, nFiles / seconds, mb / seconds);
+	return nFailed ? 1 : 0;
+}
+
+static bool ReadWholeFile(const fs::path& fn, std::vector<byte>& data)
+{
+	FILE* file = File_Open(fn, "rb");
+	if (!file)
+		return false;
+	byte buffer[0x4000];
+	std::size_t n;
+	data.clear();
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(file);
+	return true;
+}
+
+static int Command_Render(int argc, char** argv)
+{
+	const char* input = nullptr;
+	const char* output = nullptr;
+	const char* golden = nullptr;
+	RenderOptions opt;
+	int nFrames = 1000;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--zoom") && i + 1 < argc)
+			opt.zoom = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--grid"))
+			opt.bGrid = true;
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			nFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--golden") && i + 1 < argc)
+			golden = argv[++i];
+		else if (!input)
+			input = argv[i];
+		else if (!output)
+			output = argv[i];
+		else
+		{
+			PrintUsage();
+			return 2;
+		}
+	}
+	if (!input || !output || opt.zoom < 1 || opt.zoom > RENDER_MAX_ZOOM || nFrames < 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(input), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(input), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	int size = Render_GetGridSize(opt);
+	std::vector<dword> pixels(static_cast<std::size_t>(size) * size);
+	Framebuffer fb = { pixels.data(), size, size, size };
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; ++i)
+		Render_PaletteGrid(fb, palette, opt);
+	double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nFrames;
+	printf("%dx%d, %d frame(s): %.2f us/frame\n", size, size, nFrames, us);
+
+	if (!Image_Write(fs::u8path(output), fb))
+	{
+		LogError(fs::u8path(output), "Cannot write image.");
+		return 1;
+	}
+
+	if (golden)
+	{
+		std::vector<byte> outData, goldenData;
+		if (!ReadWholeFile(fs::u8path(golden), goldenData) || !ReadWholeFile(fs::u8path(output), outData))
+		{
+			LogError(fs::u8path(golden), "Cannot read golden image.");
+			return 1;
+		}
+		if (outData != goldenData)
+		{
+			printf("Image differs from %s\n", golden);
+			return 1;
+		}
+		printf("Image matches %s\n", golden);
+	}
+	return 0;
+}
+
+static bool ParseAddress(const char* str, dword& address)
+{
+	if (*str == '$')
+		++str;
+	else if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		str += 2;
+	char* pEnd = nullptr;
+	unsigned long value = strtoul(str, &pEnd, 16);
+	if (!*str || *pEnd || value > 0xFFFFFF)
+		return false;
+	address = static_cast<dword>(value);
+	return true;
+}
+
+// Options shared by rom-read and rom-write. Returns false on a bad option.
+static bool ParseRomOption(int argc, char** argv, int& i, std::size_t& nColors, RomMapping& mapping)
+{
+	if (!strcmp(argv[i], "--colors") && i + 1 < argc)
+	{
+		nColors = strtoul(argv[++i], nullptr, 0);
+		return nColors > 0 && nColors <= PAL_COLORS;
+	}
+	if (!strcmp(argv[i], "--lorom"))
+		mapping = ROM_MAP_LOROM;
+	else if (!strcmp(argv[i], "--hirom"))
+		mapping = ROM_MAP_HIROM;
+	else
+		return false;
+	return true;
+}
+
+static int Command_RomRead(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nColors = PAL_COLORS;
+	RomMapping mapping = ROM_MAP_UNKNOWN;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (argv[i][0] == '-' && argv[i][1] == '-')
+		{
+			if (!ParseRomOption(argc, argv, i, nColors, mapping))
+			{
+				PrintUsage();
+				return 2;
+			}
+		}
+		else
+			args.push_back(argv[i]);
+	}
+
+	dword address = 0;
+	if (args.size() != 3 || !ParseAddress(args[1], address))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	Rom rom;
+	fs::path romPath = fs::u8path(args[0]);
+	if (!Rom_Open(rom, romPath, false, mapping))
+	{
+		LogError(romPath, "Cannot open ROM.");
+		return 1;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	if (!Rom_ReadPalette(rom, address, palette, nColors))
+	{
+		LogError(romPath, "Address is outside of the ROM.");
+		return 1;
+	}
+
+	PalError err = PalFile_Save(fs::u8path(args[2]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[2]), PalFile_ErrorString(err));
+		return 1;
+	}
+	printf("%s (%s, %zu byte header): read %zu color(s) from $%06X (file offset 0x%zX)\n", args[0],
+		Rom_MappingName(rom.mapping), rom.headerSize, nColors, address, Rom_SNESToOffset(rom, address));
+	return 0;
+}
+
+static int Command_RomWrite(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nColors = PAL_COLORS;
+	RomMapping mapping = ROM_MAP_UNKNOWN;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else if (argv[i][0] == '-' && argv[i][1] == '-')
+		{
+			if (!ParseRomOption(argc, argv, i, nColors, mapping))
+			{
+				PrintUsage();
+				return 2;
+			}
+		}
+		else
+			args.push_back(argv[i]);
+	}
+
+	dword address = 0;
+	if (args.size() < 3 || !ParseAddress(args[1], address))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[0]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[0]), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	std::atomic<std::size_t> nFailed{ 0 };
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		for (std::size_t i = 2; i < args.size(); ++i)
+		{
+			pool.Submit([&, i] {
+				Rom rom;
+				fs::path romPath = fs::u8path(args[i]);
+				const char* pError = nullptr;
+				if (!Rom_Open(rom, romPath, true, mapping))
+					pError = "Cannot open ROM.";
+				else if (!Rom_WritePalette(rom, address, palette, nColors))
+					pError = "Address is outside of the ROM.";
+				else if (!Rom_Save(rom))
+					pError = "Cannot write ROM.";
+				if (pError)
+				{
+					nFailed.fetch_add(1, std::memory_order_relaxed);
+					LogError(romPath, pError);
+				}
+			});
+		}
+		pool.Wait();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	std::size_t nRoms = args.size() - 2;
+	printf("Patched %zu ROM(s), %zu failed, %.3f s\n", nRoms - nFailed.load(), nFailed.load(), seconds);
+	return nFailed.load() ? 1 : 0;
+}
+
+static int Command_Gfx(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	int bpp = 4, row = 0, tilesPerRow = 16, nFrames = 1000;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--bpp") && i + 1 < argc)
+			bpp = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--row") && i + 1 < argc)
+			row = static_cast<int>(strtol(argv[++i], nullptr, 0));
+		else if (!strcmp(argv[i], "--width") && i + 1 < argc)
+			tilesPerRow = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			nFrames = atoi(argv[++i]);
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 3 || !Gfx_IsValidDepth(bpp) || row < 0 || row > 0x0F || tilesPerRow < 1 || nFrames < 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	std::vector<byte> data;
+	if (!ReadWholeFile(fs::u8path(args[0]), data))
+	{
+		LogError(fs::u8path(args[0]), "Cannot read graphics.");
+		return 1;
+	}
+	std::size_t nTiles = Gfx_TileCount(data.size(), bpp);
+	if (!nTiles)
+	{
+		LogError(fs::u8path(args[0]), "File is smaller than one tile.");
+		return 1;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[1]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[1]), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	std::vector<byte> indices(nTiles * GFX_TILE_PIXELS), reference(nTiles * GFX_TILE_PIXELS);
+	Gfx_DecodeTilesScalar(data.data(), nTiles, bpp, reference.data());
+
+	auto tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; ++i)
+		Gfx_DecodeTiles(data.data(), nTiles, bpp, indices.data());
+	double decodeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nFrames;
+	if (indices != reference)
+	{
+		fprintf(stderr, "Vectorized decoder differs from the reference decoder.\n");
+		return 1;
+	}
+
+	int width = tilesPerRow * GFX_TILE_SIZE;
+	int height = static_cast<int>((nTiles + tilesPerRow - 1) / tilesPerRow) * GFX_TILE_SIZE;
+	std::vector<dword> pixels(static_cast<std::size_t>(width) * height, RENDER_XRGB(0x00, 0x00, 0x00));
+	Framebuffer fb = { pixels.data(), width, height, width };
+	dword colors[0x100];
+
+	tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; ++i)
+	{
+		Gfx_BuildColors(palette, row, bpp, colors);
+		Gfx_RenderTiles(fb, indices.data(), nTiles, tilesPerRow, colors);
+	}
+	double recolorUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nFrames;
+	printf("%zu %dbpp tile(s), %dx%d: decode %.2f us, recolor %.2f us\n", nTiles, bpp, width, height, decodeUs, recolorUs);
+
+	// Single-color edits as done in the editor, kept in sync through the reverse map
+	// on a copy of the image, which must end up equal to a full re-render.
+	GfxColorIndex colorIndex;
+	tStart = std::chrono::steady_clock::now();
+	colorIndex.Build(indices.data(), nTiles, tilesPerRow, fb);
+	double buildUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count();
+
+	std::vector<dword> incremental(pixels);
+	Framebuffer incrementalFB = { incremental.data(), width, height, width };
+	word edited[PAL_COLORS];
+	memcpy(edited, palette, sizeof(edited));
+	std::size_t nPixels = 0;
+	tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; ++i)
+	{
+		int index = i % (1 << bpp);
+		int slot = (bpp == 8 || index == 0) ? index : row * 0x10 + index;
+		edited[slot] = (edited[slot] + 0x0421) & 0x7FFF;
+		nPixels += colorIndex.Recolor(incrementalFB, index, Render_ColorFromSNES(edited[slot]));
+	}
+	double incrementalUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tStart).count() / nFrames;
+
+	std::vector<dword> reRendered(pixels.size(), RENDER_XRGB(0x00, 0x00, 0x00));
+	Framebuffer reRenderedFB = { reRendered.data(), width, height, width };
+	Gfx_BuildColors(edited, row, bpp, colors);
+	Gfx_RenderTiles(reRenderedFB, indices.data(), nTiles, tilesPerRow, colors);
+	if (incremental != reRendered)
+	{
+		fprintf(stderr, "Incremental recolor differs from a full re-render.\n");
+		return 1;
+	}
+	printf("Reverse map built in %.2f us: one color %.2f us (%.0f px on average), full re-render %.2f us\n",
+		buildUs, incrementalUs, static_cast<double>(nPixels) / nFrames, recolorUs);
+
+	if (!Image_Write(fs::u8path(args[2]), fb))
+	{
+		LogError(fs::u8path(args[2]), "Cannot write image.");
+		return 1;
+	}
+	return 0;
+}
+
+// $BGR555 or #RRGGBB, up to the end of the string or terminator.
+static bool ParseColor(const char* str, char terminator, word& color, const char** ppEnd = nullptr)
+{
+	bool bRGB = (*str == '#');
+	if (*str == '$' || bRGB)
+		++str;
+	char* pEnd = nullptr;
+	unsigned long value = strtoul(str, &pEnd, 16);
+	if (pEnd == str || *pEnd != terminator || (bRGB ? (pEnd - str != 6) : (value > 0x7FFF)))
+		return false;
+
+	color = bRGB ? Color_ConvertToSNES((value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF) : static_cast<word>(value);
+	if (ppEnd)
+		*ppEnd = pEnd;
+	return true;
+}
+
+static bool ParseGradientKey(const char* str, GradientKey& key)
+{
+	char* pEnd = nullptr;
+	long line = strtol(str, &pEnd, 10);
+	if (pEnd == str || *pEnd != ':' || !ParseColor(pEnd + 1, '\0', key.color))
+		return false;
+	key.line = static_cast<int>(line);
+	return true;
+}
+
+// One gradient variant: generates, builds the tables and writes them by extension.
+static bool WriteGradient(const fs::path& output, const std::vector<GradientKey>& keys, const GradientOptions& opt, GradientTable type, std::size_t* pEntries)
+{
+	word colors[GRADIENT_LINES_OVERSCAN];
+	if (!Gradient_Generate(keys.data(), keys.size(), opt, colors))
+	{
+		LogError(output, "Key line outside of the gradient.");
+		return false;
+	}
+
+	std::vector<std::vector<byte>> tables;
+	Gradient_BuildHDMA(colors, opt.nLines, type, tables);
+	*pEntries = 0;
+	for (const auto& table : tables)
+		*pEntries += Gradient_GetEntryCount(table, type);
+
+	std::string ext = output.extension().u8string();
+	for (auto& ch : ext)
+		ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+	bool bOk;
+	if (ext == ".asm")
+	{
+		std::string label = output.stem().u8string();
+		for (auto& ch : label)
+			if (!isalnum(static_cast<unsigned char>(ch)))
+				ch = '_';
+		bOk = Gradient_WriteAsm(output, tables, type, label.c_str());
+	}
+	else
+		bOk = Gradient_WriteBinary(output, tables);
+	if (!bOk)
+		LogError(output, "Cannot write gradient.");
+	return bOk;
+}
+
+static int Command_Gradient(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	const char* batch = nullptr;
+	GradientOptions opt;
+	GradientTable type = GRADIENT_TABLE_CGRAM;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--lines") && i + 1 < argc)
+			opt.nLines = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--dither"))
+			opt.bDither = true;
+		else if (!strcmp(argv[i], "--coldata"))
+			type = GRADIENT_TABLE_COLDATA;
+		else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+			batch = argv[++i];
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	if (opt.nLines != GRADIENT_LINES && opt.nLines != GRADIENT_LINES_OVERSCAN)
+	{
+		fprintf(stderr, "--lines must be %d or %d.\n", GRADIENT_LINES, GRADIENT_LINES_OVERSCAN);
+		return 2;
+	}
+
+	// Every job is an output path followed by its keys.
+	struct GradientJob
+	{
+		fs::path output;
+		std::vector<GradientKey> keys;
+	};
+	std::vector<GradientJob> jobs;
+	auto addJob = [&](const fs::path& output, const std::vector<std::string>& keyStrings) {
+		GradientJob job = { output, {} };
+		for (const auto& str : keyStrings)
+		{
+			GradientKey key;
+			if (!ParseGradientKey(str.c_str(), key))
+			{
+				fprintf(stderr, "Bad gradient key '%s', expected line:$7FFF or line:#RRGGBB.\n", str.c_str());
+				return false;
+			}
+			job.keys.push_back(key);
+		}
+		if (job.keys.empty())
+		{
+			LogError(output, "No gradient keys.");
+			return false;
+		}
+		jobs.push_back(std::move(job));
+		return true;
+	};
+
+	if (batch)
+	{
+		fs::path listPath = fs::u8path(batch);
+		std::ifstream list(listPath);
+		if (!list || !args.empty())
+		{
+			if (!list)
+				LogError(listPath, "Cannot read gradient list.");
+			else
+				PrintUsage();
+			return list ? 2 : 1;
+		}
+		std::string text;
+		while (std::getline(list, text))
+		{
+			std::istringstream tokens(text);
+			std::string output, key;
+			if (!(tokens >> output) || output[0] == '#')
+				continue;
+			std::vector<std::string> keys;
+			while (tokens >> key)
+				keys.push_back(key);
+			// Outputs are relative to the list file.
+			if (!addJob(listPath.parent_path() / fs::u8path(output), keys))
+				return 2;
+		}
+	}
+	else
+	{
+		if (args.size() < 2)
+		{
+			PrintUsage();
+			return 2;
+		}
+		if (!addJob(fs::u8path(args[0]), std::vector<std::string>(args.begin() + 1, args.end())))
+			return 2;
+	}
+
+	// The vectorized interpolation has to agree with the reference on every job.
+	for (const auto& job : jobs)
+	{
+		word simd[GRADIENT_LINES_OVERSCAN], scalar[GRADIENT_LINES_OVERSCAN];
+		if (Gradient_Generate(job.keys.data(), job.keys.size(), opt, simd) &&
+			Gradient_GenerateScalar(job.keys.data(), job.keys.size(), opt, scalar) &&
+			memcmp(simd, scalar, sizeof(word) * opt.nLines))
+		{
+			LogError(job.output, "Vectorized interpolation differs from the reference.");
+			return 1;
+		}
+	}
+
+	std::atomic<std::size_t> nFailed{ 0 }, nEntries{ 0 };
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		for (const auto& job : jobs)
+		{
+			pool.Submit([&] {
+				std::size_t entries = 0;
+				if (WriteGradient(job.output, job.keys, opt, type, &entries))
+					nEntries.fetch_add(entries, std::memory_order_relaxed);
+				else
+					nFailed.fetch_add(1, std::memory_order_relaxed);
+			});
+		}
+		pool.Wait();
+		nThreads = pool.GetThreadCount();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	printf("Generated %zu gradient(s), %zu failed, %d lines, %zu HDMA entries, %u thread(s), %.3f s: %.1f gradients/s\n",
+		jobs.size() - nFailed.load(), nFailed.load(), opt.nLines, nEntries.load(), nThreads, seconds, jobs.size() / seconds);
+	return nFailed.load() ? 1 : 0;
+}
+
+static int Command_Quantize(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	const char* preview = nullptr;
+	QuantizeOptions opt;
+	int firstRow = 0;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--palettes") && i + 1 < argc)
+			opt.nPalettes = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--colors") && i + 1 < argc)
+			opt.nColors = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--row") && i + 1 < argc)
+			firstRow = static_cast<int>(strtol(argv[++i], nullptr, 0));
+		else if (!strcmp(argv[i], "--preview") && i + 1 < argc)
+			preview = argv[++i];
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else if (!strcmp(argv[i], "--transparent") && i + 1 < argc)
+		{
+			const char* value = argv[++i];
+			opt.bTransparent = strcmp(value, "none") != 0;
+			opt.bTransparentAuto = !strcmp(value, "auto");
+			if (opt.bTransparent && !opt.bTransparentAuto)
+			{
+				char* pEnd = nullptr;
+				opt.transparent = static_cast<dword>(strtoul(value + (*value == '#'), &pEnd, 16));
+				if (*value != '#' || *pEnd || strlen(value) != 7)
+				{
+					PrintUsage();
+					return 2;
+				}
+			}
+		}
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 2 || opt.nPalettes < 1 || opt.nColors < 1 || opt.nColors > QUANTIZE_MAX_COLORS ||
+		firstRow < 0 || firstRow + opt.nPalettes > PAL_COLORS / 0x10)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	Image img;
+	if (!Image_Read(fs::u8path(args[0]), img))
+	{
+		LogError(fs::u8path(args[0]), "Cannot read image, only BMP and binary PPM are supported.");
+		return 1;
+	}
+
+	QuantizeResult result;
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		Quantize_Image(img, opt, pool, result);
+		nThreads = pool.GetThreadCount();
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	printf("%dx%d, %dx%d tiles, %d sub-palette(s) of %d color(s), %d pass(es), %u thread(s): %.1f ms, mean error %.5f\n",
+		img.width, img.height, result.tilesX, result.tilesY, opt.nPalettes, opt.nColors, result.nIterations, nThreads, ms, result.meanError);
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	for (int p = 0; p < opt.nPalettes; ++p)
+		memcpy(palette + (firstRow + p) * 0x10, result.palettes[p], sizeof(result.palettes[p]));
+	PalError err = PalFile_Save(fs::u8path(args[1]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[1]), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	if (preview)
+	{
+		std::vector<dword> pixels(img.pixels.size());
+		Framebuffer fb = { pixels.data(), img.width, img.height, img.width };
+		Quantize_Render(result, fb);
+		if (!Image_Write(fs::u8path(preview), fb))
+		{
+			LogError(fs::u8path(preview), "Cannot write image.");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// name[:amount], or tint:color:amount.
+static bool ParseTransformStep(const char* str, TransformStep& step)
+{
+	const char* pArgs = strchr(str, ':');
+	std::size_t nameLength = pArgs ? static_cast<std::size_t>(pArgs - str) : strlen(str);
+	int op = 0;
+	while (op < TRANSFORM_OP_COUNT && (strlen(Transform_OpName(static_cast<TransformOp>(op))) != nameLength ||
+		strncmp(str, Transform_OpName(static_cast<TransformOp>(op)), nameLength)))
+		++op;
+	if (op == TRANSFORM_OP_COUNT)
+		return false;
+
+	step.op = static_cast<TransformOp>(op);
+	step.amount = 1.0f;
+	step.color = 0x0000;
+	if (!pArgs)
+		return step.op == TRANSFORM_GRAYSCALE;
+	++pArgs;
+	if (step.op == TRANSFORM_TINT && !ParseColor(pArgs, ':', step.color, &pArgs))
+		return false;
+	if (step.op == TRANSFORM_TINT)
+		++pArgs;
+
+	char* pEnd = nullptr;
+	step.amount = strtof(pArgs, &pEnd);
+	return pEnd != pArgs && !*pEnd;
+}
+
+static void AdjustFile(const ConvertJob& job, const ColorTransform& xf, int first, int count, ConvertStats& stats)
+{
+	word palette[PAL_COLORS] = { 0x0000 };
+	std::size_t nRead = 0, nWritten = 0;
+
+	PalError err = PalFile_Load(job.src, palette, &nRead);
+	if (err == PALERR_OK)
+	{
+		Transform_Apply(xf, palette + first, count);
+		std::error_code ec;
+		fs::create_directories(job.dest.parent_path(), ec);
+		err = PalFile_Save(job.dest, palette, PALFMT_UNKNOWN, &nWritten);
+	}
+
+	stats.nFiles.fetch_add(1, std::memory_order_relaxed);
+	stats.nBytes.fetch_add(nRead + nWritten, std::memory_order_relaxed);
+	if (err != PALERR_OK)
+	{
+		stats.nFailed.fetch_add(1, std::memory_order_relaxed);
+		LogError(job.src, PalFile_ErrorString(err));
+	}
+}
+
+static int Command_Adjust(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::vector<TransformStep> steps;
+	int first = 0, last = PAL_COLORS - 1;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--row") && i + 1 < argc)
+		{
+			int row = static_cast<int>(strtol(argv[++i], nullptr, 0));
+			first = row * 0x10;
+			last = first + 0x0F;
+		}
+		else if (!strcmp(argv[i], "--cells") && i + 1 < argc)
+		{
+			char* pEnd = nullptr;
+			first = static_cast<int>(strtol(argv[++i], &pEnd, 16));
+			last = (*pEnd == '-') ? static_cast<int>(strtol(pEnd + 1, &pEnd, 16)) : first;
+			if (*pEnd)
+				first = -1;
+		}
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else if (args.size() < 2)
+			args.push_back(argv[i]);
+		else
+		{
+			TransformStep step;
+			if (!ParseTransformStep(argv[i], step))
+			{
+				fprintf(stderr, "Invalid step '%s'.\n", argv[i]);
+				return 2;
+			}
+			steps.push_back(step);
+		}
+	}
+	if (args.size() != 2 || steps.empty() || first < 0 || first > last || last >= PAL_COLORS)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	ColorTransform xf;
+	Transform_Compile(steps.data(), steps.size(), xf);
+
+	std::vector<ConvertJob> jobs;
+	if (!CollectJobs(fs::u8path(args[0]), fs::u8path(args[1]), PALFMT_UNKNOWN, jobs))
+		return 1;
+
+	ConvertStats stats;
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		for (const auto& job : jobs)
+			pool.Submit([&job, &xf, first, last, &stats] { AdjustFile(job, xf, first, last - first + 1, stats); });
+		pool.Wait();
+		nThreads = pool.GetThreadCount();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	std::size_t nFiles = stats.nFiles.load();
+	std::size_t nFailed = stats.nFailed.load();
+	printf("Adjusted %zu file(s), %zu failed, colors $%02X-$%02X, %zu step(s), %u thread(s), %.3f s: %.1f files/s\n",
+		nFiles - nFailed, nFailed, first, last, steps.size(), nThreads, seconds, nFiles / seconds);
+	return nFailed ? 1 : 0;
+}
+
+static int Command_Fade(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	const char* to = nullptr;
+	const char* strip = nullptr;
+	FadeOptions opt;
+	bool bTpl = false;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--mode") && i + 1 < argc)
+		{
+			int mode = 0;
+			while (mode < FADE_MODE_COUNT && strcmp(argv[i + 1], Fade_ModeName(static_cast<FadeMode>(mode))))
+				++mode;
+			if (mode == FADE_MODE_COUNT)
+			{
+				fprintf(stderr, "Unknown fade mode '%s'.\n", argv[i + 1]);
+				return 2;
+			}
+			opt.mode = static_cast<FadeMode>(mode);
+			++i;
+		}
+		else if (!strcmp(argv[i], "--to") && i + 1 < argc)
+			to = argv[++i];
+		else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			opt.nFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--in"))
+			opt.bReverse = true;
+		else if (!strcmp(argv[i], "--strip") && i + 1 < argc)
+			strip = argv[++i];
+		else if (!strcmp(argv[i], "--tpl"))
+			bTpl = true;
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 2 || opt.nFrames < 1 || opt.nFrames > FADE_MAX_FRAMES || (opt.mode == FADE_CROSS) != (to != nullptr))
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	word target[PAL_COLORS] = { 0x0000 };
+	if (to)
+	{
+		PalError err = PalFile_Load(fs::u8path(to), target);
+		if (err != PALERR_OK)
+		{
+			LogError(fs::u8path(to), PalFile_ErrorString(err));
+			return 1;
+		}
+	}
+
+	// Output names come from the palette names, the extension picks the format.
+	std::vector<ConvertJob> jobs;
+	std::error_code ec;
+	fs::path input = fs::u8path(args[0]), output = fs::u8path(args[1]);
+	if (fs::is_directory(input, ec))
+	{
+		if (!CollectJobs(input, output, PALFMT_UNKNOWN, jobs))
+			return 1;
+		for (auto& job : jobs)
+			job.dest.replace_extension(bTpl ? ".tpl" : ".bin");
+	}
+	else
+		jobs.push_back({ input, output });
+
+	std::vector<word> frames(static_cast<std::size_t>(opt.nFrames) * FADE_COLORS);
+	std::atomic<std::size_t> nFailed{ 0 };
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		for (const auto& job : jobs)
+		{
+			pool.Submit([&job, &opt, &target, &nFailed, &frames, bSingle = jobs.size() == 1] {
+				word palette[PAL_COLORS] = { 0x0000 };
+				PalError err = PalFile_Load(job.src, palette);
+				if (err != PALERR_OK)
+				{
+					LogError(job.src, PalFile_ErrorString(err));
+					nFailed.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				std::vector<word> local;
+				if (!bSingle)
+					local.resize(frames.size());
+				word* pFrames = bSingle ? frames.data() : local.data();
+				Fade_Generate(palette, target, opt, pFrames);
+
+				std::error_code ec;
+				fs::create_directories(job.dest.parent_path(), ec);
+				if (!Fade_WriteSequence(job.dest, pFrames, opt.nFrames))
+				{
+					LogError(job.dest, "Cannot write fade sequence.");
+					nFailed.fetch_add(1, std::memory_order_relaxed);
+				}
+			});
+		}
+		pool.Wait();
+		nThreads = pool.GetThreadCount();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	int status = nFailed.load() ? 1 : 0;
+	if (jobs.size() == 1 && !status)
+	{
+		// Check the vectorized frames against the scalar ones for the single palette.
+		word palette[PAL_COLORS] = { 0x0000 };
+		PalFile_Load(jobs[0].src, palette);
+		std::vector<word> reference(frames.size());
+		Fade_GenerateScalar(palette, target, opt, reference.data());
+		if (reference != frames)
+		{
+			fprintf(stderr, "error: vectorized fade differs from scalar.\n");
+			status = 1;
+		}
+		if (strip)
+		{
+			int height = std::max(opt.nFrames * 4, 64);
+			std::vector<dword> pixels(static_cast<std::size_t>(FADE_COLORS) * height);
+			Framebuffer fb = { pixels.data(), FADE_COLORS, height, FADE_COLORS };
+			Fade_RenderStrip(fb, frames.data(), opt.nFrames);
+			if (!Image_Write(fs::u8path(strip), fb))
+			{
+				LogError(fs::u8path(strip), "Cannot write image.");
+				status = 1;
+			}
+		}
+	}
+
+	printf("Faded %zu palette(s), %zu failed, %s, %d frame(s), %u thread(s), %.3f s: %.1f palettes/s\n",
+		jobs.size() - nFailed.load(), nFailed.load(), Fade_ModeName(opt.mode), opt.nFrames, nThreads, seconds, jobs.size() / seconds);
+	return status;
+}
+
+// PPU state plus the decoded graphics and tilemaps it points into.
+struct Scene
+{
+	PpuState state;
+	std::vector<byte> bgPixels[PPU_BG_COUNT];
+	std::vector<word> bgMaps[PPU_BG_COUNT];
+	std::vector<byte> objPixels;
+};
+
+static int ParseLayer(const std::string& name)
+{
+	static const char* const names[PPU_LAYER_COUNT] = { "bg1", "bg2", "bg3", "bg4", "obj", "backdrop" };
+	for (int l = 0; l < PPU_LAYER_COUNT; ++l)
+	{
+		if (name == names[l] || (l == PPU_BACKDROP && name == "color"))
+			return l;
+	}
+	return -1;
+}
+
+static bool ParseRegion(const std::string& name, PpuRegion& region)
+{
+	static const char* const names[] = { "never", "outside", "inside", "always" };
+	for (int r = 0; r < 4; ++r)
+	{
+		if (name == names[r])
+		{
+			region = static_cast<PpuRegion>(r);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool LoadDecodedTiles(const fs::path& fn, int bpp, std::vector<byte>& pixels, std::size_t& nTiles)
+{
+	std::vector<byte> data;
+	if (!ReadWholeFile(fn, data))
+		return false;
+	nTiles = Gfx_TileCount(data.size(), bpp);
+	pixels.resize(nTiles * GFX_TILE_PIXELS);
+	Gfx_DecodeTiles(data.data(), nTiles, bpp, pixels.data());
+	return true;
+}
+
+// One statement per line, '#' starts a comment; paths are relative to the scene:
+//   mode 0|1, bg3priority, brightness n, fixed color
+//   bg1..bg4 <gfx.bin> [map <tilemap.bin>] [scroll x y]
+//   obj <gfx.bin> [size small large]
+//   sprite x y tile palette priority [hflip] [vflip] [large]
+//   main|sub|mainwindow|subwindow <layer>...
+//   window1|window2 left right [first last]
+//   mask <layer|color> [w1] [w1invert] [w2] [w2invert] [or|and|xor|xnor]
+//   math add|sub [half] [subscreen] <layer|backdrop>...
+//   clip|prevent never|outside|inside|always
+static bool LoadScene(const fs::path& fn, Scene& scene)
+{
+	std::ifstream file(fn);
+	if (!file)
+	{
+		LogError(fn, "Cannot open scene.");
+		return false;
+	}
+
+	PpuState& state = scene.state;
+	std::vector<std::pair<int, fs::path>> bgFiles;
+	std::string line;
+	for (int lineNo = 1; std::getline(file, line); ++lineNo)
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		std::string key;
+		if (!(in >> key))
+			continue;
+
+		bool bOk = true;
+		int layer = ParseLayer(key);
+		if (key == "mode")
+			bOk = (in >> state.mode) && (state.mode == 0 || state.mode == 1);
+		else if (key == "bg3priority")
+			state.bBG3Priority = true;
+		else if (key == "brightness")
+			bOk = (in >> state.brightness) && state.brightness >= 0 && state.brightness <= 15;
+		else if (key == "fixed")
+		{
+			std::string color;
+			bOk = (in >> color) && ParseColor(color.c_str(), '\0', state.fixedColor);
+		}
+		else if (layer >= PPU_BG1 && layer <= PPU_BG4)
+		{
+			std::string gfx, option;
+			bOk = static_cast<bool>(in >> gfx);
+			bgFiles.emplace_back(layer, fn.parent_path() / fs::u8path(gfx));
+			PpuBackground& bg = state.bg[layer];
+			while (bOk && in >> option)
+			{
+				if (option == "scroll")
+					bOk = static_cast<bool>(in >> bg.scrollX >> bg.scrollY);
+				else if (option == "map")
+				{
+					std::string map;
+					std::vector<byte> data;
+					bOk = (in >> map) && ReadWholeFile(fn.parent_path() / fs::u8path(map), data);
+					scene.bgMaps[layer].assign(PPU_MAP_SIZE * PPU_MAP_SIZE, 0);
+					for (std::size_t i = 0; bOk && i < scene.bgMaps[layer].size() && i * 2 + 1 < data.size(); ++i)
+						scene.bgMaps[layer][i] = static_cast<word>(data[i * 2] | (data[i * 2 + 1] << 8));
+				}
+				else
+					bOk = false;
+			}
+		}
+		else if (key == "obj")
+		{
+			std::string gfx, option;
+			bOk = (in >> gfx) && LoadDecodedTiles(fn.parent_path() / fs::u8path(gfx), 4, scene.objPixels, state.nObjTiles);
+			while (bOk && in >> option)
+				bOk = (option == "size") && (in >> state.objSmall >> state.objLarge);
+		}
+		else if (key == "sprite")
+		{
+			PpuSprite sprite;
+			int tile = 0, palette = 0, priority = 0;
+			std::string flag;
+			bOk = static_cast<bool>(in >> sprite.x >> sprite.y >> tile >> palette >> priority);
+			sprite.tile = static_cast<word>(tile);
+			sprite.palette = static_cast<byte>(palette);
+			sprite.priority = static_cast<byte>(priority);
+			while (bOk && in >> flag)
+			{
+				sprite.bHFlip |= (flag == "hflip");
+				sprite.bVFlip |= (flag == "vflip");
+				sprite.bLarge |= (flag == "large");
+				bOk = (flag == "hflip" || flag == "vflip" || flag == "large");
+			}
+			state.sprites.push_back(sprite);
+		}
+		else if (key == "main" || key == "sub" || key == "mainwindow" || key == "subwindow")
+		{
+			byte& layers = (key == "main") ? state.mainLayers : (key == "sub") ? state.subLayers :
+				(key == "mainwindow") ? state.mainWindowLayers : state.subWindowLayers;
+			layers = 0;
+			std::string name;
+			while (bOk && in >> name)
+			{
+				int l = ParseLayer(name);
+				bOk = (l >= 0 && l < PPU_BACKDROP);
+				layers |= static_cast<byte>(PPU_LAYER_BIT(l));
+			}
+		}
+		else if (key == "window1" || key == "window2")
+		{
+			int left = 0, right = 0, first = 0, last = PPU_HEIGHT - 1;
+			bOk = static_cast<bool>(in >> left >> right);
+			if (bOk && in >> first)
+				bOk = static_cast<bool>(in >> last);
+			Ppu_SetWindow(state, key == "window1" ? 0 : 1, left, right, first, last);
+		}
+		else if (key == "mask")
+		{
+			std::string name, option;
+			bOk = (in >> name) && (layer = ParseLayer(name)) >= 0;
+			PpuWindowMask mask;
+			while (bOk && in >> option)
+			{
+				if (option == "w1" || option == "w1invert")
+					mask.bW1 = true, mask.bW1Invert = (option == "w1invert");
+				else if (option == "w2" || option == "w2invert")
+					mask.bW2 = true, mask.bW2Invert = (option == "w2invert");
+				else if (option == "or" || option == "and" || option == "xor" || option == "xnor")
+					mask.logic = (option == "or") ? PPU_WINDOW_OR : (option == "and") ? PPU_WINDOW_AND : (option == "xor") ? PPU_WINDOW_XOR : PPU_WINDOW_XNOR;
+				else
+					bOk = false;
+			}
+			if (bOk)
+				state.windows[layer] = mask;
+		}
+		else if (key == "math")
+		{
+			std::string op, name;
+			bOk = (in >> op) && (op == "add" || op == "sub");
+			state.bSubtract = (op == "sub");
+			state.mathLayers = 0;
+			while (bOk && in >> name)
+			{
+				if (name == "half")
+					state.bHalf = true;
+				else if (name == "subscreen")
+					state.bMathSubscreen = true;
+				else if ((layer = ParseLayer(name)) >= 0)
+					state.mathLayers |= static_cast<byte>(PPU_LAYER_BIT(layer));
+				else
+					bOk = false;
+			}
+		}
+		else if (key == "clip" || key == "prevent")
+		{
+			std::string region;
+			bOk = (in >> region) && ParseRegion(region, key == "clip" ? state.clipToBlack : state.preventMath);
+		}
+		else
+			bOk = false;
+
+		if (!bOk)
+		{
+			std::lock_guard<std::mutex> lock(logMtx);
+			fprintf(stderr, "error: %s:%d: invalid statement or unreadable file.\n", fn.u8string().c_str(), lineNo);
+			return false;
+		}
+	}
+
+	// BG depths depend on the mode, which may come after the BG statements.
+	for (const auto& bgFile : bgFiles)
+	{
+		int n = bgFile.first;
+		int bpp = Ppu_GetBGDepth(state.mode, n);
+		if (!bpp || !LoadDecodedTiles(bgFile.second, bpp, scene.bgPixels[n], state.bg[n].nTiles))
+		{
+			LogError(bgFile.second, bpp ? "Cannot read graphics." : "The mode has no such BG.");
+			return false;
+		}
+		state.bg[n].tiles = scene.bgPixels[n].data();
+		state.bg[n].tilemap = scene.bgMaps[n].empty() ? nullptr : scene.bgMaps[n].data();
+	}
+	state.objTiles = scene.objPixels.empty() ? nullptr : scene.objPixels.data();
+	return true;
+}
+
+static int Command_Compose(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	const char* golden = nullptr;
+	int nFrames = 600;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+			nFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--golden") && i + 1 < argc)
+			golden = argv[++i];
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 3 || nFrames < 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	Scene scene;
+	if (!LoadScene(fs::u8path(args[0]), scene))
+		return 1;
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[1]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[1]), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	std::vector<dword> pixels(PPU_WIDTH * PPU_HEIGHT);
+	Framebuffer fb = { pixels.data(), PPU_WIDTH, PPU_HEIGHT, PPU_WIDTH };
+	auto tStart = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; ++i)
+		Ppu_RenderFrame(scene.state, palette, fb);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+	printf("%dx%d, mode %d, %zu sprite(s), %d frame(s): %.3f ms/frame, %.1f frames/s\n",
+		PPU_WIDTH, PPU_HEIGHT, scene.state.mode, scene.state.sprites.size(), nFrames, seconds * 1000.0 / nFrames, nFrames / seconds);
+
+	if (!Image_Write(fs::u8path(args[2]), fb))
+	{
+		LogError(fs::u8path(args[2]), "Cannot write image.");
+		return 1;
+	}
+	if (golden)
+	{
+		std::vector<byte> outData, goldenData;
+		if (!ReadWholeFile(fs::u8path(golden), goldenData) || !ReadWholeFile(fs::u8path(args[2]), outData))
+		{
+			LogError(fs::u8path(golden), "Cannot read golden image.");
+			return 1;
+		}
+		if (outData != goldenData)
+		{
+			printf("Image differs from %s\n", golden);
+			return 1;
+		}
+		printf("Image matches %s\n", golden);
+	}
+	return 0;
+}
+
+static int Command_Remap(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	int row = -1;
+	int nUpdates = 64;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--row") && i + 1 < argc)
+			row = static_cast<int>(strtol(argv[++i], nullptr, 0));
+		else if (!strcmp(argv[i], "--updates") && i + 1 < argc)
+			nUpdates = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 3 || row >= PAL_COLORS / 0x10 || nUpdates < 0)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[1]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[1]), PalFile_ErrorString(err));
+		return 1;
+	}
+	Image img;
+	if (!Image_Read(fs::u8path(args[0]), img))
+	{
+		LogError(fs::u8path(args[0]), "Cannot read image, only BMP and binary PPM are supported.");
+		return 1;
+	}
+
+	// A single row skips its transparent color 0, the whole palette keeps every entry.
+	word* pColors = row >= 0 ? palette + row * 0x10 : palette;
+	int nColors = row >= 0 ? 0x10 : PAL_COLORS;
+	InverseColormap colormap;
+	ThreadPool pool(nThreads);
+	ColorSpace_GetOKLabTable();
+	auto tStart = std::chrono::steady_clock::now();
+	colormap.Build(pColors, nColors, row >= 0, &pool);
+	double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	int status = 0;
+	for (dword c = 0; c < 0x8000; ++c)
+	{
+		if (colormap.Lookup(static_cast<word>(c)) != colormap.FindNearestBruteForce(static_cast<word>(c)))
+		{
+			fprintf(stderr, "error: inverse colormap differs from brute force at $%04X.\n", c);
+			status = 1;
+			break;
+		}
+	}
+
+	std::size_t nPixels = img.pixels.size();
+	std::vector<word> colors(nPixels);
+	std::vector<byte> indices(nPixels);
+	for (std::size_t i = 0; i < nPixels; ++i)
+	{
+		dword rgb = img.pixels[i];
+		colors[i] = Color_LookupToSNES((rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF);
+	}
+
+	tStart = std::chrono::steady_clock::now();
+	colormap.Remap(colors.data(), indices.data(), nPixels);
+	double remapMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+	tStart = std::chrono::steady_clock::now();
+	std::size_t nDiffer = 0;
+	for (std::size_t i = 0; i < nPixels; ++i)
+		nDiffer += (colormap.FindNearestBruteForce(colors[i]) != indices[i]);
+	double bruteMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	if (nDiffer)
+	{
+		fprintf(stderr, "error: %zu remapped pixel(s) differ from brute force.\n", nDiffer);
+		status = 1;
+	}
+
+	std::vector<dword> pixels(nPixels);
+	for (std::size_t i = 0; i < nPixels; ++i)
+		pixels[i] = Render_ColorFromSNES(pColors[indices[i]]);
+	Framebuffer fb = { pixels.data(), img.width, img.height, img.width };
+	if (!Image_Write(fs::u8path(args[2]), fb))
+	{
+		LogError(fs::u8path(args[2]), "Cannot write image.");
+		status = 1;
+	}
+
+	// Edits one color at a time like the editor does, checking the last
+	// update against a full build from scratch.
+	double updateMs = 0.0;
+	for (int u = 0; u < nUpdates; ++u)
+	{
+		int index = (u * 7 + 1) % nColors;
+		pColors[index] = static_cast<word>((u * 2654435761u) >> 17) & 0x7FFF;
+		tStart = std::chrono::steady_clock::now();
+		colormap.Update(index, pColors[index]);
+		updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	}
+	if (nUpdates)
+	{
+		InverseColormap reference;
+		reference.Build(pColors, nColors, row >= 0, &pool);
+		for (dword c = 0; c < 0x8000; ++c)
+		{
+			if (colormap.Lookup(static_cast<word>(c)) != reference.Lookup(static_cast<word>(c)))
+			{
+				fprintf(stderr, "error: updated colormap differs from a full build at $%04X.\n", c);
+				status = 1;
+				break;
+			}
+		}
+	}
+
+	printf("%dx%d, %d color(s), %u thread(s): build %.3f ms, remap %.3f ms (brute force %.3f ms)",
+		img.width, img.height, nColors, pool.GetThreadCount(), buildMs, remapMs, bruteMs);
+	if (nUpdates)
+		printf(", update %.3f ms avg", updateMs / nUpdates);
+	printf("\n");
+	return status;
+}
+
+static int Command_Search(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	int row = -1;
+	int maxDiffs = 0;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--row") && i + 1 < argc)
+			row = static_cast<int>(strtol(argv[++i], nullptr, 0));
+		else if (!strcmp(argv[i], "--diffs") && i + 1 < argc)
+			maxDiffs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() < 2 || row >= PAL_COLORS / 0x10)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[0]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[0]), PalFile_ErrorString(err));
+		return 1;
+	}
+
+	// Single-color rows would match every blank area of the input.
+	SearchQuery query;
+	std::vector<int> rows;
+	for (int r = 0; r < PAL_COLORS / 0x10; ++r)
+	{
+		if (row >= 0 && r != row)
+			continue;
+		const word* pRow = palette + r * 0x10;
+		if (std::all_of(pRow, pRow + 0x10, [&](word c) { return (c & 0x7FFF) == (pRow[0] & 0x7FFF); }))
+			continue;
+		query.patterns.emplace_back(pRow, pRow + 0x10);
+		rows.push_back(r);
+	}
+	query.maxDiffs = maxDiffs;
+
+	PaletteSearch search;
+	if (query.patterns.empty())
+	{
+		fprintf(stderr, "Nothing to search for: the selected rows are a single color.\n");
+		return 1;
+	}
+	if (!search.Prepare(query))
+	{
+		fprintf(stderr, "--diffs must be between 0 and 15.\n");
+		return 2;
+	}
+
+	std::vector<SearchFileResult> files;
+	for (std::size_t i = 1; i < args.size(); ++i)
+	{
+		std::error_code ec;
+		fs::path input = fs::u8path(args[i]);
+		if (!fs::is_directory(input, ec))
+		{
+			files.emplace_back().fn = input;
+			continue;
+		}
+		fs::recursive_directory_iterator it(input, fs::directory_options::skip_permission_denied, ec), end;
+		for (; !ec && it != end; it.increment(ec))
+		{
+			if (it->is_regular_file(ec))
+				files.emplace_back().fn = it->path();
+		}
+		if (ec)
+			LogError(input, ec.message().c_str());
+	}
+
+	std::size_t nBytes = 0, nMatches = 0, nFailed = 0;
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		search.SearchFiles(files, pool);
+		nThreads = pool.GetThreadCount();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	for (const auto& file : files)
+	{
+		if (!file.bOpened)
+		{
+			LogError(file.fn, "Cannot open file.");
+			++nFailed;
+			continue;
+		}
+		nBytes += file.size;
+		nMatches += file.matches.size();
+		if (file.matches.empty())
+			continue;
+
+		Rom rom;
+		bool bRom = Rom_IsRomPath(file.fn) && Rom_Open(rom, file.fn, false);
+		for (const auto& match : file.matches)
+		{
+			dword address = 0;
+			printf("%s: 0x%06zX", file.fn.u8string().c_str(), match.offset);
+			if (bRom && Rom_OffsetToSNES(rom, match.offset, address))
+				printf(" ($%06X)", address);
+			printf(" row %X, %d diff(s)\n", rows[match.pattern], match.nDiffs);
+		}
+	}
+
+	printf("Searched %zu file(s), %zu failed, %u thread(s), %.3f s: %zu match(es), %.1f MB/s\n",
+		files.size() - nFailed, nFailed, nThreads, seconds, nMatches, nBytes / (1024.0 * 1024.0) / seconds);
+	return nFailed ? 1 : 0;
+}
+
+static int Command_Library(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	int row = LIBRARY_WHOLE_TABLE;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--row") && i + 1 < argc)
+			row = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	bool bImport = args.size() >= 3 && !strcmp(args[1], "import");
+	bool bFind = args.size() == 3 && !strcmp(args[1], "find");
+	if ((!bImport && !bFind) || row < LIBRARY_WHOLE_TABLE || row >= PAL_COLORS / LIBRARY_ROW_COLORS)
+	{
+		PrintUsage();
+		return 2;
+	}
+	fs::path pack = fs::u8path(args[0]);
+	std::size_t nFailed = 0;
+
+	if (bImport)
+	{
+		std::vector<fs::path> files;
+		for (std::size_t a = 2; a < args.size(); ++a)
+		{
+			fs::path input = fs::u8path(args[a]);
+			std::error_code ec;
+			if (!fs::is_directory(input, ec))
+			{
+				files.push_back(input);
+				continue;
+			}
+			fs::recursive_directory_iterator it(input, fs::directory_options::skip_permission_denied, ec), end;
+			for (; !ec && it != end; it.increment(ec))
+			{
+				if (it->is_regular_file(ec) && PalFile_FormatFromPath(it->path()) != PALFMT_UNKNOWN)
+					files.push_back(it->path());
+			}
+			if (ec)
+				LogError(input, ec.message().c_str());
+		}
+		std::sort(files.begin(), files.end());
+
+		LibraryImportStats stats;
+		std::vector<std::pair<fs::path, std::string>> errors;
+		auto tStart = std::chrono::steady_clock::now();
+		{
+			ThreadPool pool(nThreads);
+			nThreads = pool.GetThreadCount();
+			if (!Library_Import(pack, files, pool, stats, &errors))
+			{
+				LogError(pack, "Cannot read or write the pack.");
+				return 1;
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+		if (seconds <= 0.0)
+			seconds = 1e-9;
+		for (const auto& error : errors)
+			LogError(error.first, error.second.c_str());
+		printf("Imported %zu file(s), %zu failed, %u thread(s), %.3f s: %.1f files/s\n",
+			stats.nFiles - stats.nFailed, stats.nFailed, nThreads, seconds, stats.nFiles / seconds);
+		printf("%zu table(s) and %zu row(s) seen, %zu new distinct entr%s\n",
+			stats.nTables, stats.nRows, stats.nNewEntries, stats.nNewEntries == 1 ? "y" : "ies");
+		nFailed = stats.nFailed;
+	}
+
+	PaletteLibrary library;
+	auto tOpen = std::chrono::steady_clock::now();
+	if (!library.Open(pack))
+	{
+		LogError(pack, "Not a palette library pack.");
+		return 1;
+	}
+	double openUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tOpen).count();
+	std::error_code ec;
+	printf("Pack: %zu entries, %zu sources, %.2f MB, opened in %.1f us\n", library.GetEntryCount(), library.GetSourceCount(),
+		fs::file_size(pack, ec) / (1024.0 * 1024.0), openUs);
+	if (bImport)
+		return nFailed ? 1 : 0;
+
+	word palette[PAL_COLORS] = { 0x0000 };
+	PalError err = PalFile_Load(fs::u8path(args[2]), palette);
+	if (err != PALERR_OK)
+	{
+		LogError(fs::u8path(args[2]), PalFile_ErrorString(err));
+		return 1;
+	}
+	const word* colors = (row == LIBRARY_WHOLE_TABLE) ? palette : palette + row * LIBRARY_ROW_COLORS;
+	std::size_t nColors = (row == LIBRARY_WHOLE_TABLE) ? PAL_COLORS : LIBRARY_ROW_COLORS;
+	auto tFind = std::chrono::steady_clock::now();
+	long long entry = library.Find(colors, nColors);
+	double findUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - tFind).count();
+	if (entry < 0)
+	{
+		printf("Not in the library (%016llX, %.1f us).\n", Library_Hash(colors, nColors), findUs);
+		return 1;
+	}
+
+	std::vector<LibrarySource> sources;
+	library.GetSources(static_cast<std::size_t>(entry), sources);
+	printf("Entry %lld (%016llX, %.1f us), %zu source(s):\n", entry, library.GetEntry(static_cast<std::size_t>(entry)).hash, findUs, sources.size());
+	for (const auto& source : sources)
+	{
+		if (source.row == LIBRARY_WHOLE_TABLE)
+			printf("  %s\n", source.file.c_str());
+		else
+			printf("  %s, row %d\n", source.file.c_str(), source.row);
+	}
+	return 0;
+}
+
+struct DiffJob
+{
+	fs::path oldFn, newFn;		// Either may be empty for added or removed files.
+	std::string name;
+	PalError err = PALERR_OK;
+	word oldPalette[PAL_COLORS];
+	word newPalette[PAL_COLORS];
+	PaletteDiff diff;
+};
+
+static void CollectDiffFiles(const fs::path& dir, std::vector<std::string>& names)
+{
+	std::error_code ec;
+	fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+	for (; !ec && it != end; it.increment(ec))
+	{
+		if (it->is_regular_file(ec) && PalFile_FormatFromPath(it->path()) != PALFMT_UNKNOWN)
+			names.push_back(it->path().lexically_relative(dir).generic_u8string());
+	}
+	if (ec)
+		LogError(dir, ec.message().c_str());
+}
+
+static const char* DiffStatus(const DiffJob& job)
+{
+	if (job.err != PALERR_OK)
+		return "error";
+	if (job.oldFn.empty())
+		return "added";
+	if (job.newFn.empty())
+		return "removed";
+	if (!job.diff.total.nDifferent)
+		return "same";
+	return job.diff.total.nChanged ? "changed" : "minor";
+}
+
+static int Command_Diff(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	const char* grid = nullptr;
+	float threshold = DIFF_DEFAULT_THRESHOLD;
+	RenderOptions opt;
+	opt.bGrid = true;
+	opt.bTransparentFirst = false;
+	unsigned nThreads = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--threshold") && i + 1 < argc)
+			threshold = static_cast<float>(atof(argv[++i]));
+		else if (!strcmp(argv[i], "--grid") && i + 1 < argc)
+			grid = argv[++i];
+		else if (!strcmp(argv[i], "--zoom") && i + 1 < argc)
+			opt.zoom = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			nThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 2 || !(threshold > 0.0f) || opt.zoom < 1 || opt.zoom > RENDER_MAX_ZOOM)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	fs::path oldRoot = fs::u8path(args[0]), newRoot = fs::u8path(args[1]);
+	std::error_code ec;
+	bool bTrees = fs::is_directory(oldRoot, ec) && fs::is_directory(newRoot, ec);
+	std::vector<DiffJob> jobs;
+	if (bTrees)
+	{
+		std::vector<std::string> oldNames, newNames;
+		CollectDiffFiles(oldRoot, oldNames);
+		CollectDiffFiles(newRoot, newNames);
+		std::sort(oldNames.begin(), oldNames.end());
+		std::sort(newNames.begin(), newNames.end());
+		std::vector<std::string> names;
+		std::set_union(oldNames.begin(), oldNames.end(), newNames.begin(), newNames.end(), std::back_inserter(names));
+		jobs.resize(names.size());
+		for (std::size_t i = 0; i < names.size(); ++i)
+		{
+			jobs[i].name = names[i];
+			if (std::binary_search(oldNames.begin(), oldNames.end(), names[i]))
+				jobs[i].oldFn = oldRoot / fs::u8path(names[i]);
+			if (std::binary_search(newNames.begin(), newNames.end(), names[i]))
+				jobs[i].newFn = newRoot / fs::u8path(names[i]);
+		}
+	}
+	else
+	{
+		jobs.resize(1);
+		jobs[0].oldFn = oldRoot;
+		jobs[0].newFn = newRoot;
+		jobs[0].name = args[1];
+	}
+
+	auto tStart = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(nThreads);
+		nThreads = pool.GetThreadCount();
+		for (auto& job : jobs)
+		{
+			pool.Submit([&job, threshold] {
+				if (!job.oldFn.empty() && (job.err = PalFile_Load(job.oldFn, job.oldPalette)) != PALERR_OK)
+					return;
+				if (!job.newFn.empty() && (job.err = PalFile_Load(job.newFn, job.newPalette)) != PALERR_OK)
+					return;
+				if (!job.oldFn.empty() && !job.newFn.empty())
+					Diff_Compare(job.oldPalette, job.newPalette, threshold, job.diff);
+			});
+		}
+		pool.Wait();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	if (seconds <= 0.0)
+		seconds = 1e-9;
+
+	// Machine-readable on stdout, one record per line.
+	printf("# threshold\t%.2f\n", threshold);
+	printf("# file\tname\tstatus\tmax\tmean\tdifferent\tchanged\n");
+	printf("# row\tname\trow\tmax\tmean\tdifferent\tchanged\n");
+	printf("# color\tname\tindex\told\tnew\tdeltaE\n");
+	std::size_t nChanged = 0, nFailed = 0;
+	for (const auto& job : jobs)
+	{
+		const char* status = DiffStatus(job);
+		const DiffStats& total = job.diff.total;
+		bool bCompared = (job.err == PALERR_OK) && !job.oldFn.empty() && !job.newFn.empty();
+		if (job.err != PALERR_OK)
+		{
+			LogError(job.name.empty() ? job.newFn : fs::u8path(job.name), PalFile_ErrorString(job.err));
+			++nFailed;
+		}
+		else if (strcmp(status, "same") && strcmp(status, "minor"))
+			++nChanged;
+
+		if (!bCompared)
+		{
+			printf("file\t%s\t%s\t\t\t\t\n", job.name.c_str(), status);
+			continue;
+		}
+		printf("file\t%s\t%s\t%.3f\t%.3f\t%d\t%d\n", job.name.c_str(), status, total.maxDeltaE, total.meanDeltaE, total.nDifferent, total.nChanged);
+		for (int r = 0; r < DIFF_ROWS; ++r)
+		{
+			const DiffStats& row = job.diff.rows[r];
+			if (row.nDifferent)
+				printf("row\t%s\t%d\t%.3f\t%.3f\t%d\t%d\n", job.name.c_str(), r, row.maxDeltaE, row.meanDeltaE, row.nDifferent, row.nChanged);
+		}
+		for (int i = 0; i < DIFF_COLORS; ++i)
+		{
+			if (job.diff.deltaE[i] > threshold)
+				printf("color\t%s\t%d\t%04X\t%04X\t%.3f\n", job.name.c_str(), i, job.oldPalette[i] & 0x7FFF, job.newPalette[i] & 0x7FFF, job.diff.deltaE[i]);
+		}
+
+		if (grid && job.diff.total.nDifferent)
+		{
+			int width, height;
+			Diff_GetGridSize(opt, &width, &height);
+			std::vector<dword> pixels(static_cast<std::size_t>(width) * height);
+			Framebuffer fb = { pixels.data(), width, height, width };
+			Diff_RenderGrid(fb, job.oldPalette, job.newPalette, job.diff, threshold, opt);
+			fs::path image = fs::u8path(grid);
+			if (bTrees)
+			{
+				image /= fs::u8path(job.name + ".bmp");
+				fs::create_directories(image.parent_path(), ec);
+			}
+			if (!Image_Write(image, fb))
+			{
+				LogError(image, "Cannot write image.");
+				++nFailed;
+			}
+		}
+	}
+	fprintf(stderr, "Compared %zu file(s), %zu changed, %zu failed, %u thread(s), %.3f s: %.1f files/s\n",
+		jobs.size(), nChanged, nFailed, nThreads, seconds, jobs.size() / seconds);
+	return nFailed ? 2 : nChanged ? 1 : 0;
+}
+
+// Writes n random palettes into dir, one format after the other, and checks
+// that each one detects and parses back from its contents alone.
+static bool GenerateCorpus(const fs::path& dir, std::size_t n)
+{
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+	std::vector<byte> data;
+	word palette[PAL_COLORS], parsed[PAL_COLORS];
+	char name[32];
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		PalFormat fmt = static_cast<PalFormat>(PALFMT_UNKNOWN + 1 + i % (PALFMT_COUNT - 1));
+		for (int c = 0; c < PAL_COLORS; ++c)
+			palette[c] = static_cast<word>(((i * PAL_COLORS + c) * 2654435761u) >> 11) & 0x7FFF;
+		snprintf(name, sizeof(name), "pal%06zu%s", i, PalFile_FormatExtension(fmt));
+		fs::path fn = dir / name;
+		PalError err = PalFile_Save(fn, palette, fmt);
+		if (err != PALERR_OK)
+		{
+			LogError(fn, PalFile_ErrorString(err));
+			return false;
+		}
+
+		PalFormat detected = PALFMT_UNKNOWN;
+		PalFile_Serialize(palette, fmt, data);
+		if (PalFile_Parse(data.data(), data.size(), parsed, PALFMT_UNKNOWN, &detected) != PALERR_OK ||
+			detected != fmt || memcmp(parsed, palette, sizeof(palette)))
+		{
+			LogError(fn, "Does not read back as written.");
+			return false;
+		}
+	}
+	return true;
+}
+
+static int Command_Parse(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nGenerate = 0;
+	int nRounds = 5;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--generate") && i + 1 < argc)
+			nGenerate = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+			nRounds = atoi(argv[++i]);
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 1 || nRounds < 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	fs::path dir = fs::u8path(args[0]);
+	if (nGenerate && !GenerateCorpus(dir, nGenerate))
+		return 1;
+
+	// Everything is read up front, so only detection and parsing are timed.
+	std::vector<std::vector<byte>> files;
+	std::vector<fs::path> paths;
+	std::error_code ec;
+	fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+	for (; !ec && it != end; it.increment(ec))
+	{
+		std::vector<byte> data;
+		if (it->is_regular_file(ec) && ReadWholeFile(it->path(), data) && data.size() <= PAL_MAX_FILE_SIZE)
+		{
+			files.push_back(std::move(data));
+			paths.push_back(it->path());
+		}
+	}
+	if (ec)
+	{
+		LogError(dir, ec.message().c_str());
+		return 1;
+	}
+
+	std::vector<PalFormat> formats(files.size());
+	auto tStart = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < files.size(); ++i)
+		formats[i] = PalFile_Detect(files[i].data(), files[i].size(), paths[i]);
+	double detectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+
+	std::vector<std::size_t> byFormat[PALFMT_COUNT];
+	for (std::size_t i = 0; i < files.size(); ++i)
+		byFormat[formats[i]].push_back(i);
+	for (std::size_t i : byFormat[PALFMT_UNKNOWN])
+		LogError(paths[i], PalFile_ErrorString(PALERR_FORMAT));
+
+	std::size_t nFailed = byFormat[PALFMT_UNKNOWN].size();
+	word palette[PAL_COLORS];
+	printf("%-6s %8s %10s %12s %10s\n", "format", "files", "bytes", "files/s", "MB/s");
+	for (int f = PALFMT_UNKNOWN + 1; f < PALFMT_COUNT; ++f)
+	{
+		const std::vector<std::size_t>& indices = byFormat[f];
+		if (indices.empty())
+			continue;
+		std::size_t nBytes = 0;
+		for (std::size_t i : indices)
+		{
+			nBytes += files[i].size();
+			PalError err = PalFile_Parse(files[i].data(), files[i].size(), palette, static_cast<PalFormat>(f));
+			if (err != PALERR_OK)
+			{
+				LogError(paths[i], PalFile_ErrorString(err));
+				++nFailed;
+			}
+		}
+
+		double best = 1e30;
+		for (int round = 0; round < nRounds; ++round)
+		{
+			auto tRound = std::chrono::steady_clock::now();
+			for (std::size_t i : indices)
+				PalFile_Parse(files[i].data(), files[i].size(), palette, static_cast<PalFormat>(f));
+			best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - tRound).count());
+		}
+		if (best <= 0.0)
+			best = 1e-9;
+		printf("%-6s %8zu %10zu %12.0f %10.2f\n", PalFile_GetFormatInfo(static_cast<PalFormat>(f))->name,
+			indices.size(), nBytes, indices.size() / best, nBytes / (1024.0 * 1024.0) / best);
+	}
+	if (detectSeconds <= 0.0)
+		detectSeconds = 1e-9;
+	printf("Detected %zu file(s), %zu failed: %.0f files/s\n", files.size(), nFailed, files.size() / detectSeconds);
+	return nFailed ? 1 : 0;
+}
+
+// Checks that a journal replays to the palette and history it was written from.
+static bool CheckReplay(const fs::path& fn, const word* palette, bool bDrawMode, const History& history, double& ms)
+{
+	word replayed[PAL_COLORS];
+	bool bReplayedDrawMode = false;
+	History replayedHistory;
+	JournalReplayInfo info;
+	auto tStart = std::chrono::steady_clock::now();
+	if (!Journal_Replay(fn, replayed, bReplayedDrawMode, replayedHistory, &info))
+	{
+		LogError(fn, "Cannot read journal.");
+		return false;
+	}
+	ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	if (info.bTorn || memcmp(replayed, palette, sizeof(replayed)) || bReplayedDrawMode != bDrawMode ||
+		replayedHistory.GetUndoCount() != history.GetUndoCount() || replayedHistory.GetRedoCount() != history.GetRedoCount())
+	{
+		LogError(fn, "Journal does not replay to the edited palette.");
+		return false;
+	}
+	return true;
+}
+
+static int Command_Journal(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nOps = 10000;
+	unsigned rate = 0;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--ops") && i + 1 < argc)
+			nOps = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+			rate = strtoul(argv[++i], nullptr, 10);
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 2)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	fs::path palFn = fs::u8path(args[0]);
+	fs::path fn = fs::u8path(args[1]);
+	word palette[PAL_COLORS];
+	PalError err = PalFile_Load(palFn, palette);
+	if (err != PALERR_OK)
+	{
+		LogError(palFn, PalFile_ErrorString(err));
+		return 1;
+	}
+
+	History history;
+	bool bDrawMode = true;
+	history.Reset(palette, bDrawMode);
+	Journal journal;
+	journal.Open(fn, JOURNAL_NO_ADDRESS, history, palette, bDrawMode, true);
+
+	// Paints strokes of one to a few cells like draw mode does, with an undo
+	// every 8 and a redo every 32 operations.
+	auto tStart = std::chrono::steady_clock::now();
+	double appendSeconds = 0.0;
+	for (std::size_t op = 0; op < nOps; ++op)
+	{
+		if (rate)
+			std::this_thread::sleep_until(tStart + std::chrono::microseconds(op * 1000000ull / rate));
+		dword r = static_cast<dword>((op + 1) * 2654435761u);
+		auto tOp = std::chrono::steady_clock::now();
+		if (op % 8 == 7)
+		{
+			if (history.Undo(palette, bDrawMode))
+				journal.RecordUndo(palette, bDrawMode);
+		}
+		else if (op % 32 == 15)
+		{
+			if (history.Redo(palette, bDrawMode))
+				journal.RecordRedo(palette, bDrawMode);
+		}
+		else
+		{
+			int cell = r >> 24, nCells = 1 + (r & 3);
+			for (int c = 0; c < nCells; ++c)
+				palette[(cell + c) & 0xFF] = static_cast<word>((r >> 5) + c * 0x421) & 0x7FFF;
+			if (history.Record(palette, bDrawMode, L"Draw to palette."))
+				journal.RecordEdit(palette, bDrawMode, L"Draw to palette.");
+		}
+		appendSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - tOp).count();
+	}
+	if (!journal.Sync())
+	{
+		LogError(fn, "Cannot write journal.");
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tStart).count();
+	JournalStats stats = journal.GetStats();
+	printf("Journaled %zu operation(s), %zu bytes in %zu sync(s) over %.1f ms: %.2f us per operation\n",
+		stats.nOperations, stats.nBytes, stats.nWrites, seconds * 1000.0, nOps ? appendSeconds * 1e6 / nOps : 0.0);
+
+	// The journal is left as a crash would leave it.
+	double ms = 0.0;
+	if (!CheckReplay(fn, palette, bDrawMode, history, ms))
+		return 1;
+	printf("Replayed in %.2f ms, %zu undo and %zu redo step(s)\n", ms, history.GetUndoCount(), history.GetRedoCount());
+
+	tStart = std::chrono::steady_clock::now();
+	if (!journal.Compact(history, palette, bDrawMode) || !journal.Sync())
+	{
+		LogError(fn, "Cannot compact journal.");
+		return 1;
+	}
+	double compactMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	stats = journal.GetStats();
+	if (!CheckReplay(fn, palette, bDrawMode, history, ms))
+		return 1;
+	printf("Compacted to %zu bytes in %.2f ms, replayed in %.2f ms\n", stats.nBytes, compactMs, ms);
+	journal.Close(false);
+	return 0;
+}
+
+static int Command_Watch(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nWrites = 50;
+	FileWatchBackendType type = FILEWATCH_NATIVE;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--writes") && i + 1 < argc)
+			nWrites = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--poll"))
+			type = FILEWATCH_POLL;
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	fs::path fn = fs::u8path(args[0]);
+	word original[PAL_COLORS], palette[PAL_COLORS];
+	PalFormat fmt;
+	PalError err = PalFile_Load(fn, original, nullptr, &fmt);
+	if (err != PALERR_OK)
+	{
+		LogError(fn, PalFile_ErrorString(err));
+		return 1;
+	}
+	memcpy(palette, original, sizeof(palette));
+
+	std::mutex mtx;
+	std::condition_variable seen;
+	std::size_t nEvents = 0;
+	std::chrono::steady_clock::time_point tEvent;
+	FileWatcher watcher([&](const fs::path&, std::chrono::steady_clock::time_point) {
+		std::lock_guard<std::mutex> lock(mtx);
+		++nEvents;
+		tEvent = std::chrono::steady_clock::now();
+		seen.notify_one();
+	}, type);
+	watcher.Watch(fn);
+	std::this_thread::sleep_for(std::chrono::milliseconds(FILEWATCH_MAX_DELAY_MS));
+
+	// Writes are spaced out so each one is reported on its own.
+	std::vector<double> latencies;
+	std::size_t nMissed = 0;
+	for (std::size_t i = 0; i < nWrites && err == PALERR_OK; ++i)
+	{
+		palette[i & 0xFF] ^= 0x001F;
+		std::unique_lock<std::mutex> lock(mtx);
+		std::size_t nBefore = nEvents;
+		lock.unlock();
+		auto tWrite = std::chrono::steady_clock::now();
+		err = PalFile_Save(fn, palette, fmt);
+		lock.lock();
+		if (seen.wait_for(lock, std::chrono::seconds(1), [&] { return nEvents > nBefore; }))
+			latencies.push_back(std::chrono::duration<double, std::milli>(tEvent - tWrite).count());
+		else
+			++nMissed;
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::milliseconds(2 * FILEWATCH_MAX_DELAY_MS));
+	}
+
+	// A burst of writes has to come through once.
+	std::size_t nBefore;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		nBefore = nEvents;
+	}
+	for (int i = 0; i < 10 && err == PALERR_OK; ++i)
+	{
+		palette[i] ^= 0x03E0;
+		err = PalFile_Save(fn, palette, fmt);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(4 * FILEWATCH_MAX_DELAY_MS));
+	std::size_t nBurst;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		nBurst = nEvents - nBefore;
+	}
+	watcher.UnwatchAll();
+	if (err == PALERR_OK)
+		err = PalFile_Save(fn, original, fmt);
+	if (err != PALERR_OK)
+	{
+		LogError(fn, PalFile_ErrorString(err));
+		return 1;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	double p50 = latencies.empty() ? 0.0 : latencies[latencies.size() / 2];
+	double worst = latencies.empty() ? 0.0 : latencies.back();
+	printf("%s: %zu of %zu write(s) seen, p50 %.1f ms, max %.1f ms; a burst of 10 writes reported %zu time(s)\n",
+		watcher.GetBackendName(), latencies.size(), nWrites, p50, worst, nBurst);
+	return nMissed ? 1 : 0;
+}
+
+static int Command_Documents(int argc, char** argv)
+{
+	std::vector<const char*> args;
+	std::size_t nEdits = 10000;
+	for (int i = 0; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "--edits") && i + 1 < argc)
+			nEdits = strtoul(argv[++i], nullptr, 10);
+		else
+			args.push_back(argv[i]);
+	}
+	if (args.size() != 1)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	fs::path dir = fs::u8path(args[0]);
+	std::vector<PaletteDocument> documents;
+	std::vector<std::vector<word>> originals;
+	std::error_code ec;
+	fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+	for (; !ec && it != end; it.increment(ec))
+	{
+		std::vector<word> palette(PAL_COLORS);
+		if (!it->is_regular_file(ec) || PalFile_Load(it->path(), palette.data()) != PALERR_OK)
+			continue;
+		PaletteDocument doc;
+		doc.fn = it->path();
+		doc.palette = Palette(palette.data());
+		doc.saved = doc.palette;
+		documents.push_back(std::move(doc));
+		originals.push_back(std::move(palette));
+	}
+	if (ec)
+	{
+		LogError(dir, ec.message().c_str());
+		return 1;
+	}
+	if (documents.empty())
+	{
+		LogError(dir, "No palettes found.");
+		return 1;
+	}
+
+	std::vector<const Palette*> palettes;
+	for (const auto& doc : documents)
+		palettes.push_back(&doc.palette);
+	std::size_t nRows = Palette_CountRows(palettes);
+	printf("Opened %zu palette(s): %zu distinct row(s) of %zu, %.1f KB instead of %.1f KB\n", documents.size(),
+		nRows, documents.size() * PALETTE_ROWS, nRows * sizeof(PaletteRow) / 1024.0, documents.size() * PAL_COLORS * sizeof(word) / 1024.0);
+
+	// Strokes stay in one document for a while, like editing does.
+	std::vector<Palette> snapshots;
+	std::vector<double> snapshotNs;
+	snapshots.reserve(nEdits);
+	snapshotNs.reserve(nEdits);
+	for (std::size_t i = 0; i < nEdits; ++i)
+	{
+		dword r = static_cast<dword>((i + 1) * 2654435761u);
+		PaletteDocument& doc = documents[(i / 64) % documents.size()];
+		doc.palette.Set(r >> 24, static_cast<word>(r >> 5) & 0x7FFF);
+		auto tStart = std::chrono::steady_clock::now();
+		snapshots.push_back(doc.palette);
+		snapshotNs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - tStart).count());
+	}
+
+	// Edits copy their row, the disk state must be untouched.
+	std::size_t nModified = 0;
+	word saved[PAL_COLORS];
+	for (std::size_t i = 0; i < documents.size(); ++i)
+	{
+		documents[i].saved.Read(saved);
+		if (memcmp(saved, originals[i].data(), sizeof(saved)))
+		{
+			LogError(documents[i].fn, "Edit changed a shared row.");
+			return 1;
+		}
+		nModified += documents[i].IsModified();
+	}
+
+	palettes.clear();
+	for (const auto& doc : documents)
+	{
+		palettes.push_back(&doc.palette);
+		palettes.push_back(&doc.saved);
+	}
+	for (const auto& snapshot : snapshots)
+		palettes.push_back(&snapshot);
+	nRows = Palette_CountRows(palettes);
+	std::sort(snapshotNs.begin(), snapshotNs.end());
+	double p50 = snapshotNs.empty() ? 0.0 : snapshotNs[snapshotNs.size() / 2];
+	double p99 = snapshotNs.empty() ? 0.0 : snapshotNs[(snapshotNs.size() - 1) * 99 / 100];
+	// Row pointers are counted as well, they are half the size of a plain copy.
+	printf("%zu edit(s) in %zu document(s), snapshot p50 %.0f ns, p99 %.0f ns; %zu palette state(s) in %zu row(s), %.1f KB instead of %.1f KB\n",
+		nEdits, nModified, p50, p99, palettes.size(), nRows, (nRows * sizeof(PaletteRow) + palettes.size() * sizeof(Palette)) / 1024.0,
+		palettes.size() * PAL_COLORS * sizeof(word) / 1024.0);
+	return 0;
+}
+
+// Every batch kernel the CPU has must give the scalar kernel's output.
+static bool VerifyKernels()
+{
+	const std::size_t nColors = 1 << 20;
+	std::vector<word> snes(nColors), snesOut(nColors), snesRef(nColors);
+	std::vector<dword> rgb(nColors), rgbIn(nColors), rgbRef(nColors);
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		dword hash = static_cast<dword>(i * 2654435761u);
+		snes[i] = static_cast<word>(hash >> 8) & 0x7FFF;
+		rgbIn[i] = hash;
+	}
+
+	ColorKernel active = Color_GetKernel();
+	Color_SetKernel(COLOR_KERNEL_SCALAR);
+	Color_ConvertFromSNESBatch(snes.data(), rgbRef.data(), nColors);
+	Color_ConvertToSNESBatch(rgbIn.data(), snesRef.data(), nColors);
+	bool bOk = true;
+	int nKernels = 0;
+	for (int k = 0; k < COLOR_KERNEL_COUNT; ++k)
+	{
+		ColorKernel kernel = static_cast<ColorKernel>(k);
+		if (!Color_SetKernel(kernel))
+			continue;
+		++nKernels;
+		Color_ConvertFromSNESBatch(snes.data(), rgb.data(), nColors);
+		Color_ConvertToSNESBatch(rgbIn.data(), snesOut.data(), nColors);
+		if (rgb != rgbRef || snesOut != snesRef)
+		{
+			fprintf(stderr, "error: %s kernel output differs from scalar.\n", Color_KernelName(kernel));
+			bOk = false;
+		}
+	}
+	Color_SetKernel(active);
+	printf("Conversion: %d kernel(s) against scalar: %s\n", nKernels, bOk ? "ok" : "FAILED");
+	return bOk;
+}
+
+// Compares the lookup tables with the reference conversion functions for
+// every possible input in both directions.
+static bool VerifyTables()
+{
+	ColorExpand mode = Color_GetExpandMode();
+	Color_SetExpandMode(COLOR_EXPAND_DIVIDE);
+	bool bOk = true;
+	for (dword c = 0; c < 0x8000 && bOk; ++c)
+		bOk = (Color_LookupFromSNES(static_cast<word>(c)) == Color_ConvertFromSNES(static_cast<word>(c)));
+	for (dword rgb = 0; rgb < 0x1000000 && bOk; ++rgb)
+		bOk = (Color_LookupToSNES(COLOR_R(rgb), COLOR_G(rgb), COLOR_B(rgb)) == Color_ConvertToSNES(COLOR_R(rgb), COLOR_G(rgb), COLOR_B(rgb)));
+	Color_SetExpandMode(mode);
+	printf("Conversion: lookup tables against reference functions: %s\n", bOk ? "ok" : "FAILED");
+	return bOk;
+}
+
+// Gradients: one key color held over every line must come back unchanged
+// in every expansion mode, from both interpolation kernels.
+static bool VerifyGradients()
+{
+	GradientOptions opt;
+	opt.nLines = 4;
+	word lines[4], linesRef[4];
+	int nFailed = 0;
+	ColorExpand mode = Color_GetExpandMode();
+	for (int m = 0; m < COLOR_EXPAND_COUNT; ++m)
+	{
+		Color_SetExpandMode(static_cast<ColorExpand>(m));
+		int nModeFailed = 0;
+		for (dword c = 0; c < 0x8000; ++c)
+		{
+			GradientKey key = { 0, static_cast<word>(c) };
+			Gradient_Generate(&key, 1, opt, lines);
+			Gradient_GenerateScalar(&key, 1, opt, linesRef);
+			for (int y = 0; y < opt.nLines; ++y)
+			{
+				if (lines[y] != c || linesRef[y] != c)
+				{
+					++nModeFailed;
+					break;
+				}
+			}
+		}
+		if (nModeFailed)
+			fprintf(stderr, "error: %d constant gradient(s) change their color (expand: %s).\n", nModeFailed, Color_ExpandModeName(static_cast<ColorExpand>(m)));
+		nFailed += nModeFailed;
+	}
+	Color_SetExpandMode(mode);
+	printf("Gradients: constant gradients over all colors: %s\n", nFailed ? "FAILED" : "ok");
+	return !nFailed;
+}
+
+// A chain using every kind of step.
+static const TransformStep verifySteps[] = {
+	{ TRANSFORM_HUE, 40.0f, 0 }, { TRANSFORM_SATURATION, 1.3f, 0 }, { TRANSFORM_CONTRAST, 1.1f, 0 },
+	{ TRANSFORM_TINT, 0.2f, 0x7C1F }, { TRANSFORM_BRIGHTNESS, -0.05f, 0 }
+};
+
+// Transforms: no-op chains must give every color back, the SIMD kernel
+// has to match the scalar one.
+static bool VerifyTransforms()
+{
+	bool bOk = true;
+	std::vector<word> all(0x8000), allOut(0x8000), allRef(0x8000);
+	for (dword c = 0; c < 0x8000; ++c)
+		all[c] = static_cast<word>(c);
+	ColorExpand mode = Color_GetExpandMode();
+	for (int m = 0; m < COLOR_EXPAND_COUNT; ++m)
+	{
+		Color_SetExpandMode(static_cast<ColorExpand>(m));
+		allOut = all;
+		Transform_Apply(ColorTransform(), allOut.data(), allOut.size());
+		if (allOut != all)
+		{
+			fprintf(stderr, "error: identity transform changes colors (expand: %s).\n", Color_ExpandModeName(static_cast<ColorExpand>(m)));
+			bOk = false;
+		}
+	}
+	Color_SetExpandMode(mode);
+
+	ColorTransform xf;
+	Transform_Compile(verifySteps, sizeof(verifySteps) / sizeof(verifySteps[0]), xf);
+	allOut = all;
+	allRef = all;
+	Transform_Apply(xf, allOut.data(), allOut.size());
+	Transform_ApplyScalar(xf, allRef.data(), allRef.size());
+	if (allOut != allRef)
+	{
+		fprintf(stderr, "error: vectorized transform differs from scalar.\n");
+		bOk = false;
+	}
+	printf("Transforms: identity and vectorized kernel over all colors: %s\n", bOk ? "ok" : "FAILED");
+	return bOk;
+}
+
+// CIEDE2000: the reference against published pairs (Sharma et al.), the
+// kernels against the reference, and the vectorized kernel against scalar.
+static bool VerifyDeltaE()
+{
+	static const struct { Lab x, y; float deltaE; } pairs[] = {
+		{ { 50.0f, 2.6772f, -79.7751f }, { 50.0f, 0.0f, -82.7485f }, 2.0425f },
+		{ { 50.0f, 0.0f, 0.0f }, { 50.0f, -1.0f, 2.0f }, 2.3669f },
+		{ { 50.0f, 2.4900f, -0.0010f }, { 50.0f, -2.4900f, 0.0011f }, 7.2195f },
+		{ { 50.0f, 2.5f, 0.0f }, { 73.0f, 25.0f, -18.0f }, 27.1492f },
+		{ { 50.0f, 2.5f, 0.0f }, { 50.0f, 3.1736f, 0.5854f }, 1.0000f },
+		{ { 60.2574f, -34.0099f, 36.2677f }, { 60.4626f, -34.1751f, 39.4387f }, 1.2644f },
+		{ { 22.7233f, 20.0904f, -46.6940f }, { 23.0331f, 14.9730f, -42.5619f }, 2.0373f },
+		{ { 90.8027f, -2.0831f, 1.4410f }, { 91.1528f, -1.6435f, 0.0447f }, 1.4441f }
+	};
+	bool bOk = true;
+	for (const auto& pair : pairs)
+	{
+		if (std::fabs(ColorSpace_DeltaE2000(pair.x, pair.y) - pair.deltaE) > 1e-4f)
+		{
+			fprintf(stderr, "error: CIEDE2000 reference gives %.4f instead of %.4f.\n", ColorSpace_DeltaE2000(pair.x, pair.y), pair.deltaE);
+			bOk = false;
+		}
+	}
+
+	const std::size_t nColors = 1 << 20;
+	std::vector<word> snes(nColors), other(nColors);
+	std::vector<float> deltaE(nColors), deltaERef(nColors);
+	for (std::size_t i = 0; i < nColors; ++i)
+	{
+		// Half the pairs are near each other, where the hue terms matter most.
+		snes[i] = static_cast<word>(static_cast<dword>(i * 2654435761u) >> 8) & 0x7FFF;
+		dword hash = static_cast<dword>(i * 40503u + 0x9E37u) * 2654435761u;
+		other[i] = (i & 1) ? static_cast<word>(snes[i] ^ (hash & 0x0421)) : static_cast<word>(hash >> 9) & 0x7FFF;
+	}
+	Diff_DeltaE(snes.data(), other.data(), deltaE.data(), nColors);
+	Diff_DeltaEScalar(snes.data(), other.data(), deltaERef.data(), nColors);
+	if (deltaE != deltaERef)
+	{
+		fprintf(stderr, "error: vectorized CIEDE2000 differs from scalar.\n");
+		bOk = false;
+	}
+	const Lab* cieLab = ColorSpace_GetCIELabTable();
+	float maxError = 0.0f;
+	for (std::size_t i = 0; i < nColors; i += 7)
+		maxError = std::max(maxError, std::fabs(deltaE[i] - ColorSpace_DeltaE2000(cieLab[snes[i]], cieLab[other[i]])));
+	if (maxError > DIFF_KERNEL_TOLERANCE)
+	{
+		fprintf(stderr, "error: CIEDE2000 kernel is off by %.5f.\n", maxError);
+		bOk = false;
+	}
+	printf("CIEDE2000: %zu reference pair(s), kernel max error %.5f: %s\n", sizeof(pairs) / sizeof(pairs[0]), maxError, bOk ? "ok" : "FAILED");
+	return bOk;
+}
+
+static int Command_Verify(int argc, char**)
+{
+	if (argc)
+	{
+		PrintUsage();
+		return 2;
+	}
+	bool bOk = VerifyKernels();
+	bOk = VerifyTables() && bOk;
+	bOk = VerifyGradients() && bOk;
+	bOk = VerifyTransforms() && bOk;
+	bOk = VerifyDeltaE() && bOk;
+	return bOk ? 0 : 1;
+}
+
+static int RunCommand(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		PrintUsage();
+		return 2;
+	}
+
+	if (!strcmp(argv[1], "convert"))
+		return Command_Convert(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "render"))
+		return Command_Render(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "rom-read"))
+		return Command_RomRead(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "rom-write"))
+		return Command_RomWrite(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "search"))
+		return Command_Search(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "gfx"))
+		return Command_Gfx(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "gradient"))
+		return Command_Gradient(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "quantize"))
+		return Command_Quantize(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "adjust"))
+		return Command_Adjust(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "fade"))
+		return Command_Fade(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "compose"))
+		return Command_Compose(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "remap"))
+		return Command_Remap(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "library"))
+		return Command_Library(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "diff"))
+		return Command_Diff(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "parse"))
+		return Command_Parse(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "journal"))
+		return Command_Journal(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "watch"))
+		return Command_Watch(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "documents"))
+		return Command_Documents(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "verify"))
+		return Command_Verify(argc - 2, argv + 2);
+
+	PrintUsage();
+	return 2;
+}
+
+int main(int argc, char** argv)
+{
+	// --trace works with every command.
+	std::vector<char*> args(argv, argv + argc);
+	const char* traceFn = nullptr;
+	for (std::size_t i = 1; i + 1 < args.size(); ++i)
+	{
+		if (!strcmp(args[i], "--trace"))
+		{
+			traceFn = args[i + 1];
+			args.erase(args.begin() + i, args.begin() + i + 2);
+			break;
+		}
+	}
+	Trace_SetEnabled(traceFn != nullptr);
+
+	int status = RunCommand(static_cast<int>(args.size()), args.data());
+	if (traceFn)
+	{
+		Trace_SetEnabled(false);
+		if (!Trace_WriteChrome(fs::u8path(traceFn)))
+		{
+			LogError(fs::u8path(traceFn), "Cannot write trace.");
+			return status ? status : 1;
+		}
+		Trace_PrintSummary(stderr);
+	}
+	return status;
+}